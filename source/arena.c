@@ -0,0 +1,96 @@
+#include "arena.h"
+#include "stats.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN         sizeof(void*)
+#define ARENA_MINBLOCK      0x1000
+
+// the arena itself is kept at the start of its first block
+
+struct ARENABLOCK {
+    struct ARENABLOCK* pNext;
+};
+
+struct ARENA {
+    struct ARENABLOCK* pBlocks;     // blocks, the last one allocated first
+    char* pFree;                    // free space of the first block
+    size_t dwFree;
+    size_t dwNextSize;              // size of the next block
+};
+
+static size_t AlignArena(size_t dwSize) {
+    return (dwSize + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+// dwSize is the number of bytes available in the first block
+
+struct ARENA* CreateArena(size_t dwSize) {
+    size_t dwHeader = AlignArena(sizeof(struct ARENABLOCK)) + AlignArena(sizeof(struct ARENA));
+    dwSize = AlignArena(dwSize);
+    struct ARENABLOCK* pBlock = xmalloc(dwHeader + dwSize);
+    if (pBlock == NULL) {
+        return NULL;
+    }
+    pBlock->pNext = NULL;
+    struct ARENA* pArena = (struct ARENA*)((char*)pBlock + AlignArena(sizeof(struct ARENABLOCK)));
+    pArena->pBlocks = pBlock;
+    pArena->pFree = (char*)pBlock + dwHeader;
+    pArena->dwFree = dwSize;
+    pArena->dwNextSize = dwSize < ARENA_MINBLOCK ? ARENA_MINBLOCK : dwSize;
+    return pArena;
+}
+
+void DestroyArena(struct ARENA* pArena) {
+    if (pArena == NULL) {
+        return;
+    }
+    struct ARENABLOCK* pBlock = pArena->pBlocks;
+    while (pBlock != NULL) {
+        struct ARENABLOCK* pNext = pBlock->pNext;
+        free(pBlock);
+        pBlock = pNext;
+    }
+}
+
+// returns NULL if out of memory
+
+void* AllocArena(struct ARENA* pArena, size_t dwSize) {
+    dwSize = AlignArena(dwSize);
+    if (dwSize > pArena->dwFree) {
+        // the blocks grow, so there are a few of them only
+        size_t dwBlockSize = pArena->dwNextSize;
+        while (dwBlockSize < dwSize) {
+            dwBlockSize *= 2;
+        }
+        size_t dwHeader = AlignArena(sizeof(struct ARENABLOCK));
+        struct ARENABLOCK* pBlock = xmalloc(dwHeader + dwBlockSize);
+        if (pBlock == NULL) {
+            return NULL;
+        }
+        pBlock->pNext = pArena->pBlocks;
+        pArena->pBlocks = pBlock;
+        pArena->pFree = (char*)pBlock + dwHeader;
+        pArena->dwFree = dwBlockSize;
+        pArena->dwNextSize = 2 * dwBlockSize;
+    }
+    void* p = pArena->pFree;
+    pArena->pFree += dwSize;
+    pArena->dwFree -= dwSize;
+    return p;
+}
+
+char* StrNDupArena(struct ARENA* pArena, const char* pszString, size_t len) {
+    char* p = AllocArena(pArena, len + 1);
+    if (p != NULL) {
+        memcpy(p, pszString, len);
+        p[len] = '\0';
+    }
+    return p;
+}
+
+char* StrDupArena(struct ARENA* pArena, const char* pszString) {
+    return StrNDupArena(pArena, pszString, strlen(pszString));
+}
@@ -0,0 +1,18 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// memory which is released at once
+// The allocations of an arena are taken from a chain of blocks, they
+// can't be freed one by one. DestroyArena() releases all blocks.
+
+struct ARENA;
+
+struct ARENA* CreateArena(size_t dwSize);
+void DestroyArena(struct ARENA* pArena);
+void* AllocArena(struct ARENA* pArena, size_t dwSize);
+char* StrDupArena(struct ARENA* pArena, const char* pszString);
+char* StrNDupArena(struct ARENA* pArena, const char* pszString, size_t len);
+
+#endif // ARENA_H
@@ -1,6 +1,14 @@
 #include "h2incc.h"
+#include "arena.h"
+#include "hotdecls.h"
 #include "incfile.h"
 #include "list.h"
+#include "server.h"
+#include "shake.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "timereport.h"
+#include "trace.h"
 #include "util.h"
 
 #include <assert.h>
@@ -16,9 +24,8 @@
 #include <windows.h>
 #endif
 
-#define STRINGPOOLMAX       0x1000000       // address space reserved for string pool
-#define STRINGPOOLSIZE      0x10000
-#define MAXWARNINGLVL       3               // max value for -Wn switch
+#define STRINGPOOLSIZE      0x10000         // first block of the string pool
+#define INPFILESSIZE        0x400           // first block of the input file names
 
 struct StringLL {
     struct StringLL* next;                  // next in linked list chain
@@ -37,9 +44,14 @@ char* g_pszIniPath;                         // -C cmdline ini path
 char* g_pszOutDir;                          // -O cmdline output directory
 char* g_pszOutFileName;                     // -o cmdline output filename
 struct vector *g_pszIncDirs;                // -I cmdline include directories
+struct vector *g_pszDefines;                // -D/-U cmdline definitions ("Dname=value", "Uname")
+struct vector *g_pOutputSink;               // receives output written to stdout (server mode)
 uint32_t g_dwStructSuffix;                  // number used for nameless structures
 uint32_t g_dwDefCallConv;                   // default calling convention
 struct StringLL* g_pInpFiles;               // linked list of processed input files
+static struct ARENA* g_pInpFilesArena;      // holds the g_pInpFiles items
+static struct ARENA* g_pStringPool;         // strings of AddString() and AllocString()
+static struct ARENA* g_pBaseStringPool;     // strings of the server's base tables
 struct LIST* g_pStructures;                 // list of structures defined in current file
 struct LIST* g_pStructureTags;              // list of struct typedefs defined in current file
 struct LIST* g_pMacros;                     // list of macros defined in current file
@@ -52,6 +64,10 @@ struct LIST* g_pTypedefs;                   // list of typedefs
 #if DYNPROTOQUALS
 struct LIST* g_pQualifiers;                 // list of prototype qualifiers
 #endif
+struct LIST* g_pDefines;                    // list of #define values (--fold-if)
+struct LIST* g_pConstants;                  // list of constant values (--fold-constants)
+struct LIST* g_pIncludeGuards;              // list of guarded headers already converted
+struct LIST* g_pSymbolGuards;               // list of equates and prototypes written (--guard-symbols)
 
 struct SORTARRAY g_ReservedWords;       // profile file strings [Reserved Words]
 struct SORTARRAY g_KnownStructures;     // profile file strings
@@ -67,6 +83,13 @@ struct ITEM_STRSTR* g_ppAlignments;     // profile file strings
 struct ITEM_STRINT* g_ppTypeSize;       // profile file strings
 
 uint8_t g_bTerminate;                   // 1=terminate app as soon as possible
+uint8_t g_bNoFileIO;                    // 1=don't access files (library mode)
+
+// library mode hooks
+void (*g_pfnDiagnostic)(void* pContext, const char* pszText);
+void* g_pDiagnosticContext;
+int (*g_pfnLoadInclude)(void* pContext, const char* pszDirPath, const char* pszName, const char** ppData, size_t* pdwSize);
+void* g_pLoadIncludeContext;
 
 uint8_t g_bAddAlign;                    // -a cmdline switch
 uint8_t g_bBatchmode;                   // -b cmdline switch
@@ -95,6 +118,13 @@ uint8_t g_bWarningLevel;                // -W cmdline switch
 uint8_t g_bOverwrite;                   // -y cmdline switch
 #endif
 uint8_t g_b64bit;
+uint8_t g_bServer;                      // --server cmdline switch
+uint8_t g_bFoldIf;                      // --fold-if cmdline switch
+uint8_t g_bFoldConstants;               // --fold-constants cmdline switch
+uint8_t g_bIncludeGuard;                // --include-guard cmdline switch
+uint8_t g_bGuardSymbols;                // --guard-symbols cmdline switch
+char* g_pszEmitSnapshot;                // --emit-snapshot cmdline switch
+char* g_pszUseSnapshot;                 // --use-snapshot cmdline switch
 
 uint8_t g_bIniPathExpected;              // temp var for -C cmdline switch
 #ifdef OUTPUTDIRECTORY_ARG
@@ -110,6 +140,24 @@ uint8_t g_bTypedefs = 1;                // modified by -s cmdline switch
 uint8_t g_bConstants = 1;               // modified by -s cmdline switch
 uint8_t g_bExternals = 1;               // modified by -s cmdline switch
 
+// write a warning or error message to stderr,
+// or pass it to g_pfnDiagnostic if set (library mode)
+
+int diag_printf(const char* format, ...) {
+    va_list args;
+    int res;
+    va_start(args, format);
+    if (g_pfnDiagnostic != NULL) {
+        char szText[1024];
+        res = vsnprintf(szText, sizeof(szText), format, args);
+        g_pfnDiagnostic(g_pDiagnosticContext, szText);
+    } else {
+        res = vfprintf(stderr, format, args);
+    }
+    va_end(args);
+    return res;
+}
+
 #ifdef _TRACE
 int debug_printf(const char* format, ...) {
     va_list args;
@@ -161,8 +209,8 @@ struct ITEM_STRSTR g_TypeAttrConvDefault[] = {
 // usually not used, since defined in h2incc.ini
 
 struct ITEM_MACROINFO g_KnownMacrosDefault[] = {
-    { "DECLARE_HANDLE", 0, 0, NULL, NULL },
-    { "DECLARE_GUID", 0, 0, NULL, NULL },
+    { "DECLARE_HANDLE", 0, 0, 0, 0, NULL },
+    { "DECLARE_GUID", 0, 0, 0, 0, NULL },
     { 0 },
 };
 
@@ -342,6 +390,7 @@ struct CLSWITCH {
 
 #define CLS_ISBOOL  1
 #define CLS_ISPROC  2   // not used
+#define CLS_ISSTRING 4  // long switches only: --switch=value
 
 struct CLSWITCH clswitchtab[] = {
     { 'a',  CLS_ISBOOL, &g_bAddAlign },
@@ -380,6 +429,33 @@ struct CLSWITCH clswitchtab[] = {
     { 0 },
 };
 
+// long command line switch table
+
+struct CLLONGSWITCH {
+    const char* pszSwitch;
+    uint8_t bType;
+    void* pVoid;
+};
+
+struct CLLONGSWITCH cllongswitchtab[] = {
+    { "server", CLS_ISBOOL, &g_bServer },
+    { "fold-if", CLS_ISBOOL, &g_bFoldIf },
+    { "fold-constants", CLS_ISBOOL, &g_bFoldConstants },
+    { "shake", CLS_ISSTRING, &g_pszShake },
+    { "shake-asm", CLS_ISSTRING, &g_pszShakeAsm },
+    { "include-guard", CLS_ISBOOL, &g_bIncludeGuard },
+    { "guard-symbols", CLS_ISBOOL, &g_bGuardSymbols },
+    { "emit-snapshot", CLS_ISSTRING, &g_pszEmitSnapshot },
+    { "use-snapshot", CLS_ISSTRING, &g_pszUseSnapshot },
+    { "stats", CLS_ISBOOL, &g_bStats },
+    { "hot-decls", CLS_ISSTRING, &g_pszHotDecls },
+    { "time-report", CLS_ISBOOL, &g_bTimeReport },
+    { "time-report-json", CLS_ISSTRING, &g_pszTimeReportJson },
+    { "trace", CLS_ISSTRING, &g_pszTrace },
+    { "trace-file", CLS_ISSTRING, &g_pszTraceFile },
+    { 0 },
+};
+
 
 #define Summary1 "  -S: print summary (structures, macros"
 #if PROTOSUMMARY
@@ -396,7 +472,7 @@ struct CLSWITCH clswitchtab[] = {
 #define SummaryStr Summary1 Summary2 Summary3 Summary4
 
 
-char* szUsage =
+const char* szUsage =
     "h2incd " VERSION ", " COPYRIGHT "\n"
     "usage: h2incd <options> filespec\n"
     "  -a: add @align to STRUCT declarations\n"
@@ -408,6 +484,7 @@ char* szUsage =
     "     1: always assume __declspec(dllimport) is set\n"
     "     2: always assume __declspec(dllimport) is not set\n"
     "     3: if possible use @DefProto macro to define prototypes\n"
+    "  -Dname[=value]: define a macro for --fold-if (implies --fold-if)\n"
     "  -e: write full decorated names of function prototypes to a .DEF file\n"
     "  -f: prefix reserved words instead of postfix\n"
     "  -i: process #include lines\n"
@@ -428,12 +505,31 @@ char* szUsage =
     "  -t: print typedefs in summary\n"
 #endif
     "  -u: generate untyped parameters (DWORDs) in prototypes\n"
+    "  -Uname: undefine a macro for --fold-if (implies --fold-if)\n"
     "  -v: verbose mode\n"
     "  -W0|1|2|3: set warning level (default is 0)\n"
     "  -x: assume 64-bit (default = 32-bit)\n"
 #ifdef OVERWRITE_PROTECTION
     "  -y: overwrite existing .INC files without confirmation\n"
 #endif
+    "  --server: read conversion requests from stdin, write results to stdout\n"
+    "  --fold-if: evaluate #if/#elif expressions and remove branches not taken\n"
+    "  --fold-constants: write constant expressions of #define and enum as numbers\n"
+    "  --shake=names: write only the declarations needed by the names, included\n"
+    "        headers are part of the output\n"
+    "  --shake-asm=files: like --shake, the names are those used by .asm files\n"
+    "  --include-guard: enclose the output in ifndef NAME_INC/endif\n"
+    "  --guard-symbols: enclose equates and prototypes already written by another\n"
+    "        header in ifndef/endif\n"
+    "  --emit-snapshot=file: save the symbol tables to a snapshot file\n"
+    "  --use-snapshot=file: preload the symbol tables from a snapshot file\n"
+    "  --hot-decls=n: print the n declarations the analyzer spent most time on at exit\n"
+    "  --stats: print counters of the work done and the memory allocated per file at exit\n"
+    "  --time-report: print the time spent in each phase per file at exit\n"
+    "  --time-report-json=file: write the time report as JSON (implies --time-report)\n"
+    "  --trace=categories: write a Chrome trace of tokenizer, preproc, declarations,\n"
+    "        includes, output or all, separated by commas\n"
+    "  --trace-file=file: name of the trace (default h2incc.trace.json)\n"
 ;
 
 char g_szDrive[4];
@@ -441,21 +537,79 @@ char g_szDir[256];
 char g_szName[256];
 char g_szExt[256];
 
+// string pool
+// holds the names and values of the symbol tables. Server mode keeps copies
+// of the base tables, their strings are moved to a pool of their own by
+// SaveBaseStrings(). The strings of a request are released by
+// ResetStrings() before the next one, DestroyStrings() releases both.
+
+void* AllocString(size_t dwSize) {
+    if (g_pStringPool == NULL) {
+        g_pStringPool = CreateArena(STRINGPOOLSIZE);
+        if (g_pStringPool == NULL) {
+            return NULL;
+        }
+    }
+    return AllocArena(g_pStringPool, dwSize);
+}
+
 char* AddString(const char* pszString) {
     size_t stringSize = strlen(pszString) + 1;
-    size_t allocSize = stringSize;
-    char* data = malloc(allocSize);
-    strcpy(data, pszString);
+    char* data = AllocString(stringSize);
+    if (data != NULL) {
+        memcpy(data, pszString, stringSize);
+    }
     return data;
 }
 
-void DestroyString(char* pszString) {
-    free(pszString);
+void SaveBaseStrings(void) {
+    DestroyArena(g_pBaseStringPool);
+    g_pBaseStringPool = g_pStringPool;
+    g_pStringPool = NULL;
+}
+
+void ResetStrings(void) {
+    DestroyArena(g_pStringPool);
+    g_pStringPool = NULL;
+}
+
+void DestroyStrings(void) {
+    ResetStrings();
+    DestroyArena(g_pBaseStringPool);
+    g_pBaseStringPool = NULL;
+}
+
+// scan command line for long options ("--switch" or "--switch=value")
+
+static int getlongoption(char* pszArgument) {
+    char* pszValue = strchr(pszArgument, '=');
+    size_t len = pszValue != NULL ? (size_t)(pszValue - pszArgument) : strlen(pszArgument);
+    for (struct CLLONGSWITCH* pSwitch = cllongswitchtab; pSwitch->pszSwitch != NULL; pSwitch++) {
+        if (strncmp(pSwitch->pszSwitch, pszArgument, len) != 0 || pSwitch->pszSwitch[len] != '\0') {
+            continue;
+        }
+        if (pSwitch->bType == CLS_ISBOOL) {
+            if (pszValue != NULL) {
+                return 1;
+            }
+            *(uint8_t*)pSwitch->pVoid = 1;
+        } else if (pSwitch->bType == CLS_ISSTRING) {
+            if (pszValue == NULL || pszValue[1] == '\0') {
+                return 1;
+            }
+            *(char**)pSwitch->pVoid = pszValue + 1;
+        }
+        return 0;
+    }
+    return 1;
 }
 
 // scan command line for options
 
 int getoption(char* pszArgument) {
+    if (pszArgument[0] == '-' && pszArgument[1] == '-') {
+        return getlongoption(pszArgument + 2);
+    }
     if (pszArgument[0] == '-') {
         if (pszArgument[2] != '\0') {
             if (pszArgument[1] == 'W') {
@@ -465,6 +619,13 @@ int getoption(char* pszArgument) {
                 }
                 g_bWarningLevel = val;
                 return 0;
+            } else if (pszArgument[1] == 'D' || pszArgument[1] == 'U') {
+                if (!vector_charp_append(g_pszDefines, &pszArgument[1])) {
+                    diag_printf("fatal error: out of memory\n");
+                    return 1;
+                }
+                g_bFoldIf = 1;
+                return 0;
             } else if (pszArgument[1] == 'd') {
                 uint8_t val = pszArgument[2] - '0';
                 switch (val) {
@@ -554,7 +715,10 @@ int getoption(char* pszArgument) {
             }
             g_bCallConvExpected = 0;
         } else if (g_bIncDirExpected) {
-            vector_charp_append(g_pszIncDirs, pszArgument);
+            if (!vector_charp_append(g_pszIncDirs, pszArgument)) {
+                diag_printf("fatal error: out of memory\n");
+                return 1;
+            }
             g_bIncDirExpected = 0;
         } else {
             char* prevFileSpec = g_pszFilespec;
@@ -567,6 +731,100 @@ int getoption(char* pszArgument) {
     return 0;
 }
 
+// save and restore the options set by the command line
+// (server mode applies per request options on top of the startup options)
+
+struct OPTIONSTATE {
+    uint8_t bSwitches[ARRAY_SIZE(clswitchtab)];
+    uintptr_t longSwitches[ARRAY_SIZE(cllongswitchtab)];
+    uint8_t bWarningLevel;
+    uint8_t bAssumeDllImport;
+    uint8_t bIgnoreDllImport;
+    uint8_t bUseDefProto;
+    uint8_t bPrototypes;
+    uint8_t bTypedefs;
+    uint8_t bConstants;
+    uint8_t bExternals;
+    uint32_t dwDefCallConv;
+    char* pszFilespec;
+    char* pszOutDir;
+    char* pszOutFileName;
+    size_t numIncDirs;
+    size_t numDefines;
+};
+
+struct OPTIONSTATE* SaveOptions(void) {
+    struct OPTIONSTATE* pState = xmalloc(sizeof(struct OPTIONSTATE));
+    if (pState == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; clswitchtab[i].bSwitch != 0; i++) {
+        pState->bSwitches[i] = *clswitchtab[i].pVoid;
+    }
+    for (size_t i = 0; cllongswitchtab[i].pszSwitch != NULL; i++) {
+        if (cllongswitchtab[i].bType == CLS_ISBOOL) {
+            pState->longSwitches[i] = *(uint8_t*)cllongswitchtab[i].pVoid;
+        } else {
+            pState->longSwitches[i] = (uintptr_t)*(char**)cllongswitchtab[i].pVoid;
+        }
+    }
+    pState->bWarningLevel = g_bWarningLevel;
+    pState->bAssumeDllImport = g_bAssumeDllImport;
+    pState->bIgnoreDllImport = g_bIgnoreDllImport;
+    pState->bUseDefProto = g_bUseDefProto;
+    pState->bPrototypes = g_bPrototypes;
+    pState->bTypedefs = g_bTypedefs;
+    pState->bConstants = g_bConstants;
+    pState->bExternals = g_bExternals;
+    pState->dwDefCallConv = g_dwDefCallConv;
+    pState->pszFilespec = g_pszFilespec;
+    pState->pszOutDir = g_pszOutDir;
+    pState->pszOutFileName = g_pszOutFileName;
+    pState->numIncDirs = g_pszIncDirs->size;
+    pState->numDefines = g_pszDefines->size;
+    return pState;
+}
+
+void RestoreOptions(const struct OPTIONSTATE* pState) {
+    for (size_t i = 0; clswitchtab[i].bSwitch != 0; i++) {
+        *clswitchtab[i].pVoid = pState->bSwitches[i];
+    }
+    // an option still waiting for its argument doesn't apply to the next request
+    g_bIniPathExpected = 0;
+#ifdef OUTPUTDIRECTORY_ARG
+    g_bOutDirExpected = 0;
+#endif
+    g_bOutFileNameExpected = 0;
+    g_bSelExpected = 0;
+    g_bCallConvExpected = 0;
+    g_bIncDirExpected = 0;
+    for (size_t i = 0; cllongswitchtab[i].pszSwitch != NULL; i++) {
+        if (cllongswitchtab[i].bType == CLS_ISBOOL) {
+            *(uint8_t*)cllongswitchtab[i].pVoid = (uint8_t)pState->longSwitches[i];
+        } else {
+            *(char**)cllongswitchtab[i].pVoid = (char*)pState->longSwitches[i];
+        }
+    }
+    g_bWarningLevel = pState->bWarningLevel;
+    g_bAssumeDllImport = pState->bAssumeDllImport;
+    g_bIgnoreDllImport = pState->bIgnoreDllImport;
+    g_bUseDefProto = pState->bUseDefProto;
+    g_bPrototypes = pState->bPrototypes;
+    g_bTypedefs = pState->bTypedefs;
+    g_bConstants = pState->bConstants;
+    g_bExternals = pState->bExternals;
+    g_dwDefCallConv = pState->dwDefCallConv;
+    g_pszFilespec = pState->pszFilespec;
+    g_pszOutDir = pState->pszOutDir;
+    g_pszOutFileName = pState->pszOutFileName;
+    if (g_pszIncDirs->size > pState->numIncDirs) {
+        g_pszIncDirs->size = pState->numIncDirs;
+    }
+    if (g_pszDefines->size > pState->numDefines) {
+        g_pszDefines->size = pState->numDefines;
+    }
+}
+
 // profile file access procs
 
 char* xstrtok(char* str, char* delim, char* match) {
@@ -713,14 +971,17 @@ void LoadTablesFromProfile(char* pszInput, size_t dwSize) {
             size_t textLength;
             size_t nb = LoadStrings(start, NULL, NULL, tabEntry->dwFlags & CF_KEYS, &textLength, tabEntry->itemSize);
             if (nb != 0) {
-                char* textBuffer = malloc(textLength);
+                char* textBuffer = xmalloc(textLength);
                 tabEntry->pStorage = textBuffer;
-                *(char***)tabEntry->pPtr = malloc((nb + 1) * tabEntry->itemSize);
+                *(char***)tabEntry->pPtr = xmalloc((nb + 1) * tabEntry->itemSize);
                 memset(*(char**)tabEntry->pPtr, 0, (nb + 1) * tabEntry->itemSize);
                 if (tabEntry->pPtr != NULL) {
                     LoadStrings(start, *(char***)tabEntry->pPtr, textBuffer, tabEntry->dwFlags & CF_KEYS, &textLength, tabEntry->itemSize);
                 }
             }
+        } else if (tabEntry->dwFlags & CF_SORT) {
+            // pPtr and pDefault point to a SORTARRAY
+            ((struct SORTARRAY*)tabEntry->pPtr)->pItems = ((struct SORTARRAY*)tabEntry->pDefault)->pItems;
         } else {
             *(char***)tabEntry->pPtr = (char**)tabEntry->pDefault;
         }
@@ -729,37 +990,49 @@ void LoadTablesFromProfile(char* pszInput, size_t dwSize) {
 
 void FreeProfileData(void) {
     for (struct CONVTABENTRY *tabEntry = convtab; tabEntry->pszSection != NULL; tabEntry++) {
-        free(tabEntry->pStorage);
+        if (tabEntry->pStorage != NULL) {
+            free(*(char***)tabEntry->pPtr);
+            *(char***)tabEntry->pPtr = NULL;
+            free(tabEntry->pStorage);
+            tabEntry->pStorage = NULL;
+        }
     }
 }
 
-char* ReadIniFile(char* szIniPath, size_t* pSize) {
-    char* cwd;
+// read a text file, the contents are terminated by a 0
+// returns NULL if the file can't be read
+
+char* ReadTextFile(const char* pszPath, size_t* pSize) {
     FILE* f;
-    size_t dwSize;
+    long lSize;
     char* pContents;
 
-    f = fopen(szIniPath, "r");
+    *pSize = 0;
+    f = fopen(pszPath, "r");
     if (f == NULL) {
-        if (g_bVerbose) {
-            fprintf(stderr, "profile file %s not found, using defaults!\n", szIniPath);
-        }
-        *pSize = 0;
         return NULL;
     }
     fseek(f, 0, SEEK_END);
-    dwSize = ftell(f);
+    lSize = ftell(f);
     fseek(f, 0, SEEK_SET);
-    pContents = malloc(dwSize + 1);
+    pContents = lSize >= 0 ? xmalloc(lSize + 1) : NULL;
     if (pContents == NULL) {
-        fprintf(stderr, "out of memory reading profile file\n");
-        *pSize = 0;
+        fprintf(stderr, "out of memory reading %s\n", pszPath);
+        fclose(f);
         return NULL;
     }
-    fread(pContents, 1, dwSize, f);
+    // text mode may read less than the size of the file
+    *pSize = fread(pContents, 1, lSize, f);
     fclose(f);
-    pContents[dwSize] = '\0';
-    *pSize = dwSize;
+    pContents[*pSize] = '\0';
+    return pContents;
+}
+
+char* ReadIniFile(char* szIniPath, size_t* pSize) {
+    char* pContents = ReadTextFile(szIniPath, pSize);
+    if (pContents == NULL && g_bVerbose) {
+        fprintf(stderr, "profile file %s not found, using defaults!\n", szIniPath);
+    }
     return pContents;
 }
 
@@ -857,29 +1130,43 @@ static void InputFileNameToIncFileName(const char* inputFilePath, const char* ou
     }
 }
 
-// process 1 header file
-
-int ProcessFile(char* pszFileName, struct INCFILE* pParent) {
-    struct INCFILE* pIncFile;
-    char* lpFilePart;
-    // char szFileName[MAX_PATH];
-    char szOutName[MAX_PATH];
-    int res;
+// remember an input file name
+// returns 0 if the file has been processed already
 
-    // don't process files more than once
-    struct StringLL *pCurrent = g_pInpFiles;
-    while (pCurrent != NULL) {
-        pCurrent = pCurrent->next;
+static int AddInputFile(char* pszFileName) {
+    for (struct StringLL *pCurrent = g_pInpFiles; pCurrent != NULL; pCurrent = pCurrent->next) {
         if (strcasecmp(pCurrent->str, pszFileName) == 0) {
             return 0;
         }
     }
-    struct StringLL* pNew = malloc(sizeof(struct StringLL) + strlen(pszFileName) + 1);
-    pNew->str = (char*)pNew + sizeof(struct StringLL);
-    strcpy(pNew->str, pszFileName);
+    if (g_pInpFilesArena == NULL) {
+        g_pInpFilesArena = CreateArena(INPFILESSIZE);
+        if (g_pInpFilesArena == NULL) {
+            return 0;
+        }
+    }
+    struct StringLL* pNew = AllocArena(g_pInpFilesArena, sizeof(struct StringLL));
+    if (pNew == NULL) {
+        return 0;
+    }
+    pNew->str = StrDupArena(g_pInpFilesArena, pszFileName);
+    if (pNew->str == NULL) {
+        return 0;
+    }
     pNew->next = g_pInpFiles;
     g_pInpFiles = pNew;
+    return 1;
+}
+
+// forget all processed input files
 
+void ResetInputFiles(void) {
+    DestroyArena(g_pInpFilesArena);
+    g_pInpFilesArena = NULL;
+    g_pInpFiles = NULL;
+}
+
+static void PrintFileName(char* pszFileName, struct INCFILE* pParent) {
     if (g_bVerbose) {
         if (pParent != NULL) {
             uint32_t line;
@@ -888,6 +1175,39 @@ int ProcessFile(char* pszFileName, struct INCFILE* pParent) {
         }
         fprintf(stderr, "file '%s'\n", pszFileName);
     }
+}
+
+// parse, analyze and write 1 include file object
+
+static int ConvertIncFile(struct INCFILE* pIncFile, char* pszOutName) {
+    int res;
+    uint32_t dwLine;
+
+    ParserIncFile(pIncFile);
+    AnalyzerIncFile(pIncFile);
+    BEGIN_TIMESPAN(TP_OUTPUT, GetFileNameIncFile(pIncFile, &dwLine));
+    TRACE_BEGIN(TC_OUTPUT, "write", pszOutName, 0);
+    res = WriteIncFile(pIncFile, pszOutName);
+    TRACE_END(TC_OUTPUT);
+    END_TIMESPAN();
+    //WriteDefIncFile(pIncFile, szOutName);
+    DestroyIncFile(pIncFile);
+    return res;
+}
+
+// process 1 header file
+
+int ProcessFile(char* pszFileName, struct INCFILE* pParent) {
+    struct INCFILE* pIncFile;
+    char* lpFilePart;
+    // char szFileName[MAX_PATH];
+    char szOutName[MAX_PATH];
+
+    // don't process files more than once
+    if (!AddInputFile(pszFileName)) {
+        return 0;
+    }
+    PrintFileName(pszFileName, pParent);
     InputFileNameToIncFileName(pszFileName, g_pszOutDir, szOutName);
     debug_printf("%s => '%s'\n", pszFileName, szOutName);
     // _splitpath(szFileName, NULL, NULL, g_szName, g_szExt);
@@ -902,12 +1222,31 @@ int ProcessFile(char* pszFileName, struct INCFILE* pParent) {
     if (pIncFile == NULL) {
         return 0;
     }
-    ParserIncFile(pIncFile);
-    AnalyzerIncFile(pIncFile);
-    res = WriteIncFile(pIncFile, szOutName);
-    //WriteDefIncFile(pIncFile, szOutName);
-    DestroyIncFile(pIncFile);
-    return res;
+    return ConvertIncFile(pIncFile, szOutName);
+}
+
+// process 1 header held in memory
+// pszFileName is used for messages and to locate included files
+
+int ProcessBuffer(char* pszFileName, const char* pData, size_t dwSize) {
+    struct INCFILE* pIncFile;
+    char szOutName[MAX_PATH];
+
+    if (!AddInputFile(pszFileName)) {
+        return 0;
+    }
+    PrintFileName(pszFileName, NULL);
+    InputFileNameToIncFileName(pszFileName, g_pszOutDir, szOutName);
+#ifdef OVERWRITE_PROTECTION
+    if (!CheckIncFile(szOutName, pszFileName, NULL)) {
+        return 0;
+    }
+#endif
+    pIncFile = CreateIncFileFromMemory(pszFileName, pData, dwSize, NULL);
+    if (pIncFile == NULL) {
+        return 0;
+    }
+    return ConvertIncFile(pIncFile, szOutName);
 }
 
 
@@ -927,10 +1266,11 @@ union strint_strstr {
     struct ITEM_STRSTR strstr;
 };
 
-void ConvertTables() {
+void ConvertTables(void) {
     for (struct CONVTABENTRY* tabEntry = convtab; tabEntry->pszSection != NULL; tabEntry++) {
+        // the default tables are converted already
         if (tabEntry->dwFlags & CF_ATOL) {
-            if (*(char***)tabEntry->pPtr != (char**)tabEntry->pDefault) {
+            if (tabEntry->pStorage != NULL) {
                 union strint_strstr* pPtr = *(union strint_strstr**)tabEntry->pPtr;
                 while (pPtr->strstr.key != NULL) {
                     pPtr->strint.value = atol(pPtr->strstr.value);
@@ -945,7 +1285,7 @@ void ConvertTables() {
             inc = 1;
         }
         // convert string to lower case
-        if (tabEntry->dwFlags & CF_CASE && tabEntry->pPtr != tabEntry->pDefault) {
+        if (tabEntry->dwFlags & CF_CASE && tabEntry->pStorage != NULL) {
             char** pPtr = *(char***)tabEntry->pPtr;
             while (*pPtr != NULL) {
                 strlwr(*pPtr);
@@ -1092,6 +1432,9 @@ void ProcessFiles(char* pszFileSpec) {
         g_rc = !ProcessFile(pszFileSpec, NULL);
         PrintSummary(pszFileSpec);
 #endif
+        if (g_pszEmitSnapshot != NULL && !WriteSnapshot(g_pszEmitSnapshot)) {
+            g_rc = 1;
+        }
 
         DestroyAnalyzerData();
 #if 0
@@ -1101,52 +1444,3 @@ exit:
     SetCurrentDirectory(szDir);
 #endif
 }
-
-// main
-// reads profile file
-// reads command line
-// loops thru all header files calling ProcessFile
-
-int main(int argc, char** argv, char** envp) {
-    size_t dwSize;
-    char* pIniContents;
-    char* lpFilePart;
-    char szOutDir[MAX_PATH];
-    char* pszIniPath;
-
-    g_argc = argc;
-    g_argv = argv;
-    g_envp = envp;
-
-    g_rc = 1;
-
-    g_pszIncDirs = VECTOR_CHARP_CREATE();
-
-    for (int i = 1; i < argc; i++) {
-        if (getoption(argv[i])) {
-            goto main_er;
-        }
-    }
-
-    // read h2incc.ini
-    pIniContents = ReadIniFile(g_pszIniPath, &dwSize);
-    LoadTablesFromProfile(pIniContents, dwSize);
-    free(pIniContents);
-    pIniContents = NULL;
-    ConvertTables();
-    if (g_pszFilespec == NULL) {
-main_er:
-        fprintf(stderr, "%s", szUsage);
-        goto exit;
-    }
-    if (g_pszOutDir == NULL) {
-        g_pszOutDir = ".";
-    }
-
-    ProcessFiles(g_pszFilespec);
-
-exit:
-    FreeProfileData();
-    vector_free(g_pszIncDirs, NULL);
-    return g_rc;
-}
@@ -1,6 +1,7 @@
 #ifndef H2INCC_H
 #define H2INCC_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "vector.h"
@@ -12,6 +13,8 @@
 #define TYPEDEFSUMMARY  1
 #define DYNPROTOQUALS   1
 
+#define MAXWARNINGLVL   3       // max value for -Wn switch
+
 // Prototype qualifiers
 
 enum {
@@ -49,23 +52,55 @@ struct ITEM_STRINT {
     intptr_t value;
 };
 
-struct MACRO_TOKEN {
-    char *name;
-    struct MACRO_TOKEN *next;
-};
+// the numParams parameters of a macro are followed by the numContents
+// tokens of its body in pszTokens, each terminated by '\0'
 
 struct ITEM_MACROINFO {
     char *key;
     intptr_t flags;
     intptr_t containsAppend;
-    const char **params;
-    const char **contents;
+    uint32_t numParams;
+    uint32_t numContents;
+    const char *pszTokens;
+};
+
+// a constant is unknown if it may have several values, i.e. it has
+// been defined again or inside a conditional (--fold-constants)
+
+struct ITEM_CONSTANT {
+    char* key;
+    int64_t value;
+    intptr_t bKnown;
+    uint8_t bUnsigned;      // the C type of the value (struct IFVALUE)
+    uint8_t nBits;
 };
 
+struct INCFILE;
+struct OPTIONSTATE;
+
 int cmpproc(const void*, const void*);
+void* AllocString(size_t dwSize);
 char* AddString(const char* pszString);
-void DestroyString(char* pszString);
-
+void SaveBaseStrings(void);
+void ResetStrings(void);
+void DestroyStrings(void);
+
+int getoption(char* pszArgument);
+char* ReadTextFile(const char* pszPath, size_t* pSize);
+char* ReadIniFile(char* szIniPath, size_t* pSize);
+void LoadTablesFromProfile(char* pszInput, size_t dwSize);
+void ConvertTables(void);
+void FreeProfileData(void);
+void ProcessFiles(char* pszFileSpec);
+struct OPTIONSTATE* SaveOptions(void);
+void RestoreOptions(const struct OPTIONSTATE* pState);
+void ResetInputFiles(void);
+int ProcessFile(char* pszFileName, struct INCFILE* pParent);
+int ProcessBuffer(char* pszFileName, const char* pData, size_t dwSize);
+
+extern const char* szUsage;
+
+extern uint32_t g_rc;
 extern int g_argc;
 extern char** g_argv;
 extern char** g_envp;
@@ -75,7 +110,13 @@ extern char g_szDir[256];
 extern char g_szName[256];
 extern char g_szExt[256];
 
+extern char* g_pszFilespec;
+extern char* g_pszIniPath;
+extern char* g_pszOutDir;
+extern char* g_pszOutFileName;
 extern struct vector *g_pszIncDirs;
+extern struct vector *g_pszDefines;
+extern struct vector *g_pOutputSink;
 extern uint32_t g_dwStructSuffix;
 extern uint32_t g_dwDefCallConv;
 extern struct LIST* g_pStructures;
@@ -88,6 +129,10 @@ extern struct LIST* g_pPrototypes;
 extern struct LIST* g_pTypedefs;
 #endif
 extern struct LIST* g_pQualifiers;
+extern struct LIST* g_pDefines;
+extern struct LIST* g_pConstants;
+extern struct LIST* g_pIncludeGuards;
+extern struct LIST* g_pSymbolGuards;
 extern struct SORTARRAY g_ReservedWords;
 extern struct SORTARRAY g_KnownStructures;
 extern struct SORTARRAY g_ProtoQualifiers;
@@ -102,6 +147,12 @@ extern struct ITEM_STRSTR*      g_ppAlignments;
 extern struct ITEM_STRINT*      g_ppTypeSize;
 
 extern uint8_t g_bTerminate;
+extern uint8_t g_bNoFileIO;
+
+extern void (*g_pfnDiagnostic)(void* pContext, const char* pszText);
+extern void* g_pDiagnosticContext;
+extern int (*g_pfnLoadInclude)(void* pContext, const char* pszDirPath, const char* pszName, const char** ppData, size_t* pdwSize);
+extern void* g_pLoadIncludeContext;
 
 extern uint8_t g_bAddAlign;
 extern uint8_t g_bBatchmode;
@@ -124,12 +175,21 @@ extern uint8_t g_bWarningLevel;
 extern uint8_t g_bOverwrite;
 extern uint8_t g_bCreateDefs;
 extern uint8_t g_bPrefixReserved;
+extern uint8_t g_bServer;
+extern uint8_t g_bFoldIf;
+extern uint8_t g_bFoldConstants;
+extern uint8_t g_bIncludeGuard;
+extern uint8_t g_bGuardSymbols;
+extern char* g_pszEmitSnapshot;
+extern char* g_pszUseSnapshot;
 
 extern uint8_t g_bPrototypes;
 extern uint8_t g_bTypedefs;
 extern uint8_t g_bConstants;
 extern uint8_t g_bExternals;
 
+int diag_printf(const char* format, ...);
+
 #ifdef _TRACE
 int debug_printf(const char* format, ...);
 #else
@@ -0,0 +1,156 @@
+#include "hotdecls.h"
+#include "timereport.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXDECLDEPTH    256     // declarations nested deeper aren't counted
+
+struct HOTDECL {
+    double self;
+    uint32_t dwTokens;
+    uint32_t dwLine;
+    const char* pszKind;
+    char* pszName;
+    char* pszFileName;
+};
+
+struct OPENDECL {
+    const void* pFile;
+    uint32_t dwLine;
+    uint32_t dwTokens;          // tokens read when the declaration started
+    uint32_t dwChildTokens;     // tokens of the declarations of the same file started inside
+    double start;
+    double children;
+};
+
+char* g_pszHotDecls;
+uint32_t g_dwHotDecls;
+
+static struct HOTDECL* g_pHotDecls;     // sorted by self time, descending
+static uint32_t g_dwNumHotDecls;
+static struct OPENDECL g_OpenDecls[MAXDECLDEPTH];
+static uint32_t g_dwDeclDepth;          // may exceed MAXDECLDEPTH
+static uint32_t g_dwNumDecls;           // declarations seen
+static double g_totalTime;              // self time of all declarations
+static size_t g_dwTotalTokens;
+
+// returns 0 if dwCount is 0 or out of memory
+
+int InitHotDecls(uint32_t dwCount) {
+    if (dwCount == 0) {
+        return 0;
+    }
+    g_pHotDecls = calloc(dwCount, sizeof(struct HOTDECL));
+    if (g_pHotDecls == NULL) {
+        return 0;
+    }
+    g_dwHotDecls = dwCount;
+    return 1;
+}
+
+void BeginHotDecl(const void* pFile, uint32_t dwLine, uint32_t dwTokens) {
+    if (g_dwDeclDepth++ >= MAXDECLDEPTH) {
+        return;
+    }
+    struct OPENDECL* pDecl = &g_OpenDecls[g_dwDeclDepth - 1];
+    pDecl->pFile = pFile;
+    pDecl->dwLine = dwLine;
+    pDecl->dwTokens = dwTokens;
+    pDecl->dwChildTokens = 0;
+    pDecl->children = 0;
+    pDecl->start = GetTime();
+}
+
+static char* DupString(const char* pszString) {
+    char* p = malloc(strlen(pszString) + 1);
+    if (p != NULL) {
+        strcpy(p, pszString);
+    }
+    return p;
+}
+
+static void AddHotDecl(const struct HOTDECL* pHotDecl) {
+    uint32_t i = g_dwNumHotDecls;
+    if (i == g_dwHotDecls) {
+        if (g_pHotDecls[i - 1].self >= pHotDecl->self) {
+            return;
+        }
+        i--;
+        free(g_pHotDecls[i].pszName);
+        free(g_pHotDecls[i].pszFileName);
+    } else {
+        g_dwNumHotDecls++;
+    }
+    for (; i > 0 && g_pHotDecls[i - 1].self < pHotDecl->self; i--) {
+        g_pHotDecls[i] = g_pHotDecls[i - 1];
+    }
+    g_pHotDecls[i] = *pHotDecl;
+    g_pHotDecls[i].pszName = DupString(pHotDecl->pszName);
+    g_pHotDecls[i].pszFileName = DupString(pHotDecl->pszFileName);
+}
+
+// pszKind is NULL if the tokens read didn't start a declaration,
+// the time is then charged to nothing
+
+void EndHotDecl(const char* pszKind, const char* pszName, const char* pszFileName, uint32_t dwTokens) {
+    double end = GetTime();
+    if (g_dwDeclDepth == 0) {
+        return;
+    }
+    if (--g_dwDeclDepth >= MAXDECLDEPTH) {
+        return;
+    }
+    struct OPENDECL* pDecl = &g_OpenDecls[g_dwDeclDepth];
+    double elapsed = end - pDecl->start;
+    uint32_t dwRead = dwTokens - pDecl->dwTokens;
+    if (g_dwDeclDepth != 0) {
+        struct OPENDECL* pParent = &g_OpenDecls[g_dwDeclDepth - 1];
+        pParent->children += elapsed;
+        if (pParent->pFile == pDecl->pFile) {
+            pParent->dwChildTokens += dwRead;
+        }
+    }
+    if (pszKind == NULL) {
+        return;
+    }
+    struct HOTDECL hotDecl;
+    hotDecl.self = elapsed - pDecl->children;
+    hotDecl.dwTokens = dwRead - pDecl->dwChildTokens;
+    hotDecl.dwLine = pDecl->dwLine;
+    hotDecl.pszKind = pszKind;
+    hotDecl.pszName = (char*)(pszName != NULL ? pszName : "");
+    hotDecl.pszFileName = (char*)pszFileName;
+    g_dwNumDecls++;
+    g_totalTime += hotDecl.self;
+    g_dwTotalTokens += hotDecl.dwTokens;
+    AddHotDecl(&hotDecl);
+}
+
+void PrintHotDecls(FILE* f) {
+    fprintf(f, "hot declarations: %u of %u, %.3f ms, %lu tokens\n", g_dwNumHotDecls, g_dwNumDecls,
+            g_totalTime * 1e3, (unsigned long)g_dwTotalTokens);
+    fprintf(f, "   self ms   self    tokens  kind       name  file\n");
+    for (uint32_t i = 0; i < g_dwNumHotDecls; i++) {
+        struct HOTDECL* pHotDecl = &g_pHotDecls[i];
+        fprintf(f, "%10.3f %5.1f%% %9u  %-10s %s  %s:%u\n", pHotDecl->self * 1e3,
+                g_totalTime > 0 ? 100.0 * pHotDecl->self / g_totalTime : 0.0, pHotDecl->dwTokens, pHotDecl->pszKind,
+                pHotDecl->pszName != NULL ? pHotDecl->pszName : "", pHotDecl->pszFileName != NULL ? pHotDecl->pszFileName : "",
+                pHotDecl->dwLine);
+    }
+}
+
+void DestroyHotDecls(void) {
+    for (uint32_t i = 0; i < g_dwNumHotDecls; i++) {
+        free(g_pHotDecls[i].pszName);
+        free(g_pHotDecls[i].pszFileName);
+    }
+    free(g_pHotDecls);
+    g_pHotDecls = NULL;
+    g_dwNumHotDecls = 0;
+    g_dwHotDecls = 0;
+    g_dwDeclDepth = 0;
+    g_dwNumDecls = 0;
+    g_totalTime = 0;
+    g_dwTotalTokens = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef HOTDECLS_H
+#define HOTDECLS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// the most expensive declarations of the analyzer (--hot-decls)
+// The time and the tokens read of a declaration exclude the declarations
+// started inside it, e.g. the #define lines read by a lookahead.
+
+extern char* g_pszHotDecls;             // --hot-decls cmdline switch
+extern uint32_t g_dwHotDecls;           // number of declarations reported, 0 if none
+
+int InitHotDecls(uint32_t dwCount);
+void BeginHotDecl(const void* pFile, uint32_t dwLine, uint32_t dwTokens);
+void EndHotDecl(const char* pszKind, const char* pszName, const char* pszFileName, uint32_t dwTokens);
+void PrintHotDecls(FILE* f);
+void DestroyHotDecls(void);
+
+#endif // HOTDECLS_H
@@ -0,0 +1,450 @@
+#include "ifexpr.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// integer constant evaluator for #if/#elif expressions (--fold-if)
+//
+// The tokens must be macro expanded and "defined" must already be
+// replaced by 0 or 1, so an expression consists of numbers and operators
+// only. Numbers are accepted in C syntax (-D values) and in the MASM
+// syntax written by the parser (hex numbers with 'h' suffix).
+// Any token which cannot be handled makes the expression unknown.
+// EvaluateConstExpression accepts names of constants too (--fold-constants).
+//
+// The values have C types. In #if expressions these are intmax_t and
+// uintmax_t (64 bits). Constants have the types of the target, int and
+// long have 32 bits, long long has 64 bits. A number has the first type
+// of the C list for its suffix and base which can hold it, an operation
+// converts its operands to their common type (the usual arithmetic
+// conversions). An operation without a defined result in C (signed
+// overflow, a shift by the width or more, division by 0) makes the
+// expression unknown.
+
+struct IFEXPR {
+    char** ppTokens;
+    size_t numTokens;
+    size_t dwPos;
+    int bError;
+    PFNCONSTANT pfnConstant;    // resolves names, NULL for #if expressions
+    PFNSUFFIX pfnSuffix;        // suffixes the parser removed from numbers, may be NULL
+    void* pContext;
+    uint8_t nIntBits;           // width of int, 64 in #if expressions
+};
+
+// binary operators and their precedence
+
+struct IFOPERATOR {
+    const char* pszOp;
+    int nPrec;
+};
+
+static const struct IFOPERATOR g_IfOperators[] = {
+    { "||", 1 },
+    { "&&", 2 },
+    { "|",  3 },
+    { "^",  4 },
+    { "&",  5 },
+    { "==", 6 },
+    { "!=", 6 },
+    { "<",  7 },
+    { ">",  7 },
+    { "<=", 7 },
+    { ">=", 7 },
+    { "<<", 8 },
+    { ">>", 8 },
+    { "+",  9 },
+    { "-",  9 },
+    { "*",  10 },
+    { "/",  10 },
+    { "%",  10 },
+};
+
+static struct IFVALUE EvalConditional(struct IFEXPR* pExpr, int bEval);
+
+static char* PeekIfToken(struct IFEXPR* pExpr) {
+    if (pExpr->dwPos < pExpr->numTokens) {
+        return pExpr->ppTokens[pExpr->dwPos];
+    }
+    return NULL;
+}
+
+static int IsIfToken(struct IFEXPR* pExpr, const char* pszToken) {
+    char* pszNext = PeekIfToken(pExpr);
+    return pszNext != NULL && strcmp(pszNext, pszToken) == 0;
+}
+
+static int GetDigitValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static int64_t GetMaxSigned(uint8_t nBits) {
+    return nBits < 64 ? (INT64_C(1) << (nBits - 1)) - 1 : INT64_MAX;
+}
+
+static uint64_t GetMaxUnsigned(uint8_t nBits) {
+    return nBits < 64 ? (UINT64_C(1) << nBits) - 1 : UINT64_MAX;
+}
+
+static int IsSignedInRange(int64_t value, uint8_t nBits) {
+    return value <= GetMaxSigned(nBits) && value >= -GetMaxSigned(nBits) - 1;
+}
+
+// an unsigned value is reduced modulo 2^nBits, a signed one must fit
+
+static struct IFVALUE MakeValue(int64_t value, uint8_t bUnsigned, uint8_t nBits) {
+    struct IFVALUE result;
+    result.value = bUnsigned ? (int64_t)((uint64_t)value & GetMaxUnsigned(nBits)) : value;
+    result.bUnsigned = bUnsigned;
+    result.nBits = nBits;
+    return result;
+}
+
+// the result of a comparison or a logical operator, an int 0 or 1
+
+static struct IFVALUE MakeBool(struct IFEXPR* pExpr, int bValue) {
+    return MakeValue(bValue != 0, 0, pExpr->nIntBits);
+}
+
+// an operation whose result isn't defined in C
+// an operand which isn't evaluated (&&, ||, ?:) doesn't matter
+
+static struct IFVALUE Undefined(struct IFEXPR* pExpr, int bEval) {
+    if (bEval) {
+        pExpr->bError = 1;
+    }
+    return MakeValue(0, 0, pExpr->nIntBits);
+}
+
+static struct IFVALUE Invalid(struct IFEXPR* pExpr) {
+    pExpr->bError = 1;
+    return MakeValue(0, 0, pExpr->nIntBits);
+}
+
+// the usual arithmetic conversions: both operands get the wider width,
+// they are unsigned if one of them is, unless the signed one is wider
+
+static void ConvertOperands(struct IFVALUE* pLeft, struct IFVALUE* pRight) {
+    uint8_t nBits = pLeft->nBits > pRight->nBits ? pLeft->nBits : pRight->nBits;
+    uint8_t bUnsigned = pLeft->bUnsigned;
+    if (pLeft->bUnsigned != pRight->bUnsigned) {
+        struct IFVALUE* pUnsigned = pLeft->bUnsigned ? pLeft : pRight;
+        bUnsigned = pUnsigned->nBits == nBits;
+    }
+    *pLeft = MakeValue(pLeft->value, bUnsigned, nBits);
+    *pRight = MakeValue(pRight->value, bUnsigned, nBits);
+}
+
+// convert a number token
+// C: 123, 0x1F, 017 with optional u/l suffixes
+// MASM: 1Fh, 0FFh
+// the type is the first of int, unsigned int, long long and unsigned long
+// long which can hold the value; a u suffix skips the signed types, an ll
+// suffix the ones of int width. A decimal number without u suffix is
+// signed.
+
+static int GetIfNumber(struct IFEXPR* pExpr, const char* pszToken, struct IFVALUE* pValue) {
+    const char* p = pszToken;
+    size_t len = strlen(pszToken);
+    uint64_t value = 0;
+    int base = 10;
+    int nSuffix = 0;
+
+    if (pExpr->pfnSuffix != NULL) {
+        nSuffix = pExpr->pfnSuffix(pExpr->pContext, pszToken);
+        if (nSuffix < 0) {
+            return 0;
+        }
+    }
+    int numLongs = 0;
+    while (len > 1 && strchr("uUlL", p[len - 1]) != NULL) {
+        if ((p[len - 1] | 0x20) == 'u') {
+            nSuffix |= NS_UNSIGNED;
+        } else if (++numLongs == 2) {
+            nSuffix |= NS_LONGLONG;
+        }
+        len--;
+    }
+    if (len > 2 && p[0] == '0' && (p[1] | 0x20) == 'x') {
+        base = 16;
+        p += 2;
+        len -= 2;
+    } else if (len > 1 && (p[len - 1] | 0x20) == 'h') {
+        base = 16;
+        len--;
+    } else if (len > 1 && p[0] == '0') {
+        base = 8;
+    }
+    for (size_t i = 0; i < len; i++) {
+        int digit = GetDigitValue(p[i]);
+        if (digit < 0 || digit >= base || value > (UINT64_MAX - digit) / base) {
+            return 0;
+        }
+        value = value * base + digit;
+    }
+    uint8_t nBits = nSuffix & NS_LONGLONG ? 64 : pExpr->nIntBits;
+    while (1) {
+        if (!(nSuffix & NS_UNSIGNED) && value <= (uint64_t)GetMaxSigned(nBits)) {
+            *pValue = MakeValue((int64_t)value, 0, nBits);
+            return 1;
+        }
+        if (((nSuffix & NS_UNSIGNED) || base != 10) && value <= GetMaxUnsigned(nBits)) {
+            *pValue = MakeValue((int64_t)value, 1, nBits);
+            return 1;
+        }
+        if (nBits == 64) {
+            return 0;
+        }
+        nBits = 64;
+    }
+}
+
+static struct IFVALUE EvalPrimary(struct IFEXPR* pExpr, int bEval) {
+    char* pszToken = PeekIfToken(pExpr);
+    struct IFVALUE value;
+
+    if (pszToken == NULL) {
+        return Invalid(pExpr);
+    }
+    pExpr->dwPos++;
+    if (strcmp(pszToken, "(") == 0) {
+        value = EvalConditional(pExpr, bEval);
+        if (!IsIfToken(pExpr, ")")) {
+            return Invalid(pExpr);
+        }
+        pExpr->dwPos++;
+        return value;
+    } else if (strcmp(pszToken, "!") == 0) {
+        return MakeBool(pExpr, EvalPrimary(pExpr, bEval).value == 0);
+    } else if (strcmp(pszToken, "~") == 0) {
+        value = EvalPrimary(pExpr, bEval);
+        return MakeValue(~value.value, value.bUnsigned, value.nBits);
+    } else if (strcmp(pszToken, "-") == 0) {
+        value = EvalPrimary(pExpr, bEval);
+        if (!value.bUnsigned && value.value == -GetMaxSigned(value.nBits) - 1) {
+            return Undefined(pExpr, bEval);
+        }
+        return MakeValue((int64_t)(0 - (uint64_t)value.value), value.bUnsigned, value.nBits);
+    } else if (strcmp(pszToken, "+") == 0) {
+        return EvalPrimary(pExpr, bEval);
+    } else if (pszToken[0] >= '0' && pszToken[0] <= '9' && GetIfNumber(pExpr, pszToken, &value)) {
+        return value;
+    } else if (pExpr->pfnConstant != NULL && pExpr->pfnConstant(pExpr->pContext, pszToken, &value)) {
+        return value;
+    }
+    return Invalid(pExpr);
+}
+
+static int GetIfOperator(struct IFEXPR* pExpr) {
+    char* pszToken = PeekIfToken(pExpr);
+    if (pszToken != NULL) {
+        for (size_t i = 0; i < ARRAY_SIZE(g_IfOperators); i++) {
+            if (strcmp(pszToken, g_IfOperators[i].pszOp) == 0) {
+                return (int)i;
+            }
+        }
+    }
+    return -1;
+}
+
+// the left operand of a shift keeps its type, the count must be less
+// than its width
+
+static struct IFVALUE EvalShift(struct IFEXPR* pExpr, const char* pszOp, struct IFVALUE left, struct IFVALUE right, int bEval) {
+    if ((!right.bUnsigned && right.value < 0) || (uint64_t)right.value >= left.nBits) {
+        return Undefined(pExpr, bEval);
+    }
+    int nCount = (int)right.value;
+    if (left.bUnsigned) {
+        uint64_t value = (uint64_t)left.value;
+        return MakeValue((int64_t)(pszOp[0] == '<' ? value << nCount : value >> nCount), 1, left.nBits);
+    }
+    if (pszOp[0] == '>') {
+        return MakeValue(left.value >> nCount, 0, left.nBits);
+    }
+    if (left.value < 0 || left.value > (GetMaxSigned(left.nBits) >> nCount)) {
+        return Undefined(pExpr, bEval);
+    }
+    return MakeValue(left.value << nCount, 0, left.nBits);
+}
+
+// the other operators convert the operands to their common type
+
+static struct IFVALUE EvalArithmetic(struct IFEXPR* pExpr, const char* pszOp, struct IFVALUE left, struct IFVALUE right, int bEval) {
+    ConvertOperands(&left, &right);
+    int64_t l = left.value;
+    int64_t r = right.value;
+    uint8_t nBits = left.nBits;
+
+    if (left.bUnsigned) {
+        uint64_t ul = (uint64_t)l;
+        uint64_t ur = (uint64_t)r;
+        switch (pszOp[0]) {
+        case '|':
+            return MakeValue((int64_t)(ul | ur), 1, nBits);
+        case '&':
+            return MakeValue((int64_t)(ul & ur), 1, nBits);
+        case '^':
+            return MakeValue((int64_t)(ul ^ ur), 1, nBits);
+        case '=':
+            return MakeBool(pExpr, ul == ur);
+        case '!':
+            return MakeBool(pExpr, ul != ur);
+        case '<':
+            return MakeBool(pExpr, pszOp[1] == '=' ? ul <= ur : ul < ur);
+        case '>':
+            return MakeBool(pExpr, pszOp[1] == '=' ? ul >= ur : ul > ur);
+        case '+':
+            return MakeValue((int64_t)(ul + ur), 1, nBits);
+        case '-':
+            return MakeValue((int64_t)(ul - ur), 1, nBits);
+        case '*':
+            return MakeValue((int64_t)(ul * ur), 1, nBits);
+        }
+        if (ur == 0) {
+            return Undefined(pExpr, bEval);
+        }
+        return MakeValue((int64_t)(pszOp[0] == '/' ? ul / ur : ul % ur), 1, nBits);
+    }
+    int64_t result;
+    switch (pszOp[0]) {
+    case '|':
+        return MakeValue(l | r, 0, nBits);
+    case '&':
+        return MakeValue(l & r, 0, nBits);
+    case '^':
+        return MakeValue(l ^ r, 0, nBits);
+    case '=':
+        return MakeBool(pExpr, l == r);
+    case '!':
+        return MakeBool(pExpr, l != r);
+    case '<':
+        return MakeBool(pExpr, pszOp[1] == '=' ? l <= r : l < r);
+    case '>':
+        return MakeBool(pExpr, pszOp[1] == '=' ? l >= r : l > r);
+    case '+':
+        if ((r > 0 && l > INT64_MAX - r) || (r < 0 && l < INT64_MIN - r)) {
+            return Undefined(pExpr, bEval);
+        }
+        result = l + r;
+        break;
+    case '-':
+        if ((r < 0 && l > INT64_MAX + r) || (r > 0 && l < INT64_MIN + r)) {
+            return Undefined(pExpr, bEval);
+        }
+        result = l - r;
+        break;
+    case '*':
+        if (l != 0 && r != 0 && (l > 0 ? (r > 0 ? l > INT64_MAX / r : r < INT64_MIN / l)
+                                       : (r > 0 ? l < INT64_MIN / r : l < INT64_MAX / r))) {
+            return Undefined(pExpr, bEval);
+        }
+        result = l * r;
+        break;
+    default:
+        if (r == 0 || (l == INT64_MIN && r == -1)) {
+            return Undefined(pExpr, bEval);
+        }
+        result = pszOp[0] == '/' ? l / r : l % r;
+        break;
+    }
+    // a signed result narrower than 64 bits must fit as well
+    if (!IsSignedInRange(result, nBits)) {
+        return Undefined(pExpr, bEval);
+    }
+    return MakeValue(result, 0, nBits);
+}
+
+static struct IFVALUE EvalBinary(struct IFEXPR* pExpr, int nMinPrec, int bEval) {
+    struct IFVALUE left = EvalPrimary(pExpr, bEval);
+    while (!pExpr->bError) {
+        int op = GetIfOperator(pExpr);
+        if (op < 0 || g_IfOperators[op].nPrec < nMinPrec) {
+            break;
+        }
+        const char* pszOp = g_IfOperators[op].pszOp;
+        pExpr->dwPos++;
+        // right operand of && and || is not evaluated if result is known
+        int bEvalRight = bEval;
+        if (strcmp(pszOp, "&&") == 0) {
+            bEvalRight = bEval && left.value != 0;
+        } else if (strcmp(pszOp, "||") == 0) {
+            bEvalRight = bEval && left.value == 0;
+        }
+        struct IFVALUE right = EvalBinary(pExpr, g_IfOperators[op].nPrec + 1, bEvalRight);
+        if (pExpr->bError) {
+            break;
+        }
+        if (strcmp(pszOp, "&&") == 0) {
+            left = MakeBool(pExpr, left.value != 0 && right.value != 0);
+        } else if (strcmp(pszOp, "||") == 0) {
+            left = MakeBool(pExpr, left.value != 0 || right.value != 0);
+        } else if ((pszOp[0] == '<' || pszOp[0] == '>') && pszOp[1] == pszOp[0]) {
+            left = EvalShift(pExpr, pszOp, left, right, bEvalRight);
+        } else {
+            left = EvalArithmetic(pExpr, pszOp, left, right, bEvalRight);
+        }
+    }
+    return left;
+}
+
+static struct IFVALUE EvalConditional(struct IFEXPR* pExpr, int bEval) {
+    struct IFVALUE value = EvalBinary(pExpr, 1, bEval);
+    if (pExpr->bError || !IsIfToken(pExpr, "?")) {
+        return value;
+    }
+    pExpr->dwPos++;
+    struct IFVALUE value1 = EvalConditional(pExpr, bEval && value.value != 0);
+    if (pExpr->bError || !IsIfToken(pExpr, ":")) {
+        return Invalid(pExpr);
+    }
+    pExpr->dwPos++;
+    struct IFVALUE value2 = EvalConditional(pExpr, bEval && value.value == 0);
+    // the result has the common type of both operands
+    ConvertOperands(&value1, &value2);
+    return value.value != 0 ? value1 : value2;
+}
+
+// evaluate an expression
+// returns 0 if the expression cannot be evaluated
+
+static int Evaluate(char** ppTokens, size_t numTokens, PFNCONSTANT pfnConstant, PFNSUFFIX pfnSuffix, void* pContext,
+                    uint8_t nIntBits, struct IFVALUE* pValue) {
+    struct IFEXPR expr;
+
+    expr.ppTokens = ppTokens;
+    expr.numTokens = numTokens;
+    expr.dwPos = 0;
+    expr.bError = 0;
+    expr.pfnConstant = pfnConstant;
+    expr.pfnSuffix = pfnSuffix;
+    expr.pContext = pContext;
+    expr.nIntBits = nIntBits;
+    *pValue = EvalConditional(&expr, 1);
+    return !expr.bError && expr.dwPos == numTokens;
+}
+
+// #if: all values are intmax_t or uintmax_t
+
+int EvaluateIfExpression(char** ppTokens, size_t numTokens, PFNSUFFIX pfnSuffix, void* pContext, int64_t* pValue) {
+    struct IFVALUE value;
+    if (!Evaluate(ppTokens, numTokens, NULL, pfnSuffix, pContext, 64, &value)) {
+        return 0;
+    }
+    *pValue = value.value;
+    return 1;
+}
+
+// constants: int has 32 bits
+
+int EvaluateConstExpression(char** ppTokens, size_t numTokens, PFNCONSTANT pfnConstant, PFNSUFFIX pfnSuffix, void* pContext, struct IFVALUE* pValue) {
+    return Evaluate(ppTokens, numTokens, pfnConstant, pfnSuffix, pContext, 32, pValue);
+}
@@ -0,0 +1,28 @@
+#ifndef IFEXPR_H
+#define IFEXPR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// a value and its C type
+struct IFVALUE {
+    int64_t value;          // an unsigned value is stored as its bits
+    uint8_t bUnsigned;
+    uint8_t nBits;          // 32 (int, long) or 64 (long long, intmax_t)
+};
+
+// suffixes of a number which the parser removed from the token
+enum {
+    NS_UNSIGNED = 0x01,     // u
+    NS_LONGLONG = 0x02,     // ll
+};
+
+// returns 0 if pszName isn't a known constant
+typedef int (*PFNCONSTANT)(void* pContext, const char* pszName, struct IFVALUE* pValue);
+// returns the NS_ flags of a number token, -1 if they aren't known
+typedef int (*PFNSUFFIX)(void* pContext, const char* pszNumber);
+
+int EvaluateIfExpression(char** ppTokens, size_t numTokens, PFNSUFFIX pfnSuffix, void* pContext, int64_t* pValue);
+int EvaluateConstExpression(char** ppTokens, size_t numTokens, PFNCONSTANT pfnConstant, PFNSUFFIX pfnSuffix, void* pContext, struct IFVALUE* pValue);
+
+#endif // IFEXPR_H
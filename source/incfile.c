@@ -1,7 +1,16 @@
 #include "incfile.h"
+#include "arena.h"
+#include "ifexpr.h"
+#include "lexscan.h"
 #include "list.h"
 #include "h2incc.h"
+#include "hotdecls.h"
+#include "shake.h"
+#include "stats.h"
+#include "timereport.h"
+#include "trace.h"
 #include "util.h"
+#include "vector.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -21,8 +30,11 @@
 #define IFISSTRUCT      1           // handle "interface" as "struct"
 
 #define MAXSTRUCTNAME   128
+#define INCFILEARENASIZE 0x1000     // room for transient data in the first arena block of a file
+#define OUTPUTRESERVE   0x100       // room behind pszOutEnd for chars written directly
+#define OUTPUTFACTOR    4           // analyzer output buffer: file size * OUTPUTFACTOR + OUTPUTMIN
+#define OUTPUTMIN       0x4000
 
-#define MAXITEMS        0x10000	    // max. items in structure/macro list
 #define ADDTERMNULL	    0           // add ",0" to string declarations
 #define ADD50PERCENT	0		    // 1=buffer size 50% larger than file size
 							        // 0=buffer size 100% larger than file size
@@ -33,9 +45,14 @@ struct INCFILE {
     char*           pszOut;                 // pointer output stream
     char*           pszInStart;             // pointer to input start
     char*           pszOutStart;            // pointer to output start
+    char*           pszOutEnd;              // end of output buffer for xwrite/xprintf
     char*		    pBuffer1;               // buffer pointers in/out
     char*           pBuffer2;               // buffer pointers in/out
+    uint8_t*        pTokenFlags;            // TF_ flags of the tokens in pBuffer2, by offset
+    uint32_t        dwTokenFlags;           // size of pTokenFlags
     uint32_t        dwBufSize;              // size of buffers
+    uint32_t        dwOutBufSize;           // size of pBuffer1, which receives the analyzer output
+    struct ARENA*   pArena;                 // holds the object, its buffers and transient data
     struct LIST*    pDefs;                  // .DEF file content
     char*           pszFileName;            // file name
     char*           pszFullPath;            // full path
@@ -61,16 +78,45 @@ struct INCFILE {
     //FILETIME        filetime;               //
     uint8_t         bIfStack[MAXIFLEVEL+1]; // 'if' stack
     uint8_t         bIfLvl;                 // current 'if' level
+    uint8_t         bFoldStack[MAXIFLEVEL+1]; // #if folding stack (--fold-if)
+    uint8_t         bFoldLvl;               // current #if folding level
+    uint32_t        dwFoldOverflow;         // open conditionals beyond MAXIFLEVEL, not folded
     uint8_t         bSkipPP;                // >0=dont parse preprocessor lines in input stream
     uint8_t         bNewLine;               // last token was a PP_EOL
     uint8_t         bContinuation;          // preprocessor continuation line
     uint8_t         bComment;               // counter for "/*" and "*/" strings
     uint8_t         bDefinedMac;            // "defined" macro in output stream included
+    uint8_t         bOutputFull;            // output buffer overflow reported
     uint8_t         bAlignMac;              // "@align" macro in output stream included
     uint8_t         bUseLastToken;          //
     uint8_t         bC;                     // extern "C" occured
     uint8_t         bIsClass;               // inside a class definition
     uint8_t         bIsInterface;           // inside an interface definition
+    uint8_t         bGuardState;            // include guard detection state
+    uint8_t         bGuardDefined;          // guard macro is defined inside the guard
+    uint8_t         bPragmaOnce;            // "#pragma once" occured
+    uint32_t        dwGuardLevel;           // conditional level inside the guard
+    uint32_t        dwPPLevel;              // conditional level while tokenizing
+    uint32_t        dwDropLevel;            // conditional level inside a dropped region
+    uint8_t         bDropLines;             // tokenizer is in a dropped region of a false "#if"
+    char*           pszGuard;               // include guard macro (if any)
+    char*           pszGuardIf;             // first token behind the guard's #ifndef/#if
+    struct vector*  pBracketPairs;          // bracket match index (BRACKETPAIR)
+    struct vector*  pBracketStack[2];       // open "(" and "{" while tokenizing (BRACKETOPEN)
+    struct vector*  pBracketFrames;         // open conditionals while tokenizing (BRACKETFRAME)
+    struct vector*  pDeclSpans;             // declaration index (DECLSPAN)
+    struct vector*  pLineTokens;            // tokens of the current preprocessor line (PPLINE)
+    struct vector*  pMacroTokens;           // parameters and body of a macro, arguments of an invocation
+    struct vector*  pGuardNames;            // names not yet in g_pSymbolGuards (GUARDNAME, --guard-symbols)
+    uint32_t        dwDeclStart;            // start of the open span while tokenizing
+    uint8_t         bDeclParen;             // last span waits for the token behind its "("
+    uint8_t         bEnumKnown;             // dwEnumValue is the value of the next member (--fold-constants)
+    uint32_t        dwTokensConsumed;       // tokens read by the analyzer
+    uint32_t        dwTokensScanned;        // tokens read by lookaheads (bSkipPP > 0)
+    uint32_t        dwTokensPP;             // tokens read by the preprocessor line handlers
+    char            szDeclName[64];         // name of the declaration ParseC is in (--hot-decls)
+    char*           pszShakeOut;            // output not yet collected (--shake)
+    struct STATS    statsStart;             // counters when the file was created (--stats)
 };
 
 int contains(char *needle, char **array, int count) {
@@ -88,7 +134,6 @@ char *GetNextTokenPP(struct INCFILE* pIncFile);
 
 int getblock(struct INCFILE* pIncFile, char* pszStructName, uint32_t dwMode, char* pszParent);
 int MacroInvocation(struct INCFILE* pIncFile, char* pszToken, struct ITEM_MACROINFO* pMacroInfo, int bWriteLF);
-void ProcessFile(char*, struct INCFILE* pIncFile);
 int ParseTypedefFunction(struct INCFILE* pIncFile, char* pszName, int bAcceptBody, char* pszParent);
 int ParseTypedefFunctionPtr(struct INCFILE* pIncFile, char* pszParent, char**outPszName);
 char* TranslateName(char* , char*, int *);
@@ -123,75 +168,87 @@ enum {
     MF_INTERFACEEND = 0x100,	// add an "??Interface equ <>" line
 };
 
+// #if folding states (--fold-if)
+enum {
+    FS_SEARCHING    = 0x00,     // no branch taken yet, nothing written
+    FS_EMITTED      = 0x01,     // conditional written as MASM if/elseif
+    FS_TAKEN        = 0x02,     // a branch is known to be taken, skip the others
+    FS_GUARD        = 0x04,     // include guard, defines inside stay known
+};
+
+// include guard detection states
+enum {
+    GS_START        = 0,        // nothing but comments so far
+    GS_INSIDE       = 1,        // inside the guard conditional
+    GS_CLOSED       = 2,        // guard conditional has been closed
+    GS_NONE         = 3,        // file isn't guarded
+};
+
+#define MAXIFTOKENS     256     // max. tokens of an expanded #if expression
+#define MAXIFEXPANSION  16      // max. nesting of macros in #if expressions
+
 struct INPSTAT {
     char* pszIn;
     uint32_t dwLine;
-    uint8_t bIfStack[MAXIFLEVEL];
+    uint8_t bIfStack[MAXIFLEVEL+1];
     uint8_t bIfLvl;
+    uint8_t bFoldStack[MAXIFLEVEL+1];
+    uint8_t bFoldLvl;
+    uint32_t dwFoldOverflow;
     uint8_t bNewLine;
+    uint32_t dwTokensRead;      // tokens read before, to count the rescanned ones
 };
 
-#define LINKEDLIST_ITEM_CAPACITY        32
-struct LinkedList {
-    struct LinkedList* next;
-    uintptr_t items[LINKEDLIST_ITEM_CAPACITY];
-    uint8_t this_size;
+// bracket match index, built by the tokenizer
+
+enum {
+    BK_PAREN = 0,               // "(" and ")"
+    BK_BRACE = 1,               // "{" and "}"
 };
 
-struct LinkedList* CreateLinkedList(void) {
-    struct LinkedList* res = malloc(sizeof(struct LinkedList));
-    res->next = NULL;
-    res->this_size = 0;
-    return res;
-}
+struct BRACKETPAIR {
+    uint32_t dwOpen;            // offset of the opening token in pBuffer2
+    uint32_t dwClose;           // offset of the closing token, 0 if unknown
+    uint8_t bVirtual;           // "virtual" found directly inside "{" and "}"
+};
 
-void DestroyLinkedList(struct LinkedList* list) {
-    while (list != NULL) {
-        struct LinkedList *next = list->next;
-        free(list);
-        list = next;
-    }
-}
+struct BRACKETOPEN {
+    uint32_t dwPair;            // index in pBracketPairs
+    uint32_t dwFrames;          // number of open conditionals at the bracket
+    uint8_t bUnknown;           // pair must not be used
+};
 
-void AddLinkedList(struct LinkedList* list, uintptr_t item) {
-    while (list->this_size >= LINKEDLIST_ITEM_CAPACITY) {
-        struct LinkedList *next = list->next;
-        if (next == NULL) {
-            next = CreateLinkedList();
-            list->next = next;
-            break;
-        }
-        list = next;
-    }
-    list->items[list->this_size] = item;
-    list->this_size++;
-}
+struct BRACKETFRAME {
+    uint32_t dwDepth[2];        // size of the bracket stacks at the #if
+};
 
-uint32_t GetNumItemsLinkedList(struct LinkedList* list) {
-    uint32_t count = 0;
-    while (list != NULL) {
-        count += list->this_size;
-        list = list->next;
-    }
-    return count;
-}
+// declaration index, built by the tokenizer
 
-uintptr_t GetItemLinkedList(struct LinkedList* list, uint32_t index) {
-    while (index >= list->this_size) {
-        index -= list->this_size;
-        list = list->next;
-        if (list == NULL) {
-            abort();
-            return 0;
-        }
-    }
-    return list->items[index];
-}
+enum {
+    DS_END      = 0,            // ";" or "," ends the span
+    DS_BLOCK    = 1,            // "{" ends the span
+    DS_FUNCTION = 2,            // "(" ends the span
+    DS_FUNCPTR  = 3,            // "(" followed by "*" ends the span
+};
+
+struct DECLSPAN {
+    uint32_t dwStart;           // offset in pBuffer2 where the span starts
+    uint32_t dwEnd;             // offset of the token ending the span
+    uint8_t bShape;             // DS_ value
+};
+
+// a name written since ParseC started the declaration (--guard-symbols)
+
+struct GUARDNAME {
+    char* pszName;              // in the arena of the file
+    uint32_t dwOut;             // offset of the output where it was written
+};
 
 void IsDefine(struct INCFILE*);
 void IsInclude(struct INCFILE*);
 void IsError(struct INCFILE*);
 void IsPragma(struct INCFILE*);
+void IsUndef(struct INCFILE*);
 void IsIf(struct INCFILE*);
 void IsElIf(struct INCFILE*);
 void IsElse(struct INCFILE*);
@@ -200,6 +257,8 @@ void IsIfdef(struct INCFILE*);
 void IsIfndef(struct INCFILE*);
 
 void IsIfNP(struct INCFILE*);
+void IsIfdefNP(struct INCFILE*);
+void IsIfndefNP(struct INCFILE*);
 void IsElIfNP(struct INCFILE*);
 void IsElseNP(struct INCFILE*);
 void IsEndifNP(struct INCFILE*);
@@ -218,6 +277,7 @@ struct PPCMD ppcmds[] = {
     { "include", IsInclude },
     { "error", IsError },
     { "pragma", IsPragma },
+    { "undef", IsUndef },
     { "if", IsIf },
     { "elif", IsElIf },
     { "else", IsElse },
@@ -232,8 +292,8 @@ struct PPCMD ppcmdsnp[] = {
     { "elif", IsElIfNP },
     { "else", IsElseNP },
     { "endif", IsEndifNP },
-    { "ifdef", IsIfNP },
-    { "ifndef", IsIfNP },
+    { "ifdef", IsIfdefNP },
+    { "ifndef", IsIfndefNP },
     { 0 },
 };
 
@@ -276,10 +336,6 @@ const char* szMac_align =
     "endif\r\n"
 ;
 
-// delimiters known by parser
-
-const char* bDelim = ",;:()[]{}|*<>!~-+=/&#";
-
 // 2-byte opcodes known by parser
 
 #define STR2UINT16(C1, C2) ((uint16_t)(((C1)<<8) | (C2)))
@@ -301,12 +357,34 @@ const uint16_t w2CharOps[] = {
 char g_szComment[1024];
 char g_szTemp[128];
 
+// tokens read by the analyzer, for --hot-decls
+
+static uint32_t GetTokensRead(struct INCFILE* pIncFile) {
+    return pIncFile->dwTokensConsumed + pIncFile->dwTokensScanned + pIncFile->dwTokensPP;
+}
+
+// the name of a declaration is known inside its parser only,
+// the first name set is the one reported by --hot-decls
+
+static void SetDeclName(struct INCFILE* pIncFile, const char* pszName) {
+    if (g_dwHotDecls && pIncFile->szDeclName[0] == '\0' && pszName != NULL) {
+        snprintf(pIncFile->szDeclName, sizeof(pIncFile->szDeclName), "%s", pszName);
+    }
+}
+
+// only the used part of the conditional stacks is saved, the entries
+// above the current level are set when a level is entered
+
 void SaveInputStatus(struct INCFILE* pIncFile, struct INPSTAT* pStatus) {
     pStatus->pszIn      = pIncFile->pszIn;
     pStatus->dwLine     = pIncFile->dwLine;
     pStatus->bNewLine   = pIncFile->bNewLine;
     pStatus->bIfLvl     = pIncFile->bIfLvl;
-    memcpy(pStatus->bIfStack, pIncFile->bIfStack, sizeof(pStatus->bIfStack));
+    memcpy(pStatus->bIfStack, pIncFile->bIfStack, pIncFile->bIfLvl + 1);
+    pStatus->bFoldLvl   = pIncFile->bFoldLvl;
+    memcpy(pStatus->bFoldStack, pIncFile->bFoldStack, pIncFile->bFoldLvl + 1);
+    pStatus->dwFoldOverflow = pIncFile->dwFoldOverflow;
+    pStatus->dwTokensRead = pIncFile->dwTokensConsumed + pIncFile->dwTokensScanned;
 }
 
 void RestoreInputStatus(struct INCFILE* pIncFile, struct INPSTAT* pStatus) {
@@ -314,7 +392,12 @@ void RestoreInputStatus(struct INCFILE* pIncFile, struct INPSTAT* pStatus) {
     pIncFile->dwLine    = pStatus->dwLine;
     pIncFile->bNewLine  = pStatus->bNewLine;
     pIncFile->bIfLvl    = pStatus->bIfLvl;
-    memcpy(pIncFile->bIfStack, pStatus->bIfStack, sizeof(pIncFile->bIfStack));
+    memcpy(pIncFile->bIfStack, pStatus->bIfStack, pStatus->bIfLvl + 1);
+    pIncFile->bFoldLvl  = pStatus->bFoldLvl;
+    memcpy(pIncFile->bFoldStack, pStatus->bFoldStack, pStatus->bFoldLvl + 1);
+    pIncFile->dwFoldOverflow = pStatus->dwFoldOverflow;
+    g_Stats.dwRestores++;
+    g_Stats.dwTokensRescanned += pIncFile->dwTokensConsumed + pIncFile->dwTokensScanned - pStatus->dwTokensRead;
 }
 
 // add an item to a list
@@ -326,7 +409,7 @@ void* InsertItem(struct INCFILE* pIncFile, struct LIST* pList, char* pszName) {
     }
     struct LISTITEM* pos = AddItemList(pList, s);
     if (pos == NULL) {
-        fprintf(stderr, "%s, %u: out of symbol space\n", pIncFile->pszFileName, pIncFile->dwLine);
+        diag_printf("%s, %u: out of symbol space\n", pIncFile->pszFileName, pIncFile->dwLine);
         pIncFile->dwErrors++;
         g_bTerminate = 1;
         return NULL;
@@ -341,7 +424,7 @@ void* InsertStrIntItem(struct INCFILE* pIncFile, struct LIST* pList, char* pszNa
     }
     struct LISTITEM* pos = AddItemList(pList, s);
     if (pos == NULL) {
-        fprintf(stderr, "%s, %u: out of symbol space\n", pIncFile->pszFileName, pIncFile->dwLine);
+        diag_printf("%s, %u: out of symbol space\n", pIncFile->pszFileName, pIncFile->dwLine);
         pIncFile->dwErrors++;
         g_bTerminate = 1;
         return NULL;
@@ -361,7 +444,7 @@ void* InsertStrStrItem(struct INCFILE* pIncFile, struct LIST* pList, char* pszNa
     }
     struct LISTITEM* pos = AddItemList(pList, s);
     if (pos == NULL) {
-        fprintf(stderr, "%s, %u: out of symbol space\n", pIncFile->pszFileName, pIncFile->dwLine);
+        diag_printf("%s, %u: out of symbol space\n", pIncFile->pszFileName, pIncFile->dwLine);
         pIncFile->dwErrors++;
         g_bTerminate = 1;
         return NULL;
@@ -383,13 +466,13 @@ char* InsertDefItem(struct INCFILE* pIncFile, char* pszFuncName, uint32_t dwParm
     } else {
         sprintf(szProto, "%s", pszFuncName);
     }
-    char* s = AddString(szProto);
+    char* s = StrDupArena(pIncFile->pArena, szProto);
     if (s == NULL) {
         return NULL;
     }
     char* pos = AddItemList(pIncFile->pDefs, s);
     if (pos == NULL) {
-        fprintf(stderr, "%s, %u: out of symbol space\n", pIncFile->pszFileName, pIncFile->dwLine);
+        diag_printf("%s, %u: out of symbol space\n", pIncFile->pszFileName, pIncFile->dwLine);
         pIncFile->dwErrors++;
         g_bTerminate = 1;
         return NULL;
@@ -397,10 +480,34 @@ char* InsertDefItem(struct INCFILE* pIncFile, char* pszFuncName, uint32_t dwParm
     return pos;
 }
 
+// the buffers are neighbours in the arena, so the output stream must not
+// grow beyond its buffer. The text is dropped and an error reported once.
+
+static void OutputOverflow(struct INCFILE* pIncFile) {
+    if (!pIncFile->bOutputFull) {
+        diag_printf("%s, %u: output buffer too small\n", pIncFile->pszFileName, pIncFile->dwLine);
+        pIncFile->dwErrors++;
+        pIncFile->bOutputFull = 1;
+    }
+}
+
+// a vector couldn't grow, the conversion is stopped
+
+static void OutOfMemory(struct INCFILE* pIncFile) {
+    diag_printf("%s, %u: out of memory\n", pIncFile->pszFileName, pIncFile->dwLine);
+    pIncFile->dwErrors++;
+    g_bTerminate = 1;
+}
+
 // write a string to output stream
 void xwrite(struct INCFILE* pIncFile, const char* pszText) {
-    strcpy(pIncFile->pszOut, pszText);
-    pIncFile->pszOut += strlen(pszText);
+    size_t len = strlen(pszText);
+    if (len >= (size_t)(pIncFile->pszOutEnd - pIncFile->pszOut)) {
+        OutputOverflow(pIncFile);
+        return;
+    }
+    memcpy(pIncFile->pszOut, pszText, len + 1);
+    pIncFile->pszOut += len;
 }
 
 int IsNewLine(struct INCFILE* pIncFile) {
@@ -413,16 +520,86 @@ int IsNewLine(struct INCFILE* pIncFile) {
 void xprintf(struct INCFILE* pIncFile, const char* pszFormat, ...) {
     va_list args;
     va_start(args, pszFormat);
-    int nb = vsprintf(pIncFile->pszOut, pszFormat, args);
+    size_t dwFree = pIncFile->pszOutEnd - pIncFile->pszOut;
+    int nb = vsnprintf(pIncFile->pszOut, dwFree, pszFormat, args);
     va_end(args);
+    if (nb < 0 || (size_t)nb >= dwFree) {
+        pIncFile->pszOut[0] = '\0';
+        OutputOverflow(pIncFile);
+        return;
+    }
     pIncFile->pszOut += nb;
 }
 
+// flags of a token, computed from its chars
+
+uint8_t ClassifyToken(const char* pszToken) {
+    uint8_t bClass = g_bLexClass[(uint8_t)pszToken[0]];
+    uint8_t flags = TF_TOKEN;
+    if (bClass & LC_ALPHA) {
+        flags |= TF_NAME;
+    } else if (bClass & LC_DIGIT) {
+        flags |= TF_NUMBER;
+        if (strchr(pszToken + 1, ',') != NULL) {
+            flags |= TF_STRING;
+        }
+    } else if (pszToken[0] == '"') {
+        flags |= TF_STRING;
+    } else if (bClass & LC_NUMOP) {
+        flags |= TF_OPERATOR;
+    } else if ((pszToken[0] == '>' || pszToken[0] == '<') && pszToken[1] == pszToken[0]) {
+        flags |= TF_OPERATOR;
+    } else if (pszToken[0] == '#' && pszToken[1] == '\0') {
+        flags |= TF_PPHASH;
+    }
+    return flags;
+}
+
+// slot of a token of pBuffer2 in pTokenFlags
+
+static inline uint8_t* FindTokenFlags(struct INCFILE* pIncFile, const char* pszToken) {
+    uintptr_t offset = (uintptr_t)pszToken - (uintptr_t)pIncFile->pBuffer2;
+    if (offset >= pIncFile->dwTokenFlags) {
+        return NULL;
+    }
+    return &pIncFile->pTokenFlags[offset];
+}
+
+// flags of a token, looked up if the tokenizer wrote it to pBuffer2.
+// Other tokens and pointers into a token (no TF_TOKEN) are classified.
+
+static inline uint8_t TokenFlags(struct INCFILE* pIncFile, const char* pszToken) {
+    uint8_t* pFlags = FindTokenFlags(pIncFile, pszToken);
+    if (pFlags != NULL && *pFlags != 0) {
+        return *pFlags;
+    }
+    return ClassifyToken(pszToken);
+}
+
+uint8_t GetTokenFlags(struct INCFILE* pIncFile, const char* pszToken) {
+    return TokenFlags(pIncFile, pszToken);
+}
+
+// replace a token of pBuffer2 by PP_IGNORE
+
+static void IgnoreToken(struct INCFILE* pIncFile, char* pszToken) {
+    uint8_t* pFlags = FindTokenFlags(pIncFile, pszToken);
+    if (pFlags != NULL) {
+        *pFlags = 0;
+    }
+    *pszToken = PP_IGNORE;
+}
+
+// delimiters known by parser: see g_bLexClass
+
 int IsDelim(char c) {
-    return strchr(bDelim, c) != NULL;
+    return LexIsClass(c, LC_DELIM | LC_NUL);
 }
 
 int IsTwoCharOp(char ch1, char ch2) {
+    if (!LexIsClass(ch1, LC_OP2)) {
+        return 0;
+    }
     uint16_t wrd = STR2UINT16(ch1, ch2);
     for(int i = 0; w2CharOps[i] != 0; i++) {
         if (wrd == w2CharOps[i]) {
@@ -543,6 +720,7 @@ void AddComment(char* pszToken) {
 // get next token (for preprocessor lines)
 
 char* GetNextTokenPP(struct INCFILE* pIncFile) {
+    pIncFile->dwTokensPP++;
     while (1) {
         size_t len = strlen(pIncFile->pszIn);
         pIncFile->bNewLine = 0;
@@ -585,53 +763,22 @@ void CopyLine(struct INCFILE* pIncFile) {
 }
 
 int IsName(struct INCFILE* pIncFile, char* pszType) {
-    char c = *pszType;
-    if (c >= 'A' && c <= 'Z') {
-        return 1;
-    } else if (c >= 'a' && c <= 'z') {
-        return 1;
-    } else if (c == '_' || c == '?' || c == '@') {
-        return 1;
-    } else if (c == '`' && pIncFile->bIsClass) {
+    if (TokenFlags(pIncFile, pszType) & TF_NAME) {
         return 1;
     }
-    return 0;
+    return *pszType == '`' && pIncFile->bIsClass;
 }
 
 int IsAlpha(char c) {
-    if (c == '?' || c == '@') {
-        return 1;
-    }
-    if (c >= 'A' && c <= 'Z') {
-        return 1;
-    }
-    if (c == '_') {
-        return 1;
-    }
-    if (c >= 'a' && c <= 'z') {
-        return 1;
-    }
-    return 0;
+    return LexIsClass(c, LC_ALPHA);
 }
 
 int IsAlphaNumeric(char c) {
-    if (c >= '0' && c <= '9') {
-        return 1;
-    }
-    return IsAlpha(c);
+    return LexIsClass(c, LC_ALPHA | LC_DIGIT);
 }
 
-int IsNumOperator(char* c) {
-    if (*c == '-' || *c == '+' || *c == '*' || *c == '/' || *c == '|' || *c == '&') {
-        return 1;
-    }
-    if (strncmp(c, ">>", 2) == 0) {
-        return 1;
-    }
-    if (strncmp(c, "<<", 2) == 0) {
-        return 1;
-    }
-    return 0;
+int IsNumOperator(struct INCFILE* pIncFile, char* c) {
+    return (TokenFlags(pIncFile, c) & TF_OPERATOR) != 0;
 }
 
 // translate operator in #define lines
@@ -654,18 +801,11 @@ char* TranslateOperator(char* pszToken) {
 
 // is current token a number (decimal or hexadecimal)
 
-int IsNumber(char* pszInp) {
-    return *pszInp >= '0' && *pszInp <= '9';
+int IsNumber(struct INCFILE* pIncFile, char* pszInp) {
+    return (TokenFlags(pIncFile, pszInp) & TF_NUMBER) != 0;
 }
 
 int IsReservedWord(char* pszName) {
-    char szWord[64];
-
-    strcpy(szWord, pszName);
-    szWord[sizeof(szWord)-1] = '\0';
-    for (size_t i = 0; i < strlen(szWord); i++) {
-        szWord[i] = tolower(szWord[i]);
-    }
     return list_bsearch(pszName, g_ReservedWords.pItems, g_ReservedWords.numItems, sizeof(char*), cmpproc, NULL) != NULL;
 }
 
@@ -681,70 +821,260 @@ struct ITEM_MACROINFO* IsMacro(struct INCFILE* pIncFile, char* pszName) {
      return FindItemList(g_pMacros, pszName);
 }
 
-// test if its a number enclosed in braces
-void DeleteSimpleBraces(struct INCFILE* pIncFile) {
-    struct INPSTAT sis;
+// size of output buffer pszNewType must be 256 bytes at least!
 
-    SaveInputStatus(pIncFile, &sis);
-    char* firstT = GetNextTokenPP(pIncFile);
-    if (firstT != NULL && *firstT == '(') {
-        char* nextT = GetNextTokenPP(pIncFile);
-        if (nextT != NULL) {
-            if (*nextT == '-') {
-                nextT == GetNextTokenPP(pIncFile);
-                if (nextT == NULL) {
-                    goto exit;
-                }
-            }
-            if (*nextT >= '0' && *nextT <= '9') {
-                char* lastT = GetNextTokenPP(pIncFile);
-                if (lastT != NULL && *lastT == ')') {
-                    *firstT = PP_IGNORE;
-                    *lastT = PP_IGNORE;
-                }
-            }
+char* MakeType(char* pszType, int bUnsigned, int bLong, char* pszNewType) {
+    if (pszType == NULL) {
+        if (bLong) {
+            pszType = "long";
+            bLong = 0;
+        } else {
+            pszType = "int";
         }
     }
-exit:
-    RestoreInputStatus(pIncFile, &sis);
+    if (bUnsigned) {
+        sprintf(pszNewType, "unsigned %.246s", pszType);
+    } else if (bLong) {
+        sprintf(pszNewType, "long %.250s", pszType);
+    } else {
+        pszNewType = pszType;
+    }
+    return pszNewType;
 }
 
-// skip braces of "(" <number> ")" pattern
+// a preprocessor line, read once
+// The tokens are collected up to the line end and translated while they
+// are written. Casts like "(DWORD)" and braces around numbers like "(1)"
+// are marked PP_IGNORE just before the reader gets there, finding them
+// requires a few tokens of lookahead only.
 
-void SkipSimpleBraces(struct INCFILE* pIncFile) {
-    struct INPSTAT sis;
+struct PPLINE {
+    struct INCFILE* pIncFile;
+    char** ppszTokens;          // tokens up to the line end, control tokens included
+    size_t numTokens;
+    char* pszNext;              // input behind the line
+    uint8_t bEol;               // line ends with PP_EOL
+    size_t nRead;               // next token for ReadLineToken()
+    size_t nCast;               // next token to check for a cast
+    uint8_t bCastName;          // last token checked for a cast is a name
+    size_t nBraces;             // next token to check for "(" <number> ")"
+    uint8_t bBraces;            // 1=check braces, 2=all checked
+};
 
-    SaveInputStatus(pIncFile, &sis);
-    while (1) {
-        if (IsName(pIncFile, pIncFile->pszIn)) {
-            if (GetNextTokenPP(pIncFile) == NULL) {
-                break;
-            }
+static void ReadPPLine(struct INCFILE* pIncFile, struct PPLINE* pLine) {
+    struct vector* pTokens = pIncFile->pLineTokens;
+    int bOutOfMemory = 0;
+    pTokens->size = 0;
+    char* pszToken = pIncFile->pszIn;
+    size_t len;
+    while ((len = strlen(pszToken)) != 0 && !(pszToken[0] == (char)PP_EOL && pszToken[1] == '\0')) {
+        if (pszToken[0] == (char)PP_COMMENT) {
+            AddComment(pszToken);
+        }
+        if (!bOutOfMemory && !vector_charp_append(pTokens, pszToken)) {
+            OutOfMemory(pIncFile);
+            bOutOfMemory = 1;
+        }
+        pszToken += len + 1;
+    }
+    pIncFile->dwTokensPP += pTokens->size;
+    pLine->pIncFile = pIncFile;
+    pLine->ppszTokens = pTokens->data;
+    pLine->numTokens = pTokens->size;
+    pLine->bEol = len != 0;
+    pLine->pszNext = pLine->bEol ? pszToken + 2 : pszToken;
+    pLine->nRead = 0;
+    pLine->nCast = 0;
+    pLine->bCastName = 0;
+    pLine->nBraces = 0;
+    pLine->bBraces = 0;
+}
+
+static int IsLineToken(char* pszToken) {
+    if (pszToken[0] == (char)PP_WEAKEOL && pszToken[1] == '\0') {
+        return 0;
+    }
+    return pszToken[0] != (char)PP_IGNORE && pszToken[0] != (char)PP_COMMENT;
+}
+
+// index of the next token which isn't ignored, numTokens at the line end
+
+static size_t NextLineToken(struct PPLINE* pLine, size_t i) {
+    while (i < pLine->numTokens && !IsLineToken(pLine->ppszTokens[i])) {
+        i++;
+    }
+    return i;
+}
+
+// check for a '(' ... <*> ')' pattern
+
+static void CheckCastBraces(struct PPLINE* pLine, size_t iOpen) {
+    char** ppszTokens = pLine->ppszTokens;
+    char* pszUnsigned = NULL;
+    char* pszLong = NULL;
+    char szType[256];
+    size_t i;
+
+    for (i = NextLineToken(pLine, iOpen + 1); i < pLine->numTokens; i = NextLineToken(pLine, i + 1)) {
+        if (strcmp(ppszTokens[i], "unsigned") == 0) {
+            pszUnsigned = ppszTokens[i];
+        } else if (strcmp(ppszTokens[i], "long") == 0) {
+            pszLong = ppszTokens[i];
         } else {
-            DeleteSimpleBraces(pIncFile);
+            break;
         }
-        char* token = GetNextTokenPP(pIncFile);
-        if (token == NULL) {
+    }
+    if (i == pLine->numTokens) {
+        return;
+    }
+    char* token = ppszTokens[i];
+    char* pszPtr = NULL;
+    i = NextLineToken(pLine, i + 1);
+    if (i < pLine->numTokens && *ppszTokens[i] == '*') {
+        pszPtr = ppszTokens[i];
+        i = NextLineToken(pLine, i + 1);
+    }
+    if (i == pLine->numTokens || *ppszTokens[i] != ')') {
+        return;
+    }
+    char* type;
+    if (pszUnsigned != NULL || pszLong != NULL) {
+        type = TranslateType(MakeType(token, pszUnsigned != NULL, pszLong != NULL, szType), 0);
+    } else {
+        type = TranslateType(token, 0);
+    }
+    if (type != NULL && *type != '\0' && IsSimpleType(type)) {
+        IgnoreToken(pLine->pIncFile, token);
+        IgnoreToken(pLine->pIncFile, ppszTokens[i]);
+        if (pszPtr != NULL) {
+            IgnoreToken(pLine->pIncFile, pszPtr);
+        }
+        if (pszUnsigned != NULL) {
+            IgnoreToken(pLine->pIncFile, pszUnsigned);
+        }
+        if (pszLong != NULL) {
+            IgnoreToken(pLine->pIncFile, pszLong);
+        }
+        IgnoreToken(pLine->pIncFile, ppszTokens[iOpen]);
+    }
+}
+
+// check the next token for a cast, skip MACRO(type) patterns
+
+static void CheckCast(struct PPLINE* pLine) {
+    size_t i = NextLineToken(pLine, pLine->nCast);
+    if (i == pLine->numTokens) {
+        pLine->nCast = i;
+        return;
+    }
+    char* pszToken = pLine->ppszTokens[i];
+    pLine->nCast = i + 1;
+    if (IsName(pLine->pIncFile, pszToken)) {
+        pLine->bCastName = 1;
+        return;
+    }
+    if (*pszToken == '(' && !pLine->bCastName) {
+        CheckCastBraces(pLine, i);
+    }
+    pLine->bCastName = 0;
+}
+
+// index of the next token which isn't ignored, casts up to there are known
+
+static size_t NextCastChecked(struct PPLINE* pLine, size_t i) {
+    for (; i < pLine->numTokens; i++) {
+        while (pLine->nCast <= i) {
+            CheckCast(pLine);
+        }
+        if (IsLineToken(pLine->ppszTokens[i])) {
             break;
         }
     }
-    RestoreInputStatus(pIncFile, &sis);
+    return i;
 }
 
-int IsString(char* pszToken) {
-    if (*pszToken == '"') {
-        return 1;
+// test if its a number enclosed in braces
+// a negative number keeps its braces
+
+static void DeleteSimpleBraces(struct PPLINE* pLine, size_t i) {
+    char** ppszTokens = pLine->ppszTokens;
+
+    size_t first = NextCastChecked(pLine, i);
+    if (first == pLine->numTokens || *ppszTokens[first] != '(') {
+        return;
     }
-    if (*pszToken >= '0' && *pszToken <= '9') {
-        pszToken++;
-        while (*pszToken != '\0') {
-            if (*pszToken == ',') {
-                return 1;
-            }
-            pszToken++;
+    size_t next = NextCastChecked(pLine, first + 1);
+    if (next == pLine->numTokens || *ppszTokens[next] < '0' || *ppszTokens[next] > '9') {
+        return;
+    }
+    size_t last = NextCastChecked(pLine, next + 1);
+    if (last < pLine->numTokens && *ppszTokens[last] == ')') {
+        IgnoreToken(pLine->pIncFile, ppszTokens[first]);
+        IgnoreToken(pLine->pIncFile, ppszTokens[last]);
+    }
+}
+
+// skip braces of "(" <number> ")" pattern, the token behind a name
+// isn't checked (macro invocation)
+
+static void CheckBraces(struct PPLINE* pLine) {
+    size_t i = pLine->nBraces;
+    while (pLine->nCast <= i && pLine->nCast < pLine->numTokens) {
+        CheckCast(pLine);
+    }
+    if (i < pLine->numTokens && IsName(pLine->pIncFile, pLine->ppszTokens[i])) {
+        i++;
+    } else {
+        DeleteSimpleBraces(pLine, i);
+    }
+    i = NextCastChecked(pLine, i);
+    if (i == pLine->numTokens) {
+        pLine->bBraces = 2;
+        return;
+    }
+    pLine->nBraces = i + 1;
+}
+
+static void StartBraceCheck(struct PPLINE* pLine) {
+    pLine->nBraces = pLine->nRead;
+    pLine->bBraces = 1;
+}
+
+// get next token of the line, NULL at the line end
+
+static char* ReadLineToken(struct PPLINE* pLine) {
+    while (pLine->nRead < pLine->numTokens) {
+        size_t i = pLine->nRead++;
+        while (pLine->nCast <= i) {
+            CheckCast(pLine);
+        }
+        while (pLine->bBraces == 1 && pLine->nBraces <= i) {
+            CheckBraces(pLine);
+        }
+        char* pszToken = pLine->ppszTokens[i];
+        if (pszToken[0] == (char)PP_WEAKEOL && pszToken[1] == '\0') {
+            pLine->pIncFile->dwLine++;
+        } else if (IsLineToken(pszToken)) {
+            return pszToken;
         }
     }
-    return 0;
+    return NULL;
+}
+
+// continue behind the line
+
+static void EndPPLine(struct PPLINE* pLine) {
+    while (ReadLineToken(pLine) != NULL) {
+    }
+    pLine->pIncFile->pszIn = pLine->pszNext;
+    pLine->pIncFile->bNewLine = pLine->bEol;
+    if (pLine->bEol) {
+        pLine->pIncFile->dwLine++;
+    }
+}
+
+int IsString(struct INCFILE* pIncFile, char* pszToken) {
+    return (TokenFlags(pIncFile, pszToken) & TF_STRING) != 0;
 }
 
 
@@ -762,74 +1092,223 @@ void convertline_register_qualifier(struct INCFILE* pIncFile, char* pszName, int
     }
 }
 
+// the suffixes removed from a number of pBuffer2 (PFNSUFFIX of the
+// evaluator), a number elsewhere is in C syntax and keeps them.
+// returns -1 if the tokenizer couldn't record them
 
-// for EQU invocation
-// called by IsDefine
+static int GetNumberSuffix(void* pContext, const char* pszNumber) {
+    struct INCFILE* pIncFile = pContext;
+    uintptr_t offset = (uintptr_t)pszNumber - (uintptr_t)pIncFile->pBuffer2;
+    if (offset >= pIncFile->dwBufSize) {
+        return 0;
+    }
+    uint8_t* pFlags = FindTokenFlags(pIncFile, pszNumber);
+    if (pFlags == NULL || *pFlags == 0) {
+        return -1;
+    }
+    return (*pFlags & TF_UNSIGNED ? NS_UNSIGNED : 0) | (*pFlags & TF_LONGLONG ? NS_LONGLONG : 0);
+}
 
-void convertline(struct INCFILE* pIncFile, char* pszName) {
-    int bExpression;
-    char* pszValue;
-    char* pszOut;
-    struct LinkedList* ppszItems;
-    uint32_t dwCnt;
-    uint32_t dwEsp;
-    uint32_t dwTmp[2];
-    struct INPSTAT sis;
+// --fold-constants: values of #define and enum constants
+//
+// g_pConstants holds the constants seen so far (ITEM_CONSTANT). The
+// expression of a #define or enum value is evaluated if all names in it
+// are known constants; the value is written instead, the expression
+// becomes a comment.
 
-    ppszItems = NULL;
-    pszValue = GetNextTokenPP(pIncFile);
-    if (pszValue != NULL) {
-        SaveInputStatus(pIncFile, &sis);
-        bExpression = 0;
-        char* token = pszValue;
-        while (token != NULL) {
-            if (IsString(token)) {
-                bExpression = 0;
-                break;
-            }
-            if (*token >= '0' && *token <= '9') {
-                bExpression = 1;
-            } else if (*token == '(' || *token == ')') {
-            } else {
-                if (IsAlpha(*token)) {
-                    if (IsNumOperator(token)) {
-                        bExpression = 0;
-                        break;
-                    } else {
-                        bExpression = 1;
-                    }
-                }
-            }
-            token = GetNextTokenPP(pIncFile);
-        }
-        RestoreInputStatus(pIncFile, &sis);
-        if (!bExpression) {
-            xwrite(pIncFile, "<");
+// number of enclosing conditionals written as MASM "if", apart from the
+// include guard. With --fold-if the guard isn't written if it is known.
+
+static uint32_t GetConstantDepth(struct INCFILE* pIncFile) {
+    uint32_t dwDepth = 0;
+    for (; pIncFile != NULL; pIncFile = pIncFile->pParent) {
+        dwDepth += pIncFile->bIfLvl;
+        if (pIncFile->bIfLvl != 0 && pIncFile->pszGuardIf != NULL && (!g_bFoldIf || (pIncFile->bFoldStack[1] & FS_GUARD))) {
+            dwDepth--;
         }
-        pszOut = pIncFile->pszOut;
-        ppszItems = CreateLinkedList();
-        dwCnt = 0;
-        while (pszValue != NULL) {
-            AddLinkedList(ppszItems, (uintptr_t)pszValue);
-            if (dwCnt != 0) {
-                xwrite(pIncFile, " ");
-            }
-            debug_printf("%u: item %s found\n", pIncFile->dwLine, pszValue);
-            dwCnt++;
-            TranslateOperator(pszValue);
-            xwrite(pIncFile, pszValue);
-            pszValue = GetNextTokenPP(pIncFile);
+    }
+    return dwDepth;
+}
+
+// a constant defined again has no known value anymore
+// pValue is NULL if the value isn't known
+
+static void SetConstant(struct INCFILE* pIncFile, char* pszName, const struct IFVALUE* pValue) {
+    if (g_pConstants == NULL) {
+        g_pConstants = CreateList(MAXITEMS, sizeof(struct ITEM_CONSTANT));
+    }
+    struct ITEM_CONSTANT* pItem = FindItemList(g_pConstants, pszName);
+    if (pItem != NULL) {
+        pItem->bKnown = 0;
+        return;
+    }
+    pItem = InsertItem(pIncFile, g_pConstants, pszName);
+    if (pItem != NULL) {
+        pItem->bKnown = pValue != NULL && GetConstantDepth(pIncFile) == 0;
+        if (pValue != NULL) {
+            pItem->value = pValue->value;
+            pItem->bUnsigned = pValue->bUnsigned;
+            pItem->nBits = pValue->nBits;
         }
-#if DYNPROTOQUALS
-        if (g_bUseDefProto && *pszOut > '9') {
-            if (strcmp(pszOut, "__declspec ( dllimport )") == 0) {
-                convertline_register_qualifier(pIncFile, pszOut, FQ_IMPORT);
+    }
+}
+
+static void ForgetConstant(char* pszName) {
+    struct ITEM_CONSTANT* pItem = g_pConstants != NULL ? FindItemList(g_pConstants, pszName) : NULL;
+    if (pItem != NULL) {
+        pItem->bKnown = 0;
+    }
+}
+
+static int GetConstant(void* pContext, const char* pszName, struct IFVALUE* pValue) {
+    (void)pContext;
+    struct ITEM_CONSTANT* pItem = g_pConstants != NULL ? FindItemList(g_pConstants, (char*)pszName) : NULL;
+    if (pItem == NULL || !pItem->bKnown) {
+        return 0;
+    }
+    pValue->value = pItem->value;
+    pValue->bUnsigned = pItem->bUnsigned;
+    pValue->nBits = pItem->nBits;
+    return 1;
+}
+
+// a single number, negative or not, is written unchanged, unless it is
+// a C octal number which MASM would read as decimal
+
+static int IsFoldable(char** ppTokens, size_t numTokens) {
+    if (numTokens == 2 && strcmp(ppTokens[0], "-") == 0) {
+        ppTokens++;
+        numTokens--;
+    }
+    if (numTokens != 1) {
+        return 1;
+    }
+    char* p = ppTokens[0];
+    if (*p < '0' || *p > '9') {
+        return 1;
+    }
+    return p[0] == '0' && p[1] >= '0' && p[1] <= '9' && (p[strlen(p) - 1] | 0x20) != 'h';
+}
+
+// a value which fits into 32 bits, signed or unsigned
+
+static int IsDwordValue(const struct IFVALUE* pValue) {
+    if (pValue->bUnsigned) {
+        return (uint64_t)pValue->value <= UINT32_MAX;
+    }
+    return pValue->value >= INT32_MIN && pValue->value <= UINT32_MAX;
+}
+
+// MASM holds 64 bit values with -x only
+
+static int IsTargetValue(const struct IFVALUE* pValue) {
+    return g_b64bit || IsDwordValue(pValue);
+}
+
+static void FormatConstant(const struct IFVALUE* pValue, char* pszValue) {
+    char szHex[20];
+    int bNegative = !pValue->bUnsigned && pValue->value < 0;
+    uint64_t dwAbs = bNegative ? 0 - (uint64_t)pValue->value : (uint64_t)pValue->value;
+
+    sprintf(szHex, "%llX", (unsigned long long)dwAbs);
+    sprintf(pszValue, "%s%s%sh", bNegative ? "-" : "", szHex[0] > '9' ? "0" : "", szHex);
+}
+
+// write the value in front of the expression starting at pszExpr,
+// "<value>\t;<expression>"
+
+static void InsertConstant(struct INCFILE* pIncFile, char* pszExpr, const struct IFVALUE* pValue) {
+    char szValue[32];
+
+    FormatConstant(pValue, szValue);
+    size_t len = strlen(szValue);
+    if (len + 2 >= (size_t)(pIncFile->pszOutEnd - pIncFile->pszOut)) {
+        OutputOverflow(pIncFile);
+        return;
+    }
+    memmove(pszExpr + len + 2, pszExpr, pIncFile->pszOut - pszExpr + 1);
+    memcpy(pszExpr, szValue, len);
+    pszExpr[len] = '\t';
+    pszExpr[len + 1] = ';';
+    pIncFile->pszOut += len + 2;
+}
+
+// evaluate the value of a #define constant, record the constant
+// a value MASM can't hold is recorded, but not written
+
+static void FoldConstant(struct INCFILE* pIncFile, char* pszName, char** ppTokens, size_t numTokens, char* pszExpr) {
+    struct IFVALUE value;
+
+    if (EvaluateConstExpression(ppTokens, numTokens, GetConstant, GetNumberSuffix, pIncFile, &value)) {
+        if (IsFoldable(ppTokens, numTokens) && IsTargetValue(&value)) {
+            InsertConstant(pIncFile, pszExpr, &value);
+        }
+        SetConstant(pIncFile, pszName, &value);
+    } else {
+        SetConstant(pIncFile, pszName, NULL);
+    }
+}
+
+// for EQU invocation
+// called by IsDefine
+// the value is written as a text literal if it contains a string or
+// nothing but operators, "<" is inserted in front then
+
+void convertline(struct PPLINE* pLine, char* pszName) {
+    struct INCFILE* pIncFile = pLine->pIncFile;
+    int bExpression;
+    int bString;
+    char* pszValue;
+    char* pszOut;
+    struct smallvector items;
+    uint32_t dwCnt;
+
+    smallvector_init(&items);
+    pszValue = ReadLineToken(pLine);
+    if (pszValue != NULL) {
+        bExpression = 0;
+        bString = 0;
+        pszOut = pIncFile->pszOut;
+        dwCnt = 0;
+        while (pszValue != NULL) {
+            if (!bString) {
+                if (IsString(pLine->pIncFile, pszValue)) {
+                    bString = 1;
+                    bExpression = 0;
+                } else if ((*pszValue >= '0' && *pszValue <= '9') || IsAlpha(*pszValue)) {
+                    bExpression = 1;
+                }
+            }
+            if (!smallvector_append(&items, pszValue)) {
+                OutOfMemory(pIncFile);
+                break;
+            }
+            if (dwCnt != 0) {
+                xwrite(pIncFile, " ");
+            }
+            debug_printf("%u: item %s found\n", pIncFile->dwLine, pszValue);
+            dwCnt++;
+            xwrite(pIncFile, pszValue);
+            pszValue = ReadLineToken(pLine);
+        }
+        if (!bExpression) {
+            if (pIncFile->pszOutEnd - pIncFile->pszOut <= 1) {
+                OutputOverflow(pIncFile);
+            } else {
+                memmove(pszOut + 1, pszOut, pIncFile->pszOut - pszOut + 1);
+                *pszOut++ = '<';
+                pIncFile->pszOut++;
+            }
+        }
+#if DYNPROTOQUALS
+        if (g_bUseDefProto && *pszOut > '9') {
+            if (strcmp(pszOut, "__declspec ( dllimport )") == 0) {
+                convertline_register_qualifier(pIncFile, pszOut, FQ_IMPORT);
             } else {
-                int nbStackItems = GetNumItemsLinkedList(ppszItems);
-                for (int i = 0; i < nbStackItems; i++) {
-                    char* item = (char*)GetItemLinkedList(ppszItems, i);
+                for (size_t i = 0; i < items.size; i++) {
+                    char* item = smallvector_get(&items, i);
 #ifdef _DEBUG
-                    fprintf(stderr, "getting linkedlist item %X: %s\n", i, item);
+                    diag_printf("getting item %X: %s\n", (unsigned)i, item);
 #endif
                     struct LISTITEM* qualifierListItem = FindItemList(g_pQualifiers, item);
                     if (qualifierListItem != NULL) {
@@ -841,13 +1320,15 @@ void convertline(struct INCFILE* pIncFile, char* pszName) {
 #endif
         if (!bExpression) {
             xwrite(pIncFile, ">");
+        } else if (g_bFoldConstants) {
+            FoldConstant(pIncFile, pszName, items.data, items.size, pszOut);
         }
     } else {
         xwrite(pIncFile, "<>");
     }
     WriteComment(pIncFile);
     xwrite(pIncFile, "\r\n");
-    DestroyLinkedList(ppszItems);
+    smallvector_free(&items);
 }
 
 void GetInterfaceName(char* pszName, char* pszInterface) {
@@ -869,51 +1350,50 @@ void GetInterfaceName(char* pszName, char* pszInterface) {
 // check if macro is pattern "(this)->lpVtbl-><method>(this,...)"
 // if yes, return name + method name
 
-char* IsCObjMacro(struct INCFILE* pIncFile, char** pMethodName) {
-    struct INPSTAT sis;
+char* IsCObjMacro(struct PPLINE* pLine, char** pMethodName) {
+    size_t nRead = pLine->nRead;
+    uint32_t dwLine = pLine->pIncFile->dwLine;
     char* tmpThisName;
     char* tmpMethodName;
 
-
-    SaveInputStatus(pIncFile, &sis);
-    char* token = GetNextTokenPP(pIncFile);
+    char* token = ReadLineToken(pLine);
     if (token == NULL || strcmp(token, "(") != 0) {
         goto exit;
     }
-    token = GetNextTokenPP(pIncFile); // Get name of THIS
+    token = ReadLineToken(pLine); // Get name of THIS
     if (token == NULL) {
         goto exit;
     }
     tmpThisName = token;
-    if (!IsName(pIncFile, token)) {
+    if (!IsName(pLine->pIncFile, token)) {
         goto exit;
     }
-    token = GetNextTokenPP(pIncFile);
+    token = ReadLineToken(pLine);
     if (token == NULL || strcmp(token, ")") != 0) {
         goto exit;
     }
-    token = GetNextTokenPP(pIncFile);
+    token = ReadLineToken(pLine);
     if (token == NULL || strcmp(token, "->") != 0) {
         goto exit;
     }
-    token = GetNextTokenPP(pIncFile);
+    token = ReadLineToken(pLine);
     if (token == NULL || strcmp(token, "lpVtbl") != 0) {
         goto exit;
     }
-    token = GetNextTokenPP(pIncFile);
+    token = ReadLineToken(pLine);
     if (token == NULL || strcmp(token, "->") != 0) {
         goto exit;
     }
-    token = GetNextTokenPP(pIncFile); // get method name
+    token = ReadLineToken(pLine); // get method name
     if (token == NULL) {
         goto exit;
     }
     tmpMethodName = token;
-    token = GetNextTokenPP(pIncFile);
+    token = ReadLineToken(pLine);
     if (token == NULL || strcmp(token, "(") != 0) {
         goto exit;
     }
-    token = GetNextTokenPP(pIncFile);
+    token = ReadLineToken(pLine);
     if (token == NULL) {
         goto exit;
     }
@@ -923,7 +1403,8 @@ char* IsCObjMacro(struct INCFILE* pIncFile, char** pMethodName) {
     *pMethodName = tmpMethodName;
     return tmpThisName;
 exit:
-    RestoreInputStatus(pIncFile, &sis);
+    pLine->nRead = nRead;
+    pLine->pIncFile->dwLine = dwLine;
     return NULL;
 }
 
@@ -936,118 +1417,303 @@ void SkipPPLine(struct INCFILE* pIncFile) {
     }
 }
 
-// size of output buffer pszNewType must be 256 bytes at least!
+// skip typecasts in preprocessor lines
 
-char* MakeType(char* pszType, int bUnsigned, int bLong, char* pszNewType) {
-    if (pszType == NULL) {
-        if (bLong) {
-            pszType = "long";
-            bLong = 0;
-        } else {
-            pszType = "int";
-        }
+void SkipCasts(struct INCFILE* pIncFile) {
+    struct PPLINE line;
+
+    ReadPPLine(pIncFile, &line);
+    while (line.nCast < line.numTokens) {
+        CheckCast(&line);
     }
-    if (bUnsigned) {
-        sprintf(pszNewType, "unsigned %.246s", pszType);
-    } else if (bLong) {
-        sprintf(pszNewType, "long %.250s", pszType);
-    } else {
-        pszNewType = pszType;
+}
+
+
+// #define has occured
+// can be a constant or a macro
+// esi=input token stream
+
+// --fold-if: values of #define
+//
+// g_pDefines holds the macros whose state is known. value.pStr is NULL
+// for an undefined macro (#undef, -U), else it holds the tokens of the
+// value, each terminated by '\0', followed by an empty token. The value of
+// a macro with parameters is a single PP_MACRO token. Macros not in the
+// list are unknown.
+//
+// A define inside a conditional which is written as MASM "if" is known
+// in this branch only. g_pDefineLog remembers such defines, they are
+// removed from g_pDefines as soon as the branch ends.
+
+struct DEFINELOG {
+    char* pszName;
+    uint32_t dwDepth;               // number of enclosing MASM conditionals
+};
+
+static struct vector* g_pDefineLog;
+
+static const char g_szMacroValue[] = { (char)PP_MACRO, '\0', '\0' };
+
+// number of enclosing conditionals written as MASM "if"
+// include guards don't count, the header is converted once only
+
+static uint32_t GetFoldDepth(struct INCFILE* pIncFile) {
+    uint32_t dwDepth = 0;
+    for (; pIncFile != NULL; pIncFile = pIncFile->pParent) {
+        for (uint8_t i = 1; i <= pIncFile->bFoldLvl; i++) {
+            if ((pIncFile->bFoldStack[i] & (FS_EMITTED | FS_GUARD)) == FS_EMITTED) {
+                dwDepth++;
+            }
+        }
     }
-    return pszNewType;
+    return dwDepth;
 }
 
-// skip typecasts in preprocessor lines
+static void SetDefine(struct INCFILE* pIncFile, char* pszName, char* pszValue) {
+    struct LISTITEM* pItem = FindItemList(g_pDefines, pszName);
+    if (pItem == NULL) {
+        pItem = InsertItem(pIncFile, g_pDefines, pszName);
+        if (pItem == NULL) {
+            return;
+        }
+    }
+    pItem->value.pStr = pszValue;
+    uint32_t dwDepth = GetFoldDepth(pIncFile);
+    if (dwDepth > 0) {
+        struct DEFINELOG log;
+        if (g_pDefineLog == NULL) {
+            g_pDefineLog = vector_create(sizeof(struct DEFINELOG));
+        }
+        log.pszName = pItem->name;
+        log.dwDepth = dwDepth;
+        if (g_pDefineLog == NULL || !vector_append(g_pDefineLog, &log)) {
+            OutOfMemory(pIncFile);
+        }
+    }
+}
 
-void SkipCasts(struct INCFILE* pIncFile) {
-    char* pszToken;
-    int bIsName;
-    int bUnsigned;
-    int bLong;
-    char* pszUnsigned;
-    char* pszLong;
-    char* pszPtr;
-    struct INPSTAT sis;
-    struct INPSTAT sis2;
-    char szType[128];
+// a MASM conditional branch ends, defines done inside are unknown now
 
-    bIsName = 0;
-    SaveInputStatus(pIncFile, &sis);
-    while (1) {
-        pszToken = GetNextTokenPP(pIncFile);
-        if (pszToken == NULL) {
+static void ForgetBranchDefines(struct INCFILE* pIncFile) {
+    uint32_t dwDepth = GetFoldDepth(pIncFile);
+    while (g_pDefineLog != NULL && g_pDefineLog->size > 0) {
+        struct DEFINELOG* pLog = vector_get(g_pDefineLog, g_pDefineLog->size - 1);
+        if (pLog->dwDepth < dwDepth) {
             break;
         }
+        void* pItem = FindItemList(g_pDefines, pLog->pszName);
+        if (pItem != NULL) {
+            RemoveItemList(g_pDefines, pItem);
+        }
+        g_pDefineLog->size--;
+    }
+}
 
-        // skip MACRO(type) patterns
+// copy the value tokens of a #define without consuming them
+// the suffixes of the numbers are written back, the copy is in C syntax.
+// A value whose suffixes are unknown is stored like a macro, it is
+// defined, but can't be expanded.
 
-        if (IsName(pIncFile, pszToken)) {
-            bIsName = 1;
-            continue;
-        }
+static int IsDefineValueToken(char* pszToken) {
+    if (pszToken[0] == (char)PP_WEAKEOL && pszToken[1] == '\0') {
+        return 0;
+    }
+    return pszToken[0] != (char)PP_COMMENT && pszToken[0] != (char)PP_IGNORE;
+}
 
-        // check for '(' ... <*> ')' pattern
+static const char* GetSuffixText(struct INCFILE* pIncFile, char* pszToken) {
+    static const char* const pszSuffixes[] = { "", "u", "ll", "ull" };
+    if (*pszToken < '0' || *pszToken > '9') {
+        return "";
+    }
+    int nSuffix = GetNumberSuffix(pIncFile, pszToken);
+    return nSuffix < 0 ? NULL : pszSuffixes[nSuffix];
+}
 
-        if (*pszToken == '(' && !bIsName) {
-            bUnsigned = 0;
-            bLong = 0;
-            SaveInputStatus(pIncFile, &sis2);
-            char* token;
-nexttoken:
-            token = GetNextTokenPP(pIncFile);
-            if (token != NULL) {
-                if (strcmp(token, "unsigned") == 0) {
-                    bUnsigned = 1;
-                    pszUnsigned = token;
-                    goto nexttoken;
-                }
-                if (strcmp(token, "long") == 0) {
-                    bLong = 1;
-                    pszLong = token;
-                    goto nexttoken;
+static char* CopyDefineValue(struct INCFILE* pIncFile) {
+    char* pszToken = pIncFile->pszIn;
+    size_t dwSize = 1;
+    char* pszValue;
+
+    if (pszToken[0] == (char)PP_MACRO && pszToken[1] == '\0') {
+        pszValue = AllocString(sizeof(g_szMacroValue));
+        if (pszValue != NULL) {
+            memcpy(pszValue, g_szMacroValue, sizeof(g_szMacroValue));
+        }
+        return pszValue;
+    }
+    for (; *pszToken != '\0' && !(pszToken[0] == (char)PP_EOL && pszToken[1] == '\0'); pszToken += strlen(pszToken) + 1) {
+        if (IsDefineValueToken(pszToken)) {
+            const char* pszSuffix = GetSuffixText(pIncFile, pszToken);
+            if (pszSuffix == NULL) {
+                pszValue = AllocString(sizeof(g_szMacroValue));
+                if (pszValue != NULL) {
+                    memcpy(pszValue, g_szMacroValue, sizeof(g_szMacroValue));
                 }
+                return pszValue;
             }
-            if (token != NULL) {
-                char* token2 = GetNextTokenPP(pIncFile);
-                pszPtr = NULL;
-                if (token2 != NULL && *token2 == '*') {
-                    pszPtr = token2;
-                    token2 = GetNextTokenPP(pIncFile);
-                }
-                if (token2 != NULL && *token2 == ')') {
-                    char* type;
-                    if (bUnsigned || bLong) {
-                        type = TranslateType(MakeType(token, bUnsigned, bLong, szType), 0);
-                    } else {
-                        type = TranslateType(token, 0);
-                    }
-                    if (type != NULL && *type != '\0' && IsSimpleType(type)) {
-                        *token = PP_IGNORE;
-                        *token2 = PP_IGNORE;
-                        if (pszPtr != NULL) {
-                            *pszPtr = PP_IGNORE;
-                        }
-                        if (bUnsigned) {
-                            *pszUnsigned = PP_IGNORE;
-                        }
-                        if (bLong) {
-                            *pszLong = PP_IGNORE;
-                        }
-                        *pszToken = PP_IGNORE;
-                    }
-                }
+            dwSize += strlen(pszToken) + strlen(pszSuffix) + 1;
+        }
+    }
+    pszValue = AllocString(dwSize);
+    if (pszValue == NULL) {
+        return NULL;
+    }
+    char* pszOut = pszValue;
+    for (pszToken = pIncFile->pszIn; *pszToken != '\0' && !(pszToken[0] == (char)PP_EOL && pszToken[1] == '\0'); pszToken += strlen(pszToken) + 1) {
+        if (IsDefineValueToken(pszToken)) {
+            pszOut += sprintf(pszOut, "%s%s", pszToken, GetSuffixText(pIncFile, pszToken)) + 1;
+        }
+    }
+    *pszOut = '\0';
+    return pszValue;
+}
+
+// split a -D value into tokens
+
+static char* TokenizeDefineValue(const char* pszValue) {
+    char* pszTokens = AllocString(2 * strlen(pszValue) + 2);
+    if (pszTokens == NULL) {
+        return NULL;
+    }
+    char* pszOut = pszTokens;
+    while (*pszValue != '\0') {
+        if (*pszValue == ' ' || *pszValue == '\t') {
+            pszValue++;
+            continue;
+        }
+        if (IsAlphaNumeric(*pszValue)) {
+            while (IsAlphaNumeric(*pszValue)) {
+                *pszOut++ = *pszValue++;
             }
-            RestoreInputStatus(pIncFile, &sis2);
+        } else if (pszValue[1] != '\0' && IsTwoCharOp(pszValue[0], pszValue[1])) {
+            *pszOut++ = *pszValue++;
+            *pszOut++ = *pszValue++;
+        } else {
+            *pszOut++ = *pszValue++;
         }
-        bIsName = 0;
+        *pszOut++ = '\0';
     }
-    RestoreInputStatus(pIncFile, &sis);
+    *pszOut = '\0';
+    return pszTokens;
 }
 
+// apply -D and -U cmdline switches
 
-// #define has occured
-// can be a constant or a macro
-// esi=input token stream
+static void DefineCmdlineMacros(struct INCFILE* pIncFile) {
+    char szName[MAXSTRUCTNAME];
+
+    for (size_t i = 0; i < g_pszDefines->size; i++) {
+        char* pszDefine = vector_charp_get(g_pszDefines, i);
+        char* pszValue = strchr(pszDefine, '=');
+        size_t len = pszValue != NULL ? (size_t)(pszValue - pszDefine - 1) : strlen(pszDefine + 1);
+        if (len == 0 || len >= sizeof(szName)) {
+            continue;
+        }
+        memcpy(szName, pszDefine + 1, len);
+        szName[len] = '\0';
+        if (pszDefine[0] == 'U') {
+            SetDefine(pIncFile, szName, NULL);
+        } else {
+            SetDefine(pIncFile, szName, TokenizeDefineValue(pszValue != NULL ? pszValue + 1 : "1"));
+        }
+    }
+}
+
+// copy the tokens of a macro (struct ITEM_MACROINFO) to the string pool,
+// returns NULL if there are none
+
+static const char* StoreMacroTokens(struct vector* pTokens) {
+    size_t dwSize = 0;
+    for (size_t i = 0; i < pTokens->size; i++) {
+        dwSize += strlen(vector_charp_get(pTokens, i)) + 1;
+    }
+    if (dwSize == 0) {
+        return NULL;
+    }
+    char* pszTokens = AllocString(dwSize);
+    if (pszTokens == NULL) {
+        return NULL;
+    }
+    char* pszOut = pszTokens;
+    for (size_t i = 0; i < pTokens->size; i++) {
+        char* pszToken = vector_charp_get(pTokens, i);
+        size_t len = strlen(pszToken) + 1;
+        memcpy(pszOut, pszToken, len);
+        pszOut += len;
+    }
+    return pszTokens;
+}
+
+// --guard-symbols: g_pSymbolGuards holds the equates and prototypes written
+// so far, value.pStr is the header which wrote a name first. The same name
+// written by another header is enclosed in "ifndef name", so the assembler
+// skips it if both includes are used.
+// A name is kept in pGuardNames until ParseC has finished the declaration,
+// the output of a declaration may still be discarded (-s).
+
+static char* GetGuardPath(struct INCFILE* pIncFile) {
+    return pIncFile->pszFullPath != NULL ? pIncFile->pszFullPath : pIncFile->pszFileName;
+}
+
+// returns 1 if the "ifndef" line has been written
+
+static int BeginSymbolGuard(struct INCFILE* pIncFile, char* pszName) {
+    struct LISTITEM* pItem = g_pSymbolGuards != NULL ? FindItemList(g_pSymbolGuards, pszName) : NULL;
+    if (pItem == NULL) {
+        struct GUARDNAME name;
+        if (pIncFile->pGuardNames == NULL) {
+            pIncFile->pGuardNames = vector_create(sizeof(struct GUARDNAME));
+        }
+        name.pszName = StrDupArena(pIncFile->pArena, pszName);
+        name.dwOut = (uint32_t)(pIncFile->pszOut - pIncFile->pszOutStart);
+        if (pIncFile->pGuardNames == NULL || name.pszName == NULL || !vector_append(pIncFile->pGuardNames, &name)) {
+            OutOfMemory(pIncFile);
+        }
+        return 0;
+    }
+    if (pItem->value.pStr == NULL || strcmp(pItem->value.pStr, GetGuardPath(pIncFile)) == 0) {
+        return 0;
+    }
+    xprintf(pIncFile, "ifndef %s\r\n", pszName);
+    return 1;
+}
+
+// the output behind pszOut has been discarded, forget the names written there
+
+static void DiscardSymbolGuards(struct INCFILE* pIncFile, char* pszOut) {
+    uint32_t dwOut = (uint32_t)(pszOut - pIncFile->pszOutStart);
+    struct vector* pNames = pIncFile->pGuardNames;
+    while (pNames != NULL && pNames->size > 0 && ((struct GUARDNAME*)vector_get(pNames, pNames->size - 1))->dwOut >= dwOut) {
+        vector_pop(pNames);
+    }
+}
+
+static void CommitSymbolGuards(struct INCFILE* pIncFile) {
+    struct vector* pNames = pIncFile->pGuardNames;
+    if (pNames == NULL || pNames->size == 0) {
+        return;
+    }
+    if (g_pSymbolGuards == NULL) {
+        g_pSymbolGuards = CreateList(MAXITEMS, sizeof(struct LISTITEM));
+    }
+    for (size_t i = 0; i < pNames->size; i++) {
+        char* pszName = ((struct GUARDNAME*)vector_get(pNames, i))->pszName;
+        if (FindItemList(g_pSymbolGuards, pszName) == NULL) {
+            struct LISTITEM* pItem = InsertItem(pIncFile, g_pSymbolGuards, pszName);
+            if (pItem != NULL) {
+                pItem->value.pStr = AddString(GetGuardPath(pIncFile));
+            }
+        }
+    }
+    pNames->size = 0;
+}
+
+static void EndSymbolGuard(struct INCFILE* pIncFile, int bGuarded) {
+    if (bGuarded) {
+        xwrite(pIncFile, "endif\r\n");
+    }
+}
 
 void IsDefine(struct INCFILE* pIncFile) {
     int bMacro;
@@ -1061,41 +1727,55 @@ void IsDefine(struct INCFILE* pIncFile) {
     int bIsCObj;
     char szInterface[128];
     char szMethod[128];
+    struct PPLINE line;
 
+    BEGIN_TIMESPAN(TP_DEFINE, pIncFile->pszFileName);
+    if (g_dwHotDecls) {
+        BeginHotDecl(pIncFile, pIncFile->dwLine, GetTokensRead(pIncFile));
+    }
     char* storedPszOut = pIncFile->pszOut;
     pszName = GetNextTokenPP(pIncFile);  // get the name of constant/macro
     if (pszName != NULL) {
+        if (g_bFoldIf) {
+            SetDefine(pIncFile, pszName, CopyDefineValue(pIncFile));
+        }
+        if (g_bFoldConstants) {
+            ForgetConstant(pszName);
+        }
         szComment[0] = '\0'; szComment[1] = '\0';
         if (IsReservedWord(pszName)) {
             szComment[0] = ';';
             if (g_bWarningLevel > 0) {
-                fprintf(stderr, "%s, %u: reserved word '%s' used as equate/macro\n", pIncFile->pszFileName, pIncFile->dwLine, pszName);
+                diag_printf("%s, %u: reserved word '%s' used as equate/macro\n", pIncFile->pszFileName, pIncFile->dwLine, pszName);
                 pIncFile->dwWarnings++;
             }
         }
-        SkipCasts(pIncFile);
+        ReadPPLine(pIncFile, &line);
 
         int validMacro = 1;
         char *savePos = pIncFile->pszOut;
 
+        bMacro = line.numTokens != 0 && line.ppszTokens[0][0] == (char)PP_MACRO && line.ppszTokens[0][1] == '\0';
+        int bGuarded = 0;
+        if (g_bGuardSymbols && g_bConstants && !bMacro && szComment[0] == '\0') {
+            bGuarded = BeginSymbolGuard(pIncFile, pszName);
+        }
         xwrite(pIncFile, szComment);
         xwrite(pIncFile, pszName);
-        bMacro = pIncFile->pszIn[0] == (char)PP_MACRO && pIncFile->pszIn[1] == '\0';
         if (bMacro) {
-            GetNextTokenPP(pIncFile);   // skip PP_MACRO
-            GetNextTokenPP(pIncFile);   // skip "("
+            ReadLineToken(&line);       // skip PP_MACRO
+            ReadLineToken(&line);       // skip "("
             xwrite(pIncFile, " macro ");
 
             // xwrite the macro params
 
-#if 1
-            SkipSimpleBraces(pIncFile);
-#endif
+            StartBraceCheck(&line);
             dwParms = 0;
-            struct MACRO_TOKEN *params = NULL;
-            struct MACRO_TOKEN *last_parm = NULL;
+            struct vector* pTokens = pIncFile->pMacroTokens;
+            int bTokensStored = 1;
+            pTokens->size = 0;
             while (1) {
-                pszParm = GetNextTokenPP(pIncFile);
+                pszParm = ReadLineToken(&line);
                 if (pszParm == NULL) {
                     break;
                 }
@@ -1103,20 +1783,13 @@ void IsDefine(struct INCFILE* pIncFile) {
                     break;
                 }
                 if (*pszParm != ',') {
-                    // Store name of parameter
-                    struct MACRO_TOKEN *parm = malloc(sizeof(struct MACRO_TOKEN*));
-                    parm->next = NULL;
-                    parm->name = strdup(pszParm);
-                    if (last_parm == NULL) {
-                        params = parm;
-                    } else {
-                        last_parm->next = parm;
+                    if (bTokensStored && !vector_charp_append(pTokens, pszParm)) {
+                        OutOfMemory(pIncFile);
+                        bTokensStored = 0;
                     }
-                    last_parm = parm;
-
                     dwParms++;
                     if (IsReservedWord(pszParm) && g_bWarningLevel > 1) {
-                        fprintf(stderr, "%s, %u: reserved word '%s' used as macro parameter\n", pIncFile->pszFileName, pIncFile->dwLine, pszParm);
+                        diag_printf("%s, %u: reserved word '%s' used as macro parameter\n", pIncFile->pszFileName, pIncFile->dwLine, pszParm);
                         pIncFile->dwWarnings++;
                     }
                 }
@@ -1130,30 +1803,12 @@ void IsDefine(struct INCFILE* pIncFile) {
             if (IsMacro(pIncFile, pszName) == NULL) {
                 macroInfo = InsertStrIntItem(pIncFile, g_pMacros, pszName, dwParms);
             }
-            if (macroInfo) {
-                macroInfo->params = malloc(dwParms * (sizeof(char*))+1);
-                macroInfo->params[dwParms] = NULL;
-                int i = 0;
-                struct MACRO_TOKEN *p = params;
-                for (; p != NULL; p = p->next, i++) {
-                    macroInfo->params[i] = p->name;
-                }
-            }
-            while (params != NULL) {
-                struct MACRO_TOKEN *p = params->next;
-                free(params);
-                params = p;
-            }
             xwrite(pIncFile, "exitm <");
 
-            int nbContents = 0;
-            struct MACRO_TOKEN *contents = NULL;
-            struct MACRO_TOKEN *last_contents = NULL;
-
             // test if it is a "COBJMACRO"
 
             char* pszMethod;
-            pszThis = IsCObjMacro(pIncFile, &pszMethod);
+            pszThis = IsCObjMacro(&line, &pszMethod);
             bIsCObj = pszThis != NULL;
             if (bIsCObj) {
                 GetInterfaceName(pszName, szInterface);
@@ -1161,23 +1816,17 @@ void IsDefine(struct INCFILE* pIncFile) {
                 xprintf(pIncFile, "vf(%s, %s, %s)", pszThis, szInterface, TranslateName(pszMethod, NULL, &bTrans));
             }
             while (1) {
-                char* token = GetNextTokenPP(pIncFile);
+                char* token = ReadLineToken(&line);
                 if (token == NULL) {
                     break;
                 }
                 if (strcmp(token, "->") == 0 || strcmp(token, ">") == 0) {
                     validMacro = 0;
                 }
-                struct MACRO_TOKEN *content = malloc(sizeof(struct MACRO_TOKEN));
-                content->name = strdup(token);
-                content->next = NULL;
-                if (last_contents == NULL) {
-                    contents = content;
-                } else {
-                    last_contents->next = content;
+                if (bTokensStored && !vector_charp_append(pTokens, token)) {
+                    OutOfMemory(pIncFile);
+                    bTokensStored = 0;
                 }
-                nbContents++;
-                last_contents = content;
 
                 if (macroInfo != NULL && strcmp(token, "##") == 0) {
                     macroInfo->containsAppend = 1;
@@ -1189,20 +1838,13 @@ void IsDefine(struct INCFILE* pIncFile) {
                 xwrite(pIncFile, " ");
             }
 
-            if (macroInfo) {
-                macroInfo->contents = malloc(nbContents * (sizeof(char*))+1);
-                macroInfo->contents[nbContents] = NULL;
-                int i = 0;
-                struct MACRO_TOKEN *p = contents;
-                for (; p != NULL; p = p->next, i++) {
-                    macroInfo->contents[i] = p->name;
+            if (macroInfo && bTokensStored) {
+                macroInfo->pszTokens = StoreMacroTokens(pTokens);
+                if (macroInfo->pszTokens != NULL) {
+                    macroInfo->numParams = dwParms;
+                    macroInfo->numContents = (uint32_t)(pTokens->size - dwParms);
                 }
             }
-            while (contents != NULL) {
-                struct MACRO_TOKEN *p = contents->next;
-                free(contents);
-                contents = p;
-            }
 
             xwrite(pIncFile, ">");
             xwrite(pIncFile, "\r\n");
@@ -1215,17 +1857,23 @@ void IsDefine(struct INCFILE* pIncFile) {
             }
         } else {
             xwrite(pIncFile, "\tEQU\t");
-            SkipSimpleBraces(pIncFile);
-            convertline(pIncFile, pszName);
+            StartBraceCheck(&line);
+            convertline(&line, pszName);
+            EndSymbolGuard(pIncFile, bGuarded);
         }
+        EndPPLine(&line);
     }
     if (!g_bConstants) {
         pIncFile->pszOut = storedPszOut;
         *storedPszOut = '\0';
     }
+    if (g_dwHotDecls) {
+        EndHotDecl("define", pszName, pIncFile->pszFileName, GetTokensRead(pIncFile));
+    }
+    END_TIMESPAN();
 }
 
-char *strings_join(const char *s, ...) {
+char *strings_join(struct ARENA *pArena, const char *s, ...) {
     va_list va;
     size_t len = strlen(s);
     va_start(va, s);
@@ -1233,7 +1881,10 @@ char *strings_join(const char *s, ...) {
         len += strlen(next);
     }
     va_end(va);
-    char *result = malloc(len + 1);
+    char *result = AllocArena(pArena, len + 1);
+    if (result == NULL) {
+        return NULL;
+    }
     strcpy(result, s);
     va_start(va, s);
     for (const char *next = va_arg(va, char*); next != NULL; next = va_arg(va, char*)) {
@@ -1248,17 +1899,114 @@ int file_exists(const char *path) {
     return access(path, R_OK) == 0;
 }
 
-void IsInclude(struct INCFILE* pIncFile) {
-    char* pszPath;
+// g_pIncludeGuards holds the full paths of headers which have been
+// converted and are guarded by an include guard or "#pragma once".
+// value.pStr is the guard macro, NULL for "#pragma once".
+// g_pIncludePaths caches the path an #include has been resolved to,
+// so a guarded header can be skipped without accessing the file system.
+// value.pStr is NULL if the header wasn't found.
 
-    xwrite(pIncFile, "\tinclude ");
-    pszPath = GetNextTokenPP(pIncFile);
-    if (pszPath != NULL && *pszPath == '<') {
-        pszPath = GetNextTokenPP(pIncFile);
+static struct LIST* g_pIncludePaths;
+
+static void RegisterIncludeGuard(struct INCFILE* pIncFile) {
+    if (!pIncFile->bPragmaOnce && pIncFile->pszGuard == NULL) {
+        return;
     }
-    char *pszOut = pIncFile->pszOut;
-    if (pszPath != NULL) {
-        char sep = '\0';
+    if (g_pIncludeGuards == NULL) {
+        g_pIncludeGuards = CreateList(MAXITEMS, sizeof(struct LISTITEM));
+    }
+    if (FindItemList(g_pIncludeGuards, pIncFile->pszFullPath) != NULL) {
+        return;
+    }
+    struct LISTITEM* pItem = InsertItem(pIncFile, g_pIncludeGuards, pIncFile->pszFullPath);
+    if (pItem != NULL) {
+        pItem->value.pStr = pIncFile->bPragmaOnce ? NULL : AddString(pIncFile->pszGuard);
+    }
+}
+
+// #undef of a guard macro, the header has to be converted again
+
+static void ForgetIncludeGuard(struct INCFILE* pIncFile, char* pszName) {
+    for (; pIncFile != NULL; pIncFile = pIncFile->pParent) {
+        if (pIncFile->pszGuard != NULL && strcmp(pIncFile->pszGuard, pszName) == 0) {
+            pIncFile->pszGuard = NULL;
+        }
+    }
+    if (g_pIncludeGuards == NULL) {
+        return;
+    }
+    for (uint32_t i = GetNumItemsList(g_pIncludeGuards); i > 0; i--) {
+        struct LISTITEM* pItem = GetItemList(g_pIncludeGuards, i - 1);
+        if (pItem->value.pStr != NULL && strcmp(pItem->value.pStr, pszName) == 0) {
+            RemoveItemList(g_pIncludeGuards, pItem);
+        }
+    }
+}
+
+static int IsIncludeGuarded(const char* pszFullPath) {
+    return pszFullPath != NULL && g_pIncludeGuards != NULL && FindItemList(g_pIncludeGuards, (char*)pszFullPath) != NULL;
+}
+
+// search an included file in the directory of the including file
+// and in the include directories. returns the path or NULL
+
+static char* ResolveIncludePath(struct INCFILE* pIncFile, char* pszKey, char* incPathArg) {
+    struct LISTITEM* pItem = NULL;
+    if (g_pIncludePaths != NULL) {
+        pItem = FindItemList(g_pIncludePaths, pszKey);
+        if (pItem != NULL) {
+            return pItem->value.pStr;
+        }
+    }
+    char *newFullIncPath = pszKey;
+    if (!file_exists(newFullIncPath)) {
+        newFullIncPath = NULL;
+        for (size_t i = 0; i < g_pszIncDirs->size; i++) {
+            newFullIncPath = strings_join(pIncFile->pArena, ((const char**)g_pszIncDirs->data)[i], incPathArg, NULL);
+            if (newFullIncPath != NULL && file_exists(newFullIncPath)) {
+                break;
+            }
+            newFullIncPath = NULL;
+        }
+    }
+    if (g_pIncludePaths == NULL) {
+        g_pIncludePaths = CreateList(MAXITEMS, sizeof(struct LISTITEM));
+    }
+    pItem = InsertItem(pIncFile, g_pIncludePaths, pszKey);
+    if (pItem != NULL) {
+        pItem->value.pStr = newFullIncPath != NULL ? AddString(newFullIncPath) : NULL;
+    }
+    return newFullIncPath;
+}
+
+// pass the output written so far to the tree shaker (--shake), an included
+// header is converted in between, so its declarations keep the source order
+
+static void CollectShakeText(struct INCFILE* pIncFile) {
+    if (pIncFile->pszOut > pIncFile->pszShakeOut) {
+        if (!AddShakeText(pIncFile->pszShakeOut, pIncFile->pszOut - pIncFile->pszShakeOut)) {
+            OutOfMemory(pIncFile);
+        }
+    }
+    pIncFile->pszShakeOut = pIncFile->pszOut;
+}
+
+void IsInclude(struct INCFILE* pIncFile) {
+    char* pszPath;
+
+    if (SHAKE_ENABLED) {
+        CollectShakeText(pIncFile);
+    }
+    // the included header sees the names written before the #include
+    CommitSymbolGuards(pIncFile);
+    xwrite(pIncFile, "\tinclude ");
+    pszPath = GetNextTokenPP(pIncFile);
+    if (pszPath != NULL && *pszPath == '<') {
+        pszPath = GetNextTokenPP(pIncFile);
+    }
+    char *pszOut = pIncFile->pszOut;
+    if (pszPath != NULL) {
+        char sep = '\0';
         char *startIncPath = pszPath;
         if (pszPath[0] == '"') {
             pszPath++;
@@ -1277,38 +2025,60 @@ void IsInclude(struct INCFILE* pIncFile) {
             pszOut++;
             pszPath++;
         }
-        char *incPathArg = strdup(startIncPath);
-        incPathArg[pszPath - startIncPath] = '\0';
-
+        char *incPathArg = StrNDupArena(pIncFile->pArena, startIncPath, pszPath - startIncPath);
         char *newFullIncPath = NULL;
-        newFullIncPath = strings_join(pIncFile->pszDirPath, incPathArg, NULL);
-        if (!file_exists(newFullIncPath)) {
-            free(newFullIncPath);
-            newFullIncPath = NULL;
-            for (size_t i = 0; i < g_pszIncDirs->size; i++) {
-                newFullIncPath = strings_join(((const char**)g_pszIncDirs->data)[i], incPathArg, NULL);
-                if (file_exists(newFullIncPath)) {
-                    break;
+        char *pszIncPath = NULL;        // the header converted with -i
+        char *pszKey = incPathArg != NULL ? strings_join(pIncFile->pArena, pIncFile->pszDirPath, incPathArg, NULL) : NULL;
+        if (pszKey == NULL) {
+            diag_printf("fatal error: out of memory\n");
+            g_bTerminate = 1;
+        } else if (g_pfnLoadInclude != NULL) {
+            const char* pData;
+            size_t dwSize;
+            g_Stats.dwIncludes++;
+            if (IsIncludeGuarded(pszKey)) {
+                g_Stats.dwIncludesGuarded++;
+            } else if (g_pfnLoadInclude(g_pLoadIncludeContext, pIncFile->pszDirPath, incPathArg, &pData, &dwSize)) {
+                BEGIN_TIMESPAN(TP_INCLUDE, pIncFile->pszFileName);
+                TRACE_BEGIN(TC_INCLUDES, pszKey, pIncFile->pszFileName, pIncFile->dwLine);
+                struct INCFILE *subIncFile = CreateIncFileFromMemory(pszKey, pData, dwSize, pIncFile);
+                if (subIncFile != NULL) {
+                    ParserIncFile(subIncFile);
+                    AnalyzerIncFile(subIncFile);
+                    DestroyIncFile(subIncFile);
+                    g_Stats.dwIncludesFound++;
                 }
-                free(newFullIncPath);
+                TRACE_END(TC_INCLUDES);
+                END_TIMESPAN();
+            }
+        } else if (!g_bNoFileIO) {
+            g_Stats.dwIncludes++;
+            newFullIncPath = ResolveIncludePath(pIncFile, pszKey, incPathArg);
+            pszIncPath = newFullIncPath;
+            if (IsIncludeGuarded(newFullIncPath)) {
+                g_Stats.dwIncludesGuarded++;
                 newFullIncPath = NULL;
             }
         }
         if (newFullIncPath) {
+            BEGIN_TIMESPAN(TP_INCLUDE, pIncFile->pszFileName);
+            TRACE_BEGIN(TC_INCLUDES, newFullIncPath, pIncFile->pszFileName, pIncFile->dwLine);
             struct INCFILE *subIncFile = CreateIncFile(newFullIncPath, pIncFile);
-            free((char *) newFullIncPath);
             if (subIncFile != NULL) {
                 ParserIncFile(subIncFile);
                 AnalyzerIncFile(subIncFile);
                 DestroyIncFile(subIncFile);
+                g_Stats.dwIncludesFound++;
             }
+            TRACE_END(TC_INCLUDES);
+            END_TIMESPAN();
         }
 
         char ext[2];
         memcpy(ext, &pszOut[-2], 2);
         if (strnicmp(ext, ".h", 2) == 0) {
-            if (g_bProcessInclude) {
-                ProcessFile(pIncFile->pszOut, pIncFile);
+            if (g_bProcessInclude && pszIncPath != NULL && !SHAKE_ENABLED) {
+                ProcessFile(pszIncPath, pIncFile);
             }
             strcpy(&pszOut[-2], ".inc");
             pszOut += 2;
@@ -1340,6 +2110,9 @@ void IsPragma(struct INCFILE* pIncFile) {
 
     SaveInputStatus(pIncFile, &sis);
     char* token = GetNextTokenPP(pIncFile);
+    if (strcmp(token, "once") == 0) {
+        pIncFile->bPragmaOnce = 1;
+    }
     if (strcmp(token, "message") != 0) {
         RestoreInputStatus(pIncFile, &sis);
         xwrite(pIncFile, ";#pragma ");
@@ -1375,6 +2148,27 @@ void IsPragma(struct INCFILE* pIncFile) {
     }
 }
 
+// #undef is commented out, with --fold-if the macro is known to be undefined.
+// A header guarded by the macro isn't skipped anymore.
+
+void IsUndef(struct INCFILE* pIncFile) {
+    struct INPSTAT sis;
+    SaveInputStatus(pIncFile, &sis);
+    char* pszName = GetNextTokenPP(pIncFile);
+    if (pszName != NULL) {
+        ForgetIncludeGuard(pIncFile, pszName);
+        if (g_bFoldIf) {
+            SetDefine(pIncFile, pszName, NULL);
+        }
+        if (g_bFoldConstants) {
+            ForgetConstant(pszName);
+        }
+    }
+    RestoreInputStatus(pIncFile, &sis);
+    xwrite(pIncFile, ";#undef ");
+    CopyLine(pIncFile);
+}
+
 char* TranslateIfExpression(char* pszToken) {
     for (size_t i = 0; i < sizeOpConvTab; i++) {
         if (strcmp(pszToken, g_szOpConvTab[i].wOp) == 0) {
@@ -1386,7 +2180,7 @@ char* TranslateIfExpression(char* pszToken) {
 
 void IncIfLevel(struct INCFILE* pIncFile) {
     if (pIncFile->bIfLvl == MAXIFLEVEL) {
-        fprintf(stderr, "%s, %u: if nesting level too deep\n", pIncFile->pszFileName, pIncFile->dwLine);
+        diag_printf("%s, %u: if nesting level too deep\n", pIncFile->pszFileName, pIncFile->dwLine);
         pIncFile->dwErrors++;
     } else {
         pIncFile->bIfLvl++;
@@ -1398,7 +2192,7 @@ void IncElseLevel(struct INCFILE* pIncFile) {
     if (pIncFile->bIfLvl > 0) {
         pIncFile->bIfStack[pIncFile->bIfLvl]++;
     } else {
-        fprintf(stderr, "%s, %u: else/elif withuot if\n", pIncFile->pszFileName, pIncFile->dwLine);
+        diag_printf("%s, %u: else/elif withuot if\n", pIncFile->pszFileName, pIncFile->dwLine);
         pIncFile->dwErrors++;
     }
 }
@@ -1407,7 +2201,7 @@ void DecIfLevel(struct INCFILE* pIncFile) {
     if (pIncFile->bIfLvl > 0) {
         pIncFile->bIfLvl--;
     } else {
-        fprintf(stderr, "%s, %u: endif without if\n", pIncFile->pszFileName, pIncFile->dwLine);
+        diag_printf("%s, %u: endif without if\n", pIncFile->pszFileName, pIncFile->dwLine);
         pIncFile->dwErrors++;
     }
 }
@@ -1458,7 +2252,7 @@ void IfElseIf(struct INCFILE* pIncFile, int bMode) {
     }
 exit:
     while (pszToken != NULL) {
-        if (IsNumber(pszToken)) {
+        if (IsNumber(pIncFile, pszToken)) {
             xwrite(pIncFile, pszToken);
         } else {
             xwrite(pIncFile, TranslateIfExpression(pszToken));
@@ -1474,7 +2268,7 @@ void IfdefIfndef(struct INCFILE* pIncFile, char* pszCmd) {
     SkipCasts(pIncFile);
     char* pszToken = GetNextTokenPP(pIncFile);
     if (pszToken == NULL) {
-        fprintf(stderr, "%s, %u: unexpected end of line\n", pIncFile->pszFileName, pIncFile->dwLine);
+        diag_printf("%s, %u: unexpected end of line\n", pIncFile->pszFileName, pIncFile->dwLine);
         pIncFile->dwErrors++;
         xwrite(pIncFile, "if 0;");
     } else {
@@ -1496,54 +2290,374 @@ void ElseEndif(struct INCFILE* pIncFile, char* pszCmd) {
     CopyLine(pIncFile);
 }
 
+// --fold-if: conditionals whose condition is known are not written,
+// the tokens of branches not taken are skipped. The handlers return 0 if
+// the conditional has to be written as MASM if/elseif/else/endif.
+// While peeking (bSkipPP) nothing is written and defines are not changed.
+
+// get tokens of a #if expression, macros are expanded and "defined x"
+// is replaced by 0 or 1
+// returns 0 if a macro is unknown
+
+struct IFSOURCE {
+    struct INCFILE* pIncFile;       // read from input stream
+    char* pszValue;                 // or from a macro value
+};
+
+struct IFTOKENS {
+    char* ppTokens[MAXIFTOKENS];
+    size_t numTokens;
+};
+
+static char* GetNextIfToken(struct IFSOURCE* pSource) {
+    if (pSource->pIncFile != NULL) {
+        return GetNextTokenPP(pSource->pIncFile);
+    }
+    if (*pSource->pszValue == '\0') {
+        return NULL;
+    }
+    char* pszToken = pSource->pszValue;
+    pSource->pszValue += strlen(pszToken) + 1;
+    return pszToken;
+}
+
+static int AddIfToken(struct IFTOKENS* pTokens, char* pszToken) {
+    if (pTokens->numTokens == MAXIFTOKENS) {
+        return 0;
+    }
+    pTokens->ppTokens[pTokens->numTokens++] = pszToken;
+    return 1;
+}
+
+static int ExpandIfTokens(struct IFTOKENS* pTokens, struct IFSOURCE* pSource, int nDepth) {
+    char* pszToken;
+
+    while ((pszToken = GetNextIfToken(pSource)) != NULL) {
+        if (strcmp(pszToken, "defined") == 0) {
+            char* pszName = GetNextIfToken(pSource);
+            int bBrace = pszName != NULL && strcmp(pszName, "(") == 0;
+            if (bBrace) {
+                pszName = GetNextIfToken(pSource);
+            }
+            if (pszName == NULL || !IsAlpha(*pszName)) {
+                return 0;
+            }
+            if (bBrace) {
+                char* pszBrace = GetNextIfToken(pSource);
+                if (pszBrace == NULL || strcmp(pszBrace, ")") != 0) {
+                    return 0;
+                }
+            }
+            struct LISTITEM* pItem = FindItemList(g_pDefines, pszName);
+            if (pItem == NULL || !AddIfToken(pTokens, pItem->value.pStr != NULL ? "1" : "0")) {
+                return 0;
+            }
+        } else if (IsAlpha(*pszToken) && strcmp(pszToken, "?") != 0) {
+            struct LISTITEM* pItem = FindItemList(g_pDefines, pszToken);
+            if (pItem == NULL) {
+                return 0;
+            }
+            if (pItem->value.pStr == NULL) {
+                if (!AddIfToken(pTokens, "0")) {
+                    return 0;
+                }
+            } else {
+                struct IFSOURCE source;
+                source.pIncFile = NULL;
+                source.pszValue = pItem->value.pStr;
+                if (*source.pszValue == (char)PP_MACRO || nDepth == MAXIFEXPANSION) {
+                    return 0;
+                }
+                if (!ExpandIfTokens(pTokens, &source, nDepth + 1)) {
+                    return 0;
+                }
+            }
+        } else if (!AddIfToken(pTokens, pszToken)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// evaluate condition of #if/#elif/#ifdef/#ifndef
+// returns 1 (true), 0 (false) or -1 (unknown)
+// the line is consumed unless the condition is unknown
+
+static int GetIfCondition(struct INCFILE* pIncFile, char* pszCmd) {
+    struct INPSTAT sis;
+    int rc = -1;
+
+    SaveInputStatus(pIncFile, &sis);
+    if (strcmp(pszCmd, "ifdef") == 0 || strcmp(pszCmd, "ifndef") == 0) {
+        char* pszName = GetNextTokenPP(pIncFile);
+        struct LISTITEM* pItem = pszName != NULL ? FindItemList(g_pDefines, pszName) : NULL;
+        if (pItem != NULL) {
+            rc = (pItem->value.pStr != NULL) == (pszCmd[2] == 'd');
+            SkipPPLine(pIncFile);
+        }
+    } else {
+        struct IFTOKENS tokens;
+        struct IFSOURCE source;
+        int64_t value;
+        tokens.numTokens = 0;
+        source.pIncFile = pIncFile;
+        source.pszValue = NULL;
+        if (ExpandIfTokens(&tokens, &source, 0) && EvaluateIfExpression(tokens.ppTokens, tokens.numTokens, GetNumberSuffix, pIncFile, &value)) {
+            rc = value != 0;
+        }
+    }
+    if (rc < 0) {
+        RestoreInputStatus(pIncFile, &sis);
+    } else {
+        g_szComment[1] = '\0';
+    }
+    return rc;
+}
+
+// skip a branch which is not taken
+// stops in front of the next #elif/#else/#endif of the same level
+
+static void SkipIfBlock(struct INCFILE* pIncFile) {
+    uint32_t dwLevel = 0;
+    int bLineStart = 1;
+
+    while (1) {
+        char* pszToken = pIncFile->pszIn;
+        size_t len = strlen(pszToken);
+        if (len == 0) {
+            break;
+        }
+        if ((pszToken[0] == (char)PP_EOL || pszToken[0] == (char)PP_WEAKEOL) && pszToken[1] == '\0') {
+            pIncFile->dwLine++;
+            bLineStart = pszToken[0] == (char)PP_EOL;
+        } else if (pszToken[0] == (char)PP_COMMENT || pszToken[0] == (char)PP_IGNORE) {
+            // comments don't change line start
+        } else {
+            if (bLineStart && strcmp(pszToken, "#") == 0) {
+                char* pszCmd = pszToken + len + 1;
+                if (strcmp(pszCmd, "if") == 0 || strcmp(pszCmd, "ifdef") == 0 || strcmp(pszCmd, "ifndef") == 0) {
+                    dwLevel++;
+                } else if (strcmp(pszCmd, "endif") == 0) {
+                    if (dwLevel == 0) {
+                        break;
+                    }
+                    dwLevel--;
+                } else if (dwLevel == 0 && (strcmp(pszCmd, "elif") == 0 || strcmp(pszCmd, "else") == 0)) {
+                    break;
+                }
+            }
+            bLineStart = 0;
+        }
+        pIncFile->pszIn += len + 1;
+    }
+    pIncFile->bNewLine = 1;
+}
+
+static void SkipIfLine(struct INCFILE* pIncFile) {
+    SkipPPLine(pIncFile);
+    g_szComment[1] = '\0';
+}
+
+// #if/#ifdef/#ifndef
+// a conditional beyond MAXIFLEVEL is written, its #elif, #else and
+// #endif must not use the folding stack then
+
+static int FoldIf(struct INCFILE* pIncFile, char* pszCmd) {
+    if (pIncFile->bFoldLvl == MAXIFLEVEL || pIncFile->dwFoldOverflow != 0) {
+        pIncFile->dwFoldOverflow++;
+        return 0;
+    }
+    int bGuard = pIncFile->pszIn == pIncFile->pszGuardIf;
+    int rc = GetIfCondition(pIncFile, pszCmd);
+    pIncFile->bFoldLvl++;
+    if (rc < 0) {
+        pIncFile->bFoldStack[pIncFile->bFoldLvl] = bGuard ? FS_EMITTED | FS_GUARD : FS_EMITTED;
+        return 0;
+    }
+    if (rc) {
+        pIncFile->bFoldStack[pIncFile->bFoldLvl] = FS_TAKEN;
+    } else {
+        pIncFile->bFoldStack[pIncFile->bFoldLvl] = FS_SEARCHING;
+        SkipIfBlock(pIncFile);
+    }
+    return 1;
+}
+
+static int FoldElIf(struct INCFILE* pIncFile) {
+    if (pIncFile->bFoldLvl == 0 || pIncFile->dwFoldOverflow != 0) {
+        return 0;
+    }
+    uint8_t* pbState = &pIncFile->bFoldStack[pIncFile->bFoldLvl];
+    if ((*pbState & FS_EMITTED) && !pIncFile->bSkipPP) {
+        ForgetBranchDefines(pIncFile);
+    }
+    if (*pbState & FS_TAKEN) {
+        SkipIfLine(pIncFile);
+        SkipIfBlock(pIncFile);
+        return 1;
+    }
+    int rc = GetIfCondition(pIncFile, "elif");
+    if (rc < 0) {
+        if (*pbState & FS_EMITTED) {
+            return 0;
+        }
+        // first branch which is written
+        *pbState = FS_EMITTED;
+        IncIfLevel(pIncFile);
+        if (pIncFile->bSkipPP) {
+            SkipPPLine(pIncFile);
+        } else {
+            IfElseIf(pIncFile, 0);
+        }
+    } else if (rc == 0) {
+        SkipIfBlock(pIncFile);
+    } else if (*pbState & FS_EMITTED) {
+        *pbState |= FS_TAKEN;
+        IncElseLevel(pIncFile);
+        if (!pIncFile->bSkipPP) {
+            xwrite(pIncFile, "else \r\n");
+        }
+    } else {
+        *pbState = FS_TAKEN;
+    }
+    return 1;
+}
+
+static int FoldElse(struct INCFILE* pIncFile) {
+    if (pIncFile->bFoldLvl == 0 || pIncFile->dwFoldOverflow != 0) {
+        return 0;
+    }
+    uint8_t* pbState = &pIncFile->bFoldStack[pIncFile->bFoldLvl];
+    if ((*pbState & FS_EMITTED) && !pIncFile->bSkipPP) {
+        ForgetBranchDefines(pIncFile);
+    }
+    if (*pbState & FS_TAKEN) {
+        SkipIfLine(pIncFile);
+        SkipIfBlock(pIncFile);
+        return 1;
+    }
+    if (*pbState & FS_EMITTED) {
+        return 0;
+    }
+    *pbState = FS_TAKEN;
+    SkipIfLine(pIncFile);
+    return 1;
+}
+
+static int FoldEndif(struct INCFILE* pIncFile) {
+    if (pIncFile->dwFoldOverflow != 0) {
+        pIncFile->dwFoldOverflow--;
+        return 0;
+    }
+    if (pIncFile->bFoldLvl == 0) {
+        return 0;
+    }
+    uint8_t bState = pIncFile->bFoldStack[pIncFile->bFoldLvl];
+    if ((bState & (FS_EMITTED | FS_GUARD)) == FS_EMITTED && !pIncFile->bSkipPP) {
+        ForgetBranchDefines(pIncFile);
+    }
+    pIncFile->bFoldLvl--;
+    if (bState & FS_EMITTED) {
+        return 0;
+    }
+    SkipIfLine(pIncFile);
+    return 1;
+}
+
 // -------------------
 
 void IsIf(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldIf(pIncFile, "if")) {
+        return;
+    }
     IncIfLevel(pIncFile);
     IfElseIf(pIncFile, 0);
 }
 
 void IsElIf(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldElIf(pIncFile)) {
+        return;
+    }
     IncElseLevel(pIncFile);
     IfElseIf(pIncFile, 1);
 }
 
 void IsIfdef(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldIf(pIncFile, "ifdef")) {
+        return;
+    }
     IncIfLevel(pIncFile);
     IfdefIfndef(pIncFile, "ifdef");
 }
 
 void IsIfndef(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldIf(pIncFile, "ifndef")) {
+        return;
+    }
     IncIfLevel(pIncFile);
     IfdefIfndef(pIncFile, "ifndef");
 }
 
 void IsElse(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldElse(pIncFile)) {
+        return;
+    }
     IncElseLevel(pIncFile);
     ElseEndif(pIncFile, "else");
 }
 
 void IsEndif(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldEndif(pIncFile)) {
+        return;
+    }
     DecIfLevel(pIncFile);
     ElseEndif(pIncFile, "endif");
 }
 
 void IsIfNP(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldIf(pIncFile, "if")) {
+        return;
+    }
+    IncIfLevel(pIncFile);
+    SkipPPLine(pIncFile);
+}
+
+void IsIfdefNP(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldIf(pIncFile, "ifdef")) {
+        return;
+    }
+    IncIfLevel(pIncFile);
+    SkipPPLine(pIncFile);
+}
+
+void IsIfndefNP(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldIf(pIncFile, "ifndef")) {
+        return;
+    }
     IncIfLevel(pIncFile);
     SkipPPLine(pIncFile);
 }
 
 void IsElIfNP(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldElIf(pIncFile)) {
+        return;
+    }
     IncElseLevel(pIncFile);
     SkipPPLine(pIncFile);
 }
 
 void IsElseNP(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldElse(pIncFile)) {
+        return;
+    }
     IncElseLevel(pIncFile);
     SkipPPLine(pIncFile);
 }
 
 void IsEndifNP(struct INCFILE* pIncFile) {
+    if (g_bFoldIf && FoldEndif(pIncFile)) {
+        return;
+    }
     DecIfLevel(pIncFile);
     SkipPPLine(pIncFile);
 }
@@ -1571,7 +2685,9 @@ void ParsePreProcs(struct INCFILE* pIncFile) {
     }
     while (local_ppCmds->pszCmd != NULL) {
         if (strcmp(pszToken, local_ppCmds->pszCmd) == 0) {
+            TRACE_BEGIN(TC_PREPROC, local_ppCmds->pszCmd, pIncFile->pszFileName, pIncFile->dwLine);
             local_ppCmds->pfnHandler(pIncFile);
+            TRACE_END(TC_PREPROC);
             return;
         }
         local_ppCmds++;
@@ -1585,6 +2701,11 @@ void ParsePreProcs(struct INCFILE* pIncFile) {
 }
 
 char* GetNextToken(struct INCFILE* pIncFile) {
+    if (pIncFile->bSkipPP) {
+        pIncFile->dwTokensScanned++;
+    } else {
+        pIncFile->dwTokensConsumed++;
+    }
     if (pIncFile->bUseLastToken) {
         pIncFile->bUseLastToken = 0;
         pIncFile->bNewLine = 0;
@@ -1613,7 +2734,7 @@ char* GetNextToken(struct INCFILE* pIncFile) {
             }
             continue;
         }
-        if (pIncFile->bNewLine && strcmp(currentIn, "#") == 0) {
+        if (pIncFile->bNewLine && (TokenFlags(pIncFile, currentIn) & TF_PPHASH)) {
             if (WriteComment(pIncFile)) {
                 xwrite(pIncFile, "\r\n");
             }
@@ -1683,11 +2804,10 @@ char* TranslateName(char* pszName, char* pszOut, int *bTranslateHappened) {
     return pszName;
 }
 
-void WriteExpression(struct INCFILE* pIncFile, struct LinkedList* pExpression) {
-    uint32_t count = GetNumItemsLinkedList(pExpression);
-    if (count > 0) {
-        for (uint32_t i = 0; i < count; i++) {
-            xwrite(pIncFile, (char*)GetItemLinkedList(pExpression, i));
+void WriteExpression(struct INCFILE* pIncFile, struct smallvector* pExpression) {
+    if (pExpression->size > 0) {
+        for (size_t i = 0; i < pExpression->size; i++) {
+            xwrite(pIncFile, smallvector_get(pExpression, i));
         }
     } else {
         xwrite(pIncFile, "0");
@@ -1696,13 +2816,13 @@ void WriteExpression(struct INCFILE* pIncFile, struct LinkedList* pExpression) {
 
 // pszName may be NULL
 
-void AddMember(struct INCFILE* pIncFile, char* pszType, char* pszName, struct LinkedList* pszDup, int bIsStruct) {
+void AddMember(struct INCFILE* pIncFile, char* pszType, char* pszName, struct smallvector* pszDup, int bIsStruct) {
     debug_printf("%u: AddMember %s %s\n", pIncFile->dwLine, pszType, pszName);
     if (pszName != NULL) {
         int bTranslated;
         pszName = TranslateName(pszName, NULL, &bTranslated);
         if (bTranslated && g_bWarningLevel > 1) {
-            fprintf(stderr, "%s, %u: reserved word '%s' used as struct/union member\n", pIncFile->pszFileName, pIncFile->dwLine, pszName);
+            diag_printf("%s, %u: reserved word '%s' used as struct/union member\n", pIncFile->pszFileName, pIncFile->dwLine, pszName);
             pIncFile->dwWarnings++;
         }
         xwrite(pIncFile, pszName);
@@ -1713,7 +2833,6 @@ void AddMember(struct INCFILE* pIncFile, char* pszType, char* pszName, struct Li
     if (pszDup != NULL) {
         xwrite(pIncFile, " ");
         WriteExpression(pIncFile, pszDup);
-        DestroyLinkedList(pszDup);
         xwrite(pIncFile, " dup (");
     } else {
         xwrite(pIncFile, "\t");
@@ -1737,6 +2856,57 @@ int IsIfLevelActive(struct INCFILE* pIncFile, struct INPSTAT *pStat) {
     return pIncFile->bIfLvl == pStat->bIfLvl && pIncFile->bIfStack[pIncFile->bIfLvl] != pStat->bIfStack[pStat->bIfLvl];
 }
 
+// the lookaheads below count brackets behind pszIn until the bracket
+// in front of it is closed. If that bracket is in the match index, its
+// partner is returned instead, so the lookahead can jump there.
+// returns NULL if the partner is unknown
+
+static int CmpBracketPair(const void* pKey, const void* pItem) {
+    uint32_t dwOpen = *(const uint32_t*)pKey;
+    uint32_t dwItem = ((const struct BRACKETPAIR*)pItem)->dwOpen;
+    return dwOpen < dwItem ? -1 : dwOpen > dwItem ? 1 : 0;
+}
+
+static struct BRACKETPAIR* GetBracketPair(struct INCFILE* pIncFile) {
+    char* pszOpen = pIncFile->pszIn - 2;
+    if (pIncFile->pBracketPairs == NULL || pIncFile->bUseLastToken) {
+        return NULL;
+    }
+    // a pending comment is written by the lookahead at the next line end
+    if (g_bIncludeComments && g_szComment[1] != '\0') {
+        return NULL;
+    }
+    if (pszOpen <= pIncFile->pBuffer2 || pszOpen[-1] != '\0' || pszOpen[1] != '\0') {
+        return NULL;
+    }
+    uint32_t dwOpen = pszOpen - pIncFile->pBuffer2;
+    struct BRACKETPAIR* pPair = bsearch(&dwOpen, pIncFile->pBracketPairs->data, pIncFile->pBracketPairs->size,
+                                        sizeof(struct BRACKETPAIR), CmpBracketPair);
+    if (pPair == NULL || pPair->dwClose == 0) {
+        return NULL;
+    }
+    // the partner must still be the closing token of this bracket,
+    // else the lookahead falls back to counting
+    char* pszClose = pIncFile->pBuffer2 + pPair->dwClose;
+    if (pszClose[-1] != '\0' || pszClose[1] != '\0' || pszClose[0] != (pszOpen[0] == '(' ? ')' : '}')) {
+        return NULL;
+    }
+    return pPair;
+}
+
+static char* GetBracketMatch(struct INCFILE* pIncFile) {
+    struct BRACKETPAIR* pPair = GetBracketPair(pIncFile);
+    return pPair != NULL ? pIncFile->pBuffer2 + pPair->dwClose : NULL;
+}
+
+// continue behind the closing bracket returned by GetBracketMatch()
+
+static char* SkipToBracketMatch(struct INCFILE* pIncFile, char* pszClose) {
+    pIncFile->pszIn = pszClose + 2;
+    pIncFile->bNewLine = 0;
+    return pszClose;
+}
+
 // find name of a struct/union, if any
 // use pszStructName if name is a macro
 // out: eax = struct name
@@ -1754,7 +2924,11 @@ char* GetStructName(struct INCFILE* pIncFile, char* pszStructName, uint32_t* dwF
     SaveInputStatus(pIncFile, &sis);
     pIncFile->bSkipPP++;
     dwCntBrace = 1;
-    char* token;
+    char* token = GetBracketMatch(pIncFile);
+    if (token != NULL) {
+        SkipToBracketMatch(pIncFile, token);
+        dwCntBrace = 0;
+    }
     while (dwCntBrace != 0) {
         token = GetNextToken(pIncFile);
         if (token == NULL) {
@@ -1816,6 +2990,10 @@ int HasVTable(struct INCFILE* pIncFile) {
     struct INPSTAT sis;
 
     debug_printf("%u: HasVTable enter\n", pIncFile->dwLine);
+    struct BRACKETPAIR* pPair = GetBracketPair(pIncFile);
+    if (pPair != NULL) {
+        return pPair->bVirtual;
+    }
     SaveInputStatus(pIncFile, &sis);
     pIncFile->bSkipPP++;
     dwCntBrace = 1;
@@ -1829,7 +3007,13 @@ int HasVTable(struct INCFILE* pIncFile) {
             continue;
         }
         if (strcmp(token, "{") == 0) {
-            dwCntBrace++;
+            // a nested block can't contain the "virtual" searched for
+            char* pszClose = GetBracketMatch(pIncFile);
+            if (pszClose != NULL) {
+                SkipToBracketMatch(pIncFile, pszClose);
+            } else {
+                dwCntBrace++;
+            }
         } else if (strcmp(token, "}") == 0) {
             dwCntBrace--;
         } else if (dwCntBrace == 1 && strcmp(token, "virtual") == 0) {
@@ -1853,7 +3037,11 @@ int IsFunctionPtr(struct INCFILE* pIncFile) {
     pIncFile->bSkipPP++;
     dwCntBrace = 1;
     bRC = 0;
-    char* token;
+    char* token = GetBracketMatch(pIncFile);
+    if (token != NULL) {
+        SkipToBracketMatch(pIncFile, token);
+        dwCntBrace = 0;
+    }
     while (dwCntBrace != 0) {
         token = GetNextToken(pIncFile);
         if (token == NULL) {
@@ -1882,21 +3070,55 @@ exit:
     return bRC;
 }
 
-// determine if current item is a "function" declaration
-// required if keyword "struct" has been found in input stream
-// may be a struct declaration or a function returning a struct (ptr)
-// workaround:
-// + if "*" is found before next ";" or ",", it is a function <= disabled this one, needs counter-example
-// + if "(" is found before next ";" or ",", it is a function
-// + if "{" is found before next ";" or ",", it is a structure
-
-int IsFunction(struct INCFILE* pIncFile) {
-    int bRC;
-    struct INPSTAT sis;
+// the span of the declaration index containing pszIn, if any
 
-    SaveInputStatus(pIncFile, &sis);
-    pIncFile->bSkipPP++;
-    bRC = 0;
+static struct DECLSPAN* GetDeclSpan(struct INCFILE* pIncFile) {
+    if (pIncFile->pDeclSpans == NULL || pIncFile->bUseLastToken) {
+        return NULL;
+    }
+    // a pending comment is written by the lookahead at the next line end
+    if (g_bIncludeComments && g_szComment[1] != '\0') {
+        return NULL;
+    }
+    uint32_t dwPos = pIncFile->pszIn - pIncFile->pBuffer2;
+    struct DECLSPAN* pSpans = pIncFile->pDeclSpans->data;
+    size_t lo = 0;
+    size_t hi = pIncFile->pDeclSpans->size;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (pSpans[mid].dwStart <= dwPos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0 || dwPos > pSpans[lo - 1].dwEnd) {
+        return NULL;
+    }
+    return &pSpans[lo - 1];
+}
+
+// determine the kind of the current declaration
+// required if keyword "struct" or "extern" has been found in input stream
+// may be a struct declaration or a function returning a struct (ptr)
+// workaround:
+// + if "*" is found before next ";" or ",", it is a function <= disabled this one, needs counter-example
+// + if "(" is found before next ";" or ",", it is a function
+//   (a function ptr if "*" follows the "(")
+// + if "{" is found before next ";" or ",", it is a structure
+// the tokenizer has found the first of these for most positions already
+
+static int GetDeclShape(struct INCFILE* pIncFile) {
+    int bShape;
+    struct INPSTAT sis;
+
+    struct DECLSPAN* pSpan = GetDeclSpan(pIncFile);
+    if (pSpan != NULL) {
+        return pSpan->bShape;
+    }
+    SaveInputStatus(pIncFile, &sis);
+    pIncFile->bSkipPP++;
+    bShape = DS_END;
     while (1) {
         char* token = GetNextToken(pIncFile);
         if (token == NULL) {
@@ -1905,22 +3127,30 @@ int IsFunction(struct INCFILE* pIncFile) {
         if (IsIfLevelActive(pIncFile, &sis)) {
             continue;
         }
-        if (*token == ';' || *token == ',' || *token == '{') {
+        if (*token == ';' || *token == ',') {
+            break;
+        }
+        if (*token == '{') {
+            bShape = DS_BLOCK;
             break;
         }
         if (/**token == '*' ||*/ *token == '(') {
             token = GetNextToken(pIncFile);
             if (token != NULL && *token == '*') {
-                bRC = 0;
+                bShape = DS_FUNCPTR;
             } else {
-                bRC = 1;
+                bShape = DS_FUNCTION;
             }
             break;
         }
     }
     pIncFile->bSkipPP--;
     RestoreInputStatus(pIncFile, &sis);
-    return bRC;
+    return bShape;
+}
+
+int IsFunction(struct INCFILE* pIncFile) {
+    return GetDeclShape(pIncFile) == DS_FUNCTION;
 }
 
 int IsRecordEnd(struct INCFILE* pIncFile) {
@@ -2026,15 +3256,19 @@ char* GetDeclaration(struct INCFILE* pIncFile, char* pszToken, char* pszParent,
     uint32_t dwNameFlags;
     char* pszType;
     char* pszName;
-    struct LinkedList* pszDup;
+    struct smallvector dup;
+    struct smallvector* pszDup;
     char* pszRecordType;
     char* pszBits;
     char* pszEndToken;
     char* dwEsp;
+    char* pszEnumName;
+    char* pszEnumExpr;
+    struct smallvector enumExpr;
     char szStructName[MAXSTRUCTNAME];
     char szRecord[64];
     char szType[256];
-    char szTmp[8];
+    char szTmp[32];
     char szName[128];
 
     if (pszParent == NULL) {
@@ -2043,6 +3277,10 @@ char* GetDeclaration(struct INCFILE* pIncFile, char* pszToken, char* pszParent,
     dwEsp = pIncFile->pszStructName;
     pIncFile->pszStructName = pszParent;
 
+    smallvector_init(&dup);
+    smallvector_init(&enumExpr);
+    pszEnumName = NULL;
+    pszEnumExpr = NULL;
     bBits = 0;
     pszType = NULL;
     dwRes = 0;
@@ -2097,7 +3335,7 @@ nextscan:
                 }
                 SkipName(pIncFile, pszName, dwNameFlags);
             } else {
-                fprintf(stderr, "%s, %u: union without block\n", pIncFile->pszFileName, pIncFile->dwLine);
+                diag_printf("%s, %u: union without block\n", pIncFile->pszFileName, pIncFile->dwLine);
                 pIncFile->dwErrors++;
                 xwrite(pIncFile, "\r\n");
             }
@@ -2186,7 +3424,7 @@ nextscan:
                         goto nextitem;
                     }
                 } else {
-                    fprintf(stderr, "%s, %u: unexpected item %s after 'struct'\n", pIncFile->pszFileName, pIncFile->dwLine, pszType);
+                    diag_printf("%s, %u: unexpected item %s after 'struct'\n", pIncFile->pszFileName, pIncFile->dwLine, pszType);
                     pIncFile->dwErrors++;
                 }
             }
@@ -2225,7 +3463,7 @@ nextscan:
 
         if (strcmp(pszToken, "operator") == 0) {
             // operator
-            fprintf(stderr, "%s, %u: C++ syntac ('operator') found\n", pIncFile->pszFileName, pIncFile->dwLine);
+            diag_printf("%s, %u: C++ syntac ('operator') found\n", pIncFile->pszFileName, pIncFile->dwLine);
             while (1) {
                 pszToken = GetNextToken(pIncFile);
                 if (pszToken == NULL || strcmp(pszToken, ";") == 0) {
@@ -2264,6 +3502,10 @@ nextscan:
         if (macroInfo != NULL) {
             int res;
             if (bMode == DT_ENUM) {
+                // the macro name isn't a constant, the value isn't folded
+                if (!smallvector_append(&enumExpr, pszToken)) {
+                    OutOfMemory(pIncFile);
+                }
                 res = MacroInvocation(pIncFile, pszToken, macroInfo, 0);
                 pszName = "";
             } else {
@@ -2300,7 +3542,8 @@ nextscan:
         }
 
         if (strcmp(pszToken, "[") == 0) {
-            pszDup = CreateLinkedList();
+            dup.size = 0;
+            pszDup = &dup;
             while (1) {
                 char* token = GetNextToken(pIncFile);
                 if (token == NULL || strcmp(token, ";") == 0) {
@@ -2309,7 +3552,9 @@ nextscan:
                 if (strcmp(token, "]") == 0) {
                     break;
                 }
-                AddLinkedList(pszDup, (uintptr_t)token);
+                if (!smallvector_append(pszDup, token)) {
+                    OutOfMemory(pIncFile);
+                }
             }
             goto nextitem;
         }   // '['
@@ -2381,11 +3626,16 @@ nextscan:
             pszToken = typedefQ;
         } else {
             if (pszType == NULL) {
+                pszEnumName = pszToken;
                 pszType = TranslateName(pszToken, NULL, NULL);
                 xwrite(pIncFile, pszType);
                 xwrite(pIncFile, " = ");
+                pszEnumExpr = pIncFile->pszOut;
             } else {
                 pszName = pszToken;
+                if (!smallvector_append(&enumExpr, pszToken)) {
+                    OutOfMemory(pIncFile);
+                }
                 xwrite(pIncFile, TranslateOperator(pszName));
                 if (*pszToken >= '0') {
                     pIncFile->dwEnumValue = atol(pszToken) + 1;
@@ -2429,16 +3679,43 @@ nextitem:
                 xwrite(pIncFile, "near");
             } else {
                 pszType = MakeType(pszType, bUnsigned, bLong, szType);
-                // fprintf(stderr, "GetDeclaration extern: type = %s\r\n", pszType);
+                // diag_printf("GetDeclaration extern: type = %s\r\n", pszType);
                 xwrite(pIncFile, TranslateType(pszType, g_bUntypedMembers));
             }
         }
         xwrite(pIncFile, "\r\n");
     } else if (bMode == DT_ENUM) {
         if (pszType != NULL && pszName == NULL) {
-            sprintf(szTmp, "%u", pIncFile->dwEnumValue);
+            if (g_bFoldConstants && pIncFile->bEnumKnown) {
+                struct IFVALUE value = { (int32_t)pIncFile->dwEnumValue, 0, 32 };
+                FormatConstant(&value, szTmp);
+                SetConstant(pIncFile, pszEnumName, &value);
+                // the member behind INT_MAX has no int value
+                pIncFile->bEnumKnown = value.value != INT32_MAX;
+            } else {
+                sprintf(szTmp, "%u", pIncFile->dwEnumValue);
+            }
             xwrite(pIncFile, szTmp);
             pIncFile->dwEnumValue++;
+        } else if (pszType != NULL && g_bFoldConstants) {
+            // a folded value corrects the counter of the members behind it,
+            // the members are ints (MSVC accepts unsigned values as well)
+            struct IFVALUE value;
+            pIncFile->bEnumKnown = 0;
+            if (EvaluateConstExpression(enumExpr.data, enumExpr.size, GetConstant, GetNumberSuffix, pIncFile, &value)
+                && IsDwordValue(&value)) {
+                if (IsFoldable(enumExpr.data, enumExpr.size)) {
+                    InsertConstant(pIncFile, pszEnumExpr, &value);
+                }
+                value.value = (int32_t)value.value;
+                value.bUnsigned = 0;
+                value.nBits = 32;
+                pIncFile->dwEnumValue = (uint32_t)value.value + 1;
+                pIncFile->bEnumKnown = value.value != INT32_MAX;
+                SetConstant(pIncFile, pszEnumName, &value);
+            } else {
+                SetConstant(pIncFile, pszEnumName, NULL);
+            }
         }
         xwrite(pIncFile,"\r\n");
     } else {
@@ -2524,10 +3801,14 @@ nextitem:
         }
     }
 done:
+    smallvector_free(&dup);
+    smallvector_free(&enumExpr);
     return pszToken;
 error:
+    smallvector_free(&dup);
+    smallvector_free(&enumExpr);
     pIncFile->pszStructName = dwEsp;
-    fprintf(stderr, "%s, %u: unexpected item %s.%s\n", pIncFile->pszFileName, pIncFile->dwLine, pszParent, pszToken);
+    diag_printf("%s, %u: unexpected item %s.%s\n", pIncFile->pszFileName, pIncFile->dwLine, pszParent, pszToken);
     pIncFile->dwErrors++;
     return pszToken;
 }
@@ -2650,27 +3931,24 @@ nextitem:
     return 0;
 }
 
-int HasVirtualBase(struct LinkedList* pszInherit) {
-    uint32_t nb = GetNumItemsLinkedList(pszInherit);
-
-    for (uint32_t i = 0; i < nb; i++) {
-        if (strcmp((char*)GetItemLinkedList(pszInherit, i), "virtual") == 0) {
+int HasVirtualBase(struct smallvector* pszInherit) {
+    for (size_t i = 0; i < pszInherit->size; i++) {
+        if (strcmp(smallvector_get(pszInherit, i), "virtual") == 0) {
             return 1;
         }
     }
     return 0;
 }
 
-void WriteInherit(struct INCFILE* pIncFile, struct LinkedList* pszInherit, int bPreClass) {
+void WriteInherit(struct INCFILE* pIncFile, struct smallvector* pszInherit, int bPreClass) {
     int bVirtual;
     int bVbtable;
     char* pszToken;
 
-    uint32_t nbItems = GetNumItemsLinkedList(pszInherit);
     bVirtual = 0;
     bVbtable = 0;
-    for (uint32_t i = 0; i < nbItems; i++) {
-        pszToken = (char*)GetItemLinkedList(pszInherit, i);
+    for (size_t i = 0; i < pszInherit->size; i++) {
+        pszToken = smallvector_get(pszInherit, i);
         if (strcmp(pszToken, "virtual") == 0) {
             if (bPreClass && !bVbtable) {
                 xwrite(pIncFile, "DWORD ?\t;vbtable\r\n");
@@ -2707,7 +3985,8 @@ int ParseTypedefUnionStruct(struct INCFILE* pIncFile, char* pszToken, int bIsCla
     char* pszName;
     char* pszType;
     char* pszTag;
-    struct LinkedList* pszInherit;
+    struct smallvector inherit;
+    struct smallvector* pszInherit;
     char* pszSuffix;
     char* pszAlignment;
     int bSkipName;
@@ -2741,7 +4020,7 @@ int ParseTypedefUnionStruct(struct INCFILE* pIncFile, char* pszToken, int bIsCla
     }
     if (*token == ':') {
         if (0) { // (!bIsClass)
-            fprintf(stderr, "%s, %u: C++ syntax found\n", pIncFile->pszFileName, pIncFile->dwLine);
+            diag_printf("%s, %u: C++ syntax found\n", pIncFile->pszFileName, pIncFile->dwLine);
         }
         while (1) {
             token = GetNextToken(pIncFile);
@@ -2757,9 +4036,12 @@ int ParseTypedefUnionStruct(struct INCFILE* pIncFile, char* pszToken, int bIsCla
             }
             pszToken = token;
             if (pszInherit == NULL) {
-                pszInherit = CreateLinkedList();
+                smallvector_init(&inherit);
+                pszInherit = &inherit;
+            }
+            if (!smallvector_append(pszInherit, pszToken)) {
+                OutOfMemory(pIncFile);
             }
-            AddLinkedList(pszInherit, (uintptr_t)pszToken);
         }
     }
     debug_printf("%u: ParseTypedefUnionStruct, token '%s' found\n", pIncFile->dwLine, token);
@@ -2786,6 +4068,7 @@ int ParseTypedefUnionStruct(struct INCFILE* pIncFile, char* pszToken, int bIsCla
         }
 
         pszType = TranslateName(structName, szType, NULL);
+        SetDeclName(pIncFile, pszType);
         InsertItem(pIncFile, g_pStructures, pszType);
         if (pszTag != NULL && strcmp(pszTag, pszType) != 0) {
             InsertStrStrItem(pIncFile, g_pStructureTags, pszTag, pszType);
@@ -2844,8 +4127,16 @@ int ParseTypedefUnionStruct(struct INCFILE* pIncFile, char* pszToken, int bIsCla
         GetFurtherTypes(pIncFile, pszType, pszTag, token);
     }
 done:
+    if (pszInherit != NULL) {
+        smallvector_free(pszInherit);
+    }
+    SetDeclName(pIncFile, pszTag);
     return 0;
 error:
+    SetDeclName(pIncFile, pszTag);
+    if (pszInherit != NULL) {
+        smallvector_free(pszInherit);
+    }
     pIncFile->bIsClass = 0;
     return dwRes;
 }
@@ -2878,9 +4169,11 @@ int ParseTypedefEnum(struct INCFILE* pIncFile, int bIsTypedef) {
         }
         if (name != NULL) {
             pszName = name;
+            SetDeclName(pIncFile, name);
             xprintf(pIncFile, "%s typedef DWORD\r\n", name);
         }
         pIncFile->dwEnumValue = 0;
+        pIncFile->bEnumKnown = 1;
         getblock(pIncFile, pszName, DT_ENUM, NULL);
         xwrite(pIncFile, "\r\n");
         if (bIsTypedef) {
@@ -3184,7 +4477,7 @@ int ParseTypedefFunction(struct INCFILE* pIncFile, char* pszName, int bAcceptBod
 
     bFirstParam = 0;
     if (pIncFile->bIsClass) {
-        pszDecoName = malloc((2 * strlen(pszParent) + 64) & ~3);
+        pszDecoName = AllocArena(pIncFile->pArena, 2 * strlen(pszParent) + strlen(pszName) + 64);
         dwNum = 0;
         char* name = pszName;
         if (*name == '~') {
@@ -3309,8 +4602,6 @@ int ParseTypedef(struct INCFILE* pIncFile) {
     bUnsigned = 0;
 nexttoken:
     pszToken = GetNextToken(pIncFile);
-    char *nextTokens[3];
-    int countNextTokens = PeekNextTokens(pIncFile, nextTokens, sizeof(nextTokens) / sizeof(*nextTokens));
     if (pszToken != NULL) {
         pszToken = TranslateToken(pszToken);
     }
@@ -3343,13 +4634,22 @@ nexttoken:
     if (macroInfo != NULL) {
         debug_printf("%u: ParseTypedef, macro invocation %s\n", pIncFile->dwLine, pszToken);
         if (MacroInvocation(pIncFile, pszToken, macroInfo, 1)) {
+            // "typedef <macro()>;": the macro expands to the whole declaration
+            char* token = PeekNextToken(pIncFile);
+            if (token != NULL && *token == ';') {
+                GetNextToken(pIncFile);
+                dwRC = 0;
+                goto exit;
+            }
             goto nexttoken;
         }
     }
 
     // syntax: "typedef union|struct"?
     int isClass;
-    if (IsUnionStructClass(pszToken, &isClass) && contains("{", nextTokens, countNextTokens)) {
+    char *nextTokens[3];
+    if (IsUnionStructClass(pszToken, &isClass)
+            && contains("{", nextTokens, PeekNextTokens(pIncFile, nextTokens, sizeof(nextTokens) / sizeof(*nextTokens)))) {
         debug_printf("%u: ParseTypedef, '%s' found\n", pIncFile->dwLine, pszToken);
         dwRC = ParseTypedefUnionStruct(pIncFile, pszToken, isClass);
         goto exit;
@@ -3401,12 +4701,13 @@ nexttoken:
                     int transHappened;
                     char *transName = TranslateName(pszName, szType, &transHappened);
                     if (transHappened && g_bWarningLevel > 0) {
-                        fprintf(stderr, "%s, %u: reserved word '%s' used as typedef\n", pIncFile->pszFileName, pIncFile->dwLine, pszName);
+                        diag_printf("%s, %u: reserved word '%s' used as typedef\n", pIncFile->pszFileName, pIncFile->dwLine, pszName);
                         pIncFile->dwWarnings++;
                     }
                     pszName = transName;
                 }
                 debug_printf("%u: new typedef %s =%s\n", pIncFile->dwLine, pszName, pszType);
+                SetDeclName(pIncFile, pszName);
                 // if there is an array index, create a struct instead of a typedef!
                 if (pszDup && bPtr == 0) {
                     xwrite(pIncFile, pszName);
@@ -3467,12 +4768,7 @@ nexttoken:
         } else {
             if (dwSquareBraces) {
                 if (pszDup != NULL) {
-                    char* txt = malloc(strlen(token) + strlen(pszDup) + 2);
-                    strcpy(txt, pszDup);
-                    free(pszDup);
-                    pszDup = txt;
-                    strcat(pszDup, " ");
-                    strcat(pszDup, token);
+                    pszDup = strings_join(pIncFile->pArena, pszDup, " ", token, NULL);
                 } else {
                     pszDup = token;
                 }
@@ -3497,7 +4793,11 @@ nexttoken:
 exit:
 error:
     if (dwRC != 0) {
-        fprintf(stderr, "%s, %u: unexpected item %s in typedef [%p]\n", pIncFile->pszFileName, pIncFile->dwLine, pszToken, token);
+        if (pszToken != NULL) {
+            diag_printf("%s, %u: unexpected item %s in typedef\n", pIncFile->pszFileName, pIncFile->dwLine, pszToken);
+        } else {
+            diag_printf("%s, %u: unexpected end of typedef\n", pIncFile->pszFileName, pIncFile->dwLine);
+        }
         pIncFile->dwErrors++;
     }
     debug_printf("%u: ParseTypedef end\n", pIncFile->dwLine);
@@ -3550,7 +4850,7 @@ char* TranslateName2(struct INCFILE* pIncFile, char* pszFuncName) {
     int transHappened;
     char* transName = TranslateName(pszFuncName, NULL, &transHappened);
     if (transHappened && g_bWarningLevel > 0) {
-        fprintf(stderr, "%s, %u: reserved word '%s' used as prototype\n", pIncFile->pszFileName, pIncFile->dwLine, pszFuncName);
+        diag_printf("%s, %u: reserved word '%s' used as prototype\n", pIncFile->pszFileName, pIncFile->dwLine, pszFuncName);
     }
     pIncFile->dwWarnings++;
     return transName;
@@ -3581,10 +4881,15 @@ void ParsePrototype(struct INCFILE* pIncFile, char* pszFuncName, char* pszImpSpe
         }
     }
     char* pszCallConv = GetCallConvention(pIncFile->dwQualifiers);
+    int bGuarded = 0;
+    if (g_bGuardSymbols && g_bPrototypes) {
+        int bTrans;
+        bGuarded = BeginSymbolGuard(pIncFile, TranslateName(pszFuncName, NULL, &bTrans));
+    }
     if (g_bUseDefProto && pszImpSpec != NULL) {
         char* suffix;
         if (IsReservedWord(pszFuncName)) {
-            fprintf(stderr, "%s, %u: reserved word '%s' used as prototype\n", pIncFile->pszFileName, pIncFile->dwLine, pszFuncName);
+            diag_printf("%s, %u: reserved word '%s' used as prototype\n", pIncFile->pszFileName, pIncFile->dwLine, pszFuncName);
             pIncFile->dwWarnings++;
             suffix = "_";
         } else {
@@ -3726,6 +5031,7 @@ void ParsePrototype(struct INCFILE* pIncFile, char* pszFuncName, char* pszImpSpe
         xprintf(pIncFile, "externdef strcall _imp_%s%s%s: ptr proto_%s\r\n", pszPrefix, pszFuncName, szSuffix, pszFuncName);
         xprintf(pIncFile, "%s equ <_imp_%s%s%s>\r\n", TranslateName2(pIncFile, pszFuncName), pszPrefix, pszFuncName, szSuffix);
     }
+    EndSymbolGuard(pIncFile, bGuarded);
 #if PROTOSUMMARY
     if (g_bProtoSummary) {
         InsertItem(pIncFile, g_pPrototypes, pszFuncName);
@@ -3756,11 +5062,15 @@ void ParsePrototype(struct INCFILE* pIncFile, char* pszFuncName, char* pszImpSpe
     }
 }
 
-static int FindInArray(const char *needle, const char **array) {
-    for (int i = 0; array[i] != NULL; i++) {
-        if (strcmp(needle, array[i]) == 0) {
-            return i;
+// index of a macro parameter, -1 if pszToken isn't one
+
+static int FindMacroParam(const struct ITEM_MACROINFO* pMacroInfo, const char* pszToken) {
+    const char* pszParam = pMacroInfo->pszTokens;
+    for (uint32_t i = 0; i < pMacroInfo->numParams; i++) {
+        if (strcmp(pszToken, pszParam) == 0) {
+            return (int)i;
         }
+        pszParam += strlen(pszParam) + 1;
     }
     return -1;
 }
@@ -3780,9 +5090,15 @@ int MacroInvocation(struct INCFILE* pIncFile, char* pszToken, struct ITEM_MACROI
     char* pszOutSave;
     int dwRC;
 
+    BEGIN_TIMESPAN(TP_MACRO, pIncFile->pszFileName);
     if (pMacroInfo->flags & 1) {
+        // flags is an odd number of parameters here, not [Known Macros]
+        // flags (these never have bit 0 set). The address of the item was
+        // used as flags, which made the output depend on the heap layout.
+        // These macros get MF_PARAMS, so reserved words in the arguments
+        // are renamed, as in "int f OF((int size));".
         dwParms = 0;
-        dwFlags = (uintptr_t)pMacroInfo;
+        dwFlags = MF_PARAMS;
     } else {
         dwParms = pMacroInfo->flags; // number of parameters
         dwFlags = 0;
@@ -3790,9 +5106,8 @@ int MacroInvocation(struct INCFILE* pIncFile, char* pszToken, struct ITEM_MACROI
     pszOutSave = pIncFile->pszOut;
 
     if (pMacroInfo->containsAppend) {
-        int nbParams = 0;
-        struct MACRO_TOKEN *param_tokens = NULL;
-        struct MACRO_TOKEN *last_param_token = NULL;
+        struct vector* pArgs = pIncFile->pMacroTokens;
+        pArgs->size = 0;
         char *token = PeekNextToken(pIncFile);
         if (token != NULL && *token == '(') {
             token = GetNextToken(pIncFile);
@@ -3810,47 +5125,26 @@ int MacroInvocation(struct INCFILE* pIncFile, char* pszToken, struct ITEM_MACROI
                 if (dwCnt == 0) {
                     break;
                 }
-//                if (dwFlags & MF_PARAMS) {
-//                    token = TranslateName(token, NULL, NULL);
-//                }
                 debug_printf("%u: macro parameter: %s\n", pIncFile->dwLine, token);
-//                if (IsAlpha(*token)) {
-//                    xwrite(pIncFile, " ");
-//                }
-                if (*token != ',') {
-                    nbParams++;
-                    struct MACRO_TOKEN *param_token = malloc(sizeof(struct MACRO_TOKEN));
-                    param_token->name = strdup(token);
-                    param_token->next = NULL;
-                    if (last_param_token != NULL) {
-                        last_param_token->next = param_token;
-                    } else {
-                        param_tokens = param_token;
-                    }
-                    last_param_token = param_token;
+                if (*token != ',' && !vector_charp_append(pArgs, token)) {
+                    OutOfMemory(pIncFile);
                 }
             }
         }
 
-        char **params = malloc(sizeof(char*) * (nbParams + 1));
-        params[nbParams] = NULL;
-        for (int i = 0; param_tokens != NULL; i++) {
-            params[i] = param_tokens->name;
-            struct MACRO_TOKEN *p = param_tokens->next;
-            free(param_tokens);
-            param_tokens = p;
-        }
-
         char buffer[256];
         buffer[0] = '\0';
         int nextAppend = 0;
-        for (size_t content_i = 0; pMacroInfo->contents[content_i] != NULL; content_i++) {
-            const char *currentContentToken = pMacroInfo->contents[content_i];
+        const char *currentContentToken = pMacroInfo->pszTokens;
+        for (uint32_t i = 0; i < pMacroInfo->numParams; i++) {
+            currentContentToken += strlen(currentContentToken) + 1;
+        }
+        for (uint32_t content_i = 0; content_i < pMacroInfo->numContents; content_i++, currentContentToken += strlen(currentContentToken) + 1) {
             if (strcmp(currentContentToken, "##") == 0) {
                 nextAppend = 1;
                 continue;
             }
-            int param_i = FindInArray(currentContentToken, pMacroInfo->params);
+            int param_i = FindMacroParam(pMacroInfo, currentContentToken);
             if (!nextAppend) {
                 xwrite(pIncFile, TranslateOperator(buffer));
                 if (buffer[0] != '\0') {
@@ -3860,18 +5154,14 @@ int MacroInvocation(struct INCFILE* pIncFile, char* pszToken, struct ITEM_MACROI
             }
             if (param_i < 0) {
                 strcat(buffer, currentContentToken);
-            } else {
-                strcat(buffer, params[param_i]);
+            } else if ((size_t)param_i < pArgs->size) {
+                strcat(buffer, vector_charp_get(pArgs, param_i));
             }
             nextAppend = 0;
         }
         if (buffer[0]) {
             xwrite(pIncFile, TranslateOperator(buffer));
         }
-        for (int i = 0; params[i]; i++) {
-            free(params[i]);
-        }
-        free(params);
     } else {
         debug_printf("%u: macro invocation found: %s\n", pIncFile->dwLine, pszToken);
         if (dwFlags & MF_INTERFACEEND) {
@@ -4013,6 +5303,7 @@ done:
     }
     dwRC = 1;
 exit:
+    END_TIMESPAN();
     return dwRC;
 
 }
@@ -4027,12 +5318,18 @@ int ParseC(struct INCFILE* pIncFile) {
     int bIsClass;
     char* pszToken;
     int dwRC;
+    const char* pszDeclKind = NULL;     // --hot-decls: the token started a declaration
+    const char* pszDeclName = NULL;
 
     pszToken = GetNextToken(pIncFile);
     if (pszToken == NULL) {
         debug_printf("%u: ParceC, eof reached\n", pIncFile->dwLine);
         return 0;
     }
+    if (g_dwHotDecls) {
+        pIncFile->szDeclName[0] = '\0';
+        BeginHotDecl(pIncFile, pIncFile->dwLine, GetTokensRead(pIncFile));
+    }
     if (WriteComment(pIncFile)) {
         xwrite(pIncFile, "\r\n");
     }
@@ -4049,10 +5346,16 @@ int ParseC(struct INCFILE* pIncFile) {
     if (strcmp(pszToken, "typedef") == 0) {
         char* pszOut = pIncFile->pszOut;
         debug_printf("%u: ParseC, 'typedef' found\n", pIncFile->dwLine);
+        pszDeclKind = "typedef";
+        BEGIN_TIMESPAN(TP_TYPEDEF, pIncFile->pszFileName);
+        TRACE_BEGIN(TC_DECLARATIONS, "typedef", pIncFile->pszFileName, pIncFile->dwLine);
         dwRC = ParseTypedef(pIncFile);
+        TRACE_END(TC_DECLARATIONS);
+        END_TIMESPAN();
         if (!g_bTypedefs) {
             pIncFile->pszOut = pszOut;
             *pIncFile->pszOut = '\0';
+            DiscardSymbolGuards(pIncFile, pszOut);
         }
         goto exit;
     }
@@ -4065,10 +5368,16 @@ int ParseC(struct INCFILE* pIncFile) {
         debug_printf("%u: ParseTypedef, '%s' found\n", pIncFile->dwLine, pszToken);
         if (!IsFunction(pIncFile)) {
             char* pszOut = pIncFile->pszOut;
+            pszDeclKind = isClass ? "class" : *pszToken == 'u' ? "union" : "struct";
+            BEGIN_TIMESPAN(TP_TYPEDEF, pIncFile->pszFileName);
+            TRACE_BEGIN(TC_DECLARATIONS, pszToken, pIncFile->pszFileName, pIncFile->dwLine);
             dwRC = ParseTypedefUnionStruct(pIncFile, pszToken, isClass);
+            TRACE_END(TC_DECLARATIONS);
+            END_TIMESPAN();
             if (!g_bTypedefs) {
                 pIncFile->pszOut = pszOut;
                 *pIncFile->pszOut = '\0';
+                DiscardSymbolGuards(pIncFile, pszOut);
             }
             goto exit;
         }
@@ -4078,17 +5387,24 @@ int ParseC(struct INCFILE* pIncFile) {
         if (!IsFunction(pIncFile)) {
             char* pszOut = pIncFile->pszOut;
             debug_printf("%u: ParceC, 'extern' found\n", pIncFile->dwLine);
+            pszDeclKind = "extern";
+            TRACE_BEGIN(TC_DECLARATIONS, "extern", pIncFile->pszFileName, pIncFile->dwLine);
             ParseExtern(pIncFile);
+            TRACE_END(TC_DECLARATIONS);
             if (!g_bExternals) {
                 pIncFile->pszOut = pszOut;
                 *pIncFile->pszOut = '\0';
+                DiscardSymbolGuards(pIncFile, pszOut);
             }
         }
         goto exit;
     }
     if (strcmp(pszToken, "enum") == 0) {
         debug_printf("%u: ParceC, 'enum' found\n", pIncFile->dwLine);
+        pszDeclKind = "enum";
+        TRACE_BEGIN(TC_DECLARATIONS, "enum", pIncFile->pszFileName, pIncFile->dwLine);
         dwRC = ParseTypedefEnum(pIncFile, 0);
+        TRACE_END(TC_DECLARATIONS);
         goto exit;
     }
 
@@ -4110,7 +5426,12 @@ int ParseC(struct INCFILE* pIncFile) {
     if (pIncFile->dwQualifiers == 0) {
         struct ITEM_MACROINFO* macroInfo = IsMacro(pIncFile, pszToken);
         if (macroInfo != 0) {
-            if (MacroInvocation(pIncFile, pszToken, macroInfo, 1)) {
+            TRACE_BEGIN(TC_DECLARATIONS, pszToken, pIncFile->pszFileName, pIncFile->dwLine);
+            int bInvoked = MacroInvocation(pIncFile, pszToken, macroInfo, 1);
+            TRACE_END(TC_DECLARATIONS);
+            if (bInvoked) {
+                pszDeclKind = "macro";
+                pszDeclName = pszToken;
                 goto exit;
             }
         }
@@ -4119,11 +5440,18 @@ int ParseC(struct INCFILE* pIncFile) {
     if (*pszToken == '(') {
         if (pIncFile->pszLastToken != NULL) {
             debug_printf("%u: ParceC, prototype found\n", pIncFile->dwLine);
+            pszDeclKind = "prototype";
+            pszDeclName = pIncFile->pszLastToken;
             char* pszOut = pIncFile->pszOut;
+            BEGIN_TIMESPAN(TP_PROTOTYPE, pIncFile->pszFileName);
+            TRACE_BEGIN(TC_DECLARATIONS, pIncFile->pszLastToken, pIncFile->pszFileName, pIncFile->dwLine);
             ParsePrototype(pIncFile, pIncFile->pszLastToken, pIncFile->pszImpSpec, pIncFile->pszCallConv);
+            TRACE_END(TC_DECLARATIONS);
+            END_TIMESPAN();
             if (!g_bPrototypes) {
                 pIncFile->pszOut = pszOut;
                 *pIncFile->pszOut = '\0';
+                DiscardSymbolGuards(pIncFile, pszOut);
             }
             goto exit;
         }
@@ -4158,15 +5486,46 @@ exit:
         g_szComment[0] = '\0';
         xwrite(pIncFile, "\r\n");
     }
+    CommitSymbolGuards(pIncFile);
+    if (g_dwHotDecls) {
+        EndHotDecl(pszDeclKind, pszDeclName != NULL ? pszDeclName : pIncFile->szDeclName, pIncFile->pszFileName, GetTokensRead(pIncFile));
+    }
     return 1;
 }
 
 // ---------------------------------------------------
 
+// --include-guard: the name of the header without directory and extension
+// in upper case, followed by "_INC". Characters not allowed in a MASM name
+// become '_'.
+
+static void GetIncludeGuardName(const char* pszFileName, char* pszGuard, size_t dwSize) {
+    const char* pszName = pszFileName;
+    for (const char* p = pszFileName; *p != '\0'; p++) {
+        if (*p == '/' || *p == '\\' || *p == ':') {
+            pszName = p + 1;
+        }
+    }
+    const char* pszExt = strrchr(pszName, '.');
+    size_t len = pszExt != NULL ? (size_t)(pszExt - pszName) : strlen(pszName);
+    size_t i = 0;
+    if (len == 0 || (*pszName >= '0' && *pszName <= '9')) {
+        pszGuard[i++] = '_';
+    }
+    for (size_t j = 0; j < len && i + sizeof("_INC") < dwSize; j++) {
+        char c = (char)toupper((unsigned char)pszName[j]);
+        pszGuard[i++] = (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ? c : '_';
+    }
+    strcpy(pszGuard + i, "_INC");
+}
+
 void AnalyzerIncFile(struct INCFILE* pIncFile) {
     struct stat statbuf;
+    char szGuard[MAX_PATH];
 
     debug_printf("Analyzer@IncFile begin %s\n", pIncFile->pszFileName);
+    BEGIN_TIMESPAN(TP_ANALYZER, pIncFile->pszFileName);
+    TRACE_BEGIN(TC_DECLARATIONS, "analyze", pIncFile->pszFileName, 0);
 #ifdef _DEBUG
     FILE* f = fopen("~parser.tmp", "w");
     if (f != NULL) {
@@ -4176,13 +5535,20 @@ void AnalyzerIncFile(struct INCFILE* pIncFile) {
 #endif
     pIncFile->pszInStart = pIncFile->pszIn = pIncFile->pBuffer2;
     pIncFile->pszOutStart = pIncFile->pszOut = pIncFile->pBuffer1;
+    pIncFile->pszOutEnd = pIncFile->pBuffer1 + pIncFile->dwOutBufSize;
     pIncFile->pszOut[0] = '\0';
+    pIncFile->pszShakeOut = pIncFile->pszOut;
     pIncFile->bComment = 0;
     pIncFile->bDefinedMac = 0;
     pIncFile->bAlignMac = 0;
     pIncFile->bSkipPP = 0;
+    pIncFile->bFoldLvl = 0;
+    pIncFile->dwFoldOverflow = 0;
     pIncFile->dwLine = 1;
     pIncFile->bNewLine = 1;
+    pIncFile->dwTokensConsumed = 0;
+    pIncFile->dwTokensScanned = 0;
+    pIncFile->dwTokensPP = 0;
 
     if (g_pStructures == NULL) {
         g_pStructures = CreateList(MAXITEMS, sizeof(void*));
@@ -4212,6 +5578,14 @@ void AnalyzerIncFile(struct INCFILE* pIncFile) {
         AddItemArrayList(g_pQualifiers, (struct NAMEITEM*) g_ProtoQualifiers.pItems, g_ProtoQualifiers.numItems);
     }
 #endif
+    if (g_bFoldIf) {
+        if (g_pDefines == NULL) {
+            g_pDefines = CreateList(MAXITEMS, sizeof(struct LISTITEM));
+        }
+        if (pIncFile->pParent == NULL) {
+            DefineCmdlineMacros(pIncFile);
+        }
+    }
     if (g_bCreateDefs) {
         pIncFile->pDefs = CreateList(MAXITEMS, sizeof(char*));
     }
@@ -4228,15 +5602,24 @@ void AnalyzerIncFile(struct INCFILE* pIncFile) {
     }
     xwrite(pIncFile, "\r\n\r\n");
 #endif
+    if (g_bIncludeGuard) {
+        GetIncludeGuardName(pIncFile->pszFileName, szGuard, sizeof(szGuard));
+        xprintf(pIncFile, "ifndef %s\r\n%s equ 1\r\n", szGuard, szGuard);
+    }
 
     int dwRC;
     do {
         dwRC = ParseC(pIncFile);
     } while (dwRC != 0);
+    CommitSymbolGuards(pIncFile);
+
+    if (g_bIncludeGuard) {
+        xprintf(pIncFile, "endif ; %s\r\n", szGuard);
+    }
 
 #ifdef INCLUDE_GENERATOR_INFO
     if (pIncFile->bIfLvl != 0) {
-        fprintf(stderr, "%s, %u: unmatching if/endif\n", pIncFile->pszFileName, pIncFile->dwLine);
+        diag_printf("%s, %u: unmatching if/endif\n", pIncFile->pszFileName, pIncFile->dwLine);
         pIncFile->dwErrors++;
     }
     xwrite(pIncFile, "\r\n");
@@ -4247,6 +5630,21 @@ void AnalyzerIncFile(struct INCFILE* pIncFile) {
     xprintf(pIncFile, ";--- end of file ---\r\n");
 #endif
 
+    RegisterIncludeGuard(pIncFile);
+    if (SHAKE_ENABLED) {
+        CollectShakeText(pIncFile);
+    }
+
+    g_Stats.dwTokensConsumed += pIncFile->dwTokensConsumed;
+    g_Stats.dwTokensScanned += pIncFile->dwTokensScanned;
+    if (g_bVerbose) {
+        diag_printf("%s: %u tokens read, %u read again by lookaheads (%.2f per token)\n", pIncFile->pszFileName,
+                pIncFile->dwTokensConsumed, pIncFile->dwTokensScanned,
+                pIncFile->dwTokensConsumed ? (double)pIncFile->dwTokensScanned / pIncFile->dwTokensConsumed : 0.0);
+    }
+
+    TRACE_END(TC_DECLARATIONS);
+    END_TIMESPAN();
     debug_printf("Analyzer@IncFile end %s\n", pIncFile->pszFileName);
 }
 
@@ -4282,6 +5680,31 @@ void DestroyAnalyzerData(void) {
         g_pQualifiers = NULL;
     }
 #endif
+    if (g_pDefines != NULL) {
+        DestroyList(g_pDefines);
+        g_pDefines = NULL;
+    }
+    if (g_pConstants != NULL) {
+        DestroyList(g_pConstants);
+        g_pConstants = NULL;
+    }
+    ResetShake();
+    if (g_pDefineLog != NULL) {
+        vector_free(g_pDefineLog, NULL);
+        g_pDefineLog = NULL;
+    }
+    if (g_pIncludeGuards != NULL) {
+        DestroyList(g_pIncludeGuards);
+        g_pIncludeGuards = NULL;
+    }
+    if (g_pSymbolGuards != NULL) {
+        DestroyList(g_pSymbolGuards);
+        g_pSymbolGuards = NULL;
+    }
+    if (g_pIncludePaths != NULL) {
+        DestroyList(g_pIncludePaths);
+        g_pIncludePaths = NULL;
+    }
 }
 
 // parser subroutines
@@ -4304,6 +5727,22 @@ void skipcomments(struct INCFILE* pIncFile, char* pszLine) {
     szChar[1] = '\0';
 
     while (1) {
+        // jump over text which cannot change the comment state
+        size_t len = 0;
+        if (pIncFile->bComment && szChar[1] != '*') {
+            len = LexScanCommentEnd(is);
+            if (g_bIncludeComments) {
+                memcpy(os, is, len);
+                os += len;
+            }
+            memset(is, ' ', len);
+        } else if (!pIncFile->bComment && szChar[1] != '/') {
+            len = LexScanSlash(is);
+        }
+        if (len != 0) {
+            szChar[1] = is[len - 1];
+            is += len;
+        }
         SKIPCOMMENT_READCHAR(*is);
         is++;
 
@@ -4458,14 +5897,33 @@ skip1:
 #define STRINGLIT_PREVITEM_DQUOTED  0x01
 #define STRINGLIT_NOPREVCHAR        0x02
 
-void addescstr(char** pOs, char* value, uint8_t flags) {
-    char* os = *pOs;
+// start an item that is not quoted: close the quoted run
+// and separate the item from the previous one
+
+static char* StartStringItem(char* os, uint8_t flags) {
     if (flags == 0) {
         *os++ = '"';
     }
     if ((flags & STRINGLIT_NOPREVCHAR) == 0) {
         *os++ = ',';
     }
+    return os;
+}
+
+// open a quoted run unless one is open already
+
+static char* StartQuotedRun(char* os, uint8_t flags) {
+    if (flags != 0) {
+        if (flags & STRINGLIT_PREVITEM_DQUOTED) {
+            *os++ = ',';
+        }
+        *os++ = '"';
+    }
+    return os;
+}
+
+void addescstr(char** pOs, char* value, uint8_t flags) {
+    char* os = StartStringItem(*pOs, flags);
     *os++ = value[0];
     *os++ = value[1];
     *os++ = 'h';
@@ -4476,22 +5934,17 @@ void GetCharLiteral(char** pOs, char** pIs) {
     char* os = *pOs;
     char* is = *pIs;
 
-    uint8_t flags = STRINGLIT_NOPREVCHAR;
     int value;
     char c;
     c = *is++;
     if (c == '\\') {
         c = *is++;
         if (c >= '0' && c <= '7') {
-            value = c;
-            uint8_t nb = 0x3;
-            while (nb != 0) {
-                c = *is++;
-                if (c >= '0' && c <= '7') {
-                    value = value * 8 + c;
-                } else {
-                    break;
-                }
+            value = c - '0';
+            uint8_t nb = 2;
+            while (nb != 0 && *is >= '0' && *is <= '7') {
+                value = value * 8 + *is++ - '0';
+                nb--;
             }
         } else if (c == 'a') {
             value = '\a';
@@ -4508,6 +5961,7 @@ void GetCharLiteral(char** pOs, char** pIs) {
         } else if (c == 'v') {
             value = '\v';
         } else if (c == 'x') {
+            value = 0;
             uint8_t nb = 3;
             while (nb != 0) {
                 c = *is;
@@ -4515,7 +5969,7 @@ void GetCharLiteral(char** pOs, char** pIs) {
                 if (c >= '0' && c <= '9') {
                     value = value * 16 + c - '0';
                 } else if (c >= 'a' && c <= 'f') {
-                    value = value * 16 + c - 'a';
+                    value = value * 16 + c - 'a' + 10;
                 } else {
                     break;
                 }
@@ -4528,12 +5982,15 @@ void GetCharLiteral(char** pOs, char** pIs) {
     } else {
         value = c;
     }
-    char buffer[8];
+    char buffer[12];
     sprintf(buffer, "%d", value);
 
-    c = *is++;
-    while (c != '\'') {
-        c = *is++;
+    // skip the closing quote, don't run past the end of the line
+    while (*is != '\'' && *is != '\0') {
+        is++;
+    }
+    if (*is == '\'') {
+        is++;
     }
 
     *pIs = is;
@@ -4544,108 +6001,101 @@ void GetCharLiteral(char** pOs, char** pIs) {
 
 //if (c == '}') {
 //addescstr(&os, szRBRACKET, flags);
+
+// convert a string literal, pIs points behind the opening '"'.
+// Plain chars are copied in runs, up to the next '"', '\' or
+// end of line, only escapes are converted char by char.
+
 void GetStringLiteral(char** pOs, char** pIs) {
     char* os = *pOs;
     char* is = *pIs;
 
     uint8_t flags = STRINGLIT_NOPREVCHAR;
-    char c;
-    do {
+    while (1) {
+        size_t len = LexScanString(is);
+        if (len != 0) {
+            os = StartQuotedRun(os, flags);
+            memcpy(os, is, len);
+            os += len;
+            is += len;
+            flags = 0;
+        }
+        char c = *is++;
+        if (c == '"') {
+            break;
+        }
+        if (c == '\0') {
+            is--;
+            break;
+        }
         c = *is++;
-        if (c == '\\') {
-            c = *is++;
-            if (c >= '0' && c <= '7') {
-                if (flags == 0x0) {
-                    *os++ = '"';
-                }
-                *os++ = ',';
-                is--;
-                uint8_t nb = 0x3;
-                while (nb != 0) {
-                    c = *is++;
-                    if (c >= '0' && c <= '7') {
-                        *os++ = c;
-                    } else {
-                        break;
-                    }
-                    is++;
-                    nb--;
-                }
-                if (nb != 3) {
-                    *os++ = 'o';
-                }
-            } else if (c == 'a') {
-                addescstr(&os, szBell, flags);
-            } else if (c == 'b') {
-                addescstr(&os, szBackSp, flags);
-            } else if (c == 'f') {
-                addescstr(&os, szFF, flags);
-            } else if (c == 'n') {
-                addescstr(&os, szLF, flags);
-            } else if (c == 'r') {
-                addescstr(&os, szCR, flags);
-            } else if (c == 't') {
-                addescstr(&os, szHTab, flags);
-            } else if (c == 'v') {
-                addescstr(&os, szVTab, flags);
-            } else if (c == 'x') {
-                if (flags == 0) {
-                    *os++ = '"';
-                }
-                *os++ = ',';
-                uint8_t nb = 3;
-                while (nb != 0) {
-                    c = *is;
-                    c |= 0x20;
-                    if (c >= '0' && c <= '9') {
-                        *os++ = c;
-                    } else if (c >= 'a' && c <= 'f') {
-                        if (nb == 3) {
-                            *os++ = '0';
-                        }
-                        *os++ = c;
-                    } else {
-                        break;
-                    }
-                    is++;
-                    nb--;
-                }
-                if (nb != 3) {
-                    *os++ = 'h';
-                }
-            } else if (c == '"') {
-                if (flags != 0) {
-                    *os++ = ',';
-                    *os++ = '"';
-                }
-                *os++ = c;
+        if (c >= '0' && c <= '7') {
+            os = StartStringItem(os, flags);
+            uint8_t nb = 3;
+            while (nb != 0 && c >= '0' && c <= '7') {
                 *os++ = c;
-                flags = 0;
-                continue;
-            } else {
-                goto normalchar;
+                c = *is++;
+                nb--;
             }
-            flags = STRINGLIT_PREVITEM_DQUOTED;
-            continue;
-        }
-normalchar:
-        if (flags != 0) {
-            if (c == '"') {
-                break;
-            } else {
-                if (flags & STRINGLIT_PREVITEM_DQUOTED) {
-                    *os++ = ',';
+            is--;
+            *os++ = 'o';
+        } else if (c == 'a') {
+            addescstr(&os, szBell, flags);
+        } else if (c == 'b') {
+            addescstr(&os, szBackSp, flags);
+        } else if (c == 'f') {
+            addescstr(&os, szFF, flags);
+        } else if (c == 'n') {
+            addescstr(&os, szLF, flags);
+        } else if (c == 'r') {
+            addescstr(&os, szCR, flags);
+        } else if (c == 't') {
+            addescstr(&os, szHTab, flags);
+        } else if (c == 'v') {
+            addescstr(&os, szVTab, flags);
+        } else if (c == 'x') {
+            os = StartStringItem(os, flags);
+            uint8_t nb = 3;
+            while (nb != 0) {
+                c = *is;
+                c |= 0x20;
+                if (c >= '0' && c <= '9') {
+                    *os++ = c;
+                } else if (c >= 'a' && c <= 'f') {
+                    if (nb == 3) {
+                        *os++ = '0';
+                    }
+                    *os++ = c;
+                } else {
+                    break;
                 }
-                *os++ = '"';
+                is++;
+                nb--;
             }
-        }
-        if (c == '\0') {
+            if (nb == 3) {
+                *os++ = '0';
+            }
+            *os++ = 'h';
+        } else if (c == '"') {
+            os = StartQuotedRun(os, flags);
+            *os++ = '"';
+            *os++ = '"';
+            flags = 0;
+            continue;
+        } else if (c == '\0') {
             is--;
-            c = '"';
+            break;
+        } else {
+            os = StartQuotedRun(os, flags);
+            *os++ = c;
+            flags = 0;
+            continue;
         }
-        *os++ = c;
-        flags = 0;
-    } while (c != '"');
+        flags = STRINGLIT_PREVITEM_DQUOTED;
+    }
+    if (flags == 0) {
+        *os++ = '"';
+    }
     // dont add terminating 0!
     // this won't work for strings as macro
     // parameters: DECLSPEC_GUID("xxxxxxxx-xxxx...")
@@ -4670,27 +6120,41 @@ void GetWStringLiteral(char** pOs, char** pIs) {
     *pOs = os;
 }
 
+// the suffixes of a C integer number, ConvertNumber removes them
+
+static uint8_t GetSuffixFlags(const char* pszNumber, const char* pszEnd) {
+    uint8_t flags = 0;
+    while (pszEnd - pszNumber > 1 && strchr("uUlL", pszEnd[-1]) != NULL) {
+        if ((pszEnd[-1] | 0x20) == 'u') {
+            flags |= TF_UNSIGNED;
+        } else if ((pszEnd[-2] | 0x20) == 'l') {
+            flags |= TF_LONGLONG;
+            pszEnd--;
+        }
+        pszEnd--;
+    }
+    return flags;
+}
+
 // parse a source line
 
-void parseline(struct INCFILE* pIncFile, char* pszLine, int bWeak) {
-    int bIsPreProc;
+// tokenize a line, comments have been removed already
+
+static void TokenizeLine(struct INCFILE* pIncFile, char* pszLine, int bWeak, int bIsPreProc) {
     int bIsDefine;
 
-    bIsPreProc = 0;
     bIsDefine = 0;
     char* is = pszLine;
-    if (*is == '#') {
-        bIsPreProc = 1;
-    }
-    skipcomments(pIncFile, is);
     char* os = pIncFile->pszOut;
     uint32_t tokenCounter = 0;  // token counter
     while (1) {
+        is += LexSkipBlanks(is);
         char c = *is;
         if (c == '\0') {
             break;
         }
         char* start_token = os; // holds start of token
+        uint8_t bSuffix = 0;
         if (c == '/' && is[1] == '/') {
             if (g_bIncludeComments) {
                 *os++ = PP_COMMENT;
@@ -4722,8 +6186,9 @@ void parseline(struct INCFILE* pIncFile, char* pszLine, int bWeak) {
             }
 #if 1
             if (os == start_token && c >= '0' && c <= '9') {
-                is--;
+                char* pszNumber = --is;
                 ConvertNumber(&os, &is);
+                bSuffix = GetSuffixFlags(pszNumber, is);
                 break;
             }
 #endif
@@ -4743,9 +6208,18 @@ void parseline(struct INCFILE* pIncFile, char* pszLine, int bWeak) {
                 break;
             }
             *os++ = c;
+            // copy the rest of a name at once
+            size_t len = LexScanName(is);
+            memcpy(os, is, len);
+            os += len;
+            is += len;
         }
         if (start_token != os) {
             *os++ = '\0';
+            uint8_t* pFlags = FindTokenFlags(pIncFile, start_token);
+            if (pFlags != NULL) {
+                *pFlags = ClassifyToken(start_token) | bSuffix;
+            }
             tokenCounter++;
             if (tokenCounter == 2 && bIsPreProc) {
                 if (strncmp(start_token, "define", 6) == 0) {
@@ -4760,9 +6234,402 @@ void parseline(struct INCFILE* pIncFile, char* pszLine, int bWeak) {
     } else {
         cc = PP_EOL;
     }
+    uint8_t* pFlags = FindTokenFlags(pIncFile, os);
+    if (pFlags != NULL) {
+        *pFlags = TF_TOKEN;
+    }
     *os++ = cc;
     *os++ = '\0';
     pIncFile->pszOut = os;
+    g_Stats.dwTokens += tokenCounter + 1;
+}
+
+void parseline(struct INCFILE* pIncFile, char* pszLine, int bWeak) {
+    int bIsPreProc = *pszLine == '#';
+    skipcomments(pIncFile, pszLine);
+    TokenizeLine(pIncFile, pszLine, bWeak, bIsPreProc);
+}
+
+// multiple-include optimization
+// a file is guarded if everything except comments is enclosed in
+// "#ifndef X" (or "#if !defined X") ... "#endif" and X is #defined
+// inside, unconditionally. This is checked line by line while tokenizing.
+
+// next token of a tokenized line, comments are skipped
+// returns NULL at the end of the line
+
+static char* GetLineToken(char** ppszToken) {
+    char* pszToken = *ppszToken;
+    while (pszToken[0] == (char)PP_COMMENT) {
+        pszToken += strlen(pszToken) + 1;
+    }
+    if (pszToken[0] == '\0') {
+        return NULL;
+    }
+    if ((pszToken[0] == (char)PP_EOL || pszToken[0] == (char)PP_WEAKEOL) && pszToken[1] == '\0') {
+        return NULL;
+    }
+    *ppszToken = pszToken + strlen(pszToken) + 1;
+    return pszToken;
+}
+
+// is remainder of line "X", "!defined X" or "!defined(X)"?
+// returns name of X
+
+static char* GetGuardName(char* pszLine, int bIfndef) {
+    char* pszToken = GetLineToken(&pszLine);
+    if (!bIfndef) {
+        if (pszToken == NULL || strcmp(pszToken, "!") != 0) {
+            return NULL;
+        }
+        pszToken = GetLineToken(&pszLine);
+        if (pszToken == NULL || strcmp(pszToken, "defined") != 0) {
+            return NULL;
+        }
+        pszToken = GetLineToken(&pszLine);
+        if (pszToken != NULL && strcmp(pszToken, "(") == 0) {
+            char* pszName = GetLineToken(&pszLine);
+            pszToken = GetLineToken(&pszLine);
+            if (pszToken == NULL || strcmp(pszToken, ")") != 0) {
+                return NULL;
+            }
+            pszToken = pszName;
+        }
+    }
+    if (pszToken == NULL || !IsAlpha(*pszToken) || GetLineToken(&pszLine) != NULL) {
+        return NULL;
+    }
+    return pszToken;
+}
+
+static void CheckGuardLine(struct INCFILE* pIncFile, char* pszLine) {
+    char* pszToken = GetLineToken(&pszLine);
+    if (pszToken == NULL || pIncFile->bGuardState == GS_NONE) {
+        return;
+    }
+    char* pszCmd = NULL;
+    if (strcmp(pszToken, "#") == 0) {
+        pszCmd = GetLineToken(&pszLine);
+    }
+    switch (pIncFile->bGuardState) {
+    case GS_START:
+        pIncFile->bGuardState = GS_NONE;
+        if (pszCmd != NULL && (strcmp(pszCmd, "ifndef") == 0 || strcmp(pszCmd, "if") == 0)) {
+            pIncFile->pszGuard = GetGuardName(pszLine, pszCmd[2] == 'n');
+            if (pIncFile->pszGuard != NULL) {
+                pIncFile->pszGuardIf = pszLine;
+                pIncFile->dwGuardLevel = 0;
+                pIncFile->bGuardState = GS_INSIDE;
+            }
+        }
+        break;
+    case GS_INSIDE:
+        if (pszCmd == NULL) {
+            break;
+        }
+        if (strcmp(pszCmd, "if") == 0 || strcmp(pszCmd, "ifdef") == 0 || strcmp(pszCmd, "ifndef") == 0) {
+            pIncFile->dwGuardLevel++;
+        } else if (strcmp(pszCmd, "endif") == 0) {
+            if (pIncFile->dwGuardLevel == 0) {
+                pIncFile->bGuardState = GS_CLOSED;
+            } else {
+                pIncFile->dwGuardLevel--;
+            }
+        } else if (pIncFile->dwGuardLevel == 0) {
+            if (strcmp(pszCmd, "elif") == 0 || strcmp(pszCmd, "else") == 0) {
+                pIncFile->bGuardState = GS_NONE;
+            } else if (strcmp(pszCmd, "define") == 0 || strcmp(pszCmd, "undef") == 0) {
+                pszToken = GetLineToken(&pszLine);
+                if (pszToken != NULL && strcmp(pszToken, pIncFile->pszGuard) == 0) {
+                    pIncFile->bGuardDefined = pszCmd[0] == 'd';
+                }
+            }
+        }
+        break;
+    case GS_CLOSED:
+        pIncFile->bGuardState = GS_NONE;
+        break;
+    }
+}
+
+// --fold-if: regions of an "#if" which is false are dropped by the
+// analyzer, so the tokenizer doesn't create tokens for them. Just the
+// lines ends are written, the analyzer counts them. Dropping stops at the
+// #elif, #else or #endif of the "#if".
+// Only conditions without names are known here, like "#if 0" or
+// "#if (1 - 1)". Macros are defined while the analyzer runs, so a
+// condition with a name or "defined" still takes the normal path.
+
+static int IsFalseCondition(struct INCFILE* pIncFile, char* pszLine) {
+    char* ppTokens[MAXIFTOKENS];
+    size_t numTokens = 0;
+    char* pszToken;
+    int64_t value;
+
+    while ((pszToken = GetLineToken(&pszLine)) != NULL) {
+        if (numTokens == MAXIFTOKENS || isalpha((unsigned char)pszToken[0]) || pszToken[0] == '_') {
+            return 0;
+        }
+        ppTokens[numTokens++] = pszToken;
+    }
+    return numTokens != 0 && EvaluateIfExpression(ppTokens, numTokens, GetNumberSuffix, pIncFile, &value) && value == 0;
+}
+
+static void CheckDroppedRegion(struct INCFILE* pIncFile, char* pszLine) {
+    char* pszToken = GetLineToken(&pszLine);
+    if (pszToken == NULL || strcmp(pszToken, "#") != 0) {
+        return;
+    }
+    char* pszCmd = GetLineToken(&pszLine);
+    if (pszCmd == NULL) {
+        return;
+    }
+    if (strcmp(pszCmd, "if") == 0 || strcmp(pszCmd, "ifdef") == 0 || strcmp(pszCmd, "ifndef") == 0) {
+        // the analyzer doesn't fold beyond MAXIFLEVEL
+        if (g_bFoldIf && pszCmd[2] == '\0' && pIncFile->dwPPLevel < MAXIFLEVEL) {
+            if (IsFalseCondition(pIncFile, pszLine)) {
+                pIncFile->bDropLines = 1;
+                pIncFile->dwDropLevel = 0;
+            }
+        }
+        pIncFile->dwPPLevel++;
+    } else if (strcmp(pszCmd, "endif") == 0 && pIncFile->dwPPLevel > 0) {
+        pIncFile->dwPPLevel--;
+    }
+}
+
+static int IsDirective(char* pszCmd, size_t len, const char* pszName) {
+    return len == strlen(pszName) && memcmp(pszCmd, pszName, len) == 0;
+}
+
+// a line of a dropped region, comments have been removed already
+// returns 0 if the line ends the region
+
+static int DropLine(struct INCFILE* pIncFile, char* pszLine, int bContinued) {
+    char* p = pszLine + LexSkipBlanks(pszLine);
+    if (bContinued || *p != '#') {
+        return 1;
+    }
+    p++;
+    p += LexSkipBlanks(p);
+    size_t len = LexScanName(p);
+    if (IsDirective(p, len, "if") || IsDirective(p, len, "ifdef") || IsDirective(p, len, "ifndef")) {
+        pIncFile->dwDropLevel++;
+    } else if (IsDirective(p, len, "endif")) {
+        if (pIncFile->dwDropLevel == 0) {
+            pIncFile->bDropLines = 0;
+            return 0;
+        }
+        pIncFile->dwDropLevel--;
+    } else if (pIncFile->dwDropLevel == 0 && (IsDirective(p, len, "elif") || IsDirective(p, len, "else"))) {
+        pIncFile->bDropLines = 0;
+        return 0;
+    }
+    return 1;
+}
+
+// bracket match index
+// For every "(" and "{" outside of preprocessor lines the offset of the
+// closing partner is recorded, the lookaheads of the analyzer then jump
+// there instead of counting brackets (see GetBracketMatch).
+// The analyzer counts brackets in all branches of a conditional, but
+// skips branches it folds or that continue a conditional opened before
+// the lookahead started. So a pair is left unknown if an #elif, #else
+// or #endif between its brackets belongs to an #if in front of it, or
+// if the branches of a conditional between them aren't balanced.
+
+static void MarkBracketsUnknown(struct INCFILE* pIncFile, int nKind, uint32_t dwFrames) {
+    struct vector* pStack = pIncFile->pBracketStack[nKind];
+    for (size_t i = 0; i < pStack->size; i++) {
+        struct BRACKETOPEN* pOpen = vector_get(pStack, i);
+        if (pOpen->dwFrames >= dwFrames) {
+            pOpen->bUnknown = 1;
+        }
+    }
+}
+
+// returns 0 if out of memory
+
+static int OpenBracket(struct INCFILE* pIncFile, int nKind, char* pszToken) {
+    struct BRACKETPAIR pair = { pszToken - pIncFile->pBuffer2, 0, 0 };
+    struct BRACKETOPEN open = { pIncFile->pBracketPairs->size, pIncFile->pBracketFrames->size, 0 };
+    // beyond MAXIFLEVEL the analyzer stops counting the conditionals
+    if (open.dwFrames >= MAXIFLEVEL) {
+        open.bUnknown = 1;
+    }
+    return vector_append(pIncFile->pBracketPairs, &pair) && vector_append(pIncFile->pBracketStack[nKind], &open);
+}
+
+static void CloseBracket(struct INCFILE* pIncFile, int nKind, char* pszToken) {
+    struct BRACKETOPEN* pOpen = vector_pop(pIncFile->pBracketStack[nKind]);
+    if (pOpen == NULL) {
+        return;
+    }
+    if (!pOpen->bUnknown && pOpen->dwFrames == pIncFile->pBracketFrames->size) {
+        struct BRACKETPAIR* pPair = vector_get(pIncFile->pBracketPairs, pOpen->dwPair);
+        pPair->dwClose = pszToken - pIncFile->pBuffer2;
+    }
+}
+
+// for HasVTable(), which only looks at the outermost level of a class
+
+static void MarkVirtual(struct INCFILE* pIncFile) {
+    struct vector* pStack = pIncFile->pBracketStack[BK_BRACE];
+    if (pStack->size != 0) {
+        struct BRACKETOPEN* pOpen = (struct BRACKETOPEN*)pStack->data + pStack->size - 1;
+        struct BRACKETPAIR* pPair = vector_get(pIncFile->pBracketPairs, pOpen->dwPair);
+        pPair->bVirtual = 1;
+    }
+}
+
+// returns 0 if out of memory
+
+static int CheckBracketFrame(struct INCFILE* pIncFile, char* pszCmd) {
+    struct vector* pFrames = pIncFile->pBracketFrames;
+    if (strcmp(pszCmd, "if") == 0 || strcmp(pszCmd, "ifdef") == 0 || strcmp(pszCmd, "ifndef") == 0) {
+        struct BRACKETFRAME frame = { { pIncFile->pBracketStack[BK_PAREN]->size, pIncFile->pBracketStack[BK_BRACE]->size } };
+        return vector_append(pFrames, &frame);
+    }
+    if (pFrames->size == 0) {
+        return 1;
+    }
+    int bEndif = strcmp(pszCmd, "endif") == 0;
+    if (!bEndif && strcmp(pszCmd, "elif") != 0 && strcmp(pszCmd, "else") != 0) {
+        return 1;
+    }
+    struct BRACKETFRAME* pFrame = vector_get(pFrames, pFrames->size - 1);
+    for (int nKind = BK_PAREN; nKind <= BK_BRACE; nKind++) {
+        if (pIncFile->pBracketStack[nKind]->size != pFrame->dwDepth[nKind]) {
+            MarkBracketsUnknown(pIncFile, nKind, 0);
+        } else {
+            MarkBracketsUnknown(pIncFile, nKind, pFrames->size);
+        }
+    }
+    if (bEndif) {
+        pFrames->size--;
+    }
+    return 1;
+}
+
+// declaration index
+// The tokens are split into spans at every ";", ",", "{" and "(", each
+// span records which one ends it. The analyzer classifies a declaration
+// by the first of them behind its keyword, so it looks up the span of
+// pszIn instead (see GetDeclShape). A span never contains an
+// #if, #elif, #else or #endif, the analyzer may skip branches there.
+
+// returns 0 if out of memory
+
+static int EndDeclSpan(struct INCFILE* pIncFile, char* pszToken, uint8_t bShape) {
+    struct DECLSPAN span = { pIncFile->dwDeclStart, pszToken - pIncFile->pBuffer2, bShape };
+    pIncFile->dwDeclStart = span.dwEnd + strlen(pszToken) + 1;
+    return vector_append(pIncFile->pDeclSpans, &span);
+}
+
+static int IndexDeclToken(struct INCFILE* pIncFile, char* pszToken) {
+    if (pIncFile->bDeclParen) {
+        if (*pszToken == '*') {
+            struct DECLSPAN* pSpan = vector_get(pIncFile->pDeclSpans, pIncFile->pDeclSpans->size - 1);
+            pSpan->bShape = DS_FUNCPTR;
+        }
+        pIncFile->bDeclParen = 0;
+    }
+    switch (*pszToken) {
+    case ';':
+    case ',':
+        return EndDeclSpan(pIncFile, pszToken, DS_END);
+    case '{':
+        return EndDeclSpan(pIncFile, pszToken, DS_BLOCK);
+    case '(':
+        pIncFile->bDeclParen = 1;
+        return EndDeclSpan(pIncFile, pszToken, DS_FUNCTION);
+    }
+    return 1;
+}
+
+// a conditional, the next span starts behind it
+
+static void CheckDeclFrame(struct INCFILE* pIncFile, char* pszCmd) {
+    if (strcmp(pszCmd, "if") != 0 && strcmp(pszCmd, "ifdef") != 0 && strcmp(pszCmd, "ifndef") != 0
+            && strcmp(pszCmd, "elif") != 0 && strcmp(pszCmd, "else") != 0 && strcmp(pszCmd, "endif") != 0) {
+        return;
+    }
+    // with --fold-if the token behind the "(" may be in another branch
+    if (pIncFile->bDeclParen) {
+        pIncFile->pDeclSpans->size--;
+        pIncFile->bDeclParen = 0;
+    }
+    pIncFile->dwDeclStart = pIncFile->pszOut - pIncFile->pBuffer2;
+}
+
+// returns 0 if out of memory
+
+static int IndexLine(struct INCFILE* pIncFile, char* pszLine) {
+    char* pszToken = GetLineToken(&pszLine);
+    if (pszToken == NULL) {
+        return 1;
+    }
+    if (strcmp(pszToken, "#") == 0) {
+        char* pszCmd = GetLineToken(&pszLine);
+        if (pszCmd != NULL) {
+            if (!CheckBracketFrame(pIncFile, pszCmd)) {
+                return 0;
+            }
+            CheckDeclFrame(pIncFile, pszCmd);
+        }
+        return 1;
+    }
+    do {
+        if (!IndexDeclToken(pIncFile, pszToken)) {
+            return 0;
+        }
+        if (strcmp(pszToken, "virtual") == 0) {
+            MarkVirtual(pIncFile);
+        } else if (pszToken[1] == '\0') {
+            switch (pszToken[0]) {
+            case '(':
+                if (!OpenBracket(pIncFile, BK_PAREN, pszToken)) {
+                    return 0;
+                }
+                break;
+            case '{':
+                if (!OpenBracket(pIncFile, BK_BRACE, pszToken)) {
+                    return 0;
+                }
+                break;
+            case ')':
+                CloseBracket(pIncFile, BK_PAREN, pszToken);
+                break;
+            case '}':
+                CloseBracket(pIncFile, BK_BRACE, pszToken);
+                break;
+            }
+        }
+        pszToken = GetLineToken(&pszLine);
+    } while (pszToken != NULL);
+    return 1;
+}
+
+static void FreeIndexStacks(struct INCFILE* pIncFile) {
+    vector_free(pIncFile->pBracketStack[BK_PAREN], NULL);
+    vector_free(pIncFile->pBracketStack[BK_BRACE], NULL);
+    vector_free(pIncFile->pBracketFrames, NULL);
+    pIncFile->pBracketStack[BK_PAREN] = NULL;
+    pIncFile->pBracketStack[BK_BRACE] = NULL;
+    pIncFile->pBracketFrames = NULL;
+}
+
+// the indexes are dropped, the analyzer then counts the brackets itself
+
+static void IndexOutOfMemory(struct INCFILE* pIncFile) {
+    OutOfMemory(pIncFile);
+    FreeIndexStacks(pIncFile);
+    if (pIncFile->pBracketPairs != NULL) {
+        pIncFile->pBracketPairs->size = 0;
+    }
+    if (pIncFile->pDeclSpans != NULL) {
+        pIncFile->pDeclSpans->size = 0;
+    }
 }
 
 // get a source text line
@@ -4779,8 +6646,11 @@ size_t Parse_Line(struct INCFILE* pIncFile) {
     }
     char* origIs = is;
     char* lineEnd = NULL;
+    char* pszLine = pIncFile->pszOut;
+    int bContinued = pIncFile->bContinuation;
 
     while (1) {
+        is += LexScanLine(is);
         if (*is == '\0') {
             break;
         }
@@ -4820,7 +6690,26 @@ size_t Parse_Line(struct INCFILE* pIncFile) {
         }
     }
 
-    parseline(pIncFile, origIs, weak);
+    if (pIncFile->bDropLines) {
+        int bIsPreProc = *origIs == '#';
+        skipcomments(pIncFile, origIs);
+        if (DropLine(pIncFile, origIs, bContinued)) {
+            pszLine[0] = weak ? PP_WEAKEOL : PP_EOL;
+            pszLine[1] = '\0';
+            pIncFile->pszOut = pszLine + 2;
+        } else {
+            TokenizeLine(pIncFile, origIs, weak, bIsPreProc);
+        }
+    } else {
+        parseline(pIncFile, origIs, weak);
+    }
+    if (!bContinued && !pIncFile->bDropLines) {
+        CheckGuardLine(pIncFile, pszLine);
+        if (pIncFile->pBracketFrames != NULL && !IndexLine(pIncFile, pszLine)) {
+            IndexOutOfMemory(pIncFile);
+        }
+        CheckDroppedRegion(pIncFile, pszLine);
+    }
     size_t res = is - pIncFile->pszIn;
     pIncFile->pszIn = is;
     return res;
@@ -4837,16 +6726,55 @@ size_t Parse_Line(struct INCFILE* pIncFile) {
 //  output: "#define",0,"VAR1",0,"0Ah",0,"+",0,"2",0,PP_EOL,0
 
 void ParserIncFile(struct INCFILE* pIncFile) {
+    BEGIN_TIMESPAN(TP_PARSER, pIncFile->pszFileName);
+    TRACE_BEGIN(TC_TOKENIZER, "tokenize", pIncFile->pszFileName, 0);
     pIncFile->dwLine = 1;
     pIncFile->bContinuation = 0;
+    pIncFile->bGuardState = GS_START;
+    pIncFile->bGuardDefined = 0;
+    pIncFile->bDropLines = 0;
+    pIncFile->dwPPLevel = 0;
+    pIncFile->pszGuard = NULL;
+    pIncFile->pszGuardIf = NULL;
+    // calloc'ed, so the pages the tokenizer doesn't reach are never touched.
+    // Without flags the predicates inspect the chars of the tokens.
+    free(pIncFile->pTokenFlags);
+    pIncFile->pTokenFlags = xcalloc(pIncFile->dwBufSize, 1);
+    pIncFile->dwTokenFlags = pIncFile->pTokenFlags != NULL ? pIncFile->dwBufSize : 0;
+    if (pIncFile->pBracketPairs == NULL) {
+        pIncFile->pBracketPairs = vector_create(sizeof(struct BRACKETPAIR));
+    }
+    if (pIncFile->pDeclSpans == NULL) {
+        pIncFile->pDeclSpans = vector_create(sizeof(struct DECLSPAN));
+    }
+    pIncFile->dwDeclStart = 0;
+    pIncFile->bDeclParen = 0;
+    pIncFile->pBracketStack[BK_PAREN] = vector_create(sizeof(struct BRACKETOPEN));
+    pIncFile->pBracketStack[BK_BRACE] = vector_create(sizeof(struct BRACKETOPEN));
+    pIncFile->pBracketFrames = vector_create(sizeof(struct BRACKETFRAME));
+    if (pIncFile->pBracketPairs == NULL || pIncFile->pDeclSpans == NULL || pIncFile->pBracketStack[BK_PAREN] == NULL
+        || pIncFile->pBracketStack[BK_BRACE] == NULL || pIncFile->pBracketFrames == NULL) {
+        IndexOutOfMemory(pIncFile);
+    } else {
+        pIncFile->pBracketPairs->size = 0;
+        pIncFile->pDeclSpans->size = 0;
+    }
     int nb_chars;
     do {
         nb_chars = Parse_Line(pIncFile);
     } while (nb_chars != 0);
     *pIncFile->pszOut = '\0';
+    FreeIndexStacks(pIncFile);
+    if (pIncFile->bGuardState != GS_CLOSED || !pIncFile->bGuardDefined) {
+        pIncFile->pszGuard = NULL;
+        pIncFile->pszGuardIf = NULL;
+    }
+    TRACE_END(TC_TOKENIZER);
+    END_TIMESPAN();
 }
 
 // xwrite output buffer to file
+// an empty file name means stdout, or g_pOutputSink if one is set
 // eax=0 if error
 
 int WriteIncFile(struct INCFILE* pIncFile, char* pszFileName) {
@@ -4855,23 +6783,35 @@ int WriteIncFile(struct INCFILE* pIncFile, char* pszFileName) {
 
     rc = 1;
     if (pIncFile->dwErrors != 0) {
-        fprintf(stderr, "%d errors occurred while parsing %s. Skipping writing files.\n", pIncFile->dwErrors, pIncFile->pszFileName);
+        diag_printf("%d errors occurred while parsing %s. Skipping writing files.\n", pIncFile->dwErrors, pIncFile->pszFileName);
         return 0;
     }
 
-    size_t lenBuffer1 = strlen(pIncFile->pBuffer1);
+    const char* pData = pIncFile->pBuffer1;
+    size_t lenBuffer1 = strlen(pData);
+    if (SHAKE_ENABLED && !ShakeText(&pData, &lenBuffer1)) {
+        return 0;
+    }
+    if (pszFileName[0] == '\0' && g_pOutputSink != NULL) {
+        if (!vector_append_array(g_pOutputSink, pData, lenBuffer1)) {
+            diag_printf("fatal error: out of memory\n");
+            g_bTerminate = 1;
+            rc = 0;
+        }
+        return rc;
+    }
     if (pszFileName[0] == '\0') {
         file = stdout;
     } else {
         file = fopen(pszFileName, "w");
     }
     if (file == NULL) {
-        fprintf(stderr, "cannot create file %s\n", pszFileName);
+        diag_printf("cannot create file %s\n", pszFileName);
         rc = 0;
     } else {
-        size_t actual = fwrite(pIncFile->pBuffer1, 1, lenBuffer1, file);
+        size_t actual = fwrite(pData, 1, lenBuffer1, file);
         if (actual != lenBuffer1) {
-            fprintf(stderr, "%s: xwrite error\n", pszFileName);
+            diag_printf("%s: xwrite error\n", pszFileName);
             rc = 0;
         }
         if (pszFileName[0] == '\0') {
@@ -4893,12 +6833,12 @@ int WriteDefIncFile(struct INCFILE* pIncFile, char* pszFileName) {
 
     rc = 0;
     if (pIncFile->pDefs == 0) {
-        // fprintf(stderr, "no .DEF file requested\n");
+        // diag_printf("no .DEF file requested\n");
         goto exit;
     }
     if (GetNumItemsList(pIncFile->pDefs) == 0) {
         if (g_bWarningLevel > 2) {
-            fprintf(stderr, "no items for .DEF file\n");
+            diag_printf("no items for .DEF file\n");
         }
         goto exit;
     }
@@ -4906,7 +6846,7 @@ int WriteDefIncFile(struct INCFILE* pIncFile, char* pszFileName) {
     strcpy(szFile, pszFileName);
     size_t lenFileName = strlen(pszFileName);
     if (lenFileName < 5 || szFile[lenFileName-4] != '.') {
-        fprintf(stderr, "invalid file name %s for .DEF file\n", pszFileName);
+        diag_printf("invalid file name %s for .DEF file\n", pszFileName);
         goto exit;
     }
     strcpy(szFile+lenFileName-3, "def");
@@ -4925,13 +6865,21 @@ int WriteDefIncFile(struct INCFILE* pIncFile, char* pszFileName) {
         fclose(file);
         rc = 1;
     } else {
-        fprintf(stderr, "cannot create file %s\n", pszFileName);
+        diag_printf("cannot create file %s\n", pszFileName);
     }
 exit:
     return rc;
 }
 
 
+char* GetOutputIncFile(struct INCFILE* pIncFile) {
+    return pIncFile->pBuffer1;
+}
+
+uint32_t GetErrorsIncFile(struct INCFILE* pIncFile) {
+    return pIncFile->dwErrors;
+}
+
 char* GetFileNameIncFile(struct INCFILE* pIncFile, uint32_t* dwLine) {
     *dwLine = pIncFile->dwLine;
     return pIncFile->pszFileName;
@@ -4949,6 +6897,12 @@ struct INCFILE* GetParentIncFile(struct INCFILE* pIncFile) {
     return pIncFile->pParent;
 }
 
+// token stream written by ParserIncFile
+
+char* GetTokensIncFile(struct INCFILE* pIncFile) {
+    return pIncFile->pBuffer2;
+}
+
 static const char *find_last_occurrence_of_any(const char *s, const char *accept) {
     const char *current = s + strlen(s);
     for (; current != s;) {
@@ -4960,6 +6914,78 @@ static const char *find_last_occurrence_of_any(const char *s, const char *accept
     return NULL;
 }
 
+// set the file name and directory of an include file object
+
+static void SetNameIncFile(struct INCFILE* pIncFile, const char* pszFileName) {
+    pIncFile->pszFullPath = StrDupArena(pIncFile->pArena, pszFileName);
+
+    const char *incDirPathEnd = find_last_occurrence_of_any(pIncFile->pszFullPath, "/\\");
+    if (incDirPathEnd != NULL) {
+        pIncFile->pszDirPath = StrNDupArena(pIncFile->pArena, pIncFile->pszFullPath, incDirPathEnd - pIncFile->pszFullPath + 1);
+        pIncFile->pszFileName = StrDupArena(pIncFile->pArena, incDirPathEnd + 1);
+    } else {
+        pIncFile->pszDirPath = StrDupArena(pIncFile->pArena, "./");
+        pIncFile->pszFileName = pIncFile->pszFullPath;
+    }
+}
+
+// allocate an include file object for a source of dwFileSize bytes
+// the object, its names and in/out buffers are taken from one arena,
+// which also receives the transient data of the file.
+// returns NULL if out of memory
+
+static struct INCFILE* AllocIncFile(const char* pszFileName, size_t dwFileSize) {
+    uint32_t extraBuffer;
+#if ADD50PERCENT
+    extraBuffer = extraBuffer >> 1;    // add 50% to file size for buffer size
+#else
+    extraBuffer = dwFileSize;
+#endif
+    uint32_t dwBufSize = dwFileSize + extraBuffer;
+    // declarations may grow to more than twice their size (COM interfaces),
+    // the pages of the output buffer are touched as far as they are used only
+    uint32_t dwOutBufSize = dwFileSize * OUTPUTFACTOR + OUTPUTMIN;
+
+    struct ARENA* pArena = CreateArena(sizeof(struct INCFILE) + dwOutBufSize + dwBufSize + 2 * OUTPUTRESERVE + 3 * strlen(pszFileName) + INCFILEARENASIZE);
+    if (pArena == NULL) {
+        diag_printf("fatal error: out of memory\n");
+        g_bTerminate = 1;
+        return NULL;
+    }
+    struct INCFILE* pIncFile = AllocArena(pArena, sizeof(struct INCFILE));
+    memset(pIncFile, 0, sizeof(struct INCFILE));
+    pIncFile->statsStart = g_Stats;
+    pIncFile->pArena = pArena;
+    pIncFile->dwBufSize = dwBufSize;
+    pIncFile->dwOutBufSize = dwOutBufSize;
+    pIncFile->pBuffer1 = AllocArena(pArena, dwOutBufSize + OUTPUTRESERVE);
+    pIncFile->pBuffer2 = AllocArena(pArena, dwBufSize + OUTPUTRESERVE);
+    pIncFile->pLineTokens = VECTOR_CHARP_CREATE();
+    pIncFile->pMacroTokens = VECTOR_CHARP_CREATE();
+    if (pIncFile->pLineTokens == NULL || pIncFile->pMacroTokens == NULL) {
+        vector_free(pIncFile->pLineTokens, NULL);
+        vector_free(pIncFile->pMacroTokens, NULL);
+        DestroyArena(pArena);
+        diag_printf("fatal error: out of memory\n");
+        g_bTerminate = 1;
+        return NULL;
+    }
+    SetNameIncFile(pIncFile, pszFileName);
+    debug_printf("buffers for %s: %p, %p\n", pIncFile->pszFileName, pIncFile->pBuffer1, pIncFile->pBuffer2);
+    return pIncFile;
+}
+
+static void InitBuffersIncFile(struct INCFILE* pIncFile, size_t dwFileSize, struct INCFILE* pParent) {
+    pIncFile->pBuffer1[dwFileSize] = '\0';
+    pIncFile->pBuffer1[dwFileSize+1] = '\0';
+    pIncFile->pszInStart = pIncFile->pszIn = pIncFile->pBuffer1;
+    pIncFile->pszOutStart = pIncFile->pszOut = pIncFile->pBuffer2;
+    pIncFile->pszOutEnd = pIncFile->pBuffer2 + pIncFile->dwBufSize;
+    pIncFile->pszOut[0] = '\0';
+    pIncFile->pParent = pParent;
+    pIncFile->bNewLine = 1;
+}
+
 // constructor include file object
 // returns:
 //  eax = 0 if error occured
@@ -4970,91 +6996,76 @@ struct INCFILE* CreateIncFile(const char* pszFileName, struct INCFILE* pParent)
     size_t dwFileSize;
     struct INCFILE* pIncFile;
 
-    pIncFile = malloc(sizeof(struct INCFILE));
-    if (pIncFile == NULL) {
-        goto exit;
-    }
-    memset(pIncFile, 0, sizeof(struct INCFILE));
     file = fopen(pszFileName, "r");
     if (file == NULL) {
         if (pParent != NULL) {
             uint32_t parentLine;
             char* parentFileName = GetFileNameIncFile(pParent, &parentLine);
-            fprintf(stderr, "%s, %u: ", parentFileName, parentLine);
+            diag_printf("%s, %u: ", parentFileName, parentLine);
         }
-        fprintf(stderr, "cannot open file %s\n", pszFileName);
-        free(pIncFile);
-        pIncFile = NULL;
-        goto exit;
-    }
-    pIncFile->pszFullPath = AddString(pszFileName);
-
-    const char *incDirPathEnd = find_last_occurrence_of_any(pIncFile->pszFullPath, "/\\");
-    pIncFile->pszDirPath = NULL;
-    if (incDirPathEnd != NULL) {
-        pIncFile->pszDirPath = malloc(incDirPathEnd - pIncFile->pszFullPath + 2);
-        strncpy(pIncFile->pszDirPath, pIncFile->pszFullPath, incDirPathEnd - pIncFile->pszFullPath + 1);
-        pIncFile->pszDirPath[incDirPathEnd - pIncFile->pszFullPath + 1] = '\0';
-
-        pIncFile->pszFileName = malloc(strlen(pIncFile->pszFullPath) - (incDirPathEnd - pIncFile->pszFullPath));
-        strcpy(pIncFile->pszFileName, incDirPathEnd + 1);
-    } else {
-        pIncFile->pszDirPath = strdup("./");
-        pIncFile->pszFileName = AddString(pszFileName);
+        diag_printf("cannot open file %s\n", pszFileName);
+        return NULL;
     }
-
     struct stat fileStat;
     stat(pszFileName, &fileStat);
-    gmtime_r(&fileStat.st_mtime, &pIncFile->filetime);
-    pIncFile->path_uid = fileStat.st_ino;
-
     dwFileSize = fileStat.st_size;
 
-    uint32_t extraBuffer;
-#if ADD50PERCENT
-    extraBuffer = extraBuffer >> 1;    // add 50% to file size for buffer size
-#else
-    extraBuffer = dwFileSize;
-#endif
-    pIncFile->dwBufSize = dwFileSize + extraBuffer;
-
-    pIncFile->pBuffer1 = malloc(pIncFile->dwBufSize);
-    debug_printf("alloc buffer 1 for %s returned %p\n", pIncFile->pszFileName, pIncFile->pBuffer1);
-    pIncFile->pBuffer2 = malloc(pIncFile->dwBufSize);
-    debug_printf("alloc buffer 2 for %s returned %p\n", pIncFile->pszFileName, pIncFile->pBuffer2);
-    if (pIncFile->pBuffer1 == NULL || pIncFile->pBuffer2 == NULL) {
-        fprintf(stderr, "fatal error: out of memory\n");
-        free(pIncFile);
-        g_bTerminate = 1;
-        pIncFile = NULL;
-        goto exit;
+    pIncFile = AllocIncFile(pszFileName, dwFileSize);
+    if (pIncFile == NULL) {
+        fclose(file);
+        return NULL;
     }
+    gmtime_r(&fileStat.st_mtime, &pIncFile->filetime);
+    pIncFile->path_uid = fileStat.st_ino;
+
     fread(pIncFile->pBuffer1, 1, dwFileSize, file);
     fclose(file);
-    pIncFile->pBuffer1[dwFileSize] = '\0';
-    pIncFile->pBuffer1[dwFileSize+1] = '\0';
-    pIncFile->pszInStart = pIncFile->pszIn = pIncFile->pBuffer1;
-    pIncFile->pszOutStart = pIncFile->pszOut = pIncFile->pBuffer2;
-    pIncFile->pszOut[0] = '\0';
-    pIncFile->pParent = pParent;
-    pIncFile->bNewLine = 1;
-exit:
+    g_Stats.dwBytesRead += dwFileSize;
+    InitBuffersIncFile(pIncFile, dwFileSize, pParent);
+    return pIncFile;
+}
+
+// constructor include file object for a source held in memory
+// pszFileName is used for messages and to locate included files
+
+struct INCFILE* CreateIncFileFromMemory(const char* pszFileName, const char* pData, size_t dwSize, struct INCFILE* pParent) {
+    struct INCFILE* pIncFile;
+
+    pIncFile = AllocIncFile(pszFileName, dwSize);
+    if (pIncFile == NULL) {
+        return NULL;
+    }
+    time_t now = time(NULL);
+    gmtime_r(&now, &pIncFile->filetime);
+
+    memcpy(pIncFile->pBuffer1, pData, dwSize);
+    g_Stats.dwBytesRead += dwSize;
+    InitBuffersIncFile(pIncFile, dwSize, pParent);
     return pIncFile;
 }
 
 // destructor include file object
 
 void DestroyIncFile(struct INCFILE* pIncFile) {
-    free(pIncFile->pBuffer1);
-    free(pIncFile->pBuffer2);
+    if (g_bStats) {
+        uint32_t dwDepth = 0;
+        for (struct INCFILE* p = pIncFile->pParent; p != NULL; p = p->pParent) {
+            dwDepth++;
+        }
+        RecordFileStats(pIncFile->pszFileName, dwDepth, &pIncFile->statsStart);
+    }
+    free(pIncFile->pTokenFlags);
     if (pIncFile->pDefs != NULL) {
         DestroyList(pIncFile->pDefs);
         pIncFile->pDefs = NULL;
     }
-    DestroyString(pIncFile->pszFullPath);
-    DestroyString(pIncFile->pszFileName);
-
-    free(pIncFile);
+    vector_free(pIncFile->pDeclSpans, NULL);
+    vector_free(pIncFile->pLineTokens, NULL);
+    vector_free(pIncFile->pMacroTokens, NULL);
+    vector_free(pIncFile->pBracketPairs, NULL);
+    vector_free(pIncFile->pGuardNames, NULL);
+    // the object itself is part of the arena
+    DestroyArena(pIncFile->pArena);
 }
 
 
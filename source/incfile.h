@@ -1,21 +1,48 @@
 #ifndef INCFILE_H
 #define INCFILE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define MAXIFLEVEL 31
+#define MAXITEMS   0x10000  // max. items in structure/macro list
 
 struct INCFILE;
 
+// token flags, recorded by the tokenizer for each token it writes
+enum {
+    TF_TOKEN    = 0x01,     // flags are valid
+    TF_NAME     = 0x02,     // letter, '_', '?' or '@' first
+    TF_NUMBER   = 0x04,     // digit first
+    TF_STRING   = 0x08,     // string literal, maybe converted to 13,10,"text"
+    TF_OPERATOR = 0x10,     // - + * / | & >> <<
+    TF_PPHASH   = 0x20,     // "#", starts a preprocessor line at a line start
+    TF_UNSIGNED = 0x40,     // number with u suffix, the suffixes are removed
+    TF_LONGLONG = 0x80,     // number with ll suffix
+};
+
 struct INCFILE* CreateIncFile(const char*, struct INCFILE*);
+struct INCFILE* CreateIncFileFromMemory(const char*, const char*, size_t, struct INCFILE*);
 void DestroyIncFile(struct INCFILE*);
 int WriteIncFile(struct INCFILE*, char*);
 int WriteDefIncFile(struct INCFILE*, char*);
 void ParserIncFile(struct INCFILE*);
 void AnalyzerIncFile(struct INCFILE*);
 void DestroyAnalyzerData(void);
+char* GetOutputIncFile(struct INCFILE*);
+uint32_t GetErrorsIncFile(struct INCFILE*);
 char* GetFileNameIncFile(struct INCFILE* pFile, uint32_t* dwLine);
 void GetFullPathIncFile(struct INCFILE*);
 // void GetLineIncFile(struct INCFILE*);
 struct INCFILE* GetParentIncFile(struct INCFILE*);
+char* GetTokensIncFile(struct INCFILE*);
+uint8_t ClassifyToken(const char*);
+uint8_t GetTokenFlags(struct INCFILE*, const char*);
+
+// helpers of the analyzer, exported for h2incc-microbench
+char* TranslateType(char*, uint32_t);
+int IsStructure(char*);
+int IsReservedWord(char*);
+void ConvertNumber(char**, char**);
+void GetStringLiteral(char**, char**);
 #endif
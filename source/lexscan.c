@@ -0,0 +1,416 @@
+#include "lexscan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LEXSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// scanner kernels of the tokenizer
+//
+// Parse_Line and parseline use these to find line ends, blank runs and the
+// end of names several bytes at a time, skipcomments to jump to the next
+// '/' or to the end of a block comment, the literal converters to copy
+// the plain chars of a string literal in one go. The SIMD kernels classify 16 or 32
+// bytes with two shuffle lookups (low and high nibble of each byte) and
+// stop at the first byte of interest.
+// They read aligned blocks only. Such a block may contain bytes in front
+// of the string or behind its terminating '\0', but it never crosses a
+// page boundary, so this is safe.
+
+// delimiters known by parser: ,;:()[]{}|*<>!~-+=/&#
+// first chars of 2-byte operators: >> << && || >= <= == != -> :: ##
+// the analyzer's token predicates use LC_ALPHA, LC_DIGIT and LC_NUMOP
+
+// runs of chars with the same class, as plain C99 designators
+#define LC_RUN2(c, cls)     [(c)] = (cls), [(c) + 1] = (cls)
+#define LC_RUN4(c, cls)     LC_RUN2(c, cls), LC_RUN2((c) + 2, cls)
+#define LC_RUN8(c, cls)     LC_RUN4(c, cls), LC_RUN4((c) + 4, cls)
+#define LC_RUN10(c, cls)    LC_RUN8(c, cls), LC_RUN2((c) + 8, cls)
+#define LC_RUN26(c, cls)    LC_RUN8(c, cls), LC_RUN8((c) + 8, cls), LC_RUN10((c) + 16, cls)
+
+const uint8_t g_bLexClass[256] = {
+    ['\0'] = LC_NUL,
+    ['\t'] = LC_BLANK,
+    ['\n'] = LC_EOL,
+    ['\r'] = LC_EOL,
+    [' ']  = LC_BLANK,
+    ['!']  = LC_DELIM | LC_OP2,
+    ['#']  = LC_DELIM | LC_OP2,
+    ['&']  = LC_DELIM | LC_OP2 | LC_NUMOP,
+    ['(']  = LC_DELIM,
+    [')']  = LC_DELIM,
+    ['*']  = LC_DELIM | LC_NUMOP,
+    ['+']  = LC_DELIM | LC_NUMOP,
+    [',']  = LC_DELIM,
+    ['-']  = LC_DELIM | LC_OP2 | LC_NUMOP,
+    ['/']  = LC_DELIM | LC_NUMOP,
+    LC_RUN10('0', LC_DIGIT),
+    [':']  = LC_DELIM | LC_OP2,
+    [';']  = LC_DELIM,
+    ['<']  = LC_DELIM | LC_OP2,
+    ['=']  = LC_DELIM | LC_OP2,
+    ['>']  = LC_DELIM | LC_OP2,
+    ['?']  = LC_ALPHA,
+    ['@']  = LC_ALPHA,
+    LC_RUN26('A', LC_ALPHA),
+    ['[']  = LC_DELIM,
+    [']']  = LC_DELIM,
+    ['_']  = LC_ALPHA,
+    LC_RUN26('a', LC_ALPHA),
+    ['{']  = LC_DELIM,
+    ['|']  = LC_DELIM | LC_OP2 | LC_NUMOP,
+    ['}']  = LC_DELIM,
+    ['~']  = LC_DELIM,
+};
+
+#define LC_NAMESTOP (LC_DELIM | LC_BLANK | LC_NUL)
+
+static int g_nLexLevel = LEX_SCALAR;
+
+// scalar kernels
+
+static size_t ScanLineScalar(const char* p) {
+    const char* s = p;
+    while (!LexIsClass(*s, LC_EOL | LC_NUL)) {
+        s++;
+    }
+    return s - p;
+}
+
+static size_t ScanNameScalar(const char* p) {
+    const char* s = p;
+    while (!LexIsClass(*s, LC_NAMESTOP)) {
+        s++;
+    }
+    return s - p;
+}
+
+static size_t SkipBlanksScalar(const char* p) {
+    const char* s = p;
+    while (LexIsClass(*s, LC_BLANK)) {
+        s++;
+    }
+    return s - p;
+}
+
+static size_t ScanSlashScalar(const char* p) {
+    const char* s = p;
+    while (*s != '/' && *s != '\0') {
+        s++;
+    }
+    return s - p;
+}
+
+static size_t ScanStringScalar(const char* p) {
+    const char* s = p;
+    while (*s != '"' && *s != '\\' && *s != '\0') {
+        s++;
+    }
+    return s - p;
+}
+
+static size_t ScanCommentEndScalar(const char* p) {
+    const char* s = p;
+    while (*s != '\0' && (s[0] != '*' || s[1] != '/')) {
+        s++;
+    }
+    return s - p;
+}
+
+#if LEXSCAN_X86
+
+// shuffle tables for the name stop chars
+// a byte c is a stop char if g_bNibbleLo[c & 0xF] & g_bNibbleHi[c >> 4]
+
+static uint8_t g_bNibbleLo[32] __attribute__((aligned(32)));
+static uint8_t g_bNibbleHi[32] __attribute__((aligned(32)));
+
+static void InitNibbleTables(void) {
+    for (int i = 0; i < 32; i++) {
+        g_bNibbleLo[i] = 0;
+        g_bNibbleHi[i] = (i & 0xF) < 8 ? (uint8_t)(1 << (i & 7)) : 0;
+    }
+    for (int c = 0; c < 0x80; c++) {
+        if (g_bLexClass[c] & LC_NAMESTOP) {
+            g_bNibbleLo[c & 0xF] |= 1 << (c >> 4);
+            g_bNibbleLo[16 + (c & 0xF)] |= 1 << (c >> 4);
+        }
+    }
+}
+
+// 16 bytes
+
+__attribute__((target("ssse3")))
+static inline unsigned LineMask16(__m128i v) {
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()),
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+    return (unsigned)_mm_movemask_epi8(m);
+}
+
+__attribute__((target("ssse3")))
+static inline unsigned NameMask16(__m128i v) {
+    __m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+    __m128i t = _mm_and_si128(_mm_shuffle_epi8(_mm_load_si128((const __m128i*)g_bNibbleLo), lo),
+                              _mm_shuffle_epi8(_mm_load_si128((const __m128i*)g_bNibbleHi), hi));
+    return ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(t, _mm_setzero_si128())) & 0xFFFF;
+}
+
+__attribute__((target("ssse3")))
+static inline unsigned BlankMask16(__m128i v) {
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    return ~(unsigned)_mm_movemask_epi8(m) & 0xFFFF;
+}
+
+#define SCAN16(NAME, MASKFN)                                                \
+__attribute__((target("ssse3")))                                            \
+static size_t NAME(const char* p) {                                         \
+    const char* s = (const char*)((uintptr_t)p & ~(uintptr_t)15);           \
+    unsigned mask = MASKFN(_mm_load_si128((const __m128i*)s)) >> (p - s);   \
+    if (mask != 0) {                                                        \
+        return __builtin_ctz(mask);                                         \
+    }                                                                       \
+    while (1) {                                                             \
+        s += 16;                                                            \
+        mask = MASKFN(_mm_load_si128((const __m128i*)s));                   \
+        if (mask != 0) {                                                    \
+            return s + __builtin_ctz(mask) - p;                             \
+        }                                                                   \
+    }                                                                       \
+}
+
+__attribute__((target("ssse3")))
+static inline unsigned SlashMask16(__m128i v) {
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()), _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+    return (unsigned)_mm_movemask_epi8(m);
+}
+
+__attribute__((target("ssse3")))
+static inline unsigned StringMask16(__m128i v) {
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()),
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+    return (unsigned)_mm_movemask_epi8(m);
+}
+
+SCAN16(ScanLineSSSE3, LineMask16)
+SCAN16(ScanNameSSSE3, NameMask16)
+SCAN16(SkipBlanksSSSE3, BlankMask16)
+SCAN16(ScanSlashSSSE3, SlashMask16)
+SCAN16(ScanStringSSSE3, StringMask16)
+
+// "*/" search: a '/' is a hit if the byte in front of it is a '*',
+// the '*' of the last byte of a block is carried into the next block
+
+__attribute__((target("ssse3")))
+static size_t ScanCommentEndSSSE3(const char* p) {
+    const char* s = (const char*)((uintptr_t)p & ~(uintptr_t)15);
+    unsigned valid = 0xFFFFu << (p - s);
+    unsigned carry = 0;
+    while (1) {
+        __m128i v = _mm_load_si128((const __m128i*)s);
+        unsigned star = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('*'))) & valid;
+        unsigned slash = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+        unsigned nul = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) & valid;
+        unsigned hit = slash & (((star << 1) | carry) & 0xFFFF);
+        if (hit != 0 || nul != 0) {
+            int nHit = hit != 0 ? __builtin_ctz(hit) - 1 : 16;
+            int nNul = nul != 0 ? __builtin_ctz(nul) : 16;
+            return s + (nHit < nNul ? nHit : nNul) - p;
+        }
+        carry = star >> 15;
+        valid = 0xFFFF;
+        s += 16;
+    }
+}
+
+// 32 bytes
+
+__attribute__((target("avx2")))
+static inline unsigned LineMask32(__m256i v) {
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+    return (unsigned)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned NameMask32(__m256i v) {
+    __m256i lo = _mm256_and_si256(v, _mm256_set1_epi8(0x0F));
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+    __m256i t = _mm256_and_si256(_mm256_shuffle_epi8(_mm256_load_si256((const __m256i*)g_bNibbleLo), lo),
+                                 _mm256_shuffle_epi8(_mm256_load_si256((const __m256i*)g_bNibbleHi), hi));
+    return ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(t, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned BlankMask32(__m256i v) {
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+    return ~(unsigned)_mm256_movemask_epi8(m);
+}
+
+#define SCAN32(NAME, MASKFN)                                                \
+__attribute__((target("avx2")))                                             \
+static size_t NAME(const char* p) {                                         \
+    const char* s = (const char*)((uintptr_t)p & ~(uintptr_t)31);           \
+    unsigned mask = MASKFN(_mm256_load_si256((const __m256i*)s)) >> (p - s);\
+    if (mask != 0) {                                                        \
+        return __builtin_ctz(mask);                                         \
+    }                                                                       \
+    while (1) {                                                             \
+        s += 32;                                                            \
+        mask = MASKFN(_mm256_load_si256((const __m256i*)s));                \
+        if (mask != 0) {                                                    \
+            return s + __builtin_ctz(mask) - p;                             \
+        }                                                                   \
+    }                                                                       \
+}
+
+__attribute__((target("avx2")))
+static inline unsigned SlashMask32(__m256i v) {
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+    return (unsigned)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned StringMask32(__m256i v) {
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))));
+    return (unsigned)_mm256_movemask_epi8(m);
+}
+
+SCAN32(ScanLineAVX2, LineMask32)
+SCAN32(ScanNameAVX2, NameMask32)
+SCAN32(SkipBlanksAVX2, BlankMask32)
+SCAN32(ScanSlashAVX2, SlashMask32)
+SCAN32(ScanStringAVX2, StringMask32)
+
+__attribute__((target("avx2")))
+static size_t ScanCommentEndAVX2(const char* p) {
+    const char* s = (const char*)((uintptr_t)p & ~(uintptr_t)31);
+    unsigned valid = 0xFFFFFFFFu << (p - s);
+    unsigned carry = 0;
+    while (1) {
+        __m256i v = _mm256_load_si256((const __m256i*)s);
+        unsigned star = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*'))) & valid;
+        unsigned slash = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+        unsigned nul = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())) & valid;
+        unsigned hit = slash & ((star << 1) | carry);
+        if (hit != 0 || nul != 0) {
+            int nHit = hit != 0 ? __builtin_ctz(hit) - 1 : 32;
+            int nNul = nul != 0 ? __builtin_ctz(nul) : 32;
+            return s + (nHit < nNul ? nHit : nNul) - p;
+        }
+        carry = star >> 31;
+        valid = 0xFFFFFFFFu;
+        s += 32;
+    }
+}
+
+static int GetCpuLevel(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return LEX_AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return LEX_SSSE3;
+    }
+    return LEX_SCALAR;
+}
+
+#else
+
+static int GetCpuLevel(void) {
+    return LEX_SCALAR;
+}
+
+#endif
+
+// the first call of a scanner selects the implementation
+
+static size_t ScanLineAuto(const char* p) {
+    LexScanSetLevel(LEX_AUTO);
+    return g_LexScan.pfnScanLine(p);
+}
+
+static size_t ScanNameAuto(const char* p) {
+    LexScanSetLevel(LEX_AUTO);
+    return g_LexScan.pfnScanName(p);
+}
+
+static size_t SkipBlanksAuto(const char* p) {
+    LexScanSetLevel(LEX_AUTO);
+    return g_LexScan.pfnSkipBlanks(p);
+}
+
+static size_t ScanSlashAuto(const char* p) {
+    LexScanSetLevel(LEX_AUTO);
+    return g_LexScan.pfnScanSlash(p);
+}
+
+static size_t ScanCommentEndAuto(const char* p) {
+    LexScanSetLevel(LEX_AUTO);
+    return g_LexScan.pfnScanCommentEnd(p);
+}
+
+static size_t ScanStringAuto(const char* p) {
+    LexScanSetLevel(LEX_AUTO);
+    return g_LexScan.pfnScanString(p);
+}
+
+struct LEXSCAN g_LexScan = { ScanLineAuto, ScanNameAuto, SkipBlanksAuto, ScanSlashAuto, ScanCommentEndAuto, ScanStringAuto };
+
+// select the scanner implementation
+// a level not supported by the cpu is lowered
+// returns the level selected
+
+int LexScanSetLevel(int nLevel) {
+    int nCpuLevel = GetCpuLevel();
+    if (nLevel < 0 || nLevel > nCpuLevel) {
+        nLevel = nCpuLevel;
+    }
+    g_LexScan.pfnScanLine = ScanLineScalar;
+    g_LexScan.pfnScanName = ScanNameScalar;
+    g_LexScan.pfnSkipBlanks = SkipBlanksScalar;
+    g_LexScan.pfnScanSlash = ScanSlashScalar;
+    g_LexScan.pfnScanCommentEnd = ScanCommentEndScalar;
+    g_LexScan.pfnScanString = ScanStringScalar;
+#if LEXSCAN_X86
+    if (nLevel > LEX_SCALAR) {
+        InitNibbleTables();
+    }
+    if (nLevel == LEX_SSSE3) {
+        g_LexScan.pfnScanLine = ScanLineSSSE3;
+        g_LexScan.pfnScanName = ScanNameSSSE3;
+        g_LexScan.pfnSkipBlanks = SkipBlanksSSSE3;
+        g_LexScan.pfnScanSlash = ScanSlashSSSE3;
+        g_LexScan.pfnScanCommentEnd = ScanCommentEndSSSE3;
+        g_LexScan.pfnScanString = ScanStringSSSE3;
+    } else if (nLevel == LEX_AVX2) {
+        g_LexScan.pfnScanLine = ScanLineAVX2;
+        g_LexScan.pfnScanName = ScanNameAVX2;
+        g_LexScan.pfnSkipBlanks = SkipBlanksAVX2;
+        g_LexScan.pfnScanSlash = ScanSlashAVX2;
+        g_LexScan.pfnScanCommentEnd = ScanCommentEndAVX2;
+        g_LexScan.pfnScanString = ScanStringAVX2;
+    }
+#endif
+    g_nLexLevel = nLevel;
+    return nLevel;
+}
+
+int LexScanGetLevel(void) {
+    if (g_LexScan.pfnScanLine == ScanLineAuto) {
+        LexScanSetLevel(LEX_AUTO);
+    }
+    return g_nLexLevel;
+}
+
+const char* LexScanLevelName(int nLevel) {
+    switch (nLevel) {
+    case LEX_SSSE3:
+        return "ssse3";
+    case LEX_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
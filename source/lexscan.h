@@ -0,0 +1,83 @@
+#ifndef LEXSCAN_H
+#define LEXSCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// character classes of the tokenizer
+enum {
+    LC_DELIM    = 0x01,     // delimiter, always a token of its own
+    LC_BLANK    = 0x02,     // space or tab
+    LC_EOL      = 0x04,     // '\r' or '\n'
+    LC_NUL      = 0x08,     // end of string
+    LC_OP2      = 0x10,     // first char of a 2-byte operator
+    LC_ALPHA    = 0x20,     // letter, '_', '?' or '@'
+    LC_DIGIT    = 0x40,     // '0'..'9'
+    LC_NUMOP    = 0x80,     // arithmetic operator: - + * / | &
+};
+
+// scanner implementations
+enum {
+    LEX_AUTO    = -1,       // best one supported by the cpu
+    LEX_SCALAR  = 0,
+    LEX_SSSE3   = 1,        // 16 bytes at a time
+    LEX_AVX2    = 2,        // 32 bytes at a time
+};
+
+struct LEXSCAN {
+    size_t (*pfnScanLine)(const char*);
+    size_t (*pfnScanName)(const char*);
+    size_t (*pfnSkipBlanks)(const char*);
+    size_t (*pfnScanSlash)(const char*);
+    size_t (*pfnScanCommentEnd)(const char*);
+    size_t (*pfnScanString)(const char*);
+};
+
+extern const uint8_t g_bLexClass[256];
+extern struct LEXSCAN g_LexScan;
+
+int LexScanSetLevel(int nLevel);
+int LexScanGetLevel(void);
+const char* LexScanLevelName(int nLevel);
+
+// number of chars up to the first '\r', '\n' or '\0'
+
+static inline size_t LexScanLine(const char* p) {
+    return g_LexScan.pfnScanLine(p);
+}
+
+// number of chars up to the first delimiter, blank or '\0'
+
+static inline size_t LexScanName(const char* p) {
+    return g_LexScan.pfnScanName(p);
+}
+
+// number of spaces and tabs at p
+
+static inline size_t LexSkipBlanks(const char* p) {
+    return g_LexScan.pfnSkipBlanks(p);
+}
+
+// number of chars up to the first '/' or '\0'
+
+static inline size_t LexScanSlash(const char* p) {
+    return g_LexScan.pfnScanSlash(p);
+}
+
+// number of chars up to the first "*/" or '\0'
+
+static inline size_t LexScanCommentEnd(const char* p) {
+    return g_LexScan.pfnScanCommentEnd(p);
+}
+
+// number of chars up to the first '"', '\\' or '\0'
+
+static inline size_t LexScanString(const char* p) {
+    return g_LexScan.pfnScanString(p);
+}
+
+static inline int LexIsClass(char c, uint8_t bClass) {
+    return (g_bLexClass[(uint8_t)c] & bClass) != 0;
+}
+
+#endif // LEXSCAN_H
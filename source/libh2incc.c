@@ -0,0 +1,203 @@
+#include "libh2incc.h"
+#include "h2incc.h"
+#include "incfile.h"
+#include "stats.h"
+#include "vector.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct h2incc_context {
+    struct OPTIONSTATE* pDefaultOptions;    // options before any h2incc_convert
+};
+
+static struct h2incc_context* g_pActiveContext;
+
+static void DiscardDiagnostic(void* pContext, const char* pszText) {
+}
+
+struct h2incc_context* h2incc_create(const char* pProfile, size_t dwProfileSize) {
+    struct h2incc_context* pContext;
+    char* pProfileCopy = NULL;
+
+    if (g_pActiveContext != NULL) {
+        return NULL;
+    }
+    pContext = xmalloc(sizeof(struct h2incc_context));
+    if (pContext == NULL) {
+        return NULL;
+    }
+    if (g_pszIncDirs == NULL) {
+        g_pszIncDirs = VECTOR_CHARP_CREATE();
+    }
+    if (g_pszDefines == NULL) {
+        g_pszDefines = VECTOR_CHARP_CREATE();
+    }
+    if (g_pszIncDirs == NULL || g_pszDefines == NULL) {
+        free(pContext);
+        return NULL;
+    }
+    // LoadTablesFromProfile expects a terminated string
+    if (pProfile != NULL) {
+        pProfileCopy = xmalloc(dwProfileSize + 1);
+        if (pProfileCopy == NULL) {
+            free(pContext);
+            return NULL;
+        }
+        memcpy(pProfileCopy, pProfile, dwProfileSize);
+        pProfileCopy[dwProfileSize] = '\0';
+    }
+    LoadTablesFromProfile(pProfileCopy, dwProfileSize);
+    free(pProfileCopy);
+    ConvertTables();
+    g_pszOutDir = ".";
+    pContext->pDefaultOptions = SaveOptions();
+    g_pActiveContext = pContext;
+    return pContext;
+}
+
+void h2incc_destroy(struct h2incc_context* pContext) {
+    if (pContext == NULL) {
+        return;
+    }
+    RestoreOptions(pContext->pDefaultOptions);
+    free(pContext->pDefaultOptions);
+    DestroyAnalyzerData();
+    DestroyStrings();
+    FreeProfileData();
+    g_pActiveContext = NULL;
+    free(pContext);
+}
+
+void h2incc_options_init(struct h2incc_options* pOptions) {
+    memset(pOptions, 0, sizeof(struct h2incc_options));
+}
+
+// translate the option struct to the global option variables
+
+static int ApplyOptions(const struct h2incc_options* pOptions) {
+    g_bAddAlign = pOptions->bAddAlign != 0;
+    g_bIncludeComments = pOptions->bIncludeComments != 0;
+    g_bPrefixReserved = pOptions->bPrefixReserved != 0;
+    g_bNoRecords = pOptions->bNoRecords != 0;
+    g_bRecordsInUnions = pOptions->bRecordsInUnions != 0;
+    g_bUntypedParams = pOptions->bUntypedParams != 0;
+    g_b64bit = pOptions->b64bit != 0;
+    switch (pOptions->dwDllImport) {
+    case 0:
+        break;
+    case 1:
+        g_bAssumeDllImport = 1;
+        break;
+    case 2:
+        g_bIgnoreDllImport = 1;
+        break;
+    case 3:
+        g_bUseDefProto = 1;
+        break;
+    default:
+        return 0;
+    }
+    if (pOptions->dwWarningLevel < 0 || pOptions->dwWarningLevel > MAXWARNINGLVL) {
+        return 0;
+    }
+    g_bWarningLevel = (uint8_t)pOptions->dwWarningLevel;
+    switch (pOptions->cCallConv) {
+    case '\0':
+        break;
+    case 'c':
+        g_dwDefCallConv |= FQ_CDECL;
+        break;
+    case 's':
+        g_dwDefCallConv |= FQ_STDCALL;
+        break;
+    case 'p':
+        g_dwDefCallConv |= FQ_PASCAL;
+        break;
+    case 'y':
+        g_dwDefCallConv |= FQ_SYSCALL;
+        break;
+    default:
+        return 0;
+    }
+    if (pOptions->pszSelection != NULL) {
+        g_bConstants = 0;
+        g_bTypedefs = 0;
+        g_bPrototypes = 0;
+        g_bExternals = 0;
+        for (const char* p = pOptions->pszSelection; *p != '\0'; p++) {
+            switch (*p) {
+            case 'c':
+                g_bConstants = 1;
+                break;
+            case 'e':
+                g_bExternals = 1;
+                break;
+            case 'p':
+                g_bPrototypes = 1;
+                break;
+            case 't':
+                g_bTypedefs = 1;
+                break;
+            default:
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+int h2incc_convert(struct h2incc_context* pContext, const struct h2incc_options* pOptions,
+                   const char* pszName, const char* pSource, size_t dwSourceSize,
+                   char* pOutput, size_t dwOutputSize, size_t* pdwOutputSize) {
+    struct INCFILE* pIncFile;
+    int rc = H2INCC_OK;
+
+    *pdwOutputSize = 0;
+    if (pContext != g_pActiveContext) {
+        return H2INCC_ERROR_CONTEXT;
+    }
+    RestoreOptions(pContext->pDefaultOptions);
+    if (!ApplyOptions(pOptions)) {
+        RestoreOptions(pContext->pDefaultOptions);
+        return H2INCC_ERROR_OPTIONS;
+    }
+    g_bNoFileIO = 1;
+    g_pfnDiagnostic = pOptions->pfnDiagnostic != NULL ? pOptions->pfnDiagnostic : DiscardDiagnostic;
+    g_pDiagnosticContext = pOptions->pContext;
+    g_pfnLoadInclude = pOptions->pfnLoadInclude;
+    g_pLoadIncludeContext = pOptions->pContext;
+    g_bTerminate = 0;
+    g_dwStructSuffix = 0;
+
+    pIncFile = CreateIncFileFromMemory(pszName, pSource, dwSourceSize, NULL);
+    if (pIncFile == NULL) {
+        rc = H2INCC_ERROR_MEMORY;
+        goto exit;
+    }
+    ParserIncFile(pIncFile);
+    AnalyzerIncFile(pIncFile);
+    if (GetErrorsIncFile(pIncFile) != 0) {
+        rc = H2INCC_ERROR_SOURCE;
+    } else {
+        const char* pszResult = GetOutputIncFile(pIncFile);
+        size_t dwLength = strlen(pszResult);
+        *pdwOutputSize = dwLength;
+        if (dwLength < dwOutputSize) {
+            memcpy(pOutput, pszResult, dwLength + 1);
+        } else {
+            rc = H2INCC_ERROR_BUFFER;
+        }
+    }
+    DestroyIncFile(pIncFile);
+exit:
+    DestroyAnalyzerData();
+    DestroyStrings();
+    g_pfnDiagnostic = NULL;
+    g_pDiagnosticContext = NULL;
+    g_pfnLoadInclude = NULL;
+    g_pLoadIncludeContext = NULL;
+    g_bNoFileIO = 0;
+    RestoreOptions(pContext->pDefaultOptions);
+    return rc;
+}
@@ -0,0 +1,76 @@
+#ifndef LIBH2INCC_H
+#define LIBH2INCC_H
+
+// h2incc library interface
+//
+// converts a C header held in memory to a MASM include file in a caller
+// supplied buffer. The library does no file I/O and writes nothing to
+// stdout or stderr.
+//
+// The converter keeps its tables in global variables, so only one context
+// may exist at a time and calls must not be made from several threads.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    H2INCC_OK               = 0,
+    H2INCC_ERROR_OPTIONS    = 1,    // invalid option value
+    H2INCC_ERROR_MEMORY     = 2,    // out of memory
+    H2INCC_ERROR_SOURCE     = 3,    // errors occured while converting the source
+    H2INCC_ERROR_BUFFER     = 4,    // output buffer too small
+    H2INCC_ERROR_CONTEXT    = 5,    // another context is active
+};
+
+// receives the text of warnings and errors
+// a message may be passed in several pieces, the last one ends with '\n'
+typedef void (*h2incc_diagnostic)(void* pContext, const char* pszText);
+
+// resolves an #include line: pszDirPath is the directory of the including
+// header, pszName the name in the #include line.
+// returns nonzero and sets *ppData and *pdwSize if the header was found.
+// the data must stay valid until h2incc_convert returns.
+typedef int (*h2incc_include_loader)(void* pContext, const char* pszDirPath, const char* pszName, const char** ppData, size_t* pdwSize);
+
+struct h2incc_options {
+    int bAddAlign;                          // -a
+    int bIncludeComments;                   // -c
+    int dwDllImport;                        // -d0|1|2|3
+    int bPrefixReserved;                    // -f
+    char cCallConv;                         // -k c|s|p|y, 0 for default
+    int bNoRecords;                         // -q
+    int bRecordsInUnions;                   // -r
+    const char* pszSelection;               // -s, any of "cpte", NULL for everything
+    int bUntypedParams;                     // -u
+    int dwWarningLevel;                     // -W0|1|2|3
+    int b64bit;                             // -x
+    h2incc_diagnostic pfnDiagnostic;        // NULL: messages are discarded
+    h2incc_include_loader pfnLoadInclude;   // NULL: included headers are not analyzed
+    void* pContext;                         // passed to the callbacks
+};
+
+struct h2incc_context;
+
+// create a context, pProfile holds the contents of a h2incc.ini file
+// (NULL for the built-in defaults)
+struct h2incc_context* h2incc_create(const char* pProfile, size_t dwProfileSize);
+void h2incc_destroy(struct h2incc_context* pContext);
+
+void h2incc_options_init(struct h2incc_options* pOptions);
+
+// convert dwSourceSize bytes of pSource, pszName is used in messages.
+// the include file is written to pOutput, followed by a terminating 0.
+// *pdwOutputSize receives the length of the include file (without the
+// terminating 0), also if H2INCC_ERROR_BUFFER is returned.
+int h2incc_convert(struct h2incc_context* pContext, const struct h2incc_options* pOptions,
+                   const char* pszName, const char* pSource, size_t dwSourceSize,
+                   char* pOutput, size_t dwOutputSize, size_t* pdwOutputSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBH2INCC_H
@@ -1,5 +1,6 @@
 #include "list.h"
 #include "h2incc.h"
+#include "stats.h"
 #include "util.h"
 
 #include <stdio.h>
@@ -79,7 +80,7 @@ void* list_bsearch(void* key, void* base, uint32_t num, uint32_t width, int(*com
 }
 
 struct LIST* CreateList(uint32_t numItems, uint32_t itemSize) {
-    struct LIST* pList = malloc(sizeof(struct LIST) + itemSize * numItems);
+    struct LIST* pList = xmalloc(sizeof(struct LIST) + itemSize * numItems);
     if (pList == NULL) {
         return NULL;
     }
@@ -89,6 +90,25 @@ struct LIST* CreateList(uint32_t numItems, uint32_t itemSize) {
     return pList;
 }
 
+// create a copy of a list with the same capacity
+
+struct LIST* CloneList(const struct LIST* pList) {
+    if (pList == NULL) {
+        return NULL;
+    }
+    size_t dwCapacity = (char*)pList->pMax - (char*)LIST_START(pList);
+    struct LIST* pClone = xmalloc(sizeof(struct LIST) + dwCapacity);
+    if (pClone == NULL) {
+        return NULL;
+    }
+    size_t dwUsed = (char*)pList->pFree - (char*)LIST_START(pList);
+    memcpy(LIST_START(pClone), LIST_START(pList), dwUsed);
+    pClone->pFree = (char*)LIST_START(pClone) + dwUsed;
+    pClone->pMax = (char*)LIST_START(pClone) + dwCapacity;
+    pClone->dwSize = pList->dwSize;
+    return pClone;
+}
+
 void DestroyList(struct LIST* pList) {
     if (pList != NULL) {
         free(pList);
@@ -100,11 +120,11 @@ static int cmpproc2(const void* p1, const void* p2) {
 }
 
 // add an item in a list
-// return: inserted item or NULL
+// return: inserted item or NULL (list is full)
 
 void* AddItemList(struct LIST* pList, char* pItem) {
     if (pList->pFree == pList->pMax) {
-        abort();
+        return NULL;
     }
     struct NAMEITEM tmpItem;
     tmpItem.pszName = pItem;
@@ -113,12 +133,37 @@ void* AddItemList(struct LIST* pList, char* pItem) {
     if (pos == NULL) {
         pos = newpos;
     }
+    g_Stats.dwListInserts++;
+    g_Stats.dwListBytesMoved += (char*)pList->pFree - pos;
     memmove(pos + pList->dwSize, pos, (char*)pList->pFree - pos);
     pList->pFree = (char*)pList->pFree + pList->dwSize;
     ((struct NAMEITEM*)pos)->pszName = pItem;
     return pos;
 }
 
+// append an item to a list without searching
+// items must be appended in sorted order
+// return: appended item or NULL (list is full)
+
+void* AppendItemList(struct LIST* pList, char* pszName) {
+    if (pList->pFree == pList->pMax) {
+        return NULL;
+    }
+    char* pos = pList->pFree;
+    g_Stats.dwListInserts++;
+    pList->pFree = pos + pList->dwSize;
+    ((struct NAMEITEM*)pos)->pszName = pszName;
+    return pos;
+}
+
+// remove an item from a list
+
+void RemoveItemList(struct LIST* pList, void* pItem) {
+    char* pos = pItem;
+    memmove(pos, pos + pList->dwSize, (char*)pList->pFree - pos - pList->dwSize);
+    pList->pFree = (char*)pList->pFree - pList->dwSize;
+}
+
 // add an array of - already sorted! - items to a list
 
 void* AddItemArrayList(struct LIST* pList, struct NAMEITEM *pItems, uint32_t dwNum) {
@@ -147,6 +192,15 @@ void* GetNextItemList(struct LIST* pList, struct NAMEITEM* pPrevItem) {
     return res;
 }
 
+// get item at index or NULL
+
+void* GetItemList(const struct LIST* pList, uint32_t dwIndex) {
+    if (dwIndex >= GetNumItems(pList)) {
+        return NULL;
+    }
+    return (char*)LIST_START(pList) + dwIndex * pList->dwSize;
+}
+
 // find an item in a list
 
 void* FindItemList(struct LIST* pList, char* pszName) {
@@ -16,12 +16,16 @@ struct LISTITEM {
 };
 
 struct LIST* CreateList(uint32_t numItems, uint32_t itemSize);
+struct LIST* CloneList(const struct LIST*);
 void DestroyList(struct LIST*);
 void SortList(struct LIST*);
 void SortCSList(struct LIST*);
 void* AddItemList(struct LIST*, char* pszName);
+void* AppendItemList(struct LIST*, char* pszName);
+void RemoveItemList(struct LIST*, void* pItem);
 void* AddItemArrayList(struct LIST*, struct NAMEITEM* pItem, uint32_t dwItems);
 void* GetNextItemList(struct LIST*, struct NAMEITEM* pItem);
+void* GetItemList(const struct LIST*, uint32_t dwIndex);
 void* FindItemList(struct LIST*, char* pszName);
 uint32_t GetItemSizeList(const struct LIST*);
 uint32_t GetNumItemsList(const struct LIST*);
@@ -0,0 +1,110 @@
+#include "h2incc.h"
+#include "hotdecls.h"
+#include "server.h"
+#include "shake.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "timereport.h"
+#include "trace.h"
+#include "util.h"
+#include "vector.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// main
+// reads profile file
+// reads command line
+// loops thru all header files calling ProcessFile
+
+int main(int argc, char** argv, char** envp) {
+    size_t dwSize;
+    char* pIniContents;
+    char* lpFilePart;
+    char szOutDir[MAX_PATH];
+    char* pszIniPath;
+
+    g_argc = argc;
+    g_argv = argv;
+    g_envp = envp;
+
+    g_rc = 1;
+
+    g_pszIncDirs = VECTOR_CHARP_CREATE();
+    g_pszDefines = VECTOR_CHARP_CREATE();
+    if (g_pszIncDirs == NULL || g_pszDefines == NULL) {
+        fprintf(stderr, "fatal error: out of memory\n");
+        goto exit;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (getoption(argv[i])) {
+            goto main_er;
+        }
+    }
+
+    if (g_pszTimeReportJson != NULL) {
+        g_bTimeReport = 1;
+    }
+    if (g_pszHotDecls != NULL && !InitHotDecls(atoi(g_pszHotDecls))) {
+        goto main_er;
+    }
+    if (g_pszTrace != NULL && !OpenTrace(g_pszTrace, g_pszTraceFile != NULL ? g_pszTraceFile : "h2incc.trace.json")) {
+        goto exit;
+    }
+
+    // read h2incc.ini
+    BEGIN_TIMESPAN(TP_PROFILE, "(profile)");
+    pIniContents = ReadIniFile(g_pszIniPath, &dwSize);
+    LoadTablesFromProfile(pIniContents, dwSize);
+    free(pIniContents);
+    pIniContents = NULL;
+    ConvertTables();
+    END_TIMESPAN();
+    if (g_pszUseSnapshot != NULL && !LoadSnapshot(g_pszUseSnapshot)) {
+        goto exit;
+    }
+    if (g_bServer) {
+        if (g_pszOutDir == NULL) {
+            g_pszOutDir = ".";
+        }
+        g_rc = RunServer(g_pszFilespec);
+        goto exit;
+    }
+    if (g_pszFilespec == NULL) {
+main_er:
+        fprintf(stderr, "%s", szUsage);
+        goto exit;
+    }
+    if (g_pszOutDir == NULL) {
+        g_pszOutDir = ".";
+    }
+
+    ProcessFiles(g_pszFilespec);
+
+exit:
+    if (g_dwHotDecls) {
+        PrintHotDecls(stderr);
+        DestroyHotDecls();
+    }
+    if (g_bStats) {
+        PrintStats(stderr);
+        DestroyStats();
+    }
+    if (g_bTimeReport) {
+        PrintTimeReport(stderr);
+        if (g_pszTimeReportJson != NULL && !WriteTimeReportJson(g_pszTimeReportJson)) {
+            fprintf(stderr, "cannot write %s\n", g_pszTimeReportJson);
+        }
+        DestroyTimeReport();
+    }
+    CloseTrace();
+    DestroyShake();
+    ResetInputFiles();
+    UnloadSnapshot();
+    FreeProfileData();
+    DestroyStrings();
+    vector_free(g_pszIncDirs, NULL);
+    vector_free(g_pszDefines, NULL);
+    return g_rc;
+}
@@ -0,0 +1,295 @@
+#include "server.h"
+#include "h2incc.h"
+#include "incfile.h"
+#include "list.h"
+#include "stats.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// server mode
+//
+// The profile is loaded once at startup. If a base header is given on the
+// command line, it is analyzed once and the symbols it defines are kept
+// as a base symbol set which every request starts with. A snapshot loaded
+// with --use-snapshot is part of this base symbol set.
+//
+// Requests are read from stdin, one per line:
+//   CONVERT [options] path         convert a header file
+//   BUFFER [options] name size     convert the <size> bytes following the line,
+//                                  name is used for messages and includes
+//   QUIT                           terminate the server
+// Every request is answered on stdout with "OK <size>" or "ERROR <size>",
+// followed by a newline and <size> bytes: the generated include file
+// or an error message.
+
+#define MAXREQUESTLINE  (4 * MAX_PATH)
+#define MAXREQUESTARGS  64
+
+// symbol tables restored to the base set before every request
+
+static struct LIST** g_ppSymbolTables[] = {
+    &g_pStructures,
+    &g_pStructureTags,
+    &g_pMacros,
+#if PROTOSUMMARY
+    &g_pPrototypes,
+#endif
+#if TYPEDEFSUMMARY
+    &g_pTypedefs,
+#endif
+#if DYNPROTOQUALS
+    &g_pQualifiers,
+#endif
+    &g_pDefines,
+    &g_pConstants,
+    &g_pIncludeGuards,
+    &g_pSymbolGuards,
+};
+
+static struct LIST* g_pBaseTables[ARRAY_SIZE(g_ppSymbolTables)];
+static uint32_t g_dwBaseStructSuffix;
+
+// analyze the base header and save the symbol tables
+
+static int HarvestBaseFile(char* pszBaseFile) {
+    struct INCFILE* pIncFile = CreateIncFile(pszBaseFile, NULL);
+    if (pIncFile == NULL) {
+        return 0;
+    }
+    ParserIncFile(pIncFile);
+    AnalyzerIncFile(pIncFile);
+    DestroyIncFile(pIncFile);
+    return 1;
+}
+
+// clone a set of symbol tables
+// return: 0 if out of memory, the clones made so far are freed then
+
+static int CloneTables(struct LIST** ppClones, struct LIST* const* ppTables) {
+    for (size_t i = 0; i < ARRAY_SIZE(g_ppSymbolTables); i++) {
+        ppClones[i] = CloneList(ppTables[i]);
+        if (ppClones[i] == NULL && ppTables[i] != NULL) {
+            while (i != 0) {
+                DestroyList(ppClones[--i]);
+                ppClones[i] = NULL;
+            }
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int SaveBaseTables(void) {
+    struct LIST* pTables[ARRAY_SIZE(g_ppSymbolTables)];
+    for (size_t i = 0; i < ARRAY_SIZE(g_ppSymbolTables); i++) {
+        pTables[i] = *g_ppSymbolTables[i];
+    }
+    if (!CloneTables(g_pBaseTables, pTables)) {
+        return 0;
+    }
+    g_dwBaseStructSuffix = g_dwStructSuffix;
+    DestroyAnalyzerData();
+    SaveBaseStrings();
+    return 1;
+}
+
+// the strings of the previous request aren't used by any table then.
+// The base set is cloned first, if that fails the live tables are kept.
+
+static int RestoreBaseTables(void) {
+    struct LIST* pClones[ARRAY_SIZE(g_ppSymbolTables)];
+    if (!CloneTables(pClones, g_pBaseTables)) {
+        return 0;
+    }
+    DestroyAnalyzerData();
+    ResetStrings();
+    for (size_t i = 0; i < ARRAY_SIZE(g_ppSymbolTables); i++) {
+        *g_ppSymbolTables[i] = pClones[i];
+    }
+    g_dwStructSuffix = g_dwBaseStructSuffix;
+    return 1;
+}
+
+static void WriteResponse(const char* pszStatus, const char* pData, size_t dwSize) {
+    fprintf(stdout, "%s %u\n", pszStatus, (unsigned)dwSize);
+    fwrite(pData, 1, dwSize, stdout);
+    fflush(stdout);
+}
+
+static void WriteError(const char* pszMessage) {
+    WriteResponse("ERROR", pszMessage, strlen(pszMessage));
+}
+
+// split a request line into arguments
+// arguments may be enclosed in double quotes
+
+static int SplitRequest(char* pszLine, char** ppArgs) {
+    int numArgs = 0;
+    char* p = pszLine;
+    while (1) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (numArgs == MAXREQUESTARGS) {
+            return -1;
+        }
+        if (*p == '"') {
+            p++;
+            ppArgs[numArgs++] = p;
+            while (*p != '\0' && *p != '"') {
+                p++;
+            }
+        } else {
+            ppArgs[numArgs++] = p;
+            while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+                p++;
+            }
+        }
+        if (*p == '\0') {
+            break;
+        }
+        *p++ = '\0';
+    }
+    return numArgs;
+}
+
+// handle 1 CONVERT or BUFFER request
+// returns 0 if the request could not be read and the server should stop
+
+static int ServeRequest(char** ppArgs, int numArgs, int bBuffer, struct vector* pOutput) {
+    char* pData = NULL;
+    size_t dwSize = 0;
+    int rc;
+
+    if (bBuffer) {
+        if (numArgs < 3) {
+            WriteError("BUFFER requires a name and a size");
+            return 0;
+        }
+        char* pszEnd;
+        dwSize = strtoul(ppArgs[--numArgs], &pszEnd, 10);
+        if (*pszEnd != '\0') {
+            WriteError("invalid BUFFER size");
+            return 0;
+        }
+        pData = xmalloc(dwSize + 1);
+        if (pData == NULL || fread(pData, 1, dwSize, stdin) != dwSize) {
+            free(pData);
+            WriteError("BUFFER data incomplete");
+            return 0;
+        }
+    }
+
+    g_pszFilespec = NULL;
+    for (int i = 1; i < numArgs; i++) {
+        if (getoption(ppArgs[i])) {
+            free(pData);
+            WriteError("invalid option");
+            return 1;
+        }
+    }
+    if (g_pszFilespec == NULL) {
+        free(pData);
+        WriteError("no file name");
+        return 1;
+    }
+
+    if (!RestoreBaseTables()) {
+        free(pData);
+        WriteError("out of memory");
+        return 1;
+    }
+    ResetInputFiles();
+    pOutput->size = 0;
+    g_pOutputSink = pOutput;
+    if (bBuffer) {
+        rc = ProcessBuffer(g_pszFilespec, pData, dwSize);
+    } else {
+        rc = ProcessFile(g_pszFilespec, NULL);
+    }
+    g_pOutputSink = NULL;
+    free(pData);
+
+    if (rc) {
+        WriteResponse("OK", pOutput->data, pOutput->size);
+    } else {
+        WriteError("conversion failed");
+    }
+    return 1;
+}
+
+int RunServer(char* pszBaseFile) {
+    char szLine[MAXREQUESTLINE];
+    char* ppArgs[MAXREQUESTARGS];
+    struct OPTIONSTATE* pOptions;
+    struct vector* pOutput;
+    int rc = 0;
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    if (pszBaseFile != NULL) {
+        if (g_bVerbose) {
+            fprintf(stderr, "server: base file '%s'\n", pszBaseFile);
+        }
+        if (!HarvestBaseFile(pszBaseFile)) {
+            return 1;
+        }
+    }
+    if (!SaveBaseTables()) {
+        diag_printf("fatal error: out of memory\n");
+        DestroyAnalyzerData();
+        DestroyStrings();
+        return 1;
+    }
+    pOptions = SaveOptions();
+    pOutput = vector_create(sizeof(char));
+    if (pOutput == NULL) {
+        diag_printf("fatal error: out of memory\n");
+        g_bTerminate = 1;
+        rc = 1;
+    }
+    while (!g_bTerminate && fgets(szLine, sizeof(szLine), stdin) != NULL) {
+        int numArgs = SplitRequest(szLine, ppArgs);
+        if (numArgs == 0) {
+            continue;
+        }
+        if (numArgs < 0) {
+            WriteError("too many arguments");
+            continue;
+        }
+        if (strcmp(ppArgs[0], "QUIT") == 0) {
+            break;
+        } else if (strcmp(ppArgs[0], "CONVERT") == 0 || strcmp(ppArgs[0], "BUFFER") == 0) {
+            int bContinue = ServeRequest(ppArgs, numArgs, ppArgs[0][0] == 'B', pOutput);
+            RestoreOptions(pOptions);
+            if (!bContinue) {
+                rc = 1;
+                break;
+            }
+        } else {
+            WriteError("unknown request");
+        }
+    }
+    vector_free(pOutput, NULL);
+    free(pOptions);
+    DestroyAnalyzerData();
+    for (size_t i = 0; i < ARRAY_SIZE(g_pBaseTables); i++) {
+        DestroyList(g_pBaseTables[i]);
+        g_pBaseTables[i] = NULL;
+    }
+    DestroyStrings();
+    return rc;
+}
@@ -0,0 +1,6 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+int RunServer(char* pszBaseFile);
+
+#endif // SERVER_H
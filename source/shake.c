@@ -0,0 +1,567 @@
+#include "shake.h"
+#include "h2incc.h"
+#include "util.h"
+#include "vector.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NONE ((uint32_t)-1)
+
+// kinds of the lines of the collected output
+enum {
+    LK_DROP,            // comment, include or anything else not declaring a name
+    LK_DECL,            // line of a declaration
+    LK_IF,              // if, ife, ifdef, ifndef
+    LK_ELSE,            // elseif, else
+    LK_ENDIF,
+};
+
+struct SHAKELINE {
+    size_t dwStart;             // offset in the collected output
+    size_t dwLength;            // including the line end
+    uint32_t dwOwner;           // declaration (LK_DECL) or conditional of the line
+    uint8_t bKind;
+};
+
+// a declaration is a single line, a struct/union up to its "ends" or a
+// macro up to its "endm"
+struct SHAKEDECL {
+    uint32_t dwFirstLine;
+    uint32_t dwLastLine;
+    uint32_t dwCond;            // innermost conditional enclosing it
+    uint8_t bKept;
+};
+
+struct SHAKECOND {
+    uint32_t dwParent;
+    uint32_t dwFirstLine;       // the if line
+    uint32_t dwLastLine;        // the endif line
+    uint8_t bKept;
+};
+
+// names are sorted, a name declared in several places (i.e. in both
+// branches of a conditional) has an entry for each declaration
+struct SHAKENAME {
+    const char* pName;          // not terminated
+    size_t dwLength;
+    uint32_t dwDecl;
+};
+
+struct SHAKE {
+    const char* pText;
+    struct vector* pLines;      // SHAKELINE
+    struct vector* pDecls;      // SHAKEDECL
+    struct vector* pConds;      // SHAKECOND
+    struct vector* pNames;      // SHAKENAME
+    struct vector* pPending;    // kept declarations whose names aren't scanned yet
+    int bOutOfMemory;
+};
+
+struct WORD {
+    const char* p;
+    size_t len;
+};
+
+char* g_pszShake;
+char* g_pszShakeAsm;
+
+static struct vector* g_pShakeText;     // output collected so far
+static struct vector* g_pShakeResult;
+
+static const char* g_pszIfWords[] = { "if", "ife", "ifdef", "ifndef", NULL };
+static const char* g_pszElseWords[] = { "elseif", "elseife", "elseifdef", "elseifndef", "else", NULL };
+static const char* g_pszBlockWords[] = { "struct", "union", NULL };
+static const char* g_pszDeclWords[] = { "equ", "=", "textequ", "typedef", "proto", "record", "label", NULL };
+
+// returns 0 if out of memory
+
+int AddShakeText(const char* pszText, size_t dwSize) {
+    if (g_pShakeText == NULL) {
+        g_pShakeText = vector_create(sizeof(char));
+        if (g_pShakeText == NULL) {
+            return 0;
+        }
+    }
+    return vector_append_array(g_pShakeText, pszText, dwSize);
+}
+
+static const char* GetWord(const char* p, const char* pEnd, struct WORD* pWord) {
+    while (p < pEnd && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    pWord->p = p;
+    while (p < pEnd && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+        p++;
+    }
+    pWord->len = p - pWord->p;
+    return p;
+}
+
+static int IsWordOf(const struct WORD* pWord, const char** ppszWords) {
+    for (; *ppszWords != NULL; ppszWords++) {
+        if (strlen(*ppszWords) == pWord->len && strnicmp(pWord->p, *ppszWords, pWord->len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int IsWord(const struct WORD* pWord, const char* pszWord) {
+    const char* ppszWords[] = { pszWord, NULL };
+    return IsWordOf(pWord, ppszWords);
+}
+
+static int IsNameChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '_' || c == '@' || c == '?' || c == '$';
+}
+
+static int CompareName(const struct SHAKENAME* pName, const char* p, size_t len) {
+    int rc = memcmp(pName->pName, p, pName->dwLength < len ? pName->dwLength : len);
+    if (rc != 0) {
+        return rc;
+    }
+    if (pName->dwLength != len) {
+        return pName->dwLength < len ? -1 : 1;
+    }
+    return 0;
+}
+
+static int CompareNames(const void* p1, const void* p2) {
+    const struct SHAKENAME* pName1 = p1;
+    const struct SHAKENAME* pName2 = p2;
+    int rc = CompareName(pName1, pName2->pName, pName2->dwLength);
+    if (rc != 0) {
+        return rc;
+    }
+    return pName1->dwDecl < pName2->dwDecl ? -1 : pName1->dwDecl > pName2->dwDecl;
+}
+
+static struct SHAKELINE* GetLine(struct SHAKE* pShake, uint32_t dwLine) {
+    return vector_get(pShake->pLines, dwLine);
+}
+
+static struct SHAKEDECL* GetDecl(struct SHAKE* pShake, uint32_t dwDecl) {
+    return vector_get(pShake->pDecls, dwDecl);
+}
+
+static struct SHAKECOND* GetCond(struct SHAKE* pShake, uint32_t dwCond) {
+    return vector_get(pShake->pConds, dwCond);
+}
+
+// returns NONE if out of memory
+
+static uint32_t AddDecl(struct SHAKE* pShake, uint32_t dwLine, uint32_t dwCond, const struct WORD* pName) {
+    struct SHAKEDECL decl;
+    decl.dwFirstLine = dwLine;
+    decl.dwLastLine = dwLine;
+    decl.dwCond = dwCond;
+    decl.bKept = 0;
+    if (!vector_append(pShake->pDecls, &decl)) {
+        return NONE;
+    }
+    uint32_t dwDecl = (uint32_t)pShake->pDecls->size - 1;
+    if (pName->len != 0) {
+        struct SHAKENAME name;
+        name.pName = pName->p;
+        name.dwLength = pName->len;
+        name.dwDecl = dwDecl;
+        if (!vector_append(pShake->pNames, &name)) {
+            return NONE;
+        }
+    }
+    return dwDecl;
+}
+
+// the name declared by a line which isn't a struct or macro
+// returns 0 if the line doesn't declare anything
+
+static int GetDeclName(const struct WORD* pWord1, const struct WORD* pWord2, const char* pEnd, struct WORD* pName) {
+    if (IsWord(pWord1, "externdef")) {
+        // externdef c name: type
+        const char* pColon = memchr(pWord2->p, ':', pEnd - pWord2->p);
+        if (pColon == NULL) {
+            return 0;
+        }
+        pName->p = pColon;
+        while (pName->p > pWord2->p && IsNameChar(pName->p[-1])) {
+            pName->p--;
+        }
+        pName->len = pColon - pName->p;
+        return pName->len != 0;
+    }
+    if (IsWord(pWord1, "@DefProto")) {
+        // @DefProto impspec, name, callconv, ...
+        const char* pComma = memchr(pWord1->p, ',', pEnd - pWord1->p);
+        if (pComma == NULL) {
+            return 0;
+        }
+        GetWord(pComma + 1, pEnd, pName);
+        while (pName->len > 0 && !IsNameChar(pName->p[pName->len - 1])) {
+            pName->len--;
+        }
+        return pName->len != 0;
+    }
+    if (IsWordOf(pWord2, g_pszDeclWords)) {
+        *pName = *pWord1;
+        return 1;
+    }
+    return 0;
+}
+
+// split the collected output into declarations and conditionals
+// returns 0 if out of memory
+
+static int ParseShakeText(struct SHAKE* pShake, size_t dwSize) {
+    uint32_t dwCond = NONE;             // innermost open conditional
+    uint32_t dwDecl = NONE;             // open struct or macro
+    uint32_t dwDepth = 0;               // struct nesting, 0 inside a macro
+    size_t dwStart = 0;
+
+    while (dwStart < dwSize) {
+        const char* p = pShake->pText + dwStart;
+        const char* pEnd = memchr(p, '\n', dwSize - dwStart);
+        pEnd = pEnd != NULL ? pEnd + 1 : pShake->pText + dwSize;
+        uint32_t dwLine = (uint32_t)pShake->pLines->size;
+        struct SHAKELINE line;
+        struct WORD word1;
+        struct WORD word2;
+        struct WORD name;
+
+        line.dwStart = dwStart;
+        line.dwLength = pEnd - p;
+        line.dwOwner = NONE;
+        line.bKind = LK_DROP;
+        GetWord(GetWord(p, pEnd, &word1), pEnd, &word2);
+        if (dwDecl != NONE) {
+            int bEnd = 0;
+            line.bKind = LK_DECL;
+            line.dwOwner = dwDecl;
+            if (dwDepth == 0) {
+                bEnd = IsWord(&word1, "endm");
+            } else if (IsWordOf(&word1, g_pszBlockWords) || IsWordOf(&word2, g_pszBlockWords)) {
+                dwDepth++;
+            } else if (IsWord(&word1, "ends") || IsWord(&word2, "ends")) {
+                bEnd = --dwDepth == 0;
+            }
+            if (bEnd) {
+                GetDecl(pShake, dwDecl)->dwLastLine = dwLine;
+                dwDecl = NONE;
+            }
+        } else if (word1.len == 0 || *word1.p == ';') {
+        } else if (IsWordOf(&word1, g_pszIfWords)) {
+            struct SHAKECOND cond;
+            cond.dwParent = dwCond;
+            cond.dwFirstLine = dwLine;
+            cond.dwLastLine = NONE;
+            cond.bKept = 0;
+            if (!vector_append(pShake->pConds, &cond)) {
+                return 0;
+            }
+            dwCond = (uint32_t)pShake->pConds->size - 1;
+            line.bKind = LK_IF;
+            line.dwOwner = dwCond;
+        } else if (IsWordOf(&word1, g_pszElseWords)) {
+            if (dwCond != NONE) {
+                line.bKind = LK_ELSE;
+                line.dwOwner = dwCond;
+            }
+        } else if (IsWord(&word1, "endif")) {
+            if (dwCond != NONE) {
+                line.bKind = LK_ENDIF;
+                line.dwOwner = dwCond;
+                GetCond(pShake, dwCond)->dwLastLine = dwLine;
+                dwCond = GetCond(pShake, dwCond)->dwParent;
+            }
+        } else if (IsWordOf(&word2, g_pszBlockWords) || IsWordOf(&word1, g_pszBlockWords)) {
+            // an unnamed struct is never written
+            name.len = 0;
+            if (IsWordOf(&word2, g_pszBlockWords)) {
+                name = word1;
+            }
+            dwDecl = AddDecl(pShake, dwLine, dwCond, &name);
+            if (dwDecl == NONE) {
+                return 0;
+            }
+            dwDepth = 1;
+            line.bKind = LK_DECL;
+            line.dwOwner = dwDecl;
+        } else if (IsWord(&word2, "macro")) {
+            dwDecl = AddDecl(pShake, dwLine, dwCond, &word1);
+            if (dwDecl == NONE) {
+                return 0;
+            }
+            dwDepth = 0;
+            line.bKind = LK_DECL;
+            line.dwOwner = dwDecl;
+        } else if (GetDeclName(&word1, &word2, pEnd, &name)) {
+            line.bKind = LK_DECL;
+            line.dwOwner = AddDecl(pShake, dwLine, dwCond, &name);
+            if (line.dwOwner == NONE) {
+                return 0;
+            }
+        }
+        if (!vector_append(pShake->pLines, &line)) {
+            return 0;
+        }
+        dwStart += line.dwLength;
+    }
+    uint32_t dwLastLine = (uint32_t)pShake->pLines->size - 1;
+    if (dwDecl != NONE) {
+        GetDecl(pShake, dwDecl)->dwLastLine = dwLastLine;
+    }
+    // a conditional without endif is never written
+    for (; dwCond != NONE; dwCond = GetCond(pShake, dwCond)->dwParent) {
+        struct SHAKECOND* pCond = GetCond(pShake, dwCond);
+        pCond->dwLastLine = dwLastLine;
+        for (uint32_t i = pCond->dwFirstLine; i <= dwLastLine; i++) {
+            struct SHAKELINE* pLine = GetLine(pShake, i);
+            if (pLine->bKind != LK_DECL && pLine->dwOwner == dwCond) {
+                pLine->bKind = LK_DROP;
+            }
+        }
+    }
+    return 1;
+}
+
+static int IsMacroLine(struct SHAKE* pShake, uint32_t dwLine) {
+    struct SHAKELINE* pLine = GetLine(pShake, dwLine);
+    const char* p = pShake->pText + pLine->dwStart;
+    const char* pEnd = p + pLine->dwLength;
+    struct WORD word1;
+    struct WORD word2;
+    GetWord(GetWord(p, pEnd, &word1), pEnd, &word2);
+    return IsWord(&word2, "macro");
+}
+
+static void KeepDecl(struct SHAKE* pShake, uint32_t dwDecl) {
+    struct SHAKEDECL* pDecl = GetDecl(pShake, dwDecl);
+    if (!pDecl->bKept) {
+        pDecl->bKept = 1;
+        if (!vector_append(pShake->pPending, &dwDecl)) {
+            pShake->bOutOfMemory = 1;
+        }
+    }
+}
+
+// keep all declarations of a name
+// returns 0 if the name isn't declared
+
+static int KeepName(struct SHAKE* pShake, const char* p, size_t len) {
+    size_t lo = 0;
+    size_t hi = pShake->pNames->size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (CompareName(vector_get(pShake->pNames, mid), p, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    int bFound = 0;
+    for (; lo < pShake->pNames->size; lo++) {
+        struct SHAKENAME* pName = vector_get(pShake->pNames, lo);
+        if (CompareName(pName, p, len) != 0) {
+            break;
+        }
+        KeepDecl(pShake, pName->dwDecl);
+        bFound = 1;
+    }
+    return bFound;
+}
+
+// keep the declarations of the names used in the text,
+// comments and strings are skipped
+
+static void KeepUsedNames(struct SHAKE* pShake, const char* p, const char* pEnd) {
+    while (p < pEnd) {
+        char c = *p;
+        if (c == ';') {
+            while (p < pEnd && *p != '\n') {
+                p++;
+            }
+        } else if (c == '"' || c == '\'') {
+            p++;
+            while (p < pEnd && *p != c && *p != '\n') {
+                p++;
+            }
+            p++;
+        } else if (IsNameChar(c)) {
+            const char* pName = p;
+            while (p < pEnd && IsNameChar(*p)) {
+                p++;
+            }
+            if (!(c >= '0' && c <= '9')) {
+                KeepName(pShake, pName, p - pName);
+            }
+        } else {
+            p++;
+        }
+    }
+}
+
+static void KeepUsedNamesOfLine(struct SHAKE* pShake, uint32_t dwLine) {
+    struct SHAKELINE* pLine = GetLine(pShake, dwLine);
+    KeepUsedNames(pShake, pShake->pText + pLine->dwStart, pShake->pText + pLine->dwStart + pLine->dwLength);
+}
+
+// a conditional is written if a declaration inside is,
+// the names used by its conditions are needed then
+
+static void KeepCond(struct SHAKE* pShake, uint32_t dwCond) {
+    while (dwCond != NONE && !GetCond(pShake, dwCond)->bKept) {
+        struct SHAKECOND* pCond = GetCond(pShake, dwCond);
+        pCond->bKept = 1;
+        uint32_t dwLastLine = pCond->dwLastLine;
+        for (uint32_t i = pCond->dwFirstLine; i <= dwLastLine; i++) {
+            struct SHAKELINE* pLine = GetLine(pShake, i);
+            if ((pLine->bKind == LK_IF || pLine->bKind == LK_ELSE) && pLine->dwOwner == dwCond) {
+                KeepUsedNamesOfLine(pShake, i);
+            }
+        }
+        dwCond = GetCond(pShake, dwCond)->dwParent;
+    }
+}
+
+// the member names of a struct aren't used names, a member line starts
+// with its name unless the member has none
+
+static void KeepPendingDecls(struct SHAKE* pShake) {
+    while (pShake->pPending->size > 0) {
+        uint32_t dwDecl = *(uint32_t*)vector_pop(pShake->pPending);
+        struct SHAKEDECL* pDecl = GetDecl(pShake, dwDecl);
+        int bStruct = pDecl->dwFirstLine != pDecl->dwLastLine && !IsMacroLine(pShake, pDecl->dwFirstLine);
+        for (uint32_t i = pDecl->dwFirstLine; i <= pDecl->dwLastLine; i++) {
+            struct SHAKELINE* pLine = GetLine(pShake, i);
+            const char* p = pShake->pText + pLine->dwStart;
+            const char* pEnd = p + pLine->dwLength;
+            if (bStruct && i != pDecl->dwFirstLine && IsNameChar(*p)) {
+                struct WORD word;
+                p = GetWord(p, pEnd, &word);
+            }
+            KeepUsedNames(pShake, p, pEnd);
+        }
+        KeepCond(pShake, pDecl->dwCond);
+    }
+}
+
+// the names of --shake and the names used in the files of --shake-asm
+// returns 0 if a file can't be read
+
+static int KeepWantedNames(struct SHAKE* pShake) {
+    const char* p = g_pszShake != NULL ? g_pszShake : "";
+    while (*p != '\0') {
+        size_t len = strcspn(p, ",");
+        if (len != 0 && !KeepName(pShake, p, len)) {
+            diag_printf("--shake: %.*s isn't declared\n", (int)len, p);
+        }
+        p += len;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    p = g_pszShakeAsm != NULL ? g_pszShakeAsm : "";
+    while (*p != '\0') {
+        char szFileName[MAX_PATH];
+        size_t len = strcspn(p, ",");
+        if (len != 0 && len < sizeof(szFileName)) {
+            size_t dwSize;
+            memcpy(szFileName, p, len);
+            szFileName[len] = '\0';
+            char* pData = ReadTextFile(szFileName, &dwSize);
+            if (pData == NULL) {
+                diag_printf("cannot read %s\n", szFileName);
+                return 0;
+            }
+            KeepUsedNames(pShake, pData, pData + dwSize);
+            free(pData);
+        }
+        p += len;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return 1;
+}
+
+// the declarations wanted and the conditionals enclosing them,
+// the collected output is reset
+// returns 0 if a file of --shake-asm can't be read or out of memory
+
+int ShakeText(const char** ppData, size_t* pdwSize) {
+    struct SHAKE shake;
+    size_t dwSize = g_pShakeText != NULL ? g_pShakeText->size : 0;
+    int rc = 0;
+
+    shake.pText = dwSize != 0 ? g_pShakeText->data : "";
+    shake.pLines = vector_create(sizeof(struct SHAKELINE));
+    shake.pDecls = vector_create(sizeof(struct SHAKEDECL));
+    shake.pConds = vector_create(sizeof(struct SHAKECOND));
+    shake.pNames = vector_create(sizeof(struct SHAKENAME));
+    shake.pPending = vector_create(sizeof(uint32_t));
+    shake.bOutOfMemory = 0;
+    if (g_pShakeResult == NULL) {
+        g_pShakeResult = vector_create(sizeof(char));
+    }
+    if (shake.pLines == NULL || shake.pDecls == NULL || shake.pConds == NULL || shake.pNames == NULL
+        || shake.pPending == NULL || g_pShakeResult == NULL || !ParseShakeText(&shake, dwSize)) {
+        goto out_of_memory;
+    }
+    qsort(shake.pNames->data, shake.pNames->size, sizeof(struct SHAKENAME), CompareNames);
+
+    rc = KeepWantedNames(&shake);
+    KeepPendingDecls(&shake);
+    if (shake.bOutOfMemory) {
+        goto out_of_memory;
+    }
+
+    g_pShakeResult->size = 0;
+    uint32_t dwKept = 0;
+    for (size_t i = 0; i < shake.pLines->size; i++) {
+        struct SHAKELINE* pLine = GetLine(&shake, (uint32_t)i);
+        int bKeep = 0;
+        if (pLine->bKind == LK_DECL) {
+            bKeep = GetDecl(&shake, pLine->dwOwner)->bKept;
+            dwKept += bKeep && GetDecl(&shake, pLine->dwOwner)->dwFirstLine == i;
+        } else if (pLine->bKind != LK_DROP) {
+            bKeep = GetCond(&shake, pLine->dwOwner)->bKept;
+        }
+        if (bKeep && !vector_append_array(g_pShakeResult, shake.pText + pLine->dwStart, pLine->dwLength)) {
+            goto out_of_memory;
+        }
+    }
+    if (g_bVerbose) {
+        fprintf(stderr, "%u of %u declarations written\n", dwKept, (unsigned)shake.pDecls->size);
+    }
+    *ppData = g_pShakeResult->data;
+    *pdwSize = g_pShakeResult->size;
+    goto exit;
+
+out_of_memory:
+    diag_printf("fatal error: out of memory\n");
+    g_bTerminate = 1;
+    rc = 0;
+exit:
+    vector_free(shake.pLines, NULL);
+    vector_free(shake.pDecls, NULL);
+    vector_free(shake.pConds, NULL);
+    vector_free(shake.pNames, NULL);
+    vector_free(shake.pPending, NULL);
+    ResetShake();
+    return rc;
+}
+
+void ResetShake(void) {
+    if (g_pShakeText != NULL) {
+        g_pShakeText->size = 0;
+    }
+}
+
+void DestroyShake(void) {
+    vector_free(g_pShakeText, NULL);
+    g_pShakeText = NULL;
+    vector_free(g_pShakeResult, NULL);
+    g_pShakeResult = NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef SHAKE_H
+#define SHAKE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// minimal include file (--shake, --shake-asm)
+// The output of the header and of the headers it includes is collected in
+// source order. Written are the declarations of the wanted names and the
+// declarations they use (struct member types, typedef targets, equates,
+// prototype parameters), together with the conditionals enclosing them.
+
+extern char* g_pszShake;                // --shake cmdline switch
+extern char* g_pszShakeAsm;             // --shake-asm cmdline switch
+
+#define SHAKE_ENABLED (g_pszShake != NULL || g_pszShakeAsm != NULL)
+
+int AddShakeText(const char* pszText, size_t dwSize);
+int ShakeText(const char** ppData, size_t* pdwSize);
+void ResetShake(void);
+void DestroyShake(void);
+
+#endif // SHAKE_H
@@ -0,0 +1,467 @@
+#include "snapshot.h"
+#include "h2incc.h"
+#include "incfile.h"
+#include "list.h"
+#include "stats.h"
+#include "util.h"
+#include "vector.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// symbol snapshot
+//
+// A snapshot contains the symbol tables as they are after a (base) header
+// has been analyzed, so other headers can be converted with this knowledge
+// without analyzing the base header again.
+//
+// File layout (all numbers are uint32_t in host byte order):
+//   header         struct SNAPSHOTHEADER
+//   tables         struct SNAPSHOTTABLE[SNT_MAX]
+//   table records  per table numItems * dwRecordSize numbers
+//   string pool    NUL terminated strings
+// Strings are referenced by their offset in the string pool. The file is
+// mapped into memory and the strings are used in place, so loading a
+// snapshot only has to fill the list items.
+//
+// records:
+//   structures, structure tags:  name
+//   macros:                      name, flags, containsAppend, numParams,
+//                                numContents, tokens (0: none, else offset + 1
+//                                of the numParams + numContents tokens)
+//   qualifiers:                  name, value
+//   defines:                     name, value (0: undefined, else offset + 1
+//                                of the value tokens, see --fold-if)
+//   include guards:              full path, guard macro (0: #pragma once,
+//                                else offset + 1)
+//
+// prototypes and typedefs are only collected for the summary and are
+// not part of a snapshot.
+
+#define SNAPSHOT_MAGIC      "H2INCSNP"
+#define SNAPSHOT_VERSION    4
+#define SNAPSHOT_BYTEORDER  0x01020304
+
+enum {
+    SNT_STRUCTURES,
+    SNT_STRUCTURETAGS,
+    SNT_MACROS,
+    SNT_QUALIFIERS,
+    SNT_DEFINES,
+    SNT_GUARDS,
+    SNT_MAX,
+};
+
+static const uint32_t g_dwRecordSizes[SNT_MAX] = { 1, 1, 6, 2, 2, 2 };
+
+struct SNAPSHOTHEADER {
+    char szMagic[8];
+    uint32_t dwVersion;
+    uint32_t dwByteOrder;
+    uint32_t dwStructSuffix;
+    uint32_t numTables;
+    uint32_t dwStringsOffset;
+    uint32_t dwStringsSize;
+};
+
+struct SNAPSHOTTABLE {
+    uint32_t numItems;
+    uint32_t dwOffset;
+};
+
+static char* g_pSnapshot;               // mapped or loaded snapshot file
+static size_t g_dwSnapshotSize;
+
+// write a snapshot
+// the records and strings are collected first, if one of the vectors
+// can't grow, the snapshot isn't written
+
+static int g_bSnapshotOutOfMemory;
+
+static void AddSnapshotData(struct vector* pVector, const void* pData, size_t dwSize) {
+    if (!vector_append_array(pVector, pData, dwSize)) {
+        g_bSnapshotOutOfMemory = 1;
+    }
+}
+
+static uint32_t AddSnapshotString(struct vector* pStrings, const char* pszString) {
+    uint32_t dwOffset = (uint32_t)pStrings->size;
+    AddSnapshotData(pStrings, pszString, strlen(pszString) + 1);
+    return dwOffset;
+}
+
+// a define value is a list of tokens terminated by an empty token
+
+static size_t GetTokensSize(const char* pszTokens) {
+    const char* p = pszTokens;
+    while (*p != '\0') {
+        p += strlen(p) + 1;
+    }
+    return p - pszTokens + 1;
+}
+
+static uint32_t AddSnapshotTokens(struct vector* pStrings, const char* pszTokens) {
+    uint32_t dwOffset = (uint32_t)pStrings->size;
+    AddSnapshotData(pStrings, pszTokens, GetTokensSize(pszTokens));
+    return dwOffset;
+}
+
+static void AddSnapshotNumber(struct vector* pRecords, uint32_t dwNumber) {
+    AddSnapshotData(pRecords, &dwNumber, 1);
+}
+
+static void AddSnapshotNames(struct vector* pRecords, struct vector* pStrings, struct LIST* pList) {
+    if (pList == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < GetNumItemsList(pList); i++) {
+        struct NAMEITEM* pItem = GetItemList(pList, i);
+        AddSnapshotNumber(pRecords, AddSnapshotString(pStrings, pItem->pszName));
+    }
+}
+
+static uint32_t AddSnapshotMacroTokens(struct vector* pStrings, const struct ITEM_MACROINFO* pMacro) {
+    if (pMacro->pszTokens == NULL) {
+        return 0;
+    }
+    const char* p = pMacro->pszTokens;
+    for (uint32_t i = 0; i < pMacro->numParams + pMacro->numContents; i++) {
+        p += strlen(p) + 1;
+    }
+    uint32_t dwOffset = (uint32_t)pStrings->size;
+    AddSnapshotData(pStrings, pMacro->pszTokens, p - pMacro->pszTokens);
+    return dwOffset + 1;
+}
+
+int WriteSnapshot(const char* pszFileName) {
+    struct vector* pRecords[SNT_MAX];
+    struct vector* pStrings = vector_create(sizeof(char));
+    struct SNAPSHOTHEADER header;
+    struct SNAPSHOTTABLE tables[SNT_MAX];
+    int rc = 0;
+
+    g_bSnapshotOutOfMemory = pStrings == NULL;
+    for (size_t i = 0; i < SNT_MAX; i++) {
+        pRecords[i] = vector_create(sizeof(uint32_t));
+        g_bSnapshotOutOfMemory |= pRecords[i] == NULL;
+    }
+    if (g_bSnapshotOutOfMemory) {
+        diag_printf("out of memory writing snapshot %s\n", pszFileName);
+        goto exit;
+    }
+    AddSnapshotNames(pRecords[SNT_STRUCTURES], pStrings, g_pStructures);
+    AddSnapshotNames(pRecords[SNT_STRUCTURETAGS], pStrings, g_pStructureTags);
+    if (g_pMacros != NULL) {
+        for (uint32_t i = 0; i < GetNumItemsList(g_pMacros); i++) {
+            struct ITEM_MACROINFO* pMacro = GetItemList(g_pMacros, i);
+            AddSnapshotNumber(pRecords[SNT_MACROS], AddSnapshotString(pStrings, pMacro->key));
+            AddSnapshotNumber(pRecords[SNT_MACROS], (uint32_t)pMacro->flags);
+            AddSnapshotNumber(pRecords[SNT_MACROS], (uint32_t)pMacro->containsAppend);
+            AddSnapshotNumber(pRecords[SNT_MACROS], pMacro->numParams);
+            AddSnapshotNumber(pRecords[SNT_MACROS], pMacro->numContents);
+            AddSnapshotNumber(pRecords[SNT_MACROS], AddSnapshotMacroTokens(pStrings, pMacro));
+        }
+    }
+#if DYNPROTOQUALS
+    if (g_pQualifiers != NULL) {
+        for (uint32_t i = 0; i < GetNumItemsList(g_pQualifiers); i++) {
+            struct LISTITEM* pItem = GetItemList(g_pQualifiers, i);
+            AddSnapshotNumber(pRecords[SNT_QUALIFIERS], AddSnapshotString(pStrings, pItem->name));
+            AddSnapshotNumber(pRecords[SNT_QUALIFIERS], pItem->value.u32);
+        }
+    }
+#endif
+    if (g_pDefines != NULL) {
+        for (uint32_t i = 0; i < GetNumItemsList(g_pDefines); i++) {
+            struct LISTITEM* pItem = GetItemList(g_pDefines, i);
+            AddSnapshotNumber(pRecords[SNT_DEFINES], AddSnapshotString(pStrings, pItem->name));
+            AddSnapshotNumber(pRecords[SNT_DEFINES], pItem->value.pStr != NULL ? AddSnapshotTokens(pStrings, pItem->value.pStr) + 1 : 0);
+        }
+    }
+    if (g_pIncludeGuards != NULL) {
+        for (uint32_t i = 0; i < GetNumItemsList(g_pIncludeGuards); i++) {
+            struct LISTITEM* pItem = GetItemList(g_pIncludeGuards, i);
+            AddSnapshotNumber(pRecords[SNT_GUARDS], AddSnapshotString(pStrings, pItem->name));
+            AddSnapshotNumber(pRecords[SNT_GUARDS], pItem->value.pStr != NULL ? AddSnapshotString(pStrings, pItem->value.pStr) + 1 : 0);
+        }
+    }
+    if (g_bSnapshotOutOfMemory) {
+        diag_printf("out of memory writing snapshot %s\n", pszFileName);
+        goto exit;
+    }
+
+    uint32_t dwOffset = sizeof(header) + sizeof(tables);
+    for (size_t i = 0; i < SNT_MAX; i++) {
+        tables[i].numItems = (uint32_t)(pRecords[i]->size / g_dwRecordSizes[i]);
+        tables[i].dwOffset = dwOffset;
+        dwOffset += (uint32_t)(pRecords[i]->size * sizeof(uint32_t));
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.szMagic, SNAPSHOT_MAGIC, sizeof(header.szMagic));
+    header.dwVersion = SNAPSHOT_VERSION;
+    header.dwByteOrder = SNAPSHOT_BYTEORDER;
+    header.dwStructSuffix = g_dwStructSuffix;
+    header.numTables = SNT_MAX;
+    header.dwStringsOffset = dwOffset;
+    header.dwStringsSize = (uint32_t)pStrings->size;
+
+    FILE* f = fopen(pszFileName, "wb");
+    if (f == NULL) {
+        diag_printf("cannot create snapshot %s\n", pszFileName);
+        goto exit;
+    }
+    int bOk = fwrite(&header, sizeof(header), 1, f) == 1;
+    bOk = bOk && fwrite(tables, sizeof(tables), 1, f) == 1;
+    for (size_t i = 0; i < SNT_MAX; i++) {
+        bOk = bOk && fwrite(pRecords[i]->data, sizeof(uint32_t), pRecords[i]->size, f) == pRecords[i]->size;
+    }
+    bOk = bOk && fwrite(pStrings->data, 1, pStrings->size, f) == pStrings->size;
+    if (fclose(f) != 0 || !bOk) {
+        diag_printf("write error on snapshot %s\n", pszFileName);
+        remove(pszFileName);
+        goto exit;
+    }
+    if (g_bVerbose) {
+        diag_printf("snapshot %s written: %u structures, %u macros, %u qualifiers\n", pszFileName,
+                tables[SNT_STRUCTURES].numItems, tables[SNT_MACROS].numItems, tables[SNT_QUALIFIERS].numItems);
+    }
+    rc = 1;
+exit:
+    for (size_t i = 0; i < SNT_MAX; i++) {
+        vector_free(pRecords[i], NULL);
+    }
+    vector_free(pStrings, NULL);
+    return rc;
+}
+
+// load a snapshot
+
+static char* MapSnapshot(const char* pszFileName, size_t* pdwSize) {
+#ifdef _WIN32
+    FILE* f = fopen(pszFileName, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long lSize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* pData = lSize > 0 ? xmalloc(lSize) : NULL;
+    if (pData != NULL && fread(pData, 1, lSize, f) != (size_t)lSize) {
+        free(pData);
+        pData = NULL;
+    }
+    fclose(f);
+    *pdwSize = lSize;
+    return pData;
+#else
+    struct stat fileStat;
+    int fd = open(pszFileName, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    char* pData = NULL;
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+        // private writable mapping: the strings are handed out as char*
+        pData = mmap(NULL, fileStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (pData == MAP_FAILED) {
+            pData = NULL;
+        }
+        *pdwSize = fileStat.st_size;
+    }
+    close(fd);
+    return pData;
+#endif
+}
+
+static void UnmapSnapshot(char* pData, size_t dwSize) {
+#ifdef _WIN32
+    free(pData);
+#else
+    munmap(pData, dwSize);
+#endif
+}
+
+// check that all offsets of a snapshot are within the file
+
+static int CheckSnapshot(const char* pData, size_t dwSize) {
+    const struct SNAPSHOTHEADER* pHeader = (const struct SNAPSHOTHEADER*)pData;
+    const struct SNAPSHOTTABLE* pTables = (const struct SNAPSHOTTABLE*)&pHeader[1];
+
+    if (dwSize < sizeof(*pHeader) + SNT_MAX * sizeof(*pTables)
+            || memcmp(pHeader->szMagic, SNAPSHOT_MAGIC, sizeof(pHeader->szMagic)) != 0
+            || pHeader->dwVersion != SNAPSHOT_VERSION
+            || pHeader->dwByteOrder != SNAPSHOT_BYTEORDER
+            || pHeader->numTables != SNT_MAX) {
+        return 0;
+    }
+    if (pHeader->dwStringsSize == 0 || pHeader->dwStringsOffset > dwSize
+            || dwSize - pHeader->dwStringsOffset < pHeader->dwStringsSize
+            || pData[pHeader->dwStringsOffset + pHeader->dwStringsSize - 1] != '\0') {
+        return 0;
+    }
+    for (size_t i = 0; i < SNT_MAX; i++) {
+        uint64_t dwTableSize = (uint64_t)pTables[i].numItems * g_dwRecordSizes[i] * sizeof(uint32_t);
+        if (pTables[i].dwOffset % sizeof(uint32_t) != 0 || pTables[i].dwOffset > dwSize
+                || dwSize - pTables[i].dwOffset < dwTableSize) {
+            return 0;
+        }
+        if (pTables[i].numItems > MAXITEMS) {
+            return 0;
+        }
+        const uint32_t* pRecords = (const uint32_t*)(pData + pTables[i].dwOffset);
+        for (uint32_t j = 0; j < pTables[i].numItems; j++) {
+            const uint32_t* pRecord = &pRecords[j * g_dwRecordSizes[i]];
+            if (pRecord[0] >= pHeader->dwStringsSize) {
+                return 0;
+            }
+            if (i == SNT_MACROS) {
+                // the tokens must end inside the string pool
+                uint64_t numTokens = (uint64_t)pRecord[3] + pRecord[4];
+                if (pRecord[5] == 0) {
+                    if (numTokens != 0) {
+                        return 0;
+                    }
+                    continue;
+                }
+                if (pRecord[5] > pHeader->dwStringsSize) {
+                    return 0;
+                }
+                const char* p = pData + pHeader->dwStringsOffset + pRecord[5] - 1;
+                const char* pEnd = pData + pHeader->dwStringsOffset + pHeader->dwStringsSize;
+                for (uint64_t k = 0; k < numTokens; k++) {
+                    if (p >= pEnd) {
+                        return 0;
+                    }
+                    p += strlen(p) + 1;
+                }
+            } else if (i == SNT_DEFINES && pRecord[1] != 0) {
+                // the value tokens must end inside the string pool
+                if (pRecord[1] > pHeader->dwStringsSize) {
+                    return 0;
+                }
+                const char* p = pData + pHeader->dwStringsOffset + pRecord[1] - 1;
+                const char* pEnd = pData + pHeader->dwStringsOffset + pHeader->dwStringsSize;
+                while (*p != '\0') {
+                    p += strlen(p) + 1;
+                    if (p >= pEnd) {
+                        return 0;
+                    }
+                }
+            } else if (i == SNT_GUARDS && pRecord[1] > pHeader->dwStringsSize) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static struct LIST* LoadSnapshotNames(const struct SNAPSHOTTABLE* pTable, char* pStrings) {
+    struct LIST* pList = CreateList(MAXITEMS, sizeof(void*));
+    if (pList == NULL) {
+        return NULL;
+    }
+    const uint32_t* pRecords = (const uint32_t*)(g_pSnapshot + pTable->dwOffset);
+    for (uint32_t i = 0; i < pTable->numItems; i++) {
+        AppendItemList(pList, pStrings + pRecords[i]);
+    }
+    return pList;
+}
+
+int LoadSnapshot(const char* pszFileName) {
+    g_pSnapshot = MapSnapshot(pszFileName, &g_dwSnapshotSize);
+    if (g_pSnapshot == NULL) {
+        diag_printf("cannot read snapshot %s\n", pszFileName);
+        return 0;
+    }
+    if (!CheckSnapshot(g_pSnapshot, g_dwSnapshotSize)) {
+        diag_printf("%s is not a valid snapshot\n", pszFileName);
+        UnloadSnapshot();
+        return 0;
+    }
+    const struct SNAPSHOTHEADER* pHeader = (const struct SNAPSHOTHEADER*)g_pSnapshot;
+    const struct SNAPSHOTTABLE* pTables = (const struct SNAPSHOTTABLE*)&pHeader[1];
+    char* pStrings = g_pSnapshot + pHeader->dwStringsOffset;
+
+    DestroyAnalyzerData();
+    g_pStructures = LoadSnapshotNames(&pTables[SNT_STRUCTURES], pStrings);
+    g_pStructureTags = LoadSnapshotNames(&pTables[SNT_STRUCTURETAGS], pStrings);
+    g_pMacros = CreateList(MAXITEMS, sizeof(struct ITEM_MACROINFO));
+    if (g_pStructures == NULL || g_pStructureTags == NULL || g_pMacros == NULL) {
+        diag_printf("out of memory loading snapshot %s\n", pszFileName);
+        UnloadSnapshot();
+        return 0;
+    }
+    const uint32_t* pRecords = (const uint32_t*)(g_pSnapshot + pTables[SNT_MACROS].dwOffset);
+    for (uint32_t i = 0; i < pTables[SNT_MACROS].numItems; i++, pRecords += 6) {
+        struct ITEM_MACROINFO* pMacro = AppendItemList(g_pMacros, pStrings + pRecords[0]);
+        pMacro->flags = pRecords[1];
+        pMacro->containsAppend = pRecords[2];
+        pMacro->numParams = pRecords[3];
+        pMacro->numContents = pRecords[4];
+        pMacro->pszTokens = pRecords[5] != 0 ? pStrings + pRecords[5] - 1 : NULL;
+    }
+#if DYNPROTOQUALS
+    uint32_t numQualifiers = pTables[SNT_QUALIFIERS].numItems;
+    g_pQualifiers = CreateList(numQualifiers > 0x400 ? numQualifiers : 0x400, sizeof(struct LISTITEM));
+    if (g_pQualifiers == NULL) {
+        diag_printf("out of memory loading snapshot %s\n", pszFileName);
+        UnloadSnapshot();
+        return 0;
+    }
+    pRecords = (const uint32_t*)(g_pSnapshot + pTables[SNT_QUALIFIERS].dwOffset);
+    for (uint32_t i = 0; i < numQualifiers; i++, pRecords += 2) {
+        struct LISTITEM* pItem = AppendItemList(g_pQualifiers, pStrings + pRecords[0]);
+        pItem->value.u32 = pRecords[1];
+    }
+#endif
+    g_pDefines = CreateList(MAXITEMS, sizeof(struct LISTITEM));
+    if (g_pDefines == NULL) {
+        diag_printf("out of memory loading snapshot %s\n", pszFileName);
+        UnloadSnapshot();
+        return 0;
+    }
+    pRecords = (const uint32_t*)(g_pSnapshot + pTables[SNT_DEFINES].dwOffset);
+    for (uint32_t i = 0; i < pTables[SNT_DEFINES].numItems; i++, pRecords += 2) {
+        struct LISTITEM* pItem = AppendItemList(g_pDefines, pStrings + pRecords[0]);
+        pItem->value.pStr = pRecords[1] != 0 ? pStrings + pRecords[1] - 1 : NULL;
+    }
+    g_pIncludeGuards = CreateList(MAXITEMS, sizeof(struct LISTITEM));
+    if (g_pIncludeGuards == NULL) {
+        diag_printf("out of memory loading snapshot %s\n", pszFileName);
+        UnloadSnapshot();
+        return 0;
+    }
+    pRecords = (const uint32_t*)(g_pSnapshot + pTables[SNT_GUARDS].dwOffset);
+    for (uint32_t i = 0; i < pTables[SNT_GUARDS].numItems; i++, pRecords += 2) {
+        struct LISTITEM* pItem = AppendItemList(g_pIncludeGuards, pStrings + pRecords[0]);
+        pItem->value.pStr = pRecords[1] != 0 ? pStrings + pRecords[1] - 1 : NULL;
+    }
+    g_dwStructSuffix = pHeader->dwStructSuffix;
+    if (g_bVerbose) {
+        diag_printf("snapshot %s loaded: %u structures, %u macros, %u qualifiers\n", pszFileName,
+                pTables[SNT_STRUCTURES].numItems, pTables[SNT_MACROS].numItems, pTables[SNT_QUALIFIERS].numItems);
+    }
+    return 1;
+}
+
+// release a snapshot
+// the symbol tables must not be used anymore
+
+void UnloadSnapshot(void) {
+    if (g_pSnapshot == NULL) {
+        return;
+    }
+    DestroyAnalyzerData();
+    UnmapSnapshot(g_pSnapshot, g_dwSnapshotSize);
+    g_pSnapshot = NULL;
+    g_dwSnapshotSize = 0;
+}
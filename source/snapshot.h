@@ -0,0 +1,8 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+int WriteSnapshot(const char* pszFileName);
+int LoadSnapshot(const char* pszFileName);
+void UnloadSnapshot(void);
+
+#endif // SNAPSHOT_H
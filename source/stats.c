@@ -0,0 +1,136 @@
+#include "stats.h"
+#include "h2incc.h"
+#include "list.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// symbol tables, sizes recorded with the counters of a file
+enum {
+    ST_STRUCTURES,
+    ST_STRUCTURETAGS,
+    ST_MACROS,
+    ST_DEFINES,
+    ST_INCLUDEGUARDS,
+    ST_MAX
+};
+
+struct FILESTATS {
+    struct FILESTATS* pNext;
+    uint32_t dwDepth;
+    struct STATS counters;      // including the headers it includes
+    uint32_t dwTableSizes[ST_MAX];
+    char szFileName[];
+};
+
+struct STATS g_Stats;
+uint8_t g_bStats;
+
+static struct FILESTATS* g_pFileStats;
+static struct FILESTATS** g_ppLastFileStats = &g_pFileStats;
+
+void* xmalloc(size_t dwSize) {
+    g_Stats.dwMallocs++;
+    g_Stats.dwMallocBytes += dwSize;
+    return malloc(dwSize);
+}
+
+void* xcalloc(size_t num, size_t dwSize) {
+    g_Stats.dwMallocs++;
+    g_Stats.dwMallocBytes += num * dwSize;
+    return calloc(num, dwSize);
+}
+
+// a realloc counts the size it grows to
+
+void* xrealloc(void* p, size_t dwSize) {
+    g_Stats.dwMallocs++;
+    g_Stats.dwMallocBytes += dwSize;
+    return realloc(p, dwSize);
+}
+
+static uint32_t GetTableSize(struct LIST* pList) {
+    return pList != NULL ? GetNumItemsList(pList) : 0;
+}
+
+// the counters are the difference to pStart, taken when the file was created.
+// Files are recorded when they are destroyed, so an included header comes
+// before the file including it.
+
+void RecordFileStats(const char* pszFileName, uint32_t dwDepth, const struct STATS* pStart) {
+    size_t len = strlen(pszFileName);
+    struct FILESTATS* pFileStats = malloc(sizeof(struct FILESTATS) + len + 1);
+    if (pFileStats == NULL) {
+        return;
+    }
+    pFileStats->pNext = NULL;
+    pFileStats->dwDepth = dwDepth;
+    const size_t* pdwStart = (const size_t*)pStart;
+    const size_t* pdwEnd = (const size_t*)&g_Stats;
+    size_t* pdwCounters = (size_t*)&pFileStats->counters;
+    for (size_t i = 0; i < sizeof(struct STATS) / sizeof(size_t); i++) {
+        pdwCounters[i] = pdwEnd[i] - pdwStart[i];
+    }
+    pFileStats->dwTableSizes[ST_STRUCTURES] = GetTableSize(g_pStructures);
+    pFileStats->dwTableSizes[ST_STRUCTURETAGS] = GetTableSize(g_pStructureTags);
+    pFileStats->dwTableSizes[ST_MACROS] = GetTableSize(g_pMacros);
+    pFileStats->dwTableSizes[ST_DEFINES] = GetTableSize(g_pDefines);
+    pFileStats->dwTableSizes[ST_INCLUDEGUARDS] = GetTableSize(g_pIncludeGuards);
+    memcpy(pFileStats->szFileName, pszFileName, len + 1);
+    *g_ppLastFileStats = pFileStats;
+    g_ppLastFileStats = &pFileStats->pNext;
+}
+
+static long GetPeakRSS(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#endif
+}
+
+static void PrintCounters(FILE* f, const struct STATS* pStats, uint32_t dwDepth, const char* pszName) {
+    fprintf(f, "%10lu %9lu %9lu %9lu %8lu %9lu %8lu %10lu %5lu/%-5lu %8lu %10lu  %*s%s\n",
+            (unsigned long)pStats->dwBytesRead, (unsigned long)pStats->dwTokens,
+            (unsigned long)pStats->dwTokensConsumed, (unsigned long)pStats->dwTokensScanned,
+            (unsigned long)pStats->dwRestores, (unsigned long)pStats->dwTokensRescanned,
+            (unsigned long)pStats->dwListInserts, (unsigned long)pStats->dwListBytesMoved,
+            (unsigned long)pStats->dwIncludesFound, (unsigned long)pStats->dwIncludes,
+            (unsigned long)pStats->dwMallocs, (unsigned long)pStats->dwMallocBytes,
+            (int)(2 * dwDepth), "", pszName);
+}
+
+// the counters of each file, including its headers, and of the whole run
+
+void PrintStats(FILE* f) {
+    fprintf(f, "     bytes    tokens  consumed lookahead restores rescanned  inserts bytesmoved    includes  mallocs mallocbytes  file\n");
+    for (struct FILESTATS* p = g_pFileStats; p != NULL; p = p->pNext) {
+        PrintCounters(f, &p->counters, p->dwDepth, p->szFileName);
+    }
+    PrintCounters(f, &g_Stats, 0, "(total)");
+    fprintf(f, "\nstructures      tags    macros   defines    guards  file\n");
+    for (struct FILESTATS* p = g_pFileStats; p != NULL; p = p->pNext) {
+        fprintf(f, "%10u %9u %9u %9u %9u  %*s%s\n", p->dwTableSizes[ST_STRUCTURES], p->dwTableSizes[ST_STRUCTURETAGS],
+                p->dwTableSizes[ST_MACROS], p->dwTableSizes[ST_DEFINES], p->dwTableSizes[ST_INCLUDEGUARDS],
+                (int)(2 * p->dwDepth), "", p->szFileName);
+    }
+    fprintf(f, "\n%lu headers skipped by their include guard, peak RSS %ld KB\n",
+            (unsigned long)g_Stats.dwIncludesGuarded, GetPeakRSS());
+}
+
+void DestroyStats(void) {
+    struct FILESTATS* p = g_pFileStats;
+    while (p != NULL) {
+        struct FILESTATS* pNext = p->pNext;
+        free(p);
+        p = pNext;
+    }
+    g_pFileStats = NULL;
+    g_ppLastFileStats = &g_pFileStats;
+}
@@ -0,0 +1,39 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// runtime counters (--stats)
+// The counters are always updated, an update is a single add. --stats
+// records them per converted file and prints them at exit.
+
+struct STATS {
+    size_t dwBytesRead;         // size of the headers
+    size_t dwTokens;            // tokens written by the tokenizer
+    size_t dwTokensConsumed;    // tokens read by the analyzer
+    size_t dwTokensScanned;     // tokens read by lookaheads (bSkipPP > 0)
+    size_t dwRestores;          // RestoreInputStatus calls
+    size_t dwTokensRescanned;   // tokens read again after RestoreInputStatus
+    size_t dwListInserts;       // items added to sorted lists
+    size_t dwListBytesMoved;    // bytes moved by these inserts
+    size_t dwIncludes;          // #include lines with a header name
+    size_t dwIncludesFound;     // included headers which were converted
+    size_t dwIncludesGuarded;   // included headers skipped by their guard
+    size_t dwMallocs;           // allocations of xmalloc, xcalloc and xrealloc
+    size_t dwMallocBytes;
+};
+
+extern struct STATS g_Stats;
+extern uint8_t g_bStats;                // --stats cmdline switch
+
+void* xmalloc(size_t dwSize);
+void* xcalloc(size_t num, size_t dwSize);
+void* xrealloc(void* p, size_t dwSize);
+
+void RecordFileStats(const char* pszFileName, uint32_t dwDepth, const struct STATS* pStart);
+void PrintStats(FILE* f);
+void DestroyStats(void);
+
+#endif // STATS_H
@@ -0,0 +1,303 @@
+#include "timereport.h"
+#include "vector.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#endif
+
+#define MAXSPANDEPTH    256     // spans nested deeper aren't timed
+
+struct PHASETIME {
+    uint32_t dwCalls;
+    uint32_t dwOpen;            // spans of the phase started and not ended
+    double total;               // outermost spans only, recursion isn't counted twice
+    double self;
+};
+
+struct TIMEFILE {
+    char* pszName;
+    size_t dwParent;            // file of the span this file was first seen in
+    uint32_t dwDepth;
+    struct PHASETIME phases[TP_MAX];
+};
+
+struct OPENSPAN {
+    int dwPhase;
+    size_t dwFile;
+    double start;
+    double children;            // time of the spans started inside this one
+};
+
+#define NOFILE ((size_t)-1)
+
+uint8_t g_bTimeReport;
+char* g_pszTimeReportJson;
+
+static const char* g_pszPhaseNames[TP_MAX] = {
+    "profile",
+    "parser",
+    "analyzer",
+    "typedef",
+    "define",
+    "prototype",
+    "macro",
+    "include",
+    "output",
+};
+
+static struct vector* g_pTimeFiles;     // struct TIMEFILE
+static struct OPENSPAN g_OpenSpans[MAXSPANDEPTH];
+static uint32_t g_dwSpanDepth;          // may exceed MAXSPANDEPTH
+static double g_wallTime;               // time of the outermost spans
+
+double GetTime(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static struct TIMEFILE* GetTimeFile(size_t dwFile) {
+    return vector_get(g_pTimeFiles, dwFile);
+}
+
+static size_t GetEnclosingFile(void) {
+    if (g_dwSpanDepth == 0 || g_dwSpanDepth > MAXSPANDEPTH) {
+        return NOFILE;
+    }
+    return g_OpenSpans[g_dwSpanDepth - 1].dwFile;
+}
+
+// spans are mostly started for the file of the enclosing span,
+// so the files are searched from there
+
+static size_t FindTimeFile(const char* pszName) {
+    size_t dwFile = GetEnclosingFile();
+    if (dwFile != NOFILE && strcmp(GetTimeFile(dwFile)->pszName, pszName) == 0) {
+        return dwFile;
+    }
+    for (size_t i = g_pTimeFiles->size; i > 0; i--) {
+        if (strcmp(GetTimeFile(i - 1)->pszName, pszName) == 0) {
+            return i - 1;
+        }
+    }
+    return NOFILE;
+}
+
+static size_t AddTimeFile(const char* pszName) {
+    struct TIMEFILE file;
+    memset(&file, 0, sizeof(file));
+    file.pszName = malloc(strlen(pszName) + 1);
+    if (file.pszName == NULL) {
+        return NOFILE;
+    }
+    strcpy(file.pszName, pszName);
+    file.dwParent = GetEnclosingFile();
+    if (file.dwParent != NOFILE) {
+        file.dwDepth = GetTimeFile(file.dwParent)->dwDepth + 1;
+    }
+    if (!vector_append(g_pTimeFiles, &file)) {
+        free(file.pszName);
+        return NOFILE;
+    }
+    return g_pTimeFiles->size - 1;
+}
+
+void BeginTimeSpan(int dwPhase, const char* pszName) {
+    if (g_dwSpanDepth >= MAXSPANDEPTH) {
+        g_dwSpanDepth++;
+        return;
+    }
+    if (g_pTimeFiles == NULL) {
+        g_pTimeFiles = vector_create(sizeof(struct TIMEFILE));
+    }
+    size_t dwFile = g_pTimeFiles != NULL ? FindTimeFile(pszName) : NOFILE;
+    if (dwFile == NOFILE && g_pTimeFiles != NULL) {
+        dwFile = AddTimeFile(pszName);
+    }
+    struct OPENSPAN* pSpan = &g_OpenSpans[g_dwSpanDepth++];
+    if (dwFile == NOFILE) {
+        // out of memory, the span is ignored
+        pSpan->dwFile = NOFILE;
+        return;
+    }
+    GetTimeFile(dwFile)->phases[dwPhase].dwOpen++;
+    pSpan->dwPhase = dwPhase;
+    pSpan->dwFile = dwFile;
+    pSpan->children = 0;
+    pSpan->start = GetTime();
+}
+
+void EndTimeSpan(void) {
+    double end = GetTime();
+    if (g_dwSpanDepth == 0) {
+        return;
+    }
+    g_dwSpanDepth--;
+    if (g_dwSpanDepth >= MAXSPANDEPTH) {
+        return;
+    }
+    struct OPENSPAN* pSpan = &g_OpenSpans[g_dwSpanDepth];
+    if (pSpan->dwFile == NOFILE) {
+        return;
+    }
+    double elapsed = end - pSpan->start;
+    struct PHASETIME* pPhase = &GetTimeFile(pSpan->dwFile)->phases[pSpan->dwPhase];
+    pPhase->dwCalls++;
+    pPhase->self += elapsed - pSpan->children;
+    if (--pPhase->dwOpen == 0) {
+        pPhase->total += elapsed;
+    }
+    if (g_dwSpanDepth != 0) {
+        g_OpenSpans[g_dwSpanDepth - 1].children += elapsed;
+    } else {
+        g_wallTime += elapsed;
+    }
+}
+
+struct TIMEROW {
+    const char* pszName;
+    int dwPhase;
+    struct PHASETIME time;
+};
+
+static int CompareTimeRows(const void* p1, const void* p2) {
+    const struct TIMEROW* pRow1 = p1;
+    const struct TIMEROW* pRow2 = p2;
+    if (pRow1->time.self != pRow2->time.self) {
+        return pRow1->time.self < pRow2->time.self ? 1 : -1;
+    }
+    return pRow1->dwPhase - pRow2->dwPhase;
+}
+
+static void PrintTimeRows(FILE* f, struct TIMEROW* pRows, size_t numRows) {
+    qsort(pRows, numRows, sizeof(struct TIMEROW), CompareTimeRows);
+    for (size_t i = 0; i < numRows; i++) {
+        struct TIMEROW* pRow = &pRows[i];
+        fprintf(f, "%-10s %8u %10.3f %10.3f %6.1f%%  %s\n", g_pszPhaseNames[pRow->dwPhase],
+                pRow->time.dwCalls, pRow->time.total * 1e3, pRow->time.self * 1e3,
+                g_wallTime > 0 ? 100.0 * pRow->time.self / g_wallTime : 0.0,
+                pRow->pszName != NULL ? pRow->pszName : "");
+    }
+}
+
+// a table of the phases over all files, then one of the phases of each file.
+// The rows are sorted by self time.
+
+void PrintTimeReport(FILE* f) {
+    if (g_pTimeFiles == NULL) {
+        return;
+    }
+    struct TIMEROW phaseRows[TP_MAX];
+    memset(phaseRows, 0, sizeof(phaseRows));
+    size_t numFileRows = 0;
+    struct TIMEROW* pFileRows = malloc(g_pTimeFiles->size * TP_MAX * sizeof(struct TIMEROW));
+    if (pFileRows == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < g_pTimeFiles->size; i++) {
+        struct TIMEFILE* pFile = GetTimeFile(i);
+        for (int dwPhase = 0; dwPhase < TP_MAX; dwPhase++) {
+            struct PHASETIME* pTime = &pFile->phases[dwPhase];
+            if (pTime->dwCalls == 0) {
+                continue;
+            }
+            phaseRows[dwPhase].dwPhase = dwPhase;
+            phaseRows[dwPhase].time.dwCalls += pTime->dwCalls;
+            phaseRows[dwPhase].time.total += pTime->total;
+            phaseRows[dwPhase].time.self += pTime->self;
+            struct TIMEROW* pRow = &pFileRows[numFileRows++];
+            pRow->pszName = pFile->pszName;
+            pRow->dwPhase = dwPhase;
+            pRow->time = *pTime;
+        }
+    }
+    size_t numPhaseRows = 0;
+    for (int dwPhase = 0; dwPhase < TP_MAX; dwPhase++) {
+        if (phaseRows[dwPhase].time.dwCalls != 0) {
+            phaseRows[numPhaseRows++] = phaseRows[dwPhase];
+        }
+    }
+    fprintf(f, "time report: %.3f ms, %u files\n", g_wallTime * 1e3, (unsigned)g_pTimeFiles->size);
+    fprintf(f, "phase         calls   total ms    self ms   self\n");
+    PrintTimeRows(f, phaseRows, numPhaseRows);
+    fprintf(f, "\nphase         calls   total ms    self ms   self  file\n");
+    PrintTimeRows(f, pFileRows, numFileRows);
+    free(pFileRows);
+}
+
+void WriteJsonString(FILE* f, const char* pszString) {
+    fputc('"', f);
+    for (const char* p = pszString; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', f);
+            fputc(*p, f);
+        } else if ((unsigned char)*p < 0x20) {
+            fprintf(f, "\\u%04x", (unsigned char)*p);
+        } else {
+            fputc(*p, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// the spans of each file, "parent" is the file which included it
+// returns 0 if the file can't be written
+
+int WriteTimeReportJson(const char* pszPath) {
+    FILE* f = fopen(pszPath, "w");
+    if (f == NULL) {
+        return 0;
+    }
+    size_t numFiles = g_pTimeFiles != NULL ? g_pTimeFiles->size : 0;
+    fprintf(f, "{\n  \"wall_ms\": %.3f,\n  \"files\": [", g_wallTime * 1e3);
+    for (size_t i = 0; i < numFiles; i++) {
+        struct TIMEFILE* pFile = GetTimeFile(i);
+        fprintf(f, "%s\n    {\n      \"name\": ", i ? "," : "");
+        WriteJsonString(f, pFile->pszName);
+        fprintf(f, ",\n      \"parent\": ");
+        if (pFile->dwParent != NOFILE) {
+            WriteJsonString(f, GetTimeFile(pFile->dwParent)->pszName);
+        } else {
+            fprintf(f, "null");
+        }
+        fprintf(f, ",\n      \"depth\": %u,\n      \"phases\": {", pFile->dwDepth);
+        int bFirst = 1;
+        for (int dwPhase = 0; dwPhase < TP_MAX; dwPhase++) {
+            struct PHASETIME* pTime = &pFile->phases[dwPhase];
+            if (pTime->dwCalls == 0) {
+                continue;
+            }
+            fprintf(f, "%s\n        \"%s\": { \"calls\": %u, \"total_ms\": %.3f, \"self_ms\": %.3f }",
+                    bFirst ? "" : ",", g_pszPhaseNames[dwPhase], pTime->dwCalls, pTime->total * 1e3, pTime->self * 1e3);
+            bFirst = 0;
+        }
+        fprintf(f, "\n      }\n    }");
+    }
+    fprintf(f, "\n  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+static void FreeTimeFile(void* pItem) {
+    free(((struct TIMEFILE*)pItem)->pszName);
+}
+
+void DestroyTimeReport(void) {
+    if (g_pTimeFiles != NULL) {
+        vector_free(g_pTimeFiles, FreeTimeFile);
+        g_pTimeFiles = NULL;
+    }
+    g_dwSpanDepth = 0;
+    g_wallTime = 0;
+}
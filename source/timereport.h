@@ -0,0 +1,41 @@
+#ifndef TIMEREPORT_H
+#define TIMEREPORT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// time spent in the phases of a conversion (--time-report)
+// Spans nest: the self time of a span excludes the spans started inside
+// it, a header converted by an #include line is charged to its own name.
+
+enum {
+    TP_PROFILE,         // ReadIniFile, LoadTablesFromProfile, ConvertTables
+    TP_PARSER,          // ParserIncFile
+    TP_ANALYZER,        // AnalyzerIncFile
+    TP_TYPEDEF,         // ParseTypedef, struct and union declarations
+    TP_DEFINE,          // IsDefine
+    TP_PROTOTYPE,       // ParsePrototype
+    TP_MACRO,           // MacroInvocation
+    TP_INCLUDE,         // headers converted by IsInclude
+    TP_OUTPUT,          // WriteIncFile
+    TP_MAX
+};
+
+extern uint8_t g_bTimeReport;           // --time-report cmdline switch
+extern char* g_pszTimeReportJson;       // --time-report-json cmdline switch
+
+// the checks keep the costs low if no report is wanted
+#define BEGIN_TIMESPAN(phase, name) do { if (g_bTimeReport) BeginTimeSpan(phase, name); } while (0)
+#define END_TIMESPAN()              do { if (g_bTimeReport) EndTimeSpan(); } while (0)
+
+void BeginTimeSpan(int dwPhase, const char* pszName);
+void EndTimeSpan(void);
+void PrintTimeReport(FILE* f);
+int WriteTimeReportJson(const char* pszPath);
+void DestroyTimeReport(void);
+
+// shared with the trace
+double GetTime(void);
+void WriteJsonString(FILE* f, const char* pszString);
+
+#endif // TIMEREPORT_H
@@ -0,0 +1,107 @@
+#include "trace.h"
+#include "timereport.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+char* g_pszTrace;
+char* g_pszTraceFile;
+uint32_t g_dwTraceCategories;
+
+static const struct {
+    const char* pszName;
+    uint32_t dwCategory;
+} g_TraceCategories[] = {
+    { "tokenizer", TC_TOKENIZER },
+    { "preproc", TC_PREPROC },
+    { "declarations", TC_DECLARATIONS },
+    { "includes", TC_INCLUDES },
+    { "output", TC_OUTPUT },
+    { "all", TC_TOKENIZER | TC_PREPROC | TC_DECLARATIONS | TC_INCLUDES | TC_OUTPUT },
+};
+
+static FILE* g_fTrace;
+static double g_traceStart;
+static uint32_t g_dwTraceEvents;
+
+static const char* GetCategoryName(uint32_t dwCategory) {
+    for (size_t i = 0; i < ARRAY_SIZE(g_TraceCategories); i++) {
+        if (g_TraceCategories[i].dwCategory == dwCategory) {
+            return g_TraceCategories[i].pszName;
+        }
+    }
+    return "";
+}
+
+// pszCategories is a comma separated list of category names
+// returns 0 if a name is unknown or the file can't be created
+
+int OpenTrace(const char* pszCategories, const char* pszPath) {
+    uint32_t dwCategories = 0;
+    const char* p = pszCategories;
+    while (*p != '\0') {
+        size_t len = strcspn(p, ",");
+        size_t i;
+        for (i = 0; i < ARRAY_SIZE(g_TraceCategories); i++) {
+            if (strlen(g_TraceCategories[i].pszName) == len && strncmp(g_TraceCategories[i].pszName, p, len) == 0) {
+                dwCategories |= g_TraceCategories[i].dwCategory;
+                break;
+            }
+        }
+        if (i == ARRAY_SIZE(g_TraceCategories)) {
+            fprintf(stderr, "unknown trace category '%.*s'\n", (int)len, p);
+            return 0;
+        }
+        p += len;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    g_fTrace = fopen(pszPath, "w");
+    if (g_fTrace == NULL) {
+        fprintf(stderr, "cannot create %s\n", pszPath);
+        return 0;
+    }
+    fprintf(g_fTrace, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    g_traceStart = GetTime();
+    g_dwTraceEvents = 0;
+    g_dwTraceCategories = dwCategories;
+    return 1;
+}
+
+// timestamps are microseconds since the trace was opened
+
+static void WriteTraceEvent(uint32_t dwCategory, char cPhase) {
+    fprintf(g_fTrace, "%s\n{\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":1",
+            g_dwTraceEvents++ ? "," : "", GetCategoryName(dwCategory), cPhase, (GetTime() - g_traceStart) * 1e6);
+}
+
+void TraceBegin(uint32_t dwCategory, const char* pszName, const char* pszFile, uint32_t dwLine) {
+    WriteTraceEvent(dwCategory, 'B');
+    fprintf(g_fTrace, ",\"name\":");
+    WriteJsonString(g_fTrace, pszName);
+    if (pszFile != NULL) {
+        fprintf(g_fTrace, ",\"args\":{\"file\":");
+        WriteJsonString(g_fTrace, pszFile);
+        if (dwLine != 0) {
+            fprintf(g_fTrace, ",\"line\":%u", dwLine);
+        }
+        fputc('}', g_fTrace);
+    }
+    fputc('}', g_fTrace);
+}
+
+void TraceEnd(uint32_t dwCategory) {
+    WriteTraceEvent(dwCategory, 'E');
+    fputc('}', g_fTrace);
+}
+
+void CloseTrace(void) {
+    if (g_fTrace != NULL) {
+        fprintf(g_fTrace, "\n]}\n");
+        fclose(g_fTrace);
+        g_fTrace = NULL;
+    }
+    g_dwTraceCategories = 0;
+}
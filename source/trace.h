@@ -0,0 +1,31 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// structured trace in the Chrome trace event format (--trace)
+// Events are written as they happen; a begin event is always followed by
+// the end event of the same category, so the events nest.
+
+enum {
+    TC_TOKENIZER    = 0x01,     // ParserIncFile
+    TC_PREPROC      = 0x02,     // preprocessor lines
+    TC_DECLARATIONS = 0x04,     // AnalyzerIncFile and top-level declarations
+    TC_INCLUDES     = 0x08,     // headers converted by IsInclude
+    TC_OUTPUT       = 0x10,     // WriteIncFile
+};
+
+extern char* g_pszTrace;                // --trace cmdline switch
+extern char* g_pszTraceFile;            // --trace-file cmdline switch
+extern uint32_t g_dwTraceCategories;    // enabled categories, 0 if no trace
+
+// the checks keep the costs low if a category isn't traced
+#define TRACE_BEGIN(cat, name, file, line)  do { if (g_dwTraceCategories & (cat)) TraceBegin(cat, name, file, line); } while (0)
+#define TRACE_END(cat)                      do { if (g_dwTraceCategories & (cat)) TraceEnd(cat); } while (0)
+
+int OpenTrace(const char* pszCategories, const char* pszPath);
+void TraceBegin(uint32_t dwCategory, const char* pszName, const char* pszFile, uint32_t dwLine);
+void TraceEnd(uint32_t dwCategory);
+void CloseTrace(void);
+
+#endif // TRACE_H
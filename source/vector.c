@@ -1,17 +1,29 @@
 #include "vector.h"
+#include "stats.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+// returns NULL if out of memory
+
 struct vector *vector_create(size_t elemSize) {
-    struct vector *v = malloc(sizeof(struct vector));
+    struct vector *v = xmalloc(sizeof(struct vector));
+    if (v == NULL) {
+        return NULL;
+    }
     memset(v, 0, sizeof(*v));
     v->elemSize = elemSize;
-    vector_capacity_set(v, 4);
+    if (!vector_capacity_set(v, 4)) {
+        free(v);
+        return NULL;
+    }
     return v;
 }
 
 void vector_free(struct vector *v, void (*cb)(void*)) {
+    if (v == NULL) {
+        return;
+    }
     vector_foreach(v, cb);
     free(v->data);
     free(v);
@@ -24,31 +36,71 @@ void *vector_get(struct vector *v, size_t idx) {
     return v->data + idx * v->elemSize;
 }
 
-void vector_capacity_set(struct vector *v, size_t newCapacity) {
+// returns 0 if out of memory, the vector is unchanged then
+
+int vector_capacity_set(struct vector *v, size_t newCapacity) {
     if (newCapacity >= v->size && v->capacity != newCapacity) {
-        void *newdata = malloc(newCapacity * v->elemSize);
-        memcpy(newdata, v->data, v->size * v->elemSize);
-        free(v->data);
+        void *newdata = xrealloc(v->data, newCapacity * v->elemSize);
+        if (newdata == NULL) {
+            return 0;
+        }
         v->data = newdata;
         v->capacity = newCapacity;
     }
+    return 1;
 }
 
-void vector_append(struct vector *v, void *data) {
-    if (v->capacity < v->size + 1) {
-        vector_capacity_set(v, 2 * v->capacity);
+// make room for count more elements, the capacity is doubled
+
+static int vector_reserve(struct vector *v, size_t count) {
+    if (v->capacity < v->size + count) {
+        size_t newCapacity = v->capacity != 0 ? 2 * v->capacity : 4;
+        while (newCapacity < v->size + count) {
+            newCapacity *= 2;
+        }
+        return vector_capacity_set(v, newCapacity);
+    }
+    return 1;
+}
+
+// the append functions return 0 if out of memory, nothing is appended then
+
+int vector_append(struct vector *v, void *data) {
+    if (!vector_reserve(v, 1)) {
+        return 0;
     }
     memcpy(v->data + v->size * v->elemSize, data, v->elemSize);
     v->size++;
+    return 1;
+}
+
+int vector_append_array(struct vector *v, const void *data, size_t count) {
+    if (!vector_reserve(v, count)) {
+        return 0;
+    }
+    memcpy(v->data + v->size * v->elemSize, data, count * v->elemSize);
+    v->size += count;
+    return 1;
 }
 
 void vector_remove(struct vector *v, size_t idx) {
     if (idx < v->size) {
-        memmove(v->data + (idx + 1) * v->elemSize, v->data + idx * v->elemSize, (v->size - idx - 1) * v->elemSize);
+        memmove(v->data + idx * v->elemSize, v->data + (idx + 1) * v->elemSize, (v->size - idx - 1) * v->elemSize);
         v->size--;
     }
 }
 
+// remove the last element, returns it or NULL if the vector is empty
+// the element is valid until the next append
+
+void *vector_pop(struct vector *v) {
+    if (v->size == 0) {
+        return NULL;
+    }
+    v->size--;
+    return v->data + v->size * v->elemSize;
+}
+
 void vector_foreach(struct vector *v, void (*cb)(void*)) {
     if (cb) {
         for (size_t i = 0; i < v->size; i++) {
@@ -56,3 +108,40 @@ void vector_foreach(struct vector *v, void (*cb)(void*)) {
         }
     }
 }
+
+void smallvector_init(struct smallvector *v) {
+    v->data = v->items;
+    v->size = 0;
+    v->capacity = SMALLVECTOR_SIZE;
+}
+
+void smallvector_free(struct smallvector *v) {
+    if (v->data != v->items) {
+        free(v->data);
+    }
+    smallvector_init(v);
+}
+
+// returns 0 if out of memory, nothing is appended then
+
+int smallvector_append(struct smallvector *v, char *s) {
+    if (v->size == v->capacity) {
+        size_t newCapacity = 2 * v->capacity;
+        char **newdata;
+        if (v->data == v->items) {
+            newdata = xmalloc(newCapacity * sizeof(char*));
+            if (newdata != NULL) {
+                memcpy(newdata, v->items, v->size * sizeof(char*));
+            }
+        } else {
+            newdata = xrealloc(v->data, newCapacity * sizeof(char*));
+        }
+        if (newdata == NULL) {
+            return 0;
+        }
+        v->data = newdata;
+        v->capacity = newCapacity;
+    }
+    v->data[v->size++] = s;
+    return 1;
+}
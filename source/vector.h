@@ -14,18 +14,46 @@ struct vector {
 
 struct vector *vector_create(size_t elemSize);
 void vector_free(struct vector *v, void (*cb)(void*));
-void vector_capacity_set(struct vector *v, size_t newCapacity);
+int vector_capacity_set(struct vector *v, size_t newCapacity);
 void *vector_get(struct vector *v, size_t idx);
-void vector_append(struct vector *v, void *data);
+int vector_append(struct vector *v, void *data);
+int vector_append_array(struct vector *v, const void *data, size_t count);
 void vector_remove(struct vector *v, size_t idx);
+void *vector_pop(struct vector *v);
 void vector_foreach(struct vector *v, void (*cb)(void*));
 
 static char *vector_charp_get(struct vector *v, size_t idx) {
     return ((char **) v->data)[idx];
 }
 
-static void vector_charp_append(struct vector *v, char *s) {
-    vector_append(v, &s);
+static int vector_charp_append(struct vector *v, char *s) {
+    return vector_append(v, &s);
+}
+
+static char *vector_charp_pop(struct vector *v) {
+    char **ps = vector_pop(v);
+    return ps != NULL ? *ps : NULL;
+}
+
+// vector of char* with room for SMALLVECTOR_SIZE items in the struct itself,
+// a heap array is used only if there are more. The struct must not be
+// copied, data may point to items.
+
+#define SMALLVECTOR_SIZE 16
+
+struct smallvector {
+    char **data;
+    size_t size;
+    size_t capacity;
+    char *items[SMALLVECTOR_SIZE];
+};
+
+void smallvector_init(struct smallvector *v);
+void smallvector_free(struct smallvector *v);
+int smallvector_append(struct smallvector *v, char *s);
+
+static char *smallvector_get(struct smallvector *v, size_t idx) {
+    return v->data[idx];
 }
 
 
@@ -0,0 +1,105 @@
+// number of heap allocations made while converting a header
+// usage: h2incc-allocstat [--max n] [header ...]
+// Without headers a synthetic header is used. Each header is converted
+// through the library interface and the calls of malloc, calloc, realloc
+// and free are counted. Returns 1 if a conversion leaves blocks allocated
+// or needs more than n allocations.
+
+#include "libh2incc.h"
+#include "testutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if COUNTALLOCS
+
+// returns 0 if the conversion failed or leaked
+
+static int Convert(struct h2incc_context* pContext, const char* pszName, const char* pData, size_t dwSize, size_t dwMaxAllocs) {
+    struct h2incc_options options;
+    h2incc_options_init(&options);
+    size_t dwOutputSize = 4 * dwSize + 0x10000;
+    char* pOutput = malloc(dwOutputSize);
+    size_t dwLength;
+
+    g_numAllocs = 0;
+    g_numFrees = 0;
+    g_bCounting = 1;
+    int rc = h2incc_convert(pContext, &options, pszName, pData, dwSize, pOutput, dwOutputSize, &dwLength);
+    g_bCounting = 0;
+    free(pOutput);
+
+    printf("%-40s %8u bytes  mallocs: %6u  frees: %6u\n", pszName, (unsigned)dwSize, (unsigned)g_numAllocs, (unsigned)g_numFrees);
+    if (rc != H2INCC_OK && rc != H2INCC_ERROR_SOURCE) {
+        fprintf(stderr, "%s: conversion failed (%d)\n", pszName, rc);
+        return 0;
+    }
+    if (g_numAllocs != g_numFrees) {
+        fprintf(stderr, "%s: %u blocks not released\n", pszName, (unsigned)(g_numAllocs - g_numFrees));
+        return 0;
+    }
+    if (dwMaxAllocs != 0 && g_numAllocs > dwMaxAllocs) {
+        fprintf(stderr, "%s: more than %u allocations\n", pszName, (unsigned)dwMaxAllocs);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    size_t dwMaxAllocs = 0;
+    int numFiles = 0;
+    int rc = 0;
+
+    struct h2incc_context* pContext = h2incc_create(NULL, 0);
+    if (pContext == NULL) {
+        fprintf(stderr, "cannot create context\n");
+        return 1;
+    }
+    // the first conversion sets up tables which are kept by the context
+    size_t dwSize;
+    char* pData = CreateSyntheticHeader(256 * 1024, &dwSize);
+    g_bCounting = 0;
+    {
+        char szOutput[0x100];
+        struct h2incc_options options;
+        size_t dwLength;
+        h2incc_options_init(&options);
+        h2incc_convert(pContext, &options, "(warmup)", "int x;\n", 7, szOutput, sizeof(szOutput), &dwLength);
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            dwMaxAllocs = strtoul(argv[++i], NULL, 0);
+            continue;
+        }
+        size_t dwFileSize;
+        char* pFileData = ReadFile(argv[i], &dwFileSize);
+        if (pFileData == NULL) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            rc = 1;
+            break;
+        }
+        if (!Convert(pContext, argv[i], pFileData, dwFileSize, dwMaxAllocs)) {
+            rc = 1;
+        }
+        free(pFileData);
+        numFiles++;
+    }
+    if (numFiles == 0 && rc == 0) {
+        if (!Convert(pContext, "(synthetic)", pData, dwSize, dwMaxAllocs)) {
+            rc = 1;
+        }
+    }
+    free(pData);
+    h2incc_destroy(pContext);
+    return rc;
+}
+
+#else
+
+int main(int argc, char* argv[]) {
+    printf("allocation counting needs glibc\n");
+    return 0;
+}
+
+#endif
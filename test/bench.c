@@ -0,0 +1,382 @@
+// end-to-end throughput of the converter on synthetic headers
+// usage: h2incc-bench [-C profile] [--count n] [--runs n] [--case name]
+//                     [--json file] [--write dir]
+// The headers are generated from parameters: n defines, n structures with
+// nested unions and bitfields, n prototypes with qualifiers, n/8 COM
+// interfaces, deep #if nesting and an include fan-out of n/16 headers.
+// Each case is converted through the library interface, included headers
+// are served from memory. The results are written as JSON: MB/s and
+// tokens/s of the conversion, the time of the tokenizer (parse) and of
+// the rest (analyze), and the peak RSS of the process so far.
+// --write saves the generated headers, so they can be fed to h2incc.
+// Returns 1 if a case can't be converted without errors.
+
+#include "libh2incc.h"
+#include "incfile.h"
+#include "testutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#define MAXBENCHINCLUDES 256
+
+struct BENCHCASE {
+    const char* pszName;
+    void (*pfnGenerate)(struct TEXT*, int);
+};
+
+static long GetPeakRSS(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#endif
+}
+
+// the generators
+
+static void GenerateDefines(struct TEXT* pText, int n) {
+    for (int i = 0; i < n; i++) {
+        switch (i % 4) {
+        case 0:
+            Print(pText, "#define BENCH_MESSAGE_%d 0x%04X\n", i, i);
+            break;
+        case 1:
+            Print(pText, "#define BENCH_ERROR_%d ((long)0x8007%04XL)\n", i, i & 0xffff);
+            break;
+        case 2:
+            Print(pText, "#define BENCH_FLAG_%d (1 << %d)\n", i, i % 31);
+            break;
+        case 3:
+            Print(pText, "#define BENCH_MASK_%d (BENCH_FLAG_%d | BENCH_MESSAGE_%d)\n", i, i - 1, i - 3);
+            break;
+        }
+    }
+}
+
+static void GenerateStructs(struct TEXT* pText, int n) {
+    for (int i = 0; i < n; i++) {
+        Print(pText,
+              "typedef struct _BENCH_STRUCT_%d {\n"
+              "    unsigned long cbSize;\n"
+              "    unsigned int fEnabled:1;\n"
+              "    unsigned int fVisible:1;\n"
+              "    unsigned int dwReserved:30;\n"
+              "    union {\n"
+              "        struct {\n"
+              "            short x;\n"
+              "            short y;\n"
+              "        } pt;\n"
+              "        long lValue;\n"
+              "        void* pValue;\n"
+              "    } u;\n"
+              "    char szName[%d];\n"
+              "    struct _BENCH_STRUCT_%d* pNext;\n"
+              "} BENCH_STRUCT_%d, *PBENCH_STRUCT_%d;\n",
+              i, i % 64 + 1, i, i, i);
+    }
+}
+
+static void GeneratePrototypes(struct TEXT* pText, int n) {
+    for (int i = 0; i < n; i++) {
+        switch (i % 3) {
+        case 0:
+            Print(pText, "__declspec(dllimport) long __stdcall BenchFunction%d(void* hObject, unsigned long dwFlags, const char* pszName);\n", i);
+            break;
+        case 1:
+            Print(pText, "int __cdecl BenchPrintf%d(const char* pszFormat, ...);\n", i);
+            break;
+        case 2:
+            Print(pText, "__declspec(dllimport) unsigned short __stdcall BenchQuery%d(const void* pData, unsigned long* pdwSize, int bWide);\n", i);
+            break;
+        }
+    }
+}
+
+static void GenerateInterfaces(struct TEXT* pText, int n) {
+    for (int i = 0; i < n / 8 + 1; i++) {
+        Print(pText,
+              "typedef struct IBench%d IBench%d;\n"
+              "typedef struct IBench%dVtbl {\n"
+              "    long (__stdcall *QueryInterface)(IBench%d* This, const void* riid, void** ppvObject);\n"
+              "    unsigned long (__stdcall *AddRef)(IBench%d* This);\n"
+              "    unsigned long (__stdcall *Release)(IBench%d* This);\n",
+              i, i, i, i, i, i);
+        for (int j = 0; j < 8; j++) {
+            Print(pText, "    long (__stdcall *Method%d)(IBench%d* This, unsigned long dwIndex, void* pData);\n", j, i);
+        }
+        Print(pText,
+              "} IBench%dVtbl;\n"
+              "struct IBench%d {\n"
+              "    const struct IBench%dVtbl* lpVtbl;\n"
+              "};\n",
+              i, i, i);
+    }
+}
+
+static void GenerateNesting(struct TEXT* pText, int n) {
+    int depth = 24;
+    for (int i = 0; i < n / depth + 1; i++) {
+        for (int j = 0; j < depth; j++) {
+            if (j % 2 == 0) {
+                Print(pText, "#ifdef BENCH_LEVEL_%d\n", j);
+            } else {
+                Print(pText, "#if defined(BENCH_OPTION_%d) && BENCH_VERSION > %d\n", j, j);
+            }
+            Print(pText, "#define BENCH_NESTED_%d_%d %d\n", i, j, j);
+        }
+        for (int j = depth - 1; j >= 0; j--) {
+            Print(pText, "#else\n#define BENCH_OTHER_%d_%d %d\n#endif\n", i, j, j);
+        }
+    }
+}
+
+static void GenerateIncludes(struct TEXT* pText, int n) {
+    char szName[64];
+    int numIncludes = n / 16 + 1;
+    if (numIncludes > MAXBENCHINCLUDES) {
+        numIncludes = MAXBENCHINCLUDES;
+    }
+    for (int i = 0; i < numIncludes; i++) {
+        snprintf(szName, sizeof(szName), "bench_include_%d.h", i);
+        struct HEADER* pHeader = AddInclude(szName);
+        Print(&pHeader->text, "#ifndef BENCH_INCLUDE_%d_H\n#define BENCH_INCLUDE_%d_H\n", i, i);
+        if (i + 1 < numIncludes) {
+            // a chain besides the fan-out
+            Print(&pHeader->text, "#include \"bench_include_%d.h\"\n", i + 1);
+        }
+        for (int j = 0; j < 8; j++) {
+            Print(&pHeader->text, "#define BENCH_INCLUDE_%d_VALUE_%d %d\n", i, j, j);
+        }
+        Print(&pHeader->text, "typedef struct _BENCH_INCLUDE_%d { long a; long b; } BENCH_INCLUDE_%d;\n#endif\n", i, i);
+        Print(pText, "#include \"%s\"\n", pHeader->szName);
+    }
+    Print(pText, "typedef struct _BENCH_USER { BENCH_INCLUDE_0 first; } BENCH_USER;\n");
+}
+
+static void GenerateSDK(struct TEXT* pText, int n) {
+    GenerateIncludes(pText, n);
+    GenerateDefines(pText, n);
+    GenerateStructs(pText, n);
+    GeneratePrototypes(pText, n);
+    GenerateInterfaces(pText, n);
+    GenerateNesting(pText, n);
+}
+
+static const struct BENCHCASE g_Cases[] = {
+    { "defines",    GenerateDefines },
+    { "structs",    GenerateStructs },
+    { "prototypes", GeneratePrototypes },
+    { "interfaces", GenerateInterfaces },
+    { "nesting",    GenerateNesting },
+    { "includes",   GenerateIncludes },
+    { "sdk",        GenerateSDK },
+};
+
+static void PrintDiagnostic(void* pContext, const char* pszText) {
+    fputs(pszText, stderr);
+}
+
+// tokens of a header, as written by the tokenizer
+
+static size_t CountTokens(const char* pszName, const struct TEXT* pText, double* pSeconds) {
+    double start = GetSeconds();
+    struct INCFILE* pIncFile = CreateIncFileFromMemory(pszName, pText->pData, pText->dwSize, NULL);
+    if (pIncFile == NULL) {
+        return 0;
+    }
+    ParserIncFile(pIncFile);
+    *pSeconds = GetSeconds() - start;
+    size_t numTokens = 0;
+    for (char* p = GetTokensIncFile(pIncFile); *p != '\0'; p += strlen(p) + 1) {
+        numTokens++;
+    }
+    DestroyIncFile(pIncFile);
+    return numTokens;
+}
+
+static int WriteHeader(const char* pszDir, const char* pszName, const struct TEXT* pText) {
+    char szPath[1024];
+    int len = snprintf(szPath, sizeof(szPath), "%s/%s", pszDir, pszName);
+    FILE* f = len < (int)sizeof(szPath) ? fopen(szPath, "wb") : NULL;
+    if (f == NULL) {
+        fprintf(stderr, "cannot create %s\n", szPath);
+        return 0;
+    }
+    fwrite(pText->pData, 1, pText->dwSize, f);
+    fclose(f);
+    return 1;
+}
+
+static int RunCase(struct h2incc_context* pContext, const struct BENCHCASE* pCase, int n, int numRuns,
+                   const char* pszWriteDir, FILE* pJson, int bFirst) {
+    struct TEXT text = { NULL, 0, 0 };
+    char szName[64];
+    int rc = 1;
+
+    Print(&text, "/* synthetic header: %s, count %d */\n", pCase->pszName, n);
+    pCase->pfnGenerate(&text, n);
+    snprintf(szName, sizeof(szName), "bench_%s.h", pCase->pszName);
+    if (pszWriteDir != NULL) {
+        WriteHeader(pszWriteDir, szName, &text);
+        for (int i = 0; i < g_numIncludes; i++) {
+            WriteHeader(pszWriteDir, g_Includes[i].szName, &g_Includes[i].text);
+        }
+    }
+
+    // the tokenizer on its own
+    size_t dwBytes = text.dwSize;
+    double parseSeconds = 0;
+    size_t numTokens = CountTokens(szName, &text, &parseSeconds);
+    for (int i = 0; i < g_numIncludes; i++) {
+        double seconds = 0;
+        numTokens += CountTokens(g_Includes[i].szName, &g_Includes[i].text, &seconds);
+        parseSeconds += seconds;
+        dwBytes += g_Includes[i].text.dwSize;
+    }
+
+    struct h2incc_options options;
+    h2incc_options_init(&options);
+    options.pfnDiagnostic = PrintDiagnostic;
+    options.pfnLoadInclude = LoadInclude;
+    size_t dwOutputSize = 8 * text.dwSize + 0x10000;
+    char* pOutput = malloc(dwOutputSize);
+    size_t dwLength = 0;
+    double bestSeconds = 0;
+    double bestParse = parseSeconds;
+    for (int run = 0; run < numRuns; run++) {
+        if (run > 0) {
+            double seconds = 0;
+            CountTokens(szName, &text, &seconds);
+            for (int i = 0; i < g_numIncludes; i++) {
+                double s = 0;
+                CountTokens(g_Includes[i].szName, &g_Includes[i].text, &s);
+                seconds += s;
+            }
+            if (seconds < bestParse) {
+                bestParse = seconds;
+            }
+        }
+        double start = GetSeconds();
+        int result = h2incc_convert(pContext, &options, szName, text.pData, text.dwSize, pOutput, dwOutputSize, &dwLength);
+        double seconds = GetSeconds() - start;
+        if (result != H2INCC_OK) {
+            fprintf(stderr, "%s: conversion failed (%d)\n", pCase->pszName, result);
+            rc = 0;
+            break;
+        }
+        if (run == 0 || seconds < bestSeconds) {
+            bestSeconds = seconds;
+        }
+    }
+    if (bestSeconds <= 0) {
+        bestSeconds = 1e-9;
+    }
+    double analyzeSeconds = bestSeconds > bestParse ? bestSeconds - bestParse : 0;
+
+    fprintf(pJson, "%s    {\n", bFirst ? "" : ",\n");
+    fprintf(pJson, "      \"name\": \"%s\",\n", pCase->pszName);
+    fprintf(pJson, "      \"bytes\": %u,\n", (unsigned)dwBytes);
+    fprintf(pJson, "      \"headers\": %d,\n", g_numIncludes + 1);
+    fprintf(pJson, "      \"tokens\": %u,\n", (unsigned)numTokens);
+    fprintf(pJson, "      \"output_bytes\": %u,\n", (unsigned)dwLength);
+    fprintf(pJson, "      \"ok\": %s,\n", rc ? "true" : "false");
+    fprintf(pJson, "      \"seconds\": { \"parse\": %.6f, \"analyze\": %.6f, \"total\": %.6f },\n",
+            bestParse, analyzeSeconds, bestSeconds);
+    fprintf(pJson, "      \"mb_per_s\": %.2f,\n", dwBytes / bestSeconds / (1024 * 1024));
+    fprintf(pJson, "      \"tokens_per_s\": %.0f,\n", numTokens / bestSeconds);
+    fprintf(pJson, "      \"peak_rss_kb\": %ld\n", GetPeakRSS());
+    fprintf(pJson, "    }");
+
+    free(pOutput);
+    free(text.pData);
+    FreeIncludes();
+    return rc;
+}
+
+int main(int argc, char* argv[]) {
+    const char* pszProfilePath = NULL;
+    const char* pszCase = NULL;
+    const char* pszJson = NULL;
+    const char* pszWriteDir = NULL;
+    int n = 2000;
+    int numRuns = 5;
+    int rc = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            pszProfilePath = argv[++i];
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            n = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            numRuns = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--case") == 0 && i + 1 < argc) {
+            pszCase = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            pszJson = argv[++i];
+        } else if (strcmp(argv[i], "--write") == 0 && i + 1 < argc) {
+            pszWriteDir = argv[++i];
+        } else {
+            fprintf(stderr, "usage: h2incc-bench [-C profile] [--count n] [--runs n] [--case name] [--json file] [--write dir]\n");
+            return 1;
+        }
+    }
+    if (n < 1 || numRuns < 1) {
+        fprintf(stderr, "count and runs must be positive\n");
+        return 1;
+    }
+
+    char* pProfile = NULL;
+    size_t dwProfileSize = 0;
+    if (pszProfilePath != NULL) {
+        pProfile = ReadFile(pszProfilePath, &dwProfileSize);
+        if (pProfile == NULL) {
+            fprintf(stderr, "cannot read %s\n", pszProfilePath);
+            return 1;
+        }
+    }
+    struct h2incc_context* pContext = h2incc_create(pProfile, dwProfileSize);
+    free(pProfile);
+    if (pContext == NULL) {
+        fprintf(stderr, "cannot create context\n");
+        return 1;
+    }
+    FILE* pJson = stdout;
+    if (pszJson != NULL) {
+        pJson = fopen(pszJson, "w");
+        if (pJson == NULL) {
+            fprintf(stderr, "cannot create %s\n", pszJson);
+            h2incc_destroy(pContext);
+            return 1;
+        }
+    }
+
+    fprintf(pJson, "{\n  \"count\": %d,\n  \"runs\": %d,\n  \"cases\": [\n", n, numRuns);
+    int numCases = 0;
+    for (size_t i = 0; i < sizeof(g_Cases) / sizeof(g_Cases[0]); i++) {
+        if (pszCase != NULL && strcmp(pszCase, g_Cases[i].pszName) != 0) {
+            continue;
+        }
+        if (!RunCase(pContext, &g_Cases[i], n, numRuns, pszWriteDir, pJson, numCases == 0)) {
+            rc = 1;
+        }
+        numCases++;
+    }
+    fprintf(pJson, "\n  ]\n}\n");
+    if (pJson != stdout) {
+        fclose(pJson);
+    }
+    h2incc_destroy(pContext);
+    if (numCases == 0) {
+        fprintf(stderr, "unknown case %s\n", pszCase);
+        return 1;
+    }
+    return rc;
+}
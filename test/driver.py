@@ -1,11 +1,13 @@
 #!/usr/bin/env python
 import dataclasses
 import enum
+import json
 import logging
 import pathlib
 import re
 import shlex
 import subprocess
+import tempfile
 
 
 logger = logging.getLogger(__name__)
@@ -15,10 +17,117 @@ class ExpectedResult(enum.Enum):
     Fail = 1
 
 
+class Mode(enum.Enum):
+    Cmdline = 0
+    Server = 1
+
+
+def run_server(h2incc, case, h2incc_args, count):
+    # convert the case as file <count> times and once as in-memory buffer
+    data = case.read_bytes()
+    requests = f"CONVERT {shlex.quote(str(case))}\n".encode() * count
+    requests += f"BUFFER {shlex.quote(str(case))} {len(data)}\n".encode() + data
+    requests += b"QUIT\n"
+
+    cmd = [str(h2incc), "--server"] + h2incc_args
+    logger.info("cmd: `%s`", shlex.join(cmd))
+    result = subprocess.run(cmd, input=requests, capture_output=True)
+    if result.returncode != 0:
+        raise ValueError(f"server return code was {result.returncode}, expected 0")
+
+    responses = []
+    output = result.stdout
+    while output:
+        header, output = output.split(b"\n", 1)
+        status, size = header.split(b" ")
+        size = int(size)
+        body, output = output[:size], output[size:]
+        if status != b"OK":
+            raise ValueError(f"server returned {status!r}: {body!r}")
+        responses.append(body)
+    if len(responses) != count + 1:
+        raise ValueError(f"expected {count + 1} server responses, got {len(responses)}")
+    return responses
+
+
+def normalize_report(text, case_dir, masks):
+    # timings differ between runs: numbers with a fraction and the matches
+    # of the masks are replaced by "#". The report orders rows by time, so
+    # consecutive masked rows are sorted.
+    text = text.replace(b"\r\n", b"\n").decode().replace(str(case_dir), "%CASEDIR%")
+    lines = []
+    rows = []
+    for line in text.split("\n"):
+        masked = line
+        for mask in masks + [r"\d+\.\d+"]:
+            masked = re.sub(mask, "#", masked)
+        masked = " ".join(masked.split())
+        if masked != " ".join(line.split()):
+            rows.append(masked)
+            continue
+        lines += sorted(rows) + [masked]
+        rows = []
+    lines += sorted(rows)
+    return "\n".join(lines)
+
+
+def mask_json(value, case_dir):
+    if isinstance(value, float):
+        return "#"
+    if isinstance(value, str):
+        return value.replace(str(case_dir), "%CASEDIR%")
+    if isinstance(value, list):
+        return [mask_json(v, case_dir) for v in value]
+    if isinstance(value, dict):
+        return {k: mask_json(v, case_dir) for k, v in value.items()}
+    return value
+
+
+def check_trace_events(events):
+    # every "B" event must be closed by an "E" event of the same thread,
+    # the timestamps of a thread don't go back
+    stacks = {}
+    last_ts = {}
+    for event in events:
+        tid = (event["pid"], event["tid"])
+        if event["ts"] < last_ts.get(tid, 0):
+            raise ValueError(f"trace timestamp goes back: {event!r}")
+        last_ts[tid] = event["ts"]
+        if event["ph"] == "B":
+            stacks.setdefault(tid, []).append(event)
+        elif event["ph"] == "E":
+            if not stacks.get(tid):
+                raise ValueError(f"trace end event without begin: {event!r}")
+            begin = stacks[tid].pop()
+            if begin["cat"] != event["cat"]:
+                raise ValueError(f"trace end event {event!r} closes {begin!r}")
+    for tid, stack in stacks.items():
+        if stack:
+            raise ValueError(f"trace begin events not closed: {stack!r}")
+
+
+def check_output(result_bytes, reference_path, update):
+    # returns 0 if the normalized output differs from the reference
+    if update:
+        with reference_path.open("wb") as f:
+            f.write(result_bytes)
+
+    with reference_path.open("rb") as f:
+        reference_bytes = f.read()
+
+    normalized_result_bytes = result_bytes.replace(b"\r\n", b"\n")
+    normalized_reference_bytes = reference_bytes.replace(b"\r\n", b"\n")
+
+    logger.info("reference bytes = %r", reference_bytes)
+    logger.info("normalized reference bytes = %r", normalized_reference_bytes)
+    return normalized_result_bytes == normalized_reference_bytes
+
+
 def main():
     import argparse
     parser = argparse.ArgumentParser(allow_abbrev=False)
     parser.add_argument("--h2incc", type=pathlib.Path, required=True, help="path of h2incc")
+    parser.add_argument("--libdriver", type=pathlib.Path, help="run the case through the library using this driver")
     parser.add_argument("--iniconfig", type=pathlib.Path, required=True, help="path to ini config")
     parser.add_argument("--desc", type=pathlib.Path, required=False, help="description of test")
     parser.add_argument("--case", type=pathlib.Path, required=True, help="path of test case")
@@ -28,9 +137,17 @@ def main():
 
     logging.basicConfig(level=args.loglevel)
 
+    tmpdir = tempfile.TemporaryDirectory()
     h2incc_args = []
+    prepare_args = None
+    mode = Mode.Cmdline
+    requests = 2
     expected = ExpectedResult.Success
     reference_path = None
+    stderr_path = None
+    masks = []
+    json_path = None
+    json_reference_path = None
 
     found_driver_spec = False
 
@@ -42,13 +159,32 @@ def main():
             found_driver_spec = True
             key, value = m.group(1).split("=", 1)
             key, value = key.strip(), value.strip()
-            if key == "args":
+            if key in ("args", "prepare", "json"):
                 value = value.replace("%INICONFIG%", f"'{args.iniconfig}'")
-                h2incc_args = shlex.split(value)
+                value = value.replace("%CASEDIR%", f"'{args.case.parent}'")
+                value = value.replace("%TMPDIR%", f"'{tmpdir.name}'")
+                if key == "args":
+                    h2incc_args = shlex.split(value)
+                elif key == "json":
+                    json_path = pathlib.Path(shlex.split(value)[0])
+                else:
+                    prepare_args = shlex.split(value)
+            elif key == "mode":
+                mode = {k.lower():Mode[k] for k in Mode.__members__}[value]
+            elif key == "requests":
+                requests = int(value)
             elif key == "expected":
                 expected = {k.lower():ExpectedResult[k] for k in ExpectedResult.__members__}[value]
             elif key == "reference":
                 reference_path = args.case.parent / value
+            elif key == "stderr":
+                # the reports written to stderr, see normalize_report
+                stderr_path = args.case.parent / value
+            elif key == "mask":
+                masks.append(value)
+            elif key == "json_reference":
+                # the JSON written to the file of key "json", floats are masked
+                json_reference_path = args.case.parent / value
             else:
                 raise ValueError(key)
 
@@ -59,37 +195,59 @@ def main():
     if expected == ExpectedResult.Success and not reference_path:
         raise ValueError("Success state requires reference file")
 
-    cmd = [str(args.h2incc), str(args.case)] + h2incc_args
-
     logger.info("expected: %r", expected)
     logger.info("reference_path: %s", reference_path)
-    logger.info("cmd: `%s`", shlex.join(cmd))
 
-    result = subprocess.run(cmd, capture_output=True)
-    result_bytes = result.stdout
+    if prepare_args is not None:
+        # e.g. create a snapshot used by the case
+        cmd = [str(args.h2incc)] + prepare_args
+        logger.info("prepare cmd: `%s`", shlex.join(cmd))
+        result = subprocess.run(cmd, capture_output=True)
+        if result.returncode != 0:
+            raise ValueError(f"prepare return code was {result.returncode}, expected 0")
+
+    if mode == Mode.Server:
+        if stderr_path:
+            raise ValueError("stderr can't be checked in server mode")
+        results = run_server(args.h2incc, args.case, h2incc_args, requests)
+        result_bytes = results[0]
+        if any(r != result_bytes for r in results[1:]):
+            raise ValueError("server responses differ")
+    else:
+        cmd = [str(args.libdriver or args.h2incc), str(args.case)] + h2incc_args
+        logger.info("cmd: `%s`", shlex.join(cmd))
+
+        result = subprocess.run(cmd, capture_output=True)
+        result_bytes = result.stdout
+        stderr_bytes = result.stderr
+
+        if expected == ExpectedResult.Success and result.returncode != 0:
+            raise ValueError(f"return code was {result.returncode}, expected 0")
+
     normalized_result_bytes = result_bytes.replace(b"\r\n", b"\n")
     logger.info("result bytes = %r", result_bytes)
     logger.info("normalized result bytes = %r", normalized_result_bytes)
 
-    if expected == ExpectedResult.Success and result.returncode != 0:
-        raise ValueError(f"return code was {result.returncode}, expected 0")
-
     if reference_path:
-        if args.update:
-            with reference_path.open("wb") as f:
-                f.write(result_bytes)
-
-        with reference_path.open("rb") as f:
-            reference_bytes = f.read()
-
-        normalized_reference_bytes = reference_bytes.replace(b"\r\n", b"\n")
-
-        logger.info("reference bytes = %r", reference_bytes)
-        logger.info("normalized reference bytes = %r", normalized_reference_bytes)
-
-        if normalized_result_bytes != normalized_reference_bytes:
+        if not check_output(result_bytes, reference_path, args.update):
             raise ValueError
 
+    if stderr_path:
+        report = normalize_report(stderr_bytes, args.case.parent, masks)
+        logger.info("normalized stderr = %r", report)
+        if not check_output(report.encode(), stderr_path, args.update):
+            raise ValueError("stderr differs")
+
+    if json_path:
+        data = json.loads(json_path.read_text())
+        if "traceEvents" in data:
+            check_trace_events(data["traceEvents"])
+        if json_reference_path:
+            text = json.dumps(mask_json(data, args.case.parent), indent=1) + "\n"
+            logger.info("masked json = %r", text)
+            if not check_output(text.encode(), json_reference_path, args.update):
+                raise ValueError("json differs")
+
 
 if __name__ == "__main__":
     raise SystemExit(main())
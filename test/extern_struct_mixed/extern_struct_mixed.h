@@ -0,0 +1,35 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=extern_struct_mixed.ref
+struct _POINT;
+
+struct _POINT {
+    int x;
+#ifdef USE_Z
+    int z;
+#endif
+    int y;
+};
+
+struct _POINT* GetPoint(int n);
+
+extern int counter;
+extern int (*handler)(int code);
+extern int Compute(int a, int b);
+extern struct _POINT
+#ifdef USE_Z
+    *GetPoint3(int n);
+#else
+    *GetPoint2(int n);
+#endif
+
+class IObject {
+public:
+    virtual long AddRef(void);
+    virtual long Release(void);
+};
+
+class CPlain {
+public:
+    int value;
+};
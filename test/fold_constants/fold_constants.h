@@ -0,0 +1,37 @@
+// driver: args=--fold-constants
+// driver: expected=success
+// driver: reference=fold_constants.ref
+
+#define FC_BASE 0x10
+#define FC_SHIFTED (FC_BASE << 2)
+#define FC_MASK (FC_SHIFTED | 0x3)
+#define FC_HIGH (1u << 31)
+#define FC_MINUS -1
+#define FC_ALL ~0
+#define FC_OCTAL 010
+#define FC_HALF (FC_BASE >> 1) & 0xF
+#define FC_STRING "fold"
+#define FC_UNKNOWN FC_EXTERNAL + 1
+#define FC_HALF_MAX (~0UL / 2)
+#define FC_UMAX_SHIFTED (~0u >> 1)
+#define FC_UMAX ~0u
+#define FC_LONGLONG (1LL << 32)
+#define FC_TOO_WIDE (1 << 32)
+#define FC_OVERFLOW (1 << 31)
+#define FC_INT_SUM (0x7FFFFFFF + 1)
+#define FC_MIXED (-1 < 0u)
+
+#ifdef FC_OPTION
+#define FC_COND 1
+#else
+#define FC_COND 2
+#endif
+#define FC_USES_COND (FC_COND + 1)
+
+#define FC_AGAIN 1
+#define FC_AGAIN 2
+#define FC_USES_AGAIN (FC_AGAIN * 2)
+
+enum { FE_FIRST = 1, FE_SHIFTED = FE_FIRST << 3, FE_NEXT, FE_OR = 0x20 | FE_SHIFTED, FE_LAST };
+enum { FE_MAX = ~0u >> 1, FE_BEHIND_MAX };
+typedef enum _FC_KIND { FK_BASE = FC_BASE, FK_NEXT = FK_BASE + 1 } FC_KIND;
@@ -0,0 +1,20 @@
+// driver: args=-i --include-guard --guard-symbols -s cpe
+// driver: expected=success
+// driver: reference=guard_symbols.ref
+
+#include "guard_symbols_base.h"
+
+#define SHARED_FLAG 0x10
+#define OWN_FLAG 0x20
+#define STRUCT_FLAG 0x40
+
+#ifdef USE_WIDE
+#define OWN_SIZE 2
+#else
+#define OWN_SIZE 1
+#endif
+
+#define SHARED_MACRO(x) ((x) + 1)
+
+int shared_function(int value);
+int own_function(void);
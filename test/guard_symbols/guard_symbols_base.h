@@ -0,0 +1,9 @@
+#define SHARED_FLAG 0x10
+#define BASE_ONLY 1
+
+int shared_function(int value);
+
+typedef struct _BASE_STRUCT {
+#define STRUCT_FLAG 0x40
+    int member;
+} BASE_STRUCT;
@@ -0,0 +1,19 @@
+// driver: args=--hot-decls=8
+// driver: expected=success
+// driver: reference=hot_decls.ref
+// driver: stderr=hot_decls.stderr
+
+#define HOT_COUNT 4
+#define HOT_MASK(n) ((1 << (n)) - 1)
+
+typedef enum _HOT_KIND { HK_NONE, HK_TYPEDEF, HK_DEFINE, HK_PROTOTYPE } HOT_KIND;
+
+typedef struct _HOT_ITEM {
+    HOT_KIND kind;
+    unsigned long dwTokens;
+    char szName[16];
+} HOT_ITEM;
+
+extern int g_HotCount;
+
+long __stdcall HotItems(HOT_ITEM* pItem, unsigned long dwCount);
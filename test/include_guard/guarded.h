@@ -0,0 +1,11 @@
+/* guarded by a macro */
+#ifndef GUARDED_H
+#define GUARDED_H
+
+#define GUARDED_VERSION 2
+
+typedef struct {
+    int g1;
+} guarded_t;
+
+#endif /* GUARDED_H */
@@ -0,0 +1,19 @@
+// driver: args=--fold-if
+// driver: expected=success
+// driver: reference=include_guard.ref
+
+#include "guarded.h"
+#include "once.h"
+#include "guarded.h"
+#include "once.h"
+
+#if GUARDED_VERSION >= 2
+struct user {
+    guarded_t e1;
+    once_t e2;
+};
+#else
+struct user {
+    int e1;
+};
+#endif
@@ -0,0 +1,5 @@
+#pragma once
+
+typedef struct {
+    short o1;
+} once_t;
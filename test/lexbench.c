@@ -0,0 +1,219 @@
+// throughput of the tokenizer scanners in MB/s
+// usage: h2incc-lexbench [--check] [header ...]
+// Without headers a synthetic header is used. Each header is tokenized
+// with every scanner implementation the cpu supports. The cost of the
+// analyzer's token predicates is compared per token: branchy char tests
+// as they were, the char class table and the flags of the tokenizer.
+// --check compares the SIMD scanners with the scalar ones on random
+// input and returns 1 if they differ.
+
+#include "incfile.h"
+#include "lexscan.h"
+#include "testutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MINSECONDS  0.25
+
+static double MeasureParser(const char* pszName, const char* pData, size_t dwSize) {
+    int numRuns = 0;
+    double start = GetSeconds();
+    double elapsed;
+    do {
+        struct INCFILE* pIncFile = CreateIncFileFromMemory(pszName, pData, dwSize, NULL);
+        if (pIncFile == NULL) {
+            return 0;
+        }
+        ParserIncFile(pIncFile);
+        DestroyIncFile(pIncFile);
+        numRuns++;
+        elapsed = GetSeconds() - start;
+    } while (elapsed < MINSECONDS);
+    return (double)dwSize * numRuns / elapsed / (1024 * 1024);
+}
+
+static double MeasureLines(const char* pData, size_t dwSize) {
+    int numRuns = 0;
+    size_t numLines = 0;
+    double start = GetSeconds();
+    double elapsed;
+    do {
+        const char* p = pData;
+        while (1) {
+            p += LexScanLine(p);
+            if (*p == '\0') {
+                break;
+            }
+            p++;
+            numLines++;
+        }
+        numRuns++;
+        elapsed = GetSeconds() - start;
+    } while (elapsed < MINSECONDS);
+    return numLines != 0 ? (double)dwSize * numRuns / elapsed / (1024 * 1024) : 0;
+}
+
+// name, number, string and operator tests with char comparisons
+
+static uint8_t ClassifyBranchy(const char* p) {
+    uint8_t flags = TF_TOKEN;
+    char c = *p;
+    if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_' || c == '?' || c == '@') {
+        flags |= TF_NAME;
+    }
+    if (c >= '0' && c <= '9') {
+        flags |= TF_NUMBER;
+        if (strchr(p + 1, ',') != NULL) {
+            flags |= TF_STRING;
+        }
+    }
+    if (c == '"') {
+        flags |= TF_STRING;
+    }
+    if (c == '-' || c == '+' || c == '*' || c == '/' || c == '|' || c == '&'
+            || strncmp(p, ">>", 2) == 0 || strncmp(p, "<<", 2) == 0) {
+        flags |= TF_OPERATOR;
+    }
+    if (strcmp(p, "#") == 0) {
+        flags |= TF_PPHASH;
+    }
+    return flags;
+}
+
+enum { PRED_BRANCHY, PRED_TABLE, PRED_FLAGS };
+
+static double MeasurePredicate(struct INCFILE* pIncFile, char** ppTokens, size_t numTokens, int nKind) {
+    size_t numRuns = 0;
+    unsigned sum = 0;
+    double start = GetSeconds();
+    double elapsed;
+    do {
+        for (size_t i = 0; i < numTokens; i++) {
+            switch (nKind) {
+            case PRED_BRANCHY:
+                sum += ClassifyBranchy(ppTokens[i]);
+                break;
+            case PRED_TABLE:
+                sum += ClassifyToken(ppTokens[i]);
+                break;
+            default:
+                sum += GetTokenFlags(pIncFile, ppTokens[i]);
+                break;
+            }
+        }
+        numRuns++;
+        elapsed = GetSeconds() - start;
+    } while (elapsed < MINSECONDS);
+    if (sum == 0) {
+        return 0;
+    }
+    return elapsed * 1e9 / ((double)numTokens * numRuns);
+}
+
+static void BenchmarkPredicates(const char* pszName, const char* pData, size_t dwSize) {
+    struct INCFILE* pIncFile = CreateIncFileFromMemory(pszName, pData, dwSize, NULL);
+    if (pIncFile == NULL) {
+        return;
+    }
+    ParserIncFile(pIncFile);
+    size_t numTokens = 0;
+    for (char* p = GetTokensIncFile(pIncFile); *p != '\0'; p += strlen(p) + 1) {
+        numTokens++;
+    }
+    char** ppTokens = malloc(numTokens * sizeof(char*) + 1);
+    size_t i = 0;
+    for (char* p = GetTokensIncFile(pIncFile); *p != '\0'; p += strlen(p) + 1) {
+        ppTokens[i++] = p;
+    }
+    printf("%-40s %-7s predicates: branchy %5.2f  table %5.2f  flags %5.2f ns/token\n", pszName, "",
+           MeasurePredicate(pIncFile, ppTokens, numTokens, PRED_BRANCHY),
+           MeasurePredicate(pIncFile, ppTokens, numTokens, PRED_TABLE),
+           MeasurePredicate(pIncFile, ppTokens, numTokens, PRED_FLAGS));
+    free(ppTokens);
+    DestroyIncFile(pIncFile);
+}
+
+static void Benchmark(const char* pszName, const char* pData, size_t dwSize) {
+    int nMaxLevel = LexScanSetLevel(LEX_AUTO);
+    for (int nLevel = LEX_SCALAR; nLevel <= nMaxLevel; nLevel++) {
+        LexScanSetLevel(nLevel);
+        printf("%-40s %-7s lines: %8.1f MB/s  parser: %8.1f MB/s\n", pszName, LexScanLevelName(nLevel),
+               MeasureLines(pData, dwSize), MeasureParser(pszName, pData, dwSize));
+    }
+    BenchmarkPredicates(pszName, pData, dwSize);
+}
+
+// compare the scanners of all levels
+
+static const char g_szCheckChars[] = "abcXYZ_09 \t\r\n,;:()[]{}|*<>!~-+=/&#.'\"\\\x80\xe0\xff***///";
+
+static int Check(void) {
+    static char buffer[256] __attribute__((aligned(64)));
+    int nMaxLevel = LexScanSetLevel(LEX_AUTO);
+    int numErrors = 0;
+
+    srand(1);
+    for (int i = 0; i < 100000; i++) {
+        size_t start = rand() % 64;
+        size_t len = rand() % 128;
+        memset(buffer, 'x', sizeof(buffer));
+        for (size_t j = 0; j < len; j++) {
+            buffer[start + j] = g_szCheckChars[rand() % (sizeof(g_szCheckChars) - 1)];
+        }
+        buffer[start + len] = '\0';
+        size_t results[6];
+        for (int nLevel = LEX_SCALAR; nLevel <= nMaxLevel; nLevel++) {
+            LexScanSetLevel(nLevel);
+            size_t line = LexScanLine(buffer + start);
+            size_t name = LexScanName(buffer + start);
+            size_t blanks = LexSkipBlanks(buffer + start);
+            size_t slash = LexScanSlash(buffer + start);
+            size_t commentEnd = LexScanCommentEnd(buffer + start);
+            size_t string = LexScanString(buffer + start);
+            if (nLevel == LEX_SCALAR) {
+                results[0] = line;
+                results[1] = name;
+                results[2] = blanks;
+                results[3] = slash;
+                results[4] = commentEnd;
+                results[5] = string;
+            } else if (line != results[0] || name != results[1] || blanks != results[2]
+                    || slash != results[3] || commentEnd != results[4] || string != results[5]) {
+                fprintf(stderr, "%s differs at offset %u, length %u\n", LexScanLevelName(nLevel), (unsigned)start, (unsigned)len);
+                numErrors++;
+            }
+        }
+    }
+    printf("checked scanners up to %s: %d errors\n", LexScanLevelName(nMaxLevel), numErrors);
+    return numErrors == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    int numFiles = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--check") == 0) {
+            return Check();
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        size_t dwSize;
+        char* pData = ReadFile(argv[i], &dwSize);
+        if (pData == NULL) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            return 1;
+        }
+        Benchmark(argv[i], pData, dwSize);
+        free(pData);
+        numFiles++;
+    }
+    if (numFiles == 0) {
+        size_t dwSize;
+        char* pData = CreateSyntheticHeader(8 * 1024 * 1024, &dwSize);
+        Benchmark("(synthetic)", pData, dwSize);
+        free(pData);
+    }
+    return 0;
+}
@@ -0,0 +1,101 @@
+// runs a test case through the library interface instead of the executable
+// usage: h2incc-libdriver [-C profile] [options] header
+
+#include "libh2incc.h"
+#include "testutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void PrintDiagnostic(void* pContext, const char* pszText) {
+    fputs(pszText, stderr);
+}
+
+int main(int argc, char* argv[]) {
+    struct h2incc_options options;
+    const char* pszProfilePath = NULL;
+    const char* pszHeader = NULL;
+    char* pProfile = NULL;
+    size_t dwProfileSize = 0;
+
+    h2incc_options_init(&options);
+    options.pfnDiagnostic = PrintDiagnostic;
+    // included headers are read here, the library itself never opens files
+    g_bReadIncludes = 1;
+    options.pfnLoadInclude = LoadInclude;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (arg[0] != '-') {
+            pszHeader = arg;
+        } else if (strcmp(arg, "-C") == 0 && i + 1 < argc) {
+            pszProfilePath = argv[++i];
+        } else if (strcmp(arg, "-a") == 0) {
+            options.bAddAlign = 1;
+        } else if (strcmp(arg, "-c") == 0) {
+            options.bIncludeComments = 1;
+        } else if (strcmp(arg, "-f") == 0) {
+            options.bPrefixReserved = 1;
+        } else if (strcmp(arg, "-q") == 0) {
+            options.bNoRecords = 1;
+        } else if (strcmp(arg, "-r") == 0) {
+            options.bRecordsInUnions = 1;
+        } else if (strcmp(arg, "-u") == 0) {
+            options.bUntypedParams = 1;
+        } else if (strcmp(arg, "-x") == 0) {
+            options.b64bit = 1;
+        } else if (arg[1] == 'd' && arg[2] != '\0') {
+            options.dwDllImport = atoi(arg + 2);
+        } else if (arg[1] == 'W' && arg[2] != '\0') {
+            options.dwWarningLevel = atoi(arg + 2);
+        } else if (strcmp(arg, "-k") == 0 && i + 1 < argc) {
+            options.cCallConv = argv[++i][0];
+        } else if (strcmp(arg, "-s") == 0 && i + 1 < argc) {
+            options.pszSelection = argv[++i];
+        } else {
+            fprintf(stderr, "unsupported option %s\n", arg);
+            return 1;
+        }
+    }
+    if (pszHeader == NULL) {
+        fprintf(stderr, "usage: h2incc-libdriver [-C profile] [options] header\n");
+        return 1;
+    }
+    if (pszProfilePath != NULL) {
+        pProfile = ReadFile(pszProfilePath, &dwProfileSize);
+    }
+    size_t dwSourceSize;
+    char* pSource = ReadFile(pszHeader, &dwSourceSize);
+    if (pSource == NULL) {
+        fprintf(stderr, "cannot open file %s\n", pszHeader);
+        return 1;
+    }
+
+    struct h2incc_context* pContext = h2incc_create(pProfile, dwProfileSize);
+    if (pContext == NULL) {
+        fprintf(stderr, "h2incc_create failed\n");
+        return 1;
+    }
+    // start with a small buffer to exercise H2INCC_ERROR_BUFFER
+    size_t dwOutputSize = 16;
+    char* pOutput = malloc(dwOutputSize);
+    size_t dwNeeded;
+    int rc = h2incc_convert(pContext, &options, pszHeader, pSource, dwSourceSize, pOutput, dwOutputSize, &dwNeeded);
+    if (rc == H2INCC_ERROR_BUFFER) {
+        free(pOutput);
+        dwOutputSize = dwNeeded + 1;
+        pOutput = malloc(dwOutputSize);
+        rc = h2incc_convert(pContext, &options, pszHeader, pSource, dwSourceSize, pOutput, dwOutputSize, &dwNeeded);
+    }
+    if (rc == H2INCC_OK) {
+        fwrite(pOutput, 1, dwNeeded, stdout);
+    } else {
+        fprintf(stderr, "h2incc_convert failed: %d\n", rc);
+    }
+    h2incc_destroy(pContext);
+    free(pOutput);
+    free(pSource);
+    free(pProfile);
+    FreeIncludes();
+    return rc != H2INCC_OK;
+}
@@ -0,0 +1,8 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=macro_define_char_escapes.ref
+#define ABC '\101'
+#define DEF '\x4a'
+#define GHI '\n'
+#define JKL '\0'
+#define MNO '\''
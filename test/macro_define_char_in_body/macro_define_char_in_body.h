@@ -0,0 +1,5 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=macro_define_char_in_body.ref
+#define ISASCII(c) ((c) >= '\0' && (c) <= '\x7f')
+#define TERMINATE(p, n) ((p)[n] = '\0', (p))
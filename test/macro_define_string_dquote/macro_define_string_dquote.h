@@ -0,0 +1,6 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=macro_define_string_dquote.ref
+#define ABC "a\"b"
+#define DEF "\"def\""
+#define GHI "g\"\"h"
@@ -0,0 +1,5 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=macro_define_string_escchars.ref
+#define ABC "a\\b\'c\?d"
+#define DEF "\r\n"
@@ -0,0 +1,5 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=macro_define_string_hex.ref
+#define ABC "\x41\x4a\x4Bz"
+#define DEF "d\xff\x7"
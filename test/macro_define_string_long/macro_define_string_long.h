@@ -0,0 +1,5 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=macro_define_string_long.ref
+#define ABC "The quick brown fox jumps over the lazy dog, the quick brown fox\tjumps over the lazy dog\n"
+#define DEF "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde\x7f"
@@ -0,0 +1,5 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=macro_define_string_octal.ref
+#define ABC "\101BC\0"
+#define DEF "d\7\60\1234"
@@ -0,0 +1,10 @@
+// driver: args=-C %INICONFIG%
+// driver: expected=success
+// driver: reference=macro_function_reserved_params.ref
+#define OF(args) args
+#define Z_ARG(args) args
+int inflateBack OF((void *strm, in_func in, void FAR *in_desc));
+int gzread OF((void *file, void *buf, unsigned size));
+int gzprintf Z_ARG((void *file, const char *format, ...));
+int gzputs OF((void *file, const char *s));
+int gzputc OF((void *file, int c));
@@ -0,0 +1,174 @@
+// driver: args=-DFOO=2 -UBAR
+// driver: expected=success
+// driver: reference=macro_if_fold.ref
+#define VERSION 0x0501
+#define HAS_X
+
+#if VERSION >= 0x0500
+extern int version_new;
+#else
+extern int version_old;
+#endif
+
+#ifdef HAS_X
+extern int has_x;
+#elif UNKNOWN
+extern int unknown1;
+#endif
+
+#if UNKNOWN
+extern int unknown2;
+#elif VERSION == 0x0400
+extern int version_0400;
+#elif defined(HAS_X) && (FOO + 1) * 2 == 6
+extern int foo_is_2;
+#else
+extern int not_taken;
+#endif
+
+#if BAR || !defined(FOO)
+extern int bar;
+#endif
+
+#undef HAS_X
+#ifdef HAS_X
+extern int has_x_again;
+#endif
+
+#if 0
+#if UNKNOWN
+extern int nested;
+#endif
+#else
+extern int else_of_0;
+#endif
+
+struct s {
+    int x;
+#if VERSION < 0x0400
+    int y;
+#endif
+    int z;
+};
+
+#ifndef GUARD_H
+#define INNER 1
+#if INNER
+extern int inner_known;
+#endif
+#endif
+
+#if INNER
+extern int inner_unknown;
+#endif
+
+#if 0
+/* #endif in a comment
+#endif */
+#define DROPPED_MACRO 1 \
+#endif
+#if UNKNOWN
+extern int dropped_nested;
+#endif
+extern int dropped;
+#elif INNER
+extern int elif_of_0;
+#endif
+
+#if (2 * 3 - 6) /* false without macros */
+/* #else in a comment */
+#if UNKNOWN
+extern int dropped_expr_nested;
+#else
+extern int dropped_expr_else;
+#endif
+#else
+extern int else_of_expr;
+#endif
+
+#if ~0u > 0
+extern int unsigned_max;
+#endif
+
+#if -1 < 0u
+extern int unsigned_compare;
+#endif
+
+#define ALL_ONES ~0UL
+#if ALL_ONES / 2 > 0x7FFFFFFF
+extern int unsigned_define;
+#endif
+
+#if 0x7FFFFFFFFFFFFFFF + 1 > 0
+extern int signed_overflow;
+#endif
+
+// the conditional beyond MAXIFLEVEL is written
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if 1
+#if UNKNOWN
+extern int deep_if;
+#else
+extern int deep_else;
+#endif
+extern int deep_after;
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
+#endif
@@ -0,0 +1,390 @@
+// the hot helpers of the converter, each measured in isolation
+// usage: h2incc-microbench [-C profile] [--rounds n] [--kernel name]
+// The lookups are fed with the names of the tables loaded from the
+// profile, mixed with synthetic identifiers which mostly miss. Numbers
+// and string literals resemble the ones of the SDK headers, Parse_Line
+// tokenizes a synthetic header line by line. For each kernel the time
+// and the number of heap allocations per operation are printed.
+
+#include "libh2incc.h"
+#include "h2incc.h"
+#include "incfile.h"
+#include "list.h"
+#include "testutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUMSYNTHETIC    2048
+#define NUMHEADERLINES  4096
+
+struct KEYS {
+    char** ppItems;
+    int numItems;
+    int maxItems;
+};
+
+struct KERNEL {
+    const char* pszName;
+    size_t (*pfnRun)(void);     // one pass, returns the number of operations
+};
+
+// inputs of the kernels
+static struct KEYS g_Synthetic;     // identifiers of a header, not in any table
+static struct KEYS g_Names;         // reserved words and synthetic identifiers
+static struct KEYS g_Types;         // types of the conversion tables, structures and synthetic identifiers
+static struct KEYS g_Structures;    // known and defined structures and synthetic identifiers
+static struct KEYS g_Numbers;
+static struct KEYS g_Strings;       // without the leading '"'
+static char* g_pHeader;
+static size_t g_dwHeaderSize;
+static struct LIST* g_pNameList;    // synthetic identifiers, for FindItemList
+static char g_szOutput[0x1000];
+
+static volatile size_t g_dwSink;
+static uint32_t g_dwSeed = 1;
+
+static uint32_t Random(void) {
+    g_dwSeed = g_dwSeed * 1103515245 + 12345;
+    return g_dwSeed >> 8;
+}
+
+static void AddKey(struct KEYS* pKeys, char* pszKey) {
+    if (pKeys->numItems == pKeys->maxItems) {
+        pKeys->maxItems = pKeys->maxItems ? 2 * pKeys->maxItems : 256;
+        pKeys->ppItems = realloc(pKeys->ppItems, pKeys->maxItems * sizeof(char*));
+    }
+    pKeys->ppItems[pKeys->numItems++] = pszKey;
+}
+
+static void AddKeys(struct KEYS* pKeys, char** ppItems, int numItems) {
+    for (int i = 0; i < numItems; i++) {
+        AddKey(pKeys, ppItems[i]);
+    }
+}
+
+static void AddStrStrKeys(struct KEYS* pKeys, struct ITEM_STRSTR* pItems) {
+    for (int i = 0; pItems != NULL && pItems[i].key != NULL; i++) {
+        AddKey(pKeys, pItems[i].key);
+    }
+}
+
+// the order of the lookups shouldn't be the order of the tables
+
+static void ShuffleKeys(struct KEYS* pKeys) {
+    for (int i = pKeys->numItems - 1; i > 0; i--) {
+        int j = Random() % (i + 1);
+        char* pszTemp = pKeys->ppItems[i];
+        pKeys->ppItems[i] = pKeys->ppItems[j];
+        pKeys->ppItems[j] = pszTemp;
+    }
+}
+
+static void FreeKeys(struct KEYS* pKeys, int bItems) {
+    if (bItems) {
+        for (int i = 0; i < pKeys->numItems; i++) {
+            free(pKeys->ppItems[i]);
+        }
+    }
+    free(pKeys->ppItems);
+    memset(pKeys, 0, sizeof(*pKeys));
+}
+
+static char* FormatKey(const char* pszFormat, uint32_t dwValue) {
+    char szKey[64];
+    snprintf(szKey, sizeof(szKey), pszFormat, dwValue, dwValue);
+    return strdup(szKey);
+}
+
+static void CreateInputs(void) {
+    static const char* ppszIdentifiers[] = {
+        "Synthetic_Function_%u", "SYNTHETIC_CONSTANT_%u", "_SYNTHETIC_%u", "PSYNTHETIC_%u",
+        "hObject%u", "dwFlags%u", "IID_ISynthetic%u", "lpVtbl%u",
+    };
+    for (uint32_t i = 0; i < NUMSYNTHETIC; i++) {
+        AddKey(&g_Synthetic, FormatKey(ppszIdentifiers[i % 8], i));
+    }
+    ShuffleKeys(&g_Synthetic);
+
+    AddKeys(&g_Names, g_ReservedWords.pItems, g_ReservedWords.numItems);
+    AddKeys(&g_Names, g_Synthetic.ppItems, g_Synthetic.numItems);
+    ShuffleKeys(&g_Names);
+
+    AddStrStrKeys(&g_Types, g_ppConvertTypes1);
+    AddStrStrKeys(&g_Types, g_ppConvertTypes2);
+    AddStrStrKeys(&g_Types, g_ppConvertTypes3);
+    AddKeys(&g_Types, g_KnownStructures.pItems, g_KnownStructures.numItems);
+    AddKeys(&g_Types, g_Synthetic.ppItems, g_Synthetic.numItems / 4);
+    ShuffleKeys(&g_Types);
+
+    // half of the synthetic identifiers are structures defined by the header
+    AddKeys(&g_Structures, g_KnownStructures.pItems, g_KnownStructures.numItems);
+    AddKeys(&g_Structures, g_Synthetic.ppItems, g_Synthetic.numItems);
+    ShuffleKeys(&g_Structures);
+    if (g_pStructures == NULL) {
+        g_pStructures = CreateList(MAXITEMS, sizeof(void*));
+    }
+    g_pNameList = CreateList(MAXITEMS, sizeof(void*));
+    for (int i = 0; i < g_Synthetic.numItems / 2; i++) {
+        AddItemList(g_pStructures, g_Synthetic.ppItems[i]);
+        AddItemList(g_pNameList, g_Synthetic.ppItems[i]);
+    }
+
+    static const char* ppszNumbers[] = {
+        "0x%08X", "%u", "%uL", "0x%XUL", "0%o", "%uu", "0x%Xi64", "%u.5",
+    };
+    for (uint32_t i = 0; i < NUMSYNTHETIC; i++) {
+        AddKey(&g_Numbers, FormatKey(ppszNumbers[i % 8], Random() >> (i % 24)));
+    }
+
+    static const char* ppszStrings[] = {
+        "Synthetic string %u\"",
+        "\\\\Device\\\\Synthetic%u\"",
+        "line %u\\r\\n\"",
+        "\\x1b[%um\\t\"",
+        "%u\"",
+    };
+    for (uint32_t i = 0; i < NUMSYNTHETIC; i++) {
+        AddKey(&g_Strings, FormatKey(ppszStrings[i % 5], i));
+    }
+
+    size_t dwMax = NUMHEADERLINES * 128;
+    g_pHeader = malloc(dwMax);
+    size_t pos = 0;
+    for (int i = 0; i < NUMHEADERLINES; i++) {
+        switch (i % 8) {
+        case 0:
+            pos += sprintf(g_pHeader + pos, "/* Synthetic_Function_%d: returns the state of object %d */\n", i, i);
+            break;
+        case 1:
+        case 2:
+            pos += sprintf(g_pHeader + pos, "#define SYNTHETIC_CONSTANT_%d\t\t\t(0x%08X | SYNTHETIC_CONSTANT_%d)\n", i, i * 17, i - 5);
+            break;
+        case 3:
+            pos += sprintf(g_pHeader + pos, "typedef struct _SYNTHETIC_%d {\n", i);
+            break;
+        case 4:
+            pos += sprintf(g_pHeader + pos, "    unsigned long dwSize; void* pReserved; char szName[%d + 1];\n", i % 64);
+            break;
+        case 5:
+            pos += sprintf(g_pHeader + pos, "} SYNTHETIC_%d, *PSYNTHETIC_%d;\n", i - 2, i - 2);
+            break;
+        case 6:
+            pos += sprintf(g_pHeader + pos, "long __stdcall Synthetic_Function_%d(void* hObject, unsigned long dwFlags);\n", i);
+            break;
+        case 7:
+            pos += sprintf(g_pHeader + pos, "#define SYNTHETIC_TEXT_%d \"line %d\\r\\n\"\n", i, i);
+            break;
+        }
+    }
+    g_dwHeaderSize = pos;
+}
+
+static void DestroyInputs(void) {
+    DestroyList(g_pNameList);
+    DestroyList(g_pStructures);
+    g_pStructures = NULL;
+    FreeKeys(&g_Names, 0);
+    FreeKeys(&g_Types, 0);
+    FreeKeys(&g_Structures, 0);
+    FreeKeys(&g_Synthetic, 1);
+    FreeKeys(&g_Numbers, 1);
+    FreeKeys(&g_Strings, 1);
+    free(g_pHeader);
+}
+
+static size_t RunListBsearch(void) {
+    size_t dwFound = 0;
+    for (int i = 0; i < g_Names.numItems; i++) {
+        void* pNext;
+        dwFound += list_bsearch(g_Names.ppItems[i], g_ReservedWords.pItems, g_ReservedWords.numItems, sizeof(char*), cmpproc, &pNext) != NULL;
+    }
+    g_dwSink += dwFound;
+    return g_Names.numItems;
+}
+
+static size_t RunAddItemList(void) {
+    struct LIST* pList = CreateList(MAXITEMS, sizeof(void*));
+    for (int i = 0; i < g_Synthetic.numItems; i++) {
+        AddItemList(pList, g_Synthetic.ppItems[i]);
+    }
+    g_dwSink += GetNumItemsList(pList);
+    DestroyList(pList);
+    return g_Synthetic.numItems;
+}
+
+static size_t RunFindItemList(void) {
+    size_t dwFound = 0;
+    for (int i = 0; i < g_Names.numItems; i++) {
+        dwFound += FindItemList(g_pNameList, g_Names.ppItems[i]) != NULL;
+    }
+    g_dwSink += dwFound;
+    return g_Names.numItems;
+}
+
+static size_t RunIsReservedWord(void) {
+    size_t dwFound = 0;
+    for (int i = 0; i < g_Names.numItems; i++) {
+        dwFound += IsReservedWord(g_Names.ppItems[i]);
+    }
+    g_dwSink += dwFound;
+    return g_Names.numItems;
+}
+
+static size_t RunTranslateType(void) {
+    size_t dwLength = 0;
+    for (int i = 0; i < g_Types.numItems; i++) {
+        dwLength += (size_t)TranslateType(g_Types.ppItems[i], i & 1);
+    }
+    g_dwSink += dwLength;
+    return g_Types.numItems;
+}
+
+static size_t RunIsStructure(void) {
+    size_t dwFound = 0;
+    for (int i = 0; i < g_Structures.numItems; i++) {
+        dwFound += IsStructure(g_Structures.ppItems[i]);
+    }
+    g_dwSink += dwFound;
+    return g_Structures.numItems;
+}
+
+static size_t RunConvertNumber(void) {
+    size_t dwLength = 0;
+    for (int i = 0; i < g_Numbers.numItems; i++) {
+        char* os = g_szOutput;
+        char* is = g_Numbers.ppItems[i];
+        ConvertNumber(&os, &is);
+        dwLength += os - g_szOutput;
+    }
+    g_dwSink += dwLength;
+    return g_Numbers.numItems;
+}
+
+static size_t RunGetStringLiteral(void) {
+    size_t dwLength = 0;
+    for (int i = 0; i < g_Strings.numItems; i++) {
+        char* os = g_szOutput;
+        char* is = g_Strings.ppItems[i];
+        GetStringLiteral(&os, &is);
+        dwLength += os - g_szOutput;
+    }
+    g_dwSink += dwLength;
+    return g_Strings.numItems;
+}
+
+// Parse_Line needs the state set up by ParserIncFile, so the whole
+// header is tokenized and the time is divided by its lines
+
+static size_t RunParseLine(void) {
+    struct INCFILE* pIncFile = CreateIncFileFromMemory("microbench.h", g_pHeader, g_dwHeaderSize, NULL);
+    if (pIncFile == NULL) {
+        return 0;
+    }
+    ParserIncFile(pIncFile);
+    g_dwSink += GetErrorsIncFile(pIncFile);
+    DestroyIncFile(pIncFile);
+    return NUMHEADERLINES;
+}
+
+static const struct KERNEL g_Kernels[] = {
+    { "list_bsearch",       RunListBsearch },
+    { "AddItemList",        RunAddItemList },
+    { "FindItemList",       RunFindItemList },
+    { "IsReservedWord",     RunIsReservedWord },
+    { "TranslateType",      RunTranslateType },
+    { "IsStructure",        RunIsStructure },
+    { "ConvertNumber",      RunConvertNumber },
+    { "GetStringLiteral",   RunGetStringLiteral },
+    { "Parse_Line",         RunParseLine },
+};
+
+// returns 0 if the kernel did nothing
+
+static int RunKernel(const struct KERNEL* pKernel, int numRounds) {
+    // the first pass warms up the caches and isn't counted
+    size_t numOps = pKernel->pfnRun();
+    if (numOps == 0) {
+        fprintf(stderr, "%s: no operations\n", pKernel->pszName);
+        return 0;
+    }
+    numOps = 0;
+    g_numAllocs = 0;
+    g_numMoves = 0;
+    g_bCounting = 1;
+    double start = GetSeconds();
+    for (int i = 0; i < numRounds; i++) {
+        numOps += pKernel->pfnRun();
+    }
+    double seconds = GetSeconds() - start;
+    g_bCounting = 0;
+
+    printf("%-18s %10.1f ns/op", pKernel->pszName, seconds * 1e9 / numOps);
+    if (COUNTALLOCS) {
+        printf(" %10.4f allocs/op", (double)(g_numAllocs + g_numMoves) / numOps);
+    }
+    printf(" %10u ops\n", (unsigned)numOps);
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    const char* pszProfilePath = NULL;
+    const char* pszKernel = NULL;
+    int numRounds = 20;
+    int rc = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            pszProfilePath = argv[++i];
+        } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            numRounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            pszKernel = argv[++i];
+        } else {
+            fprintf(stderr, "usage: h2incc-microbench [-C profile] [--rounds n] [--kernel name]\n");
+            return 1;
+        }
+    }
+    if (numRounds < 1) {
+        fprintf(stderr, "rounds must be positive\n");
+        return 1;
+    }
+
+    char* pProfile = NULL;
+    size_t dwProfileSize = 0;
+    if (pszProfilePath != NULL) {
+        pProfile = ReadFile(pszProfilePath, &dwProfileSize);
+        if (pProfile == NULL) {
+            fprintf(stderr, "cannot read %s\n", pszProfilePath);
+            return 1;
+        }
+    }
+    struct h2incc_context* pContext = h2incc_create(pProfile, dwProfileSize);
+    free(pProfile);
+    if (pContext == NULL) {
+        fprintf(stderr, "cannot create context\n");
+        return 1;
+    }
+    CreateInputs();
+    printf("reserved words: %u, known structures: %u, synthetic identifiers: %u\n",
+           (unsigned)g_ReservedWords.numItems, (unsigned)g_KnownStructures.numItems, (unsigned)g_Synthetic.numItems);
+
+    int numKernels = 0;
+    for (size_t i = 0; i < sizeof(g_Kernels) / sizeof(g_Kernels[0]); i++) {
+        if (pszKernel != NULL && strcmp(pszKernel, g_Kernels[i].pszName) != 0) {
+            continue;
+        }
+        if (!RunKernel(&g_Kernels[i], numRounds)) {
+            rc = 1;
+        }
+        numKernels++;
+    }
+    DestroyInputs();
+    h2incc_destroy(pContext);
+    if (numKernels == 0) {
+        fprintf(stderr, "unknown kernel %s\n", pszKernel);
+        return 1;
+    }
+    return rc;
+}
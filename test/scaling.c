@@ -0,0 +1,270 @@
+// growth of the conversion time with the size of pathological headers
+// usage: h2incc-scaling [-C profile] [--case name] [--runs n] [--slack f]
+// Each case generates headers of n, 2n, 4n and 8n items (macros, structures,
+// terms of a macro body, members of a structure, parameters of a prototype,
+// nested includes) and converts them through the library interface. n is
+// doubled until the smallest header takes long enough to be timed. The case
+// fails if t(8n) / t(n) exceeds the budget of its complexity class, 8 for
+// linear and 8 * log(8n) / log(n) for n log n, times the slack factor. A
+// quadratic path grows by 64, so the test doesn't depend on the speed of
+// the machine.
+
+#include "libh2incc.h"
+#include "testutil.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MINSECONDS      0.02    // time of the smallest header
+#define MAXSECONDS      0.5     // don't grow n further if it takes longer
+
+enum {
+    CX_LINEAR,
+    CX_NLOGN,
+};
+
+struct SCALINGCASE {
+    const char* pszName;
+    void (*pfnGenerate)(struct TEXT*, int);
+    int dwComplexity;
+    int dwStart;        // initial n
+    int dwLimit;        // maximum n
+};
+
+// the generators
+
+static void GenerateMacros(struct TEXT* pText, int n) {
+    for (int i = 0; i < n; i++) {
+        switch (i % 3) {
+        case 0:
+            Print(pText, "#define SCALE_VALUE_%d 0x%04X\n", i, i);
+            break;
+        case 1:
+            Print(pText, "#define SCALE_MACRO_%d(a, b) ((a) + (b) * %d)\n", i, i);
+            break;
+        case 2:
+            Print(pText, "#define SCALE_USE_%d SCALE_MACRO_%d(SCALE_VALUE_%d, 2)\n", i, i - 1, i - 2);
+            break;
+        }
+    }
+}
+
+static void GenerateStructs(struct TEXT* pText, int n) {
+    for (int i = 0; i < n; i++) {
+        Print(pText, "typedef struct _SCALE_STRUCT_%d {\n    unsigned long cbSize;\n", i);
+        if (i > 0) {
+            Print(pText, "    struct _SCALE_STRUCT_%d* pPrev;\n", i - 1);
+        }
+        Print(pText, "    char szName[%d];\n} SCALE_STRUCT_%d, *PSCALE_STRUCT_%d;\n", i % 64 + 1, i, i);
+    }
+}
+
+static void GenerateMacroBody(struct TEXT* pText, int n) {
+    Print(pText, "#define SCALE_BODY(x) ((x)");
+    for (int i = 0; i < n; i++) {
+        if (i % 16 == 0) {
+            Print(pText, " \\\n   ");
+        }
+        Print(pText, " + %d", i);
+    }
+    Print(pText, ")\n#define SCALE_BODY_USE SCALE_BODY(1)\n");
+}
+
+static void GenerateWideStruct(struct TEXT* pText, int n) {
+    Print(pText, "typedef struct _SCALE_WIDE {\n");
+    for (int i = 0; i < n; i++) {
+        switch (i % 4) {
+        case 0:
+            Print(pText, "    unsigned long dwValue%d;\n", i);
+            break;
+        case 1:
+            Print(pText, "    unsigned int fFlag%d:1;\n", i);
+            break;
+        case 2:
+            Print(pText, "    void* pData%d;\n", i);
+            break;
+        case 3:
+            Print(pText, "    char szText%d[%d];\n", i, i % 32 + 1);
+            break;
+        }
+    }
+    Print(pText, "} SCALE_WIDE, *PSCALE_WIDE;\n");
+}
+
+static void GeneratePrototype(struct TEXT* pText, int n) {
+    Print(pText, "long __stdcall ScaleFunction(void* hObject");
+    for (int i = 0; i < n; i++) {
+        switch (i % 3) {
+        case 0:
+            Print(pText, ",\n    unsigned long dwParam%d", i);
+            break;
+        case 1:
+            Print(pText, ",\n    const char* pszParam%d", i);
+            break;
+        case 2:
+            Print(pText, ",\n    struct _SCALE_PARAM* (__stdcall *pfnParam%d)(int)", i);
+            break;
+        }
+    }
+    Print(pText, ");\n");
+}
+
+static void GenerateIncludes(struct TEXT* pText, int n) {
+    char szName[64];
+    int numIncludes = n < MAXINCLUDES ? n : MAXINCLUDES;
+    for (int i = 0; i < numIncludes; i++) {
+        snprintf(szName, sizeof(szName), "scale_include_%d.h", i);
+        struct TEXT* pInclude = &AddInclude(szName)->text;
+        Print(pInclude, "#ifndef SCALE_INCLUDE_%d_H\n#define SCALE_INCLUDE_%d_H\n", i, i);
+        if (i + 1 < numIncludes) {
+            Print(pInclude, "#include \"scale_include_%d.h\"\n", i + 1);
+        }
+        for (int j = 0; j < 32; j++) {
+            Print(pInclude, "#define SCALE_INCLUDE_%d_VALUE_%d %d\n", i, j, j);
+        }
+        Print(pInclude, "typedef struct _SCALE_INCLUDE_%d { long a; long b; } SCALE_INCLUDE_%d;\n#endif\n", i, i);
+    }
+    // the chain is included again from the top, the guards skip it
+    for (int i = 0; i < numIncludes; i++) {
+        Print(pText, "#include \"scale_include_%d.h\"\n", i);
+    }
+}
+
+static const struct SCALINGCASE g_Cases[] = {
+    { "macros",      GenerateMacros,     CX_NLOGN,  256, 1 << 12 },
+    { "structs",     GenerateStructs,    CX_NLOGN,  64,  1 << 12 },
+    { "macro_body",  GenerateMacroBody,  CX_LINEAR, 256, 1 << 16 },
+    { "wide_struct", GenerateWideStruct, CX_LINEAR, 64,  1 << 14 },
+    { "prototype",   GeneratePrototype,  CX_LINEAR, 32,  1 << 14 },
+    { "includes",    GenerateIncludes,   CX_NLOGN,  16,  MAXINCLUDES / 8 },
+};
+
+// best time of numRuns conversions of a header with n items, -1 on errors
+
+static double TimeCase(struct h2incc_context* pContext, const struct SCALINGCASE* pCase, int n, int numRuns) {
+    struct TEXT text = { NULL, 0, 0 };
+    Print(&text, "/* scaling: %s, count %d */\n", pCase->pszName, n);
+    pCase->pfnGenerate(&text, n);
+
+    struct h2incc_options options;
+    h2incc_options_init(&options);
+    options.pfnLoadInclude = LoadInclude;
+    size_t dwOutputSize = 8 * text.dwSize + 0x10000;
+    char* pOutput = malloc(dwOutputSize);
+    double bestSeconds = -1;
+    for (int run = 0; run < numRuns; run++) {
+        size_t dwLength;
+        double start = GetSeconds();
+        int rc = h2incc_convert(pContext, &options, "scaling.h", text.pData, text.dwSize, pOutput, dwOutputSize, &dwLength);
+        double seconds = GetSeconds() - start;
+        if (rc != H2INCC_OK) {
+            fprintf(stderr, "%s, count %d: conversion failed (%d)\n", pCase->pszName, n, rc);
+            bestSeconds = -1;
+            break;
+        }
+        if (bestSeconds < 0 || seconds < bestSeconds) {
+            bestSeconds = seconds;
+        }
+    }
+    free(pOutput);
+    free(text.pData);
+    FreeIncludes();
+    return bestSeconds;
+}
+
+// returns 0 if the time grows faster than the budget
+
+static int RunCase(struct h2incc_context* pContext, const struct SCALINGCASE* pCase, int numRuns, double slack) {
+    double times[4];
+    int n = pCase->dwStart;
+    times[0] = TimeCase(pContext, pCase, n, numRuns);
+    while (times[0] >= 0 && times[0] < MINSECONDS && 2 * n <= pCase->dwLimit) {
+        n *= 2;
+        times[0] = TimeCase(pContext, pCase, n, numRuns);
+    }
+    for (int i = 1; i < 4 && times[0] >= 0; i++) {
+        times[i] = TimeCase(pContext, pCase, n << i, numRuns);
+        if (times[i] < 0) {
+            times[0] = -1;
+        }
+    }
+    if (times[0] < 0) {
+        return 0;
+    }
+
+    double budget = 8.0;
+    if (pCase->dwComplexity == CX_NLOGN) {
+        budget = 8.0 * log(8.0 * n) / log((double)n);
+    }
+    double ratio = times[3] / times[0];
+    int ok = ratio <= budget * slack;
+    printf("%-12s n=%-6d %9.3f %9.3f %9.3f %9.3f ms  ratio %6.2f  budget %6.2f  %s\n",
+           pCase->pszName, n, times[0] * 1e3, times[1] * 1e3, times[2] * 1e3, times[3] * 1e3,
+           ratio, budget * slack, ok ? "ok" : "FAILED");
+    if (times[0] > MAXSECONDS / 8) {
+        printf("%-12s warning: n=%d takes %.3f s, the ratio may not be reliable\n", pCase->pszName, n, times[0]);
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    const char* pszProfilePath = NULL;
+    const char* pszCase = NULL;
+    int numRuns = 5;
+    double slack = 2.0;
+    int rc = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            pszProfilePath = argv[++i];
+        } else if (strcmp(argv[i], "--case") == 0 && i + 1 < argc) {
+            pszCase = argv[++i];
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            numRuns = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--slack") == 0 && i + 1 < argc) {
+            slack = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: h2incc-scaling [-C profile] [--case name] [--runs n] [--slack f]\n");
+            return 1;
+        }
+    }
+    if (numRuns < 1 || slack < 1.0) {
+        fprintf(stderr, "runs must be positive, slack at least 1\n");
+        return 1;
+    }
+
+    char* pProfile = NULL;
+    size_t dwProfileSize = 0;
+    if (pszProfilePath != NULL) {
+        pProfile = ReadFile(pszProfilePath, &dwProfileSize);
+        if (pProfile == NULL) {
+            fprintf(stderr, "cannot read %s\n", pszProfilePath);
+            return 1;
+        }
+    }
+    struct h2incc_context* pContext = h2incc_create(pProfile, dwProfileSize);
+    free(pProfile);
+    if (pContext == NULL) {
+        fprintf(stderr, "cannot create context\n");
+        return 1;
+    }
+
+    int numCases = 0;
+    for (size_t i = 0; i < sizeof(g_Cases) / sizeof(g_Cases[0]); i++) {
+        if (pszCase != NULL && strcmp(pszCase, g_Cases[i].pszName) != 0) {
+            continue;
+        }
+        if (!RunCase(pContext, &g_Cases[i], numRuns, slack)) {
+            rc = 1;
+        }
+        numCases++;
+    }
+    h2incc_destroy(pContext);
+    if (numCases == 0) {
+        fprintf(stderr, "unknown case %s\n", pszCase);
+        return 1;
+    }
+    return rc;
+}
@@ -0,0 +1,4 @@
+typedef struct {
+    int e1;
+    int e2;
+} subtype1;
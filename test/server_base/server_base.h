@@ -0,0 +1,11 @@
+// driver: mode=server
+// driver: args=%CASEDIR%/base.h
+// driver: expected=success
+// driver: reference=server_base.ref
+
+struct user {
+    int e1;
+    subtype1 e2;
+};
+
+extern subtype1 s1;
@@ -0,0 +1,12 @@
+#ifndef BASE_H
+#define BASE_H
+
+#define BASE_SIZE 16
+#define BASE_NAME "base"
+
+typedef struct {
+    int b1;
+    char b2[BASE_SIZE];
+} basetype;
+
+#endif
@@ -0,0 +1,24 @@
+// driver: mode=server
+// driver: args=%CASEDIR%/base.h --fold-if --fold-constants
+// driver: requests=200
+// driver: expected=success
+// driver: reference=server_requests.ref
+
+#include "base.h"
+
+#define REQ_SIZE (BASE_SIZE * 2)
+#define REQ_NAME "request"
+
+#ifdef BASE_H
+struct req {
+    basetype r1;
+    char r2[REQ_SIZE];
+};
+#endif
+
+enum req_kind {
+    REQ_FIRST = BASE_SIZE,
+    REQ_SECOND,
+};
+
+extern struct req r;
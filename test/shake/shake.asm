@@ -0,0 +1,2 @@
+; names in comments are not used: ShakeUnused
+	invoke	ShakeInit, addr item, SHAKE_FLAGS
@@ -0,0 +1,21 @@
+// driver: args=--shake=SHAKE_NONE --shake-asm=%CASEDIR%/shake.asm
+// driver: expected=success
+// driver: reference=shake.ref
+
+#include "shake_types.h"
+
+typedef struct _SHAKE_ITEM {
+    SHAKE_ID id;
+    SHAKE_POINT points[SHAKE_MAX];
+} SHAKE_ITEM;
+
+#ifdef SHAKE_WIDE
+#define SHAKE_FLAGS 2
+#else
+#define SHAKE_FLAGS 1
+#endif
+
+#define SHAKE_NONE 0
+
+long __stdcall ShakeInit(SHAKE_ITEM* pItem, unsigned long dwFlags);
+long __stdcall ShakeUnused(SHAKE_UNUSED_ITEM* pItem);
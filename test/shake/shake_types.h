@@ -0,0 +1,18 @@
+#ifndef SHAKE_TYPES_H
+#define SHAKE_TYPES_H
+
+#define SHAKE_MAX 8
+#define SHAKE_UNUSED 3
+
+typedef unsigned long SHAKE_ID;
+
+typedef struct _SHAKE_POINT {
+    long x;
+    long y;
+} SHAKE_POINT;
+
+typedef struct _SHAKE_UNUSED_ITEM {
+    long unused;
+} SHAKE_UNUSED_ITEM;
+
+#endif
@@ -0,0 +1,7 @@
+typedef struct {
+    int e1;
+    int e2;
+} subtype1;
+
+#define ADD(a, b) a + b
+#define CAT(a, b) a##_##b
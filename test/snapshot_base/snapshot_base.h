@@ -0,0 +1,17 @@
+// driver: prepare=%CASEDIR%/base.h --emit-snapshot=%TMPDIR%/base.snp
+// driver: args=--use-snapshot=%TMPDIR%/base.snp
+// driver: expected=success
+// driver: reference=snapshot_base.ref
+
+struct user {
+    int e1;
+    subtype1 e2;
+};
+
+extern subtype1 s1;
+
+int x = ADD(1, 2);
+
+enum {
+    E1 = CAT(VALUE, 1),
+};
@@ -0,0 +1,11 @@
+#ifndef COUNTED_H_
+#define COUNTED_H_
+
+#define COUNTED_VERSION 0x0200
+
+typedef struct _COUNTED {
+    unsigned long cbSize;
+    unsigned long dwCount;
+} COUNTED, *PCOUNTED;
+
+#endif
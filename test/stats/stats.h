@@ -0,0 +1,18 @@
+// driver: args=--stats
+// driver: expected=success
+// driver: reference=stats.ref
+// driver: stderr=stats.stderr
+// driver: mask=(?<=/\d) +\d+ +\d+
+// driver: mask=peak RSS \d+
+
+#include "counted.h"
+#include "counted.h"
+
+#define COUNTED_MASK(n) ((1 << (n)) - 1)
+
+typedef struct _COUNTED_ARRAY {
+    COUNTED items[4];
+    struct _COUNTED_ARRAY* pNext;
+} COUNTED_ARRAY;
+
+long __stdcall CountItems(PCOUNTED pCounted, unsigned long dwFlags);
@@ -0,0 +1,31 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=struct_conditional_braces.ref
+typedef struct _OUTER {
+    int a;
+#ifdef HAS_INNER
+    struct _INNER {
+        int b;
+        void (*pfn)(int x, int y);
+    } inner;
+#else
+    struct _INNER2 {
+        int c;
+    } inner2;
+#endif
+    int d;
+} OUTER;
+
+typedef void (*PFNCALLBACK)(int x, OUTER* pOuter);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _LAST {
+    int f;
+} LAST;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,199 @@
+#include "testutil.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+int g_bCounting;
+size_t g_numAllocs;
+size_t g_numFrees;
+size_t g_numMoves;
+
+struct HEADER g_Includes[MAXINCLUDES];
+int g_numIncludes;
+int g_bReadIncludes;
+
+static int g_nNextInclude;      // where LoadInclude starts to search
+
+#ifdef __GLIBC__
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t num, size_t size);
+extern void* __libc_realloc(void* p, size_t size);
+extern void __libc_free(void* p);
+
+void* malloc(size_t size) {
+    void* p = __libc_malloc(size);
+    if (g_bCounting && p != NULL) {
+        g_numAllocs++;
+    }
+    return p;
+}
+
+void* calloc(size_t num, size_t size) {
+    void* p = __libc_calloc(num, size);
+    if (g_bCounting && p != NULL) {
+        g_numAllocs++;
+    }
+    return p;
+}
+
+void* realloc(void* p, size_t size) {
+    void* pNew = __libc_realloc(p, size);
+    if (g_bCounting && pNew != NULL) {
+        if (p == NULL) {
+            g_numAllocs++;
+        } else if (size == 0) {
+            g_numFrees++;
+        } else if (pNew != p) {
+            g_numMoves++;
+        }
+    }
+    return pNew;
+}
+
+void free(void* p) {
+    if (g_bCounting && p != NULL) {
+        g_numFrees++;
+    }
+    __libc_free(p);
+}
+
+#endif
+
+double GetSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+char* ReadFile(const char* pszPath, size_t* pdwSize) {
+    FILE* f = fopen(pszPath, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = size >= 0 ? malloc(size + 1) : NULL;
+    if (data != NULL) {
+        *pdwSize = fread(data, 1, size, f);
+        data[*pdwSize] = '\0';
+    }
+    fclose(f);
+    return data;
+}
+
+void Print(struct TEXT* pText, const char* pszFormat, ...) {
+    va_list args;
+    va_start(args, pszFormat);
+    int len = vsnprintf(NULL, 0, pszFormat, args);
+    va_end(args);
+    if (pText->dwSize + len + 1 > pText->dwMax) {
+        pText->dwMax = (pText->dwSize + len + 1) * 2;
+        pText->pData = realloc(pText->pData, pText->dwMax);
+        if (pText->pData == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    va_start(args, pszFormat);
+    vsnprintf(pText->pData + pText->dwSize, len + 1, pszFormat, args);
+    va_end(args);
+    pText->dwSize += len;
+}
+
+// a header resembling the SDK of about dwMax bytes: comments, defines,
+// macros, structures, prototypes
+
+char* CreateSyntheticHeader(size_t dwMax, size_t* pdwSize) {
+    struct TEXT text = { NULL, 0, 0 };
+    for (int i = 0; text.dwSize < dwMax; i++) {
+        switch (i % 5) {
+        case 0:
+            Print(&text, "/*\r\n * Synthetic_Function_%d: returns the state of object %d\r\n */\r\n", i, i);
+            break;
+        case 1:
+            Print(&text, "#define SYNTHETIC_CONSTANT_%d\t\t\t(0x%08X | SYNTHETIC_CONSTANT_%d)\r\n", i, i * 17, i - 5);
+            break;
+        case 2:
+            Print(&text, "typedef struct _SYNTHETIC_%d {\r\n    unsigned long dwSize;\r\n    void* pReserved;\r\n    char szName[%d + 1];\r\n} SYNTHETIC_%d, *PSYNTHETIC_%d;\r\n", i, i % 64, i, i);
+            break;
+        case 3:
+            Print(&text, "__declspec(dllimport) long __stdcall Synthetic_Function_%d(void* hObject, unsigned long dwFlags);\r\n", i);
+            break;
+        case 4:
+            Print(&text, "#define SYNTHETIC_MACRO_%d(a, b) ((a) + (b) * %d)\r\n#define SYNTHETIC_VALUE_%d SYNTHETIC_MACRO_%d(1, 2)\r\n", i, i, i, i);
+            break;
+        }
+    }
+    *pdwSize = text.dwSize;
+    return text.pData;
+}
+
+// included headers
+// The generators add them with AddInclude, LoadInclude serves them to
+// the library. Chains of includes are requested in the order they were
+// added, so the search starts behind the last header found.
+
+struct HEADER* AddInclude(const char* pszName) {
+    if (g_numIncludes == MAXINCLUDES) {
+        return NULL;
+    }
+    struct HEADER* pHeader = &g_Includes[g_numIncludes++];
+    snprintf(pHeader->szName, sizeof(pHeader->szName), "%s", pszName);
+    return pHeader;
+}
+
+void FreeIncludes(void) {
+    for (int i = 0; i < g_numIncludes; i++) {
+        free(g_Includes[i].text.pData);
+        memset(&g_Includes[i], 0, sizeof(g_Includes[i]));
+    }
+    g_numIncludes = 0;
+    g_nNextInclude = 0;
+}
+
+static struct HEADER* FindInclude(const char* pszName) {
+    for (int n = 0; n < g_numIncludes; n++) {
+        int i = (g_nNextInclude + n) % g_numIncludes;
+        if (strcmp(g_Includes[i].szName, pszName) == 0) {
+            g_nNextInclude = i + 1;
+            return &g_Includes[i];
+        }
+    }
+    return NULL;
+}
+
+// with g_bReadIncludes the header is read from the directory of the
+// including one, the library itself never opens files
+
+static struct HEADER* ReadInclude(const char* pszDirPath, const char* pszName) {
+    char szPath[1024];
+    size_t dwSize;
+    snprintf(szPath, sizeof(szPath), "%s%s", pszDirPath, pszName);
+    char* pData = ReadFile(szPath, &dwSize);
+    if (pData == NULL) {
+        return NULL;
+    }
+    struct HEADER* pHeader = AddInclude(pszName);
+    if (pHeader == NULL) {
+        free(pData);
+        return NULL;
+    }
+    pHeader->text.pData = pData;
+    pHeader->text.dwSize = dwSize;
+    pHeader->text.dwMax = dwSize + 1;
+    return pHeader;
+}
+
+int LoadInclude(void* pContext, const char* pszDirPath, const char* pszName, const char** ppData, size_t* pdwSize) {
+    struct HEADER* pHeader = g_bReadIncludes ? ReadInclude(pszDirPath, pszName) : FindInclude(pszName);
+    if (pHeader == NULL) {
+        return 0;
+    }
+    *ppData = pHeader->text.pData;
+    *pdwSize = pHeader->text.dwSize;
+    return 1;
+}
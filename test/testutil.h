@@ -0,0 +1,50 @@
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+// helpers shared by the test programs
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#define MAXINCLUDES     2048
+
+// text which grows with Print()
+struct TEXT {
+    char* pData;
+    size_t dwSize;
+    size_t dwMax;
+};
+
+// an included header served from memory
+struct HEADER {
+    char szName[64];
+    struct TEXT text;
+};
+
+// the calls of malloc, calloc, realloc and free are counted while
+// g_bCounting is set. Counting needs glibc, COUNTALLOCS is 0 otherwise.
+#ifdef __GLIBC__
+#define COUNTALLOCS 1
+#else
+#define COUNTALLOCS 0
+#endif
+
+extern int g_bCounting;
+extern size_t g_numAllocs;      // new blocks
+extern size_t g_numFrees;       // released blocks
+extern size_t g_numMoves;       // blocks moved by realloc
+
+extern struct HEADER g_Includes[MAXINCLUDES];
+extern int g_numIncludes;
+extern int g_bReadIncludes;     // LoadInclude reads the headers from disk
+
+double GetSeconds(void);
+char* ReadFile(const char* pszPath, size_t* pdwSize);
+void Print(struct TEXT* pText, const char* pszFormat, ...);
+char* CreateSyntheticHeader(size_t dwMax, size_t* pdwSize);
+
+struct HEADER* AddInclude(const char* pszName);
+void FreeIncludes(void);
+int LoadInclude(void* pContext, const char* pszDirPath, const char* pszName, const char** ppData, size_t* pdwSize);
+
+#endif // TESTUTIL_H
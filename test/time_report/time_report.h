@@ -0,0 +1,18 @@
+// driver: args=--time-report --time-report-json=%TMPDIR%/time_report.json
+// driver: expected=success
+// driver: reference=time_report.ref
+// driver: stderr=time_report.stderr
+// driver: json=%TMPDIR%/time_report.json
+// driver: json_reference=time_report.json
+
+#include "timed.h"
+
+#define TIMED_FLAG(n) (1 << (n))
+#define TIMED_ALL (TIMED_FLAG(0) | TIMED_FLAG(1))
+
+typedef struct _TIMED_LIST {
+    TIMED first;
+    struct _TIMED_LIST* pNext;
+} TIMED_LIST;
+
+long __stdcall TimedFunction(PTIMED pTimed, unsigned long dwFlags);
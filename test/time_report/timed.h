@@ -0,0 +1,11 @@
+#ifndef TIMED_H_
+#define TIMED_H_
+
+#define TIMED_VERSION 0x0100
+
+typedef struct _TIMED {
+    unsigned long cbSize;
+    void* pData;
+} TIMED, *PTIMED;
+
+#endif
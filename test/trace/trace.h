@@ -0,0 +1,20 @@
+// driver: args=--trace=tokenizer,preproc,declarations,includes,output --trace-file=%TMPDIR%/trace.json
+// driver: expected=success
+// driver: reference=trace.ref
+// driver: json=%TMPDIR%/trace.json
+// driver: json_reference=trace.json
+
+#include "traced.h"
+
+#define TRACED_MASK(n) ((1 << (n)) - 1)
+
+enum TRACE_KIND { TK_NONE, TK_FILE, TK_DECL };
+
+typedef struct _TRACED_LIST {
+    TRACED first;
+    struct _TRACED_LIST* pNext;
+} TRACED_LIST;
+
+extern int g_TraceLevel;
+
+long __stdcall TraceItems(PTRACED pTraced, unsigned long dwFlags);
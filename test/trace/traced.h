@@ -0,0 +1,11 @@
+#ifndef TRACED_H_
+#define TRACED_H_
+
+#define TRACED_LIMIT 16
+
+typedef struct _TRACED {
+    unsigned long cbSize;
+    char szName[TRACED_LIMIT];
+} TRACED, *PTRACED;
+
+#endif
@@ -0,0 +1,6 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=typedef_array_expression.ref
+#define N 4
+typedef int T[N + 1];
+typedef char U[2 * N];
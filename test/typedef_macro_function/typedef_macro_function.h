@@ -0,0 +1,9 @@
+// driver: args=
+// driver: expected=success
+// driver: reference=typedef_macro_function.ref
+#define PNGARG(a) a
+#define PNGCBAPI
+#define PNG_CALLBACK(type,name,args) type (PNGCBAPI name) PNGARG(args)
+typedef PNG_CALLBACK(void, *png_error_ptr, (png_structp, png_const_charp));
+typedef PNG_CALLBACK(void, *png_flush_ptr, (png_structp));
+typedef void (*png_free_ptr)(png_structp, png_voidp);